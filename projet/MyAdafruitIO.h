@@ -14,10 +14,13 @@
  * - Dans la page des Feeds (topics MQTT), créer les Feeds suivants: 
  *   - slider 
  *   - onoff
- *   - temperature
- *   - humidity
+ *   - setpoint (consigne d'arrosage, cf. \ref irrigation)
+ *   - un feed par voie des capteurs (cf. \ref sensors) : soil, temperature, humidity, dryness
  *   Adafruit a défini la notion de Feeds qui est utilisé indifféremment pour des attributs et
  *   des données de télémétrie MQTT.
+ * - Dans la page des Groups, créer le groupe GROUP_KEY ("plante") : les feeds temp, hum, soil et dry
+ *   y sont créés automatiquement à la première publication (cf. Publication groupée ci-dessous).
+ *   Les feeds du groupe portent la clé courte de chaque voie des capteurs.
  * - Dans la page des Dashboards, créer un dashboard et éditer le. Dans celui-ci, ajouter les "blocks" suivants:
  *   - Un Slider associé au feed slider
  *   - Un Indicator associé au feed onoff, en indiquant la condition "=ON"
@@ -36,6 +39,19 @@
  * Voici un exemple de clients qui utilisent l'API MQTT : https://learn.adafruit.com/desktop-mqtt-client-for-adafruit-io/overview
  * Vous pouvez aussi utiliser la REST API pour intéragir avec la plateforme Adafruit IO.
  * 
+ * <H2>Publication groupée</H2>
+ * Publier chaque mesure sur son feed coûte un message MQTT par mesure. Avec ADAFRUIT_GROUP_MODE, toutes
+ * les voies des capteurs (cf. \ref sensors) sont envoyées en un seul message sur le topic du groupe,
+ * avec leur clé courte : IO_USERNAME/groups/GROUP_KEY/json
+ * \verbatim {"feeds":{"soil":37,"temp":21.5,"hum":45.0,"dry":0}} \endverbatim
+ *
+ * Adafruit IO limite le nombre de données reçues par minute (30 pour un compte gratuit; une publication
+ * groupée compte pour autant de données que de feeds) et déconnecte les clients qui dépassent la limite.
+ * Les envois passent donc par un seau de jetons (token bucket) : ADAFRUIT_RATE_LIMIT jetons par minute,
+ * au plus ADAFRUIT_BURST jetons d'avance, un jeton par donnée. Tant qu'il n'y a pas assez de jetons,
+ * les nouvelles mesures remplacent celles en attente (on n'envoie que les plus récentes). Si Adafruit
+ * nous signale malgré tout un dépassement (feed IO_USERNAME/throttle), le seau est vidé.
+ *
  * <H2>Bibliothèque à installer</H2>
  * Pour utiliser l'API MQTT d'Adafruit, installer :
  * - Adafruit MQTT library by Adafruit : https://github.com/adafruit/Adafruit_MQTT_Library
@@ -52,93 +68,86 @@
 /************************* Configuration *************************************/
 // Connexion Adafruit
 #define IO_SERVER         "io.adafruit.com"
+#define ADAFRUIT_TLS      0               // 1 : MQTT sur TLS (cf. \ref tls), 0 : en clair
+#define IO_FINGERPRINT    ""              // Empreinte SHA-1 du certificat de io.adafruit.com, obligatoire avec TLS
+#if ADAFRUIT_TLS
+#define IO_SERVERPORT     8883
+#else
 #define IO_SERVERPORT     1883
+#endif
 #define IO_USERNAME    "isatys"
 #define  IO_KEY         "30bcd5bfe9294a03afde64ff868e7021"
 
 // Feeds
 #define FEED_SLIDER       "/feeds/slider"
 #define FEED_ONOFF        "/feeds/onoff"
-#define FEED_TEMPERATURE  "/feeds/temperature"
-#define FEED_HUMIDITY     "/feeds/humidity"
+#define FEED_PREFIX       "/feeds/"       // Feeds des voies des capteurs : FEED_PREFIX + nom de la voie
+#define FEED_THROTTLE     "/throttle"
+#define FEED_SETPOINT     "/feeds/setpoint"
+// Publication groupée : 1 pour un seul message sur le groupe, 0 pour un message par feed
+#define ADAFRUIT_GROUP_MODE 1
+#define GROUP_KEY         "plante"
+#define GROUP_TOPIC       "/groups/" GROUP_KEY "/json"
+// Limitation du débit
+#define ADAFRUIT_RATE_LIMIT 30            // Nombre de données par minute autorisées par Adafruit IO
+#define ADAFRUIT_BURST    8               // Nombre max de jetons d'avance
 // Frequence d'envoi des données
 #define FEED_FREQ         5
+// Délai entre 2 tentatives de connexion au broker (ms)
+#define ADAFRUIT_RETRY    10000
 // Actuateur
 int iAdafruitActuatorPin = 2;             // Broche à utiliser pour l'actuateur
 /************************** Variables ****************************************/
 // Instanciation du client WiFi qui servira à se connecter au broker Adafruit
+#if ADAFRUIT_TLS
+static_assert(sizeof(IO_FINGERPRINT) > 1, "ADAFRUIT_TLS : renseigner IO_FINGERPRINT (cf. MyTLS.h)");
+BearSSL::WiFiClientSecure client;
+TlsTransport AdafruitTls = {IO_SERVER, IO_SERVERPORT, IO_FINGERPRINT, TLS_SLOT_ADAFRUIT};
+#else
 WiFiClient client;
+#endif
 // Instanciation du client Adafruit avec les informations de connexion
 Adafruit_MQTT_Client MyAdafruitMqtt(&client, IO_SERVER, IO_SERVERPORT, IO_USERNAME, IO_USERNAME, IO_KEY);
-// Variable de stockage de la valeur du slider
-uint32_t uiSliderValue=0;
+// Variable de stockage de la valeur du slider (luminosité en %) et de l'interrupteur
+uint32_t uiSliderValue=100;
+bool bAdafruitActuatorOn = true;
+int8_t cAdafruitActuatorChannel = -1;    // Canal PWM de l'actuateur (cf. \ref pwm)
+#define ADAFRUIT_FADE_MS  400             // Durée des transitions de l'actuateur (ms)
 Ticker MyAdafruitTicker;
 /****************************** Feeds ****************************************/
 // Création des Feed auxquels nous allons souscrire :
-// Un FEED 'time' pour récupérer l'heure
-Adafruit_MQTT_Subscribe timefeed = Adafruit_MQTT_Subscribe(&MyAdafruitMqtt, "time/seconds");
 // Un FEED 'slider' pour récupérer la valeur d'un slider présent sur le dashboard
 Adafruit_MQTT_Subscribe slider = Adafruit_MQTT_Subscribe(&MyAdafruitMqtt, IO_USERNAME FEED_SLIDER, MQTT_QOS_1);
 // Un FEED 'onoff' pour récupérer l'état d'un interrupteur présent sur le dashboard
 Adafruit_MQTT_Subscribe onoffbutton = Adafruit_MQTT_Subscribe(&MyAdafruitMqtt, IO_USERNAME FEED_ONOFF, MQTT_QOS_1);
-// Un FEED 'temperature' et 'humidity' pour publier des données de télémétrie
-Adafruit_MQTT_Publish temperatureFeed = Adafruit_MQTT_Publish(&MyAdafruitMqtt, IO_USERNAME FEED_TEMPERATURE);
-Adafruit_MQTT_Publish humidityFeed = Adafruit_MQTT_Publish(&MyAdafruitMqtt, IO_USERNAME FEED_HUMIDITY);
+// Un FEED 'throttle' sur lequel Adafruit nous signale un dépassement du débit autorisé
+Adafruit_MQTT_Subscribe throttlefeed = Adafruit_MQTT_Subscribe(&MyAdafruitMqtt, IO_USERNAME FEED_THROTTLE);
+// Un FEED 'setpoint' pour imposer la consigne d'arrosage depuis le cloud (cf. \ref irrigation)
+Adafruit_MQTT_Subscribe setpointfeed = Adafruit_MQTT_Subscribe(&MyAdafruitMqtt, IO_USERNAME FEED_SETPOINT, MQTT_QOS_1);
+// Les topics de publication des données de télémétrie en QoS 1 (cf. \ref adafruitqos)
+#if ADAFRUIT_GROUP_MODE
+uint8_t ucGroupTopic;
+#else
+uint8_t aucFeedTopics[SENSOR_NB_CHANNELS];                  // Un topic par voie des capteurs
+char    acFeedTopics[SENSOR_NB_CHANNELS][QOS_TOPIC_MAX + 1];
+#endif
+// Seau de jetons et mesures en attente d'envoi
+uint32_t ulAdafruitTokens = ADAFRUIT_BURST * 1000;   // En millièmes de jeton
+uint32_t ulAdafruitLastRefill = 0;
+bool     bAdafruitDataPending = false;
+uint32_t ulAdafruitCoalesced = 0;                    // Nombre de mesures remplacées avant envoi
+uint32_t ulAdafruitLastConnect = 0;                  // Date de la dernière tentative de connexion
 /*************************** Sketch Code ************************************/
 
-int sec;
-int mini;
-int hour;
-
-int timeZone = -4; // utc-4 eastern daylight time (nyc)
-
-void timecallback(uint32_t current) {
-
-  // adjust to local time zone
-  current += (timeZone * 60 * 60);
-
-  // calculate current time
-  sec = current % 60;
-  current /= 60;
-  mini = current % 60;
-  current /= 60;
-  hour = current % 24;
-
-  // print hour
-  if(hour == 0 || hour == 12)
-    Serial.print("12");
-  if(hour < 12)
-    Serial.print(hour);
-  else
-    Serial.print(hour - 12);
-
-  // print mins
-  Serial.print(":");
-  if(mini < 10) Serial.print("0");
-  Serial.print(mini);
-
-  // print seconds
-  Serial.print(":");
-  if(sec < 10) Serial.print("0");
-  Serial.print(sec);
-
-  if(hour < 12)
-    Serial.println(" AM");
-  else
-    Serial.println(" PM");
-
-}
-
 /**
- * Callback associée au Slider présent sur le dashboard
+ * Callback associée au Slider présent sur le dashboard (valeurs entières : pas de conversion en double)
  */
-void slidercallback(double uiSliderValue) {
+void slidercallback(uint32_t ulSliderValue) {
   MYDEBUG_PRINT("-AdafruitIO : Callback du feed slider avec la valeur ");
-  MYDEBUG_PRINTLN(uiSliderValue);
-
-  if (digitalRead(iAdafruitActuatorPin) == LOW){ // Polarité inversée sur la LED vs la pin D4 (broche 2)
-    int i = map(uiSliderValue,0,100,0,PWMRANGE);
-    analogWrite(iAdafruitActuatorPin, i);
+  MYDEBUG_PRINTLN(ulSliderValue);
+  uiSliderValue = min(ulSliderValue, (uint32_t)100);
+  if (bAdafruitActuatorOn){                      // Transition vers la nouvelle luminosité, sans attente
+    fadePwm(cAdafruitActuatorChannel, map(uiSliderValue,0,100,0,PWMRANGE), ADAFRUIT_FADE_MS, PWM_GAMMA);
   }
 }
 
@@ -148,27 +157,100 @@ void slidercallback(double uiSliderValue) {
 void onoffcallback(char *data, uint16_t len) {
   MYDEBUG_PRINT("-AdafruitIO : Callback du feed onoff avec la valeur ");
   MYDEBUG_PRINTLN(data);
-  if (!strcmp(data, "allumé")){
-    MYDEBUG_PRINTLN("-AdafruitIO : J'allume");
-    digitalWrite(iAdafruitActuatorPin, LOW); // Polarité inversée sur la LED vs la pin D4 (broche 2)
-  }
-  else { 
-    MYDEBUG_PRINTLN("-AdafruitIO : J'éteins");
-    digitalWrite(iAdafruitActuatorPin, HIGH); // Polarité inversée sur la LED vs la pin D4 (broche 2)
-  }
+  bAdafruitActuatorOn = !strcmp(data, "allumé");
+  MYDEBUG_PRINTLN(bAdafruitActuatorOn ? "-AdafruitIO : J'allume" : "-AdafruitIO : J'éteins");
+  uint16_t uiTarget = bAdafruitActuatorOn ? map(uiSliderValue,0,100,0,PWMRANGE) : 0;
+  fadePwm(cAdafruitActuatorChannel, uiTarget, ADAFRUIT_FADE_MS, PWM_EASE);
+}
+
+/**
+ * Callback associée au feed throttle : Adafruit nous signale un dépassement, on vide le seau
+ */
+void throttlecallback(char *data, uint16_t len) {
+  MYDEBUG_PRINT("-AdafruitIO : Limitation du débit : ");
+  MYDEBUG_PRINTLN(data);
+  ulAdafruitTokens = 0;
 }
 
 /**
- * Récupération et envoi des données de télémétrie
+ * Callback associée au feed setpoint : humidité cible en %, ou "auto" pour revenir à la consigne locale
+ */
+void setpointcallback(char *data, uint16_t len) {
+  MYDEBUG_PRINT("-AdafruitIO : Callback du feed setpoint avec la valeur ");
+  MYDEBUG_PRINTLN(data);
+  Fixed lSetpoint;
+  if (!parseFixed(data, lSetpoint)) { lSetpoint = FIXED_NAN; }   // "auto" ou valeur invalide
+  setIrrigationOverride(lSetpoint);
+}
+
+/**
+ * Prise de ucCount jetons dans le seau, après l'avoir rempli du temps écoulé.
+ * Renvoie false s'il n'y a pas assez de jetons.
+ */
+bool takeAdafruitTokens(uint8_t ucCount){
+  uint32_t ulElapsed = millis() - ulAdafruitLastRefill;
+  ulAdafruitLastRefill += ulElapsed;
+  if (ulElapsed > 60000) { ulElapsed = 60000; }               // Seau forcément plein
+  ulAdafruitTokens += ulElapsed * ADAFRUIT_RATE_LIMIT / 60;   // ms * jetons/min / 60 = millièmes de jeton
+  if (ulAdafruitTokens > ADAFRUIT_BURST * 1000) { ulAdafruitTokens = ADAFRUIT_BURST * 1000; }
+  if (ulAdafruitTokens < ucCount * 1000UL) { return false; }
+  ulAdafruitTokens -= ucCount * 1000UL;
+  return true;
+}
+
+/**
+ * Récupération des données de télémétrie : appelée par le Ticker, elle ne fait que signaler
+ * que des mesures sont à envoyer. Les valeurs sont lues au moment de l'envoi : si des mesures
+ * étaient déjà en attente, elles sont remplacées par les nouvelles.
  */
 void getAndSendDataToAdafruit(){
-  // Récupération des données
-  float myRandomTemp = 20+(float)random(-50,50)/10;
-  float myRandomHum = 50+(float)random(-100,100)/10;
+  if (bAdafruitDataPending) { ulAdafruitCoalesced++; }
+  bAdafruitDataPending = true;
+}
 
-  // Envoi des données au Broker
-  temperatureFeed.publish(fTemperature);
-  humidityFeed.publish(fHumidity);
+/**
+ * Envoi des données de télémétrie en attente, si le seau de jetons et la fenêtre QoS 1 le permettent
+ */
+void sendDataToAdafruit(){
+  if (!bAdafruitDataPending || !MyAdafruitMqtt.connected()) { return; }
+  // Les voies en erreur de lecture (FIXED_NAN) sont omises, chaque voie publiée coûte un jeton
+  Fixed alValues[SENSOR_NB_CHANNELS];
+  sensors.values(alValues);
+  uint8_t ucCount = 0;
+  for (uint8_t c = 0; c < SENSOR_NB_CHANNELS; c++) { ucCount += !fixedIsNan(alValues[c]); }
+  if (ucCount == 0) { return; }
+#if ADAFRUIT_GROUP_MODE
+  // Un seul message sur le groupe
+  if (getAdafruitQoSInFlight() >= QOS_WINDOW || !takeAdafruitTokens(ucCount)) { return; }
+  char cPayload[QOS_PAYLOAD_MAX + 1];
+  int iLength = snprintf(cPayload, sizeof(cPayload), "{\"feeds\":{");
+  for (uint8_t c = 0; c < SENSOR_NB_CHANNELS && iLength < (int)sizeof(cPayload); c++) {
+    if (fixedIsNan(alValues[c])) { continue; }
+    const SensorChannel *channel = sensors.channel(c);
+    char cValue[14];
+    formatFixed(cValue, alValues[c], channel->ucDecimals);
+    iLength += snprintf(cPayload + iLength, sizeof(cPayload) - iLength, "%s\"%s\":%s",
+                        cPayload[iLength - 1] == '{' ? "" : ",", channel->strKey, cValue);
+  }
+  if (iLength < (int)sizeof(cPayload)) { iLength += snprintf(cPayload + iLength, sizeof(cPayload) - iLength, "}}"); }
+  if (iLength >= (int)sizeof(cPayload)) {
+    MYDEBUG_PRINTLN("-AdafruitIO : Trop de voies pour une publication groupée");
+  } else {
+    publishAdafruitQoS(ucGroupTopic, cPayload);
+  }
+  printAdafruitQoSStats();
+#else
+  // Un message par feed, en QoS 1 sans attendre les PUBACK
+  if (getAdafruitQoSInFlight() > QOS_WINDOW - ucCount || !takeAdafruitTokens(ucCount)) { return; }
+  char cValue[14];
+  for (uint8_t c = 0; c < SENSOR_NB_CHANNELS; c++) {
+    if (fixedIsNan(alValues[c])) { continue; }
+    formatFixed(cValue, alValues[c], sensors.channel(c)->ucDecimals);
+    publishAdafruitQoS(aucFeedTopics[c], cValue);
+  }
+  printAdafruitQoSStats();
+#endif
+  bAdafruitDataPending = false;
 }
 
 /**
@@ -181,51 +263,93 @@ void setupAdafruitIO() {
 
   if (WiFi.status() != WL_CONNECTED){setupWiFi();}     // Vérification de la connexion WiFi
 
-  // Configuration de l'actuateur et initialisation à LOW
-  pinMode(iAdafruitActuatorPin, OUTPUT);
-  digitalWrite(iAdafruitActuatorPin, LOW);
+  // Configuration de l'actuateur (polarité inversée sur la LED vs la pin D4, broche 2), allumé
+  cAdafruitActuatorChannel = attachPwmChannel(iAdafruitActuatorPin, true);
+  fadePwm(cAdafruitActuatorChannel, map(uiSliderValue,0,100,0,PWMRANGE), 0);
 
   // Configuration des callbacks pour les FEEDs auxquels on veut souscrire
-  timefeed.setCallback(timecallback);
   slider.setCallback(slidercallback);
   onoffbutton.setCallback(onoffcallback);
+  throttlefeed.setCallback(throttlecallback);
+  setpointfeed.setCallback(setpointcallback);
   
   // Souscription aux FEEDs
-  MyAdafruitMqtt.subscribe(&timefeed);
   MyAdafruitMqtt.subscribe(&slider);
   MyAdafruitMqtt.subscribe(&onoffbutton);
+  MyAdafruitMqtt.subscribe(&throttlefeed);
+  MyAdafruitMqtt.subscribe(&setpointfeed);
+
+#if ADAFRUIT_TLS
+  setupTLS(AdafruitTls, client);                       // Session, buffers et empreinte TLS
+#endif
+
+  // Publication et réception QoS 1 : les topics doivent toujours être enregistrés dans le même ordre
+  setupAdafruitQoS(&client);
+#if ADAFRUIT_GROUP_MODE
+  ucGroupTopic = registerAdafruitTopic(IO_USERNAME GROUP_TOPIC);
+#else
+  for (uint8_t c = 0; c < SENSOR_NB_CHANNELS; c++) {
+    snprintf(acFeedTopics[c], sizeof(acFeedTopics[c]), IO_USERNAME FEED_PREFIX "%s", sensors.channel(c)->strName);
+    aucFeedTopics[c] = registerAdafruitTopic(acFeedTopics[c]);
+  }
+#endif
+  subscribeAdafruitQoS(&slider);
+  subscribeAdafruitQoS(&onoffbutton);
+  subscribeAdafruitQoS(&throttlefeed);
+  subscribeAdafruitQoS(&setpointfeed);
 
   MyAdafruitTicker.attach(FEED_FREQ, getAndSendDataToAdafruit);
 }
 
 /**
- * Connexion au broker Adafruit IO
+ * Connexion au broker Adafruit IO : une tentative au plus toutes les ADAFRUIT_RETRY ms, pour ne pas
+ * bloquer la boucle (mesures, autres modules) tant que le broker est injoignable.
+ * Renvoie true si on est connecté.
  */
-void connectAdafruitIO() {
-  if (MyAdafruitMqtt.connected()) { return; }                      // Si déjà connecté, alors c'est tout bon
+bool connectAdafruitIO() {
+  if (MyAdafruitMqtt.connected()) { return true; }                 // Si déjà connecté, alors c'est tout bon
+  if (ulAdafruitLastConnect != 0 && millis() - ulAdafruitLastConnect < ADAFRUIT_RETRY) { return false; }
+  ulAdafruitLastConnect = millis() | 1;
 
   MYDEBUG_PRINT("-AdafruitIO : Connexion au broker ... ");
-  int8_t ret;
-  while ((ret = MyAdafruitMqtt.connect()) != 0) {                  // Retourne 0 si déjà connecté
+  incrementCounter(CNT_MQTT_RECONNECTS);
+#if ADAFRUIT_TLS
+  tlsBeginConnect(AdafruitTls);
+  int8_t ret = MyAdafruitMqtt.connect();                           // Retourne 0 si connecté
+  tlsEndConnect(AdafruitTls, ret == 0);
+#else
+  uint8_t ucEnergy = energyEnter(ENERGY_TCP_CONNECT);
+  int8_t ret = MyAdafruitMqtt.connect();                           // Retourne 0 si connecté
+  energyLeave(ucEnergy);
+#endif
+  if (ret != 0) {
      MYDEBUG_PRINT("[ERREUR : ");
      MYDEBUG_PRINT(MyAdafruitMqtt.connectErrorString(ret));
-     MYDEBUG_PRINT("] nouvelle tentative dans 10 secondes ...");
+     MYDEBUG_PRINTLN("] nouvelle tentative dans 10 secondes ...");
      MyAdafruitMqtt.disconnect();                                  // Deconnexion pour être propre
-     delay(10000);                                                 // On attend 10 secondes avant de retenter le coup
+     return false;
   }
   MYDEBUG_PRINTLN("[OK]");
+  resetAdafruitQoSSession();                                       // Nouvelle session : réception et keep-alive
+  retransmitAdafruitQoS();                                         // Messages en attente de PUBACK
+  return true;
 }
 
 /**
- * Boucle Adafruit IO
+ * Boucle Adafruit IO, sans attente : à appeler le plus souvent possible
  * - Vérification de l'état de la connexion
- * - Traitement des messages reçus
- * - Maintien de la connexion en vie avec un Ping si on aucun publish télémétrie n'est fait
+ * - Traitement des messages déjà reçus (callbacks des feeds et PUBACK)
+ * - Envoi des données de télémétrie en attente
+ * - Maintien de la connexion en vie avec un Ping si aucun paquet n'a été envoyé depuis longtemps
  */
 void loopAdafruitIO() {
-  connectAdafruitIO();
-  MyAdafruitMqtt.processPackets(10000);
-  if(! MyAdafruitMqtt.ping()) {
-    MyAdafruitMqtt.disconnect();
+  uint8_t ucWatchdog = watchdogEnter(WDT_ADAFRUIT);
+  if (connectAdafruitIO()) {
+    pollAdafruitPackets();
+    sendDataToAdafruit();
+    if(! keepAliveAdafruitQoS()) {
+      MyAdafruitMqtt.disconnect();
+    }
   }
+  watchdogLeave(ucWatchdog);
 }
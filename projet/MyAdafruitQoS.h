@@ -0,0 +1,466 @@
+/**
+ * \file MyAdafruitQoS.h
+ * \page adafruitqos Adafruit IO QoS 1
+ * \brief Publication fiable des feeds avec une fenêtre de messages en vol
+ *
+ * Avec un publish QoS 0, le message est envoyé sans garantie de réception (cf. \ref mqtt) : on ne
+ * sait pas distinguer une mesure reçue d'une mesure perdue. En QoS 1, le broker accuse réception de
+ * chaque message avec un PUBACK qui reprend l'identifiant (packet id) du message.
+ *
+ * La bibliothèque Adafruit MQTT sait publier en QoS 1 mais attend le PUBACK de chaque message avant
+ * de rendre la main : un aller-retour complet avec le broker par message. Nous gérons donc nous-mêmes :
+ * - Une fenêtre de QOS_WINDOW messages en vol : on publie sans attendre, tant que la fenêtre n'est
+ *   pas pleine. Chaque PUBACK reçu libère la place de son message.
+ * - La retransmission des messages en vol (avec le flag DUP) à chaque reconnexion au broker. Les
+ *   messages publiés pendant une déconnexion attendent dans la fenêtre.
+ * - La persistance de la fenêtre en mémoire RTC (cf. \ref rtcmemory) : les messages en vol et leurs
+ *   identifiants survivent à un reset ou à un Deep Sleep.
+ * - Des statistiques par feed : messages publiés, acquittés, retransmis, refusés (fenêtre pleine) et
+ *   latence de livraison (publication -> PUBACK). Consultables via GET /api/qos.
+ *
+ * Pour recevoir les PUBACK, la lecture des paquets du broker est faite par ce module et non plus par
+ * processPackets() de la bibliothèque, qui les ignore : les messages des feeds auxquels on est abonné
+ * sont transmis aux callbacks des Adafruit_MQTT_Subscribe, comme le fait la bibliothèque. Un message
+ * plus long que QOS_PACKET_MAX est ignoré, mais acquitté s'il est en QoS 1.
+ *
+ * La réception ne bloque jamais : pollAdafruitPackets() ne traite que les octets déjà arrivés, au fil
+ * d'un automate (en-tête, longueur, corps) qui reprend un paquet incomplet à l'appel suivant. Une
+ * callback est donc appelée dès la boucle qui suit l'arrivée de son message. Le PINGREQ n'est envoyé
+ * que si aucun paquet n'est parti vers le broker depuis presque MQTT_CONN_KEEPALIVE secondes : tant
+ * que l'on publie, aucun ping n'est nécessaire. Il est avancé au réveil prévu qui précède cette
+ * échéance (cf. \ref power), pour ne pas réveiller la radio rien que pour lui.
+ *
+ * \note Les topics sont persistés par leur index dans la table des topics : ils doivent être
+ * enregistrés toujours dans le même ordre au démarrage.
+ *
+ * Fichier \ref MyAdafruitQoS.h
+ */
+
+#include "Adafruit_MQTT.h"
+
+#define QOS_WINDOW            4           // Nombre max de messages en attente de PUBACK
+#define QOS_PAYLOAD_MAX       58          // Taille max d'une payload (pour tenir en mémoire RTC)
+#define QOS_TOPIC_MAX         64          // Taille max d'un topic
+#define QOS_MAX_TOPICS        4           // Nombre max de topics de publication
+#define QOS_MAX_SUBSCRIPTIONS 4           // Nombre max de feeds souscrits
+#define QOS_PACKET_MAX        128         // Taille du buffer de réception
+#define QOS_RX_BUDGET         512         // Nombre max d'octets traités par appel de pollAdafruitPackets()
+#define QOS_KEEPALIVE_MARGIN  10000       // PINGREQ envoyé 10 s avant l'expiration du keep-alive (ms)
+#define QOS_PINGRESP_TIMEOUT  5000        // Délai max de réception du PINGRESP (ms)
+#define QOS_FIRST_PACKET_ID   0x8000      // Nos packet id, distincts de ceux de la bibliothèque
+
+// Types de paquets MQTT
+#define MQTT_PUBLISH          3
+#define MQTT_PUBACK           4
+#define MQTT_PINGREQ          12
+#define MQTT_PINGRESP         13
+
+/** Message publié en attente de PUBACK */
+struct QoSMessage {
+  uint16_t uiPacketId;                    /*!< 0 si la place est libre */
+  uint8_t  ucTopic;                       /*!< Index dans strQoSTopics */
+  uint8_t  ucLength;                      /*!< Longueur de la payload */
+  char     cPayload[QOS_PAYLOAD_MAX];
+};
+
+/** Fenêtre de messages en vol, persistée en mémoire RTC */
+struct QoSWindow {
+  uint16_t   uiNextPacketId;
+  uint16_t   uiReserved;
+  QoSMessage messages[QOS_WINDOW];
+};
+static_assert(sizeof(QoSWindow) + 4 <= RTC_QOS_SIZE, "Fenêtre QoS trop grande pour la mémoire RTC");
+
+/** Etats de l'automate de réception */
+enum QoSRxState { QOS_RX_HEADER, QOS_RX_LENGTH, QOS_RX_BODY };
+
+/** Paquet en cours de réception */
+struct QoSReceiver {
+  uint8_t  ucState;                       /*!< QoSRxState */
+  uint8_t  ucHeader;                      /*!< Premier octet : type et flags */
+  uint8_t  ucShift;                       /*!< Décalage du prochain octet de la longueur restante */
+  uint32_t ulLength;                      /*!< Longueur restante annoncée */
+  uint32_t ulIndex;                       /*!< Octets du corps déjà reçus */
+};
+
+/** Statistiques de livraison d'un feed */
+struct QoSStats {
+  uint32_t ulPublished;                   /*!< Messages publiés */
+  uint32_t ulAcked;                       /*!< Messages acquittés par un PUBACK */
+  uint32_t ulRetransmitted;               /*!< Retransmissions */
+  uint32_t ulRejected;                    /*!< Publications refusées, fenêtre pleine */
+  uint32_t ulLatencySum;                  /*!< Somme des latences (ms) */
+  uint32_t ulLatencyMin;
+  uint32_t ulLatencyMax;
+  uint32_t ulLatencyLast;
+};
+
+Client                  *pQoSClient = NULL;                          // Connexion TCP au broker
+QoSWindow                qosWindow;                                  // Messages en vol
+uint32_t                 aulQoSSentAt[QOS_WINDOW];                   // Date d'envoi (millis), 0 si non envoyé
+const char              *strQoSTopics[QOS_MAX_TOPICS];               // Topics de publication
+QoSStats                 qosStats[QOS_MAX_TOPICS];                   // Statistiques par topic
+uint8_t                  ucQoSNbTopics = 0;
+Adafruit_MQTT_Subscribe *qosSubscriptions[QOS_MAX_SUBSCRIPTIONS];    // Feeds souscrits
+uint8_t                  ucQoSNbSubscriptions = 0;
+uint8_t                  aucQoSPacket[QOS_PACKET_MAX];               // Buffer de réception
+QoSReceiver              qosRx = {QOS_RX_HEADER, 0, 0, 0, 0};        // Automate de réception
+uint32_t                 ulQoSLastSent = 0;                          // Date du dernier paquet envoyé (millis)
+uint32_t                 ulQoSPingSentAt = 0;                        // Date du PINGREQ en cours, 0 si aucun
+uint32_t                 ulQoSPackets = 0;                           // Nombre de paquets reçus
+
+// ------------------------------------------------------------------------------------------------
+// TOPICS & SOUSCRIPTIONS
+// ------------------------------------------------------------------------------------------------
+/**
+ * Enregistrement d'un topic de publication, renvoie son index (0xFF si impossible)
+ */
+uint8_t registerAdafruitTopic(const char *strTopic){
+  if (ucQoSNbTopics >= QOS_MAX_TOPICS || strlen(strTopic) > QOS_TOPIC_MAX) { return 0xFF; }
+  strQoSTopics[ucQoSNbTopics] = strTopic;
+  memset(&qosStats[ucQoSNbTopics], 0, sizeof(QoSStats));
+  qosStats[ucQoSNbTopics].ulLatencyMin = UINT32_MAX;
+  return ucQoSNbTopics++;
+}
+
+/**
+ * Enregistrement d'un feed souscrit dont on doit appeler la callback
+ * \note Le feed doit aussi être souscrit auprès de la bibliothèque (MyAdafruitMqtt.subscribe)
+ */
+void subscribeAdafruitQoS(Adafruit_MQTT_Subscribe *subscription){
+  if (ucQoSNbSubscriptions < QOS_MAX_SUBSCRIPTIONS) {
+    qosSubscriptions[ucQoSNbSubscriptions++] = subscription;
+  }
+}
+
+// ------------------------------------------------------------------------------------------------
+// PUBLICATION
+// ------------------------------------------------------------------------------------------------
+/**
+ * Nombre de messages en attente de PUBACK
+ */
+uint8_t getAdafruitQoSInFlight(){
+  uint8_t ucCount = 0;
+  for (uint8_t i = 0; i < QOS_WINDOW; i++) {
+    if (qosWindow.messages[i].uiPacketId != 0) { ucCount++; }
+  }
+  return ucCount;
+}
+
+/**
+ * Ecriture d'un paquet vers le broker, en notant la date pour le keep-alive
+ */
+bool qosWrite(const uint8_t *aucBuffer, size_t uiLength){
+  if (pQoSClient->write(aucBuffer, uiLength) != uiLength) { return false; }
+  ulQoSLastSent = millis();
+  return true;
+}
+
+/**
+ * Envoi d'un paquet PUBLISH QoS 1 en une seule écriture
+ */
+bool qosSendPublish(const QoSMessage &message, bool bDup){
+  if (pQoSClient == NULL || !pQoSClient->connected()) { return false; }
+  uint8_t aucBuffer[5 + 2 + QOS_TOPIC_MAX + 2 + QOS_PAYLOAD_MAX];
+  uint16_t uiTopicLength = strlen(strQoSTopics[message.ucTopic]);
+  uint16_t uiRemaining = 2 + uiTopicLength + 2 + message.ucLength;
+  uint16_t uiLength = 0;
+
+  aucBuffer[uiLength++] = (MQTT_PUBLISH << 4) | (bDup ? 0x08 : 0x00) | (1 << 1);   // QoS 1
+  do {                                                                            // Longueur restante
+    uint8_t ucByte = uiRemaining % 128;
+    uiRemaining /= 128;
+    aucBuffer[uiLength++] = ucByte | (uiRemaining > 0 ? 0x80 : 0x00);
+  } while (uiRemaining > 0);
+  aucBuffer[uiLength++] = uiTopicLength >> 8;
+  aucBuffer[uiLength++] = uiTopicLength & 0xFF;
+  memcpy(aucBuffer + uiLength, strQoSTopics[message.ucTopic], uiTopicLength);
+  uiLength += uiTopicLength;
+  aucBuffer[uiLength++] = message.uiPacketId >> 8;
+  aucBuffer[uiLength++] = message.uiPacketId & 0xFF;
+  memcpy(aucBuffer + uiLength, message.cPayload, message.ucLength);
+  uiLength += message.ucLength;
+
+  uint8_t ucEnergy = energyEnter(ENERGY_PUBLISH);
+  bool bOk = qosWrite(aucBuffer, uiLength);
+  energyLeave(ucEnergy);
+  if (bOk && !bDup) { energyMessage(); }                     // Les retransmissions s'ajoutent au message suivant
+  return bOk;
+}
+
+/**
+ * Publication QoS 1 sans attente du PUBACK.
+ * Renvoie false si la fenêtre est pleine ou la payload trop longue : le message n'est pas publié.
+ * Si on n'est pas connecté, le message attend dans la fenêtre la prochaine reconnexion.
+ */
+bool publishAdafruitQoS(uint8_t ucTopic, const char *strPayload){
+  if (ucTopic >= ucQoSNbTopics) { return false; }
+  size_t uiLength = strlen(strPayload);
+  int iSlot = -1;
+  for (uint8_t i = 0; i < QOS_WINDOW && iSlot < 0; i++) {
+    if (qosWindow.messages[i].uiPacketId == 0) { iSlot = i; }
+  }
+  if (iSlot < 0 || uiLength > QOS_PAYLOAD_MAX) {
+    qosStats[ucTopic].ulRejected++;
+    incrementCounter(CNT_PUBLISH_FAILURES);
+    MYDEBUG_PRINT("-QOS : Publication refusée sur ");
+    MYDEBUG_PRINTLN(strQoSTopics[ucTopic]);
+    return false;
+  }
+
+  QoSMessage *message = &qosWindow.messages[iSlot];
+  aulQoSSentAt[iSlot] = millis() | 1;                        // 0 est réservé à "non envoyé"
+  message->uiPacketId = qosWindow.uiNextPacketId;
+  message->ucTopic = ucTopic;
+  message->ucLength = uiLength;
+  memcpy(message->cPayload, strPayload, uiLength);
+  qosWindow.uiNextPacketId = (qosWindow.uiNextPacketId == 0xFFFF) ? QOS_FIRST_PACKET_ID : qosWindow.uiNextPacketId + 1;
+  writeRTCMemory(RTC_QOS_OFFSET, qosWindow);
+  qosStats[ucTopic].ulPublished++;
+
+  qosSendPublish(*message, false);
+  return true;
+}
+
+/**
+ * Retransmission de tous les messages en vol, à appeler après chaque (re)connexion au broker
+ */
+void retransmitAdafruitQoS(){
+  for (uint8_t i = 0; i < QOS_WINDOW; i++) {
+    QoSMessage &message = qosWindow.messages[i];
+    if (message.uiPacketId == 0) { continue; }
+    if (aulQoSSentAt[i] == 0) { aulQoSSentAt[i] = millis(); }   // Message restauré après un reset
+    if (qosSendPublish(message, true)) {
+      qosStats[message.ucTopic].ulRetransmitted++;
+      MYDEBUG_PRINT("-QOS : Retransmission du message ");
+      MYDEBUG_PRINTLN(message.uiPacketId);
+    }
+  }
+}
+
+/**
+ * Réception d'un PUBACK : libération du message et mise à jour des statistiques
+ */
+void qosHandlePubAck(uint16_t uiPacketId){
+  for (uint8_t i = 0; i < QOS_WINDOW; i++) {
+    QoSMessage &message = qosWindow.messages[i];
+    if (message.uiPacketId != uiPacketId) { continue; }
+    QoSStats &stats = qosStats[message.ucTopic];
+    uint32_t ulLatency = millis() - aulQoSSentAt[i];
+    stats.ulAcked++;
+    stats.ulLatencySum += ulLatency;
+    stats.ulLatencyLast = ulLatency;
+    if (ulLatency < stats.ulLatencyMin) { stats.ulLatencyMin = ulLatency; }
+    if (ulLatency > stats.ulLatencyMax) { stats.ulLatencyMax = ulLatency; }
+    message.uiPacketId = 0;
+    aulQoSSentAt[i] = 0;
+    writeRTCMemory(RTC_QOS_OFFSET, qosWindow);
+    return;
+  }
+}
+
+// ------------------------------------------------------------------------------------------------
+// RECEPTION
+// ------------------------------------------------------------------------------------------------
+/**
+ * Réception d'un PUBLISH : transmission à la callback du feed souscrit, PUBACK si QoS 1
+ */
+void qosHandlePublish(uint8_t ucHeader, uint16_t uiLength){
+  uint16_t uiTopicLength = (aucQoSPacket[0] << 8) | aucQoSPacket[1];
+  uint8_t ucQoS = (ucHeader >> 1) & 0x03;
+  uint16_t uiPayload = 2 + uiTopicLength + (ucQoS > 0 ? 2 : 0);
+  if (uiPayload > uiLength) { return; }
+  const char *strTopic = (const char*)aucQoSPacket + 2;
+
+  if (ucQoS > 0) {                                           // Accusé de réception
+    uint8_t aucPubAck[4] = {MQTT_PUBACK << 4, 2, aucQoSPacket[2 + uiTopicLength], aucQoSPacket[3 + uiTopicLength]};
+    qosWrite(aucPubAck, sizeof(aucPubAck));
+  }
+
+  for (uint8_t i = 0; i < ucQoSNbSubscriptions; i++) {
+    Adafruit_MQTT_Subscribe *sub = qosSubscriptions[i];
+    if (strlen(sub->topic) != uiTopicLength || strncmp(sub->topic, strTopic, uiTopicLength) != 0) { continue; }
+    sub->datalen = uiLength - uiPayload;
+    if (sub->datalen > SUBSCRIPTIONDATALEN - 1) { sub->datalen = SUBSCRIPTIONDATALEN - 1; }
+    memcpy(sub->lastread, aucQoSPacket + uiPayload, sub->datalen);
+    sub->lastread[sub->datalen] = 0;
+    // Appel de la callback, comme Adafruit_MQTT::processPackets()
+    if (sub->callback_uint32t != NULL)     { sub->callback_uint32t(atoi((char*)sub->lastread)); }
+    else if (sub->callback_double != NULL) { sub->callback_double(atof((char*)sub->lastread)); }
+    else if (sub->callback_buffer != NULL) { sub->callback_buffer((char*)sub->lastread, sub->datalen); }
+    return;
+  }
+}
+
+/**
+ * PUBLISH plus long que le buffer de réception : le message est ignoré, mais s'il est en QoS 1 son
+ * PUBACK est envoyé quand même, sinon le broker le retransmettrait à chaque reconnexion.
+ */
+void qosAckTruncatedPublish(uint8_t ucHeader){
+  if (((ucHeader >> 1) & 0x03) == 0) { return; }
+  uint16_t uiTopicLength = (aucQoSPacket[0] << 8) | aucQoSPacket[1];
+  if (4 + uiTopicLength > QOS_PACKET_MAX) { return; }         // Packet id hors du buffer
+  uint8_t aucPubAck[4] = {MQTT_PUBACK << 4, 2, aucQoSPacket[2 + uiTopicLength], aucQoSPacket[3 + uiTopicLength]};
+  qosWrite(aucPubAck, sizeof(aucPubAck));
+  MYDEBUG_PRINTLN("-QOS : Message trop long ignoré");
+}
+
+/**
+ * Traitement d'un paquet complet reçu du broker
+ */
+void qosDispatchPacket(){
+  switch (qosRx.ucHeader >> 4) {
+    case MQTT_PUBACK :
+      if (qosRx.ulLength >= 2) { qosHandlePubAck((aucQoSPacket[0] << 8) | aucQoSPacket[1]); }
+      break;
+    case MQTT_PUBLISH :
+      if (qosRx.ulLength <= QOS_PACKET_MAX) { qosHandlePublish(qosRx.ucHeader, qosRx.ulLength); }
+      else { qosAckTruncatedPublish(qosRx.ucHeader); }
+      break;
+    case MQTT_PINGRESP :
+      ulQoSPingSentAt = 0;
+      break;
+    default :
+      break;
+  }
+  ulQoSPackets++;
+}
+
+/**
+ * Avancement de l'automate de réception d'un octet : en-tête, longueur restante, corps du paquet
+ */
+void qosReceiveByte(uint8_t ucByte){
+  switch (qosRx.ucState) {
+    case QOS_RX_HEADER :
+      qosRx.ucHeader = ucByte;
+      qosRx.ulLength = 0;
+      qosRx.ucShift = 0;
+      qosRx.ucState = QOS_RX_LENGTH;
+      break;
+    case QOS_RX_LENGTH :
+      qosRx.ulLength |= (uint32_t)(ucByte & 0x7F) << qosRx.ucShift;
+      qosRx.ucShift += 7;
+      if (ucByte & 0x80) {
+        if (qosRx.ucShift > 21) { qosRx.ucState = QOS_RX_HEADER; }   // Longueur invalide (4 octets max)
+        break;
+      }
+      qosRx.ulIndex = 0;
+      if (qosRx.ulLength == 0) {
+        qosDispatchPacket();
+        qosRx.ucState = QOS_RX_HEADER;
+      } else {
+        qosRx.ucState = QOS_RX_BODY;
+      }
+      break;
+    case QOS_RX_BODY :                                       // Corps du paquet, tronqué au buffer
+      if (qosRx.ulIndex < QOS_PACKET_MAX) { aucQoSPacket[qosRx.ulIndex] = ucByte; }
+      if (++qosRx.ulIndex == qosRx.ulLength) {
+        qosDispatchPacket();
+        qosRx.ucState = QOS_RX_HEADER;
+      }
+      break;
+  }
+}
+
+/**
+ * Traitement des octets déjà reçus du broker, sans jamais attendre : un paquet incomplet est
+ * repris au prochain appel. Les callbacks des feeds sont appelées dès que leur paquet est complet.
+ */
+void pollAdafruitPackets(){
+  if (pQoSClient == NULL || !pQoSClient->connected()) { return; }
+  uint8_t aucChunk[64];
+  uint16_t uiBudget = QOS_RX_BUDGET;                         // Pour rendre la main même sous un flot de données
+  int iAvailable;
+  while (uiBudget > 0 && (iAvailable = pQoSClient->available()) > 0) {
+    size_t uiSize = min((size_t)iAvailable, min(sizeof(aucChunk), (size_t)uiBudget));
+    int iRead = pQoSClient->read(aucChunk, uiSize);
+    if (iRead <= 0) { break; }
+    for (int i = 0; i < iRead; i++) { qosReceiveByte(aucChunk[i]); }
+    uiBudget -= iRead;
+  }
+}
+
+/**
+ * Maintien de la connexion : un PINGREQ n'est envoyé que si rien n'a été envoyé au broker depuis
+ * presque tout l'intervalle de keep-alive, ou s'il le sera avant le prochain réveil prévu. Renvoie false si le PINGRESP n'est pas arrivé à temps.
+ */
+bool keepAliveAdafruitQoS(){
+  if (pQoSClient == NULL || !pQoSClient->connected()) { return false; }
+  uint32_t ulNow = millis();
+  if (ulQoSPingSentAt != 0) {                                // PINGRESP attendu
+    if (ulNow - ulQoSPingSentAt < QOS_PINGRESP_TIMEOUT) { return true; }
+    MYDEBUG_PRINTLN("-QOS : Pas de PINGRESP du broker");
+    return false;
+  }
+  if (!powerPingDue(ulNow - ulQoSLastSent, MQTT_CONN_KEEPALIVE * 1000UL - QOS_KEEPALIVE_MARGIN)) { return true; }
+  uint8_t aucPingReq[2] = {MQTT_PINGREQ << 4, 0};
+  if (!qosWrite(aucPingReq, sizeof(aucPingReq))) { return false; }
+  ulQoSPingSentAt = ulNow | 1;                               // 0 est réservé à "pas de ping en cours"
+  return true;
+}
+
+/**
+ * Remise à zéro de la réception et du keep-alive, à appeler après chaque (re)connexion au broker
+ */
+void resetAdafruitQoSSession(){
+  qosRx.ucState = QOS_RX_HEADER;
+  ulQoSLastSent = millis();                                  // Le CONNECT et les SUBSCRIBE viennent d'être envoyés
+  ulQoSPingSentAt = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// STATISTIQUES
+// ------------------------------------------------------------------------------------------------
+void printAdafruitQoSStats(){
+  for (uint8_t t = 0; t < ucQoSNbTopics; t++) {
+    QoSStats &stats = qosStats[t];
+    MYDEBUG_PRINT("-QOS : ");
+    MYDEBUG_PRINT(strQoSTopics[t]);
+    MYDEBUG_PRINT(" [publiés : ");
+    MYDEBUG_PRINT(stats.ulPublished);
+    MYDEBUG_PRINT(" / acquittés : ");
+    MYDEBUG_PRINT(stats.ulAcked);
+    MYDEBUG_PRINT(" / latence moyenne : ");
+    MYDEBUG_PRINT(stats.ulAcked ? stats.ulLatencySum / stats.ulAcked : 0);
+    MYDEBUG_PRINTLN(" ms]");
+  }
+}
+
+/**
+ * GET /api/qos : statistiques de livraison par feed
+ */
+void handleAdafruitQoSStats(){
+  String strResponse = "{\"inFlight\":" + String(getAdafruitQoSInFlight()) + ",\"packets\":" + String(ulQoSPackets) + ",\"feeds\":{";
+  for (uint8_t t = 0; t < ucQoSNbTopics; t++) {
+    QoSStats &stats = qosStats[t];
+    char cBuffer[192];
+    snprintf(cBuffer, sizeof(cBuffer),
+             "%s\"%s\":{\"published\":%lu,\"acked\":%lu,\"retransmitted\":%lu,\"rejected\":%lu,"
+             "\"latencyAvg\":%lu,\"latencyMin\":%lu,\"latencyMax\":%lu,\"latencyLast\":%lu}",
+             t > 0 ? "," : "", strQoSTopics[t],
+             (unsigned long)stats.ulPublished, (unsigned long)stats.ulAcked,
+             (unsigned long)stats.ulRetransmitted, (unsigned long)stats.ulRejected,
+             (unsigned long)(stats.ulAcked ? stats.ulLatencySum / stats.ulAcked : 0),
+             (unsigned long)(stats.ulAcked ? stats.ulLatencyMin : 0),
+             (unsigned long)stats.ulLatencyMax, (unsigned long)stats.ulLatencyLast);
+    strResponse += cBuffer;
+  }
+  strResponse += "}}";
+  HTTPServer.send(200, "application/json", strResponse);
+}
+
+/**
+ * Initialisation : connexion TCP utilisée et restauration de la fenêtre depuis la mémoire RTC
+ */
+void setupAdafruitQoS(Client *pClient){
+  pQoSClient = pClient;
+  memset(aulQoSSentAt, 0, sizeof(aulQoSSentAt));
+  if (readRTCMemory(RTC_QOS_OFFSET, qosWindow)) {
+    MYDEBUG_PRINT("-QOS : Messages en vol restaurés : ");
+    MYDEBUG_PRINTLN(getAdafruitQoSInFlight());
+  } else {
+    memset(&qosWindow, 0, sizeof(qosWindow));
+    qosWindow.uiNextPacketId = QOS_FIRST_PACKET_ID;
+  }
+  registerHttpRoute("/api/qos", HTTP_GET, handleAdafruitQoSStats);
+}
@@ -0,0 +1,681 @@
+/**
+ * \file MyAsyncHttp.h
+ * \page asynchttp Serveur HTTP asynchrone
+ * \brief Connexions TCP gérées par les callbacks de lwIP : un client lent ne bloque plus la boucle
+ *
+ * ESP8266WebServer traite un client à la fois, et lit la requête en attendant les octets : un
+ * navigateur qui ouvre une connexion sans rien envoyer (préconnexion) ou un client lent bloque la
+ * boucle jusqu'à HTTP_MAX_DATA_WAIT (5 s), donc aussi les mesures et le keep-alive MQTT.
+ *
+ * AsyncHttpServer reprend les fonctions d'ESP8266WebServer utilisées par les modules (send(),
+ * sendContent(), arg(), streamFile() ...) : les routes du serveur partagé (cf. \ref httpserver) n'ont
+ * pas à changer. Mais le réseau est géré directement par l'API "raw" de lwIP, à la manière
+ * d'ESPAsyncTCP :
+ * - Les connexions sont acceptées et lues par les callbacks de lwIP, sans jamais attendre. Au plus
+ *   ASYNC_HTTP_MAX_CONN connexions simultanées, chacune avec sa machine à états : lecture de la
+ *   requête, requête prête, envoi de la réponse. Au-delà, les connexions sont refusées.
+ * - Une requête n'est traitée par la boucle (handleClient()) qu'une fois complète (en-têtes et corps) :
+ *   le traitement ne dépend plus de la vitesse du client.
+ * - La réponse est écrite dans le tampon d'émission de lwIP, le surplus dans des blocs d'un pool
+ *   statique (ASYNC_HTTP_BLOCKS blocs de ASYNC_HTTP_BLOCK_SIZE octets, partagés par les connexions).
+ *   Les blocs et les fichiers statiques sont envoyés au fil des acquittements, à chaque itération de
+ *   la boucle.
+ * - Une réponse longue (séries, métriques, liste des feuilles ...) n'est pas écrite par le traitement
+ *   mais produite par un générateur (HttpGenerator, cf. sendGenerated()) : la boucle lui demande les
+ *   étapes suivantes au fil des acquittements, un bloc à la fois, seulement quand un bloc libre peut
+ *   recevoir ce que lwIP refuse. Un pool plein la fait attendre, sans l'interrompre. Seule une
+ *   réponse écrite d'un coup par le traitement et plus grande que le tampon d'émission et le pool
+ *   interrompt sa connexion.
+ * - Délais : une connexion dont la requête n'est pas complète après ASYNC_HTTP_REQUEST_TIMEOUT ms, ou
+ *   dont la réponse n'avance plus depuis ASYNC_HTTP_RESPONSE_TIMEOUT ms, est interrompue.
+ * - Keep-alive : une réponse de longueur connue (Content-Length, cf. \ref template) laisse la connexion
+ *   ouverte pour la requête suivante (HTTP/1.1, sauf "Connection: close" du client). Une connexion
+ *   inactive est fermée après ASYNC_HTTP_KEEPALIVE_TIMEOUT ms, ou dès qu'une nouvelle connexion a besoin
+ *   de sa place. Seule une réponse de longueur inconnue (CONTENT_LENGTH_UNKNOWN) ferme la connexion :
+ *   pas de découpage en chunks, c'est la fin de la connexion qui marque la fin de la réponse. Les
+ *   requêtes envoyées avant la fin de la réponse précédente (pipelining) ne sont pas gérées.
+ *
+ * Connexions acceptées, refusées, interrompues et pic de connexions simultanées sont ajoutés aux
+ * statistiques de GET /api/http.
+ *
+ * \note ASYNC_HTTP_MAX_CONN suit la limite de pcb TCP de lwIP sur l'ESP8266 (MEMP_NUM_TCP_PCB, 5) :
+ * au-delà, lwIP ignore de toute façon les nouvelles connexions, que le client retente. Avec 10 clients
+ * simultanés, 5 sont servis et les autres attendent ou sont refusés, sans effet sur la boucle.
+ *
+ * \note Les requêtes sont limitées à ASYNC_HTTP_REQUEST_MAX octets (en-têtes et corps) et à
+ * ASYNC_HTTP_MAX_ARGS arguments. Seules les méthodes GET, POST et PUT sont acceptées.
+ *
+ * Fichier \ref MyAsyncHttp.h
+ */
+
+#include <ESP8266WebServer.h>                 // HTTPMethod, CONTENT_LENGTH_UNKNOWN
+#include <FS.h>
+#include <lwip/tcp.h>
+
+#define ASYNC_HTTP_MAX_CONN         5         // Connexions simultanées (MEMP_NUM_TCP_PCB de lwIP)
+#define ASYNC_HTTP_REQUEST_MAX      512       // Taille max d'une requête (en-têtes et corps)
+#define ASYNC_HTTP_MAX_ARGS         8         // Arguments max par requête
+#define ASYNC_HTTP_BLOCKS           6         // Blocs du pool de réponse
+#define ASYNC_HTTP_BLOCK_SIZE       512
+#define ASYNC_HTTP_REQUEST_TIMEOUT  5000      // Délai max de réception de la requête (ms)
+#define ASYNC_HTTP_RESPONSE_TIMEOUT 10000     // Délai max sans acquittement pendant la réponse (ms)
+#define ASYNC_HTTP_KEEPALIVE_TIMEOUT 5000     // Délai max d'une connexion keep-alive sans nouvelle requête (ms)
+#define ASYNC_HTTP_CONTEXT_SIZE     16        // Contexte d'un générateur de réponse, copié dans la connexion
+#define ASYNC_HTTP_NO_BLOCK         0xFF
+
+/**
+ * Générateur d'une réponse par étapes : écrit l'étape uiStep dans output et renvoie false après la
+ * dernière. Une étape tient dans un bloc (ASYNC_HTTP_BLOCK_SIZE octets) ; pContext peut garder un état
+ * d'une étape à l'autre.
+ */
+typedef bool (*HttpGenerator)(Print &output, uint16_t uiStep, void *pContext);
+
+/** Etat d'une connexion */
+enum AsyncHttpState : uint8_t {
+  ASYNC_HTTP_FREE = 0,
+  ASYNC_HTTP_REQUEST,                         /*!< Lecture de la requête */
+  ASYNC_HTTP_READY,                           /*!< Requête complète, à traiter par la boucle */
+  ASYNC_HTTP_RESPONSE,                        /*!< Envoi de la réponse */
+};
+
+/** Bloc du pool de réponse */
+struct AsyncHttpBlock {
+  uint16_t uiLength;
+  uint16_t uiSent;
+  uint8_t  ucNext;                            /*!< Bloc suivant de la même réponse */
+  uint8_t  aucData[ASYNC_HTTP_BLOCK_SIZE];
+};
+
+/** Connexion : machine à états, requête et réponse en cours */
+struct AsyncHttpConnection {
+  struct tcp_pcb *pPcb;
+  AsyncHttpState  state;
+  bool            bDone;                      /*!< Réponse entièrement écrite par le traitement */
+  bool            bHeadersSent;
+  bool            bKeepAlive;                 /*!< Connexion gardée ouverte après la réponse */
+  bool            bIdle;                      /*!< Keep-alive : en attente de la requête suivante */
+  bool            bPeerClosed;                /*!< Fermée par le client (FIN) : pas de requête suivante */
+  uint32_t        ulLastActivity;
+  uint16_t        uiLength;                   /*!< Octets reçus */
+  uint16_t        uiExpected;                 /*!< Longueur totale attendue, 0 tant que les en-têtes ne sont pas complets */
+  char            cRequest[ASYNC_HTTP_REQUEST_MAX + 1];
+  // Requête décodée, les chaînes sont dans cRequest
+  HTTPMethod      method;
+  const char     *strUri;
+  uint8_t         ucNbArgs;
+  const char     *astrArgNames[ASYNC_HTTP_MAX_ARGS];
+  const char     *astrArgValues[ASYNC_HTTP_MAX_ARGS];
+  // Réponse
+  uint8_t         ucFirstBlock;
+  uint8_t         ucLastBlock;
+  File            file;                       /*!< Fichier statique en cours d'envoi */
+  HttpGenerator   generator;                  /*!< Réponse par étapes en cours, NULL sinon */
+  uint16_t        uiStep;                     /*!< Prochaine étape du générateur */
+  uint8_t         ucContextSize;
+  uint8_t         aucContext[ASYNC_HTTP_CONTEXT_SIZE];
+};
+
+AsyncHttpConnection asyncHttpConnections[ASYNC_HTTP_MAX_CONN];
+AsyncHttpBlock      asyncHttpBlocks[ASYNC_HTTP_BLOCKS];
+uint8_t             ucAsyncHttpFreeBlock = ASYNC_HTTP_NO_BLOCK;   // Liste des blocs libres
+// Statistiques
+uint32_t            ulAsyncHttpAccepted = 0;
+uint32_t            ulAsyncHttpRejected = 0;  // Trop de connexions simultanées
+uint32_t            ulAsyncHttpTimeouts = 0;
+uint32_t            ulAsyncHttpOverflows = 0; // Requête trop grande, réponse plus grande que le pool ou étape plus grande qu'un bloc
+uint8_t             ucAsyncHttpPeak = 0;      // Pic de connexions simultanées
+
+// ------------------------------------------------------------------------------------------------
+// POOL DE BLOCS
+// ------------------------------------------------------------------------------------------------
+uint8_t takeAsyncHttpBlock(){
+  uint8_t ucBlock = ucAsyncHttpFreeBlock;
+  if (ucBlock == ASYNC_HTTP_NO_BLOCK) { return ucBlock; }
+  ucAsyncHttpFreeBlock = asyncHttpBlocks[ucBlock].ucNext;
+  asyncHttpBlocks[ucBlock].uiLength = asyncHttpBlocks[ucBlock].uiSent = 0;
+  asyncHttpBlocks[ucBlock].ucNext = ASYNC_HTTP_NO_BLOCK;
+  return ucBlock;
+}
+
+void releaseAsyncHttpBlocks(uint8_t ucBlock){
+  while (ucBlock != ASYNC_HTTP_NO_BLOCK) {
+    uint8_t ucNext = asyncHttpBlocks[ucBlock].ucNext;
+    asyncHttpBlocks[ucBlock].ucNext = ucAsyncHttpFreeBlock;
+    ucAsyncHttpFreeBlock = ucBlock;
+    ucBlock = ucNext;
+  }
+}
+
+/**
+ * Ecriture d'une réponse : directement dans le tampon d'émission de lwIP s'il n'y a rien en attente,
+ * le surplus dans les blocs du pool. Renvoie false si le pool est épuisé.
+ */
+bool queueAsyncHttpData(struct tcp_pcb *pPcb, uint8_t &ucFirstBlock, uint8_t &ucLastBlock, const uint8_t *aucData, size_t uiSize){
+  if (ucFirstBlock == ASYNC_HTTP_NO_BLOCK) {
+    size_t uiDirect = min(uiSize, (size_t)tcp_sndbuf(pPcb));
+    if (uiDirect > 0 && tcp_write(pPcb, aucData, uiDirect, TCP_WRITE_FLAG_COPY) == ERR_OK) {
+      aucData += uiDirect;
+      uiSize -= uiDirect;
+    }
+  }
+  while (uiSize > 0) {
+    uint8_t ucBlock = ucLastBlock;
+    if (ucBlock == ASYNC_HTTP_NO_BLOCK || asyncHttpBlocks[ucBlock].uiLength == ASYNC_HTTP_BLOCK_SIZE) {
+      ucBlock = takeAsyncHttpBlock();
+      if (ucBlock == ASYNC_HTTP_NO_BLOCK) { return false; }
+      if (ucLastBlock == ASYNC_HTTP_NO_BLOCK) { ucFirstBlock = ucBlock; }
+      else { asyncHttpBlocks[ucLastBlock].ucNext = ucBlock; }
+      ucLastBlock = ucBlock;
+    }
+    AsyncHttpBlock &block = asyncHttpBlocks[ucBlock];
+    size_t uiChunk = min(uiSize, (size_t)(ASYNC_HTTP_BLOCK_SIZE - block.uiLength));
+    memcpy(block.aucData + block.uiLength, aucData, uiChunk);
+    block.uiLength += uiChunk;
+    aucData += uiChunk;
+    uiSize -= uiChunk;
+  }
+  return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// GENERATEURS
+// ------------------------------------------------------------------------------------------------
+/** Print borné sur un buffer : au-delà, l'écriture est refusée et signalée */
+class HttpStepWriter : public Print {
+public:
+  size_t uiLength = 0;
+  bool   bOverflow = false;
+  HttpStepWriter(uint8_t *aucBuffer, size_t uiSize) : aucBuffer(aucBuffer), uiSize(uiSize) {}
+  size_t write(uint8_t ucByte) override { return write(&ucByte, 1); }
+  size_t write(const uint8_t *aucData, size_t uiData) override {
+    if (bOverflow || uiLength + uiData > uiSize) {
+      bOverflow = true;
+      return 0;
+    }
+    memcpy(aucBuffer + uiLength, aucData, uiData);
+    uiLength += uiData;
+    return uiData;
+  }
+private:
+  uint8_t *aucBuffer;
+  size_t   uiSize;
+};
+
+/**
+ * Rendu d'autant d'étapes que possible dans aucBuffer, à partir de l'étape uiStep (avancée d'autant).
+ * Une étape qui ne tient plus est annulée, contexte compris, pour être rendue dans le buffer suivant.
+ * Renvoie la longueur rendue ; bMore passe à false après la dernière étape. Une longueur nulle avec
+ * bMore signale une étape plus grande que le buffer.
+ */
+size_t renderHttpSteps(HttpGenerator generator, uint16_t &uiStep, void *pContext, size_t uiContextSize,
+                       uint8_t *aucBuffer, size_t uiSize, bool &bMore){
+  HttpStepWriter writer(aucBuffer, uiSize);
+  uint8_t aucSaved[ASYNC_HTTP_CONTEXT_SIZE];
+  bMore = true;
+  while (bMore) {
+    size_t uiBefore = writer.uiLength;
+    memcpy(aucSaved, pContext, uiContextSize);
+    bMore = generator(writer, uiStep, pContext);
+    if (writer.bOverflow) {                                   // A refaire dans le buffer suivant
+      writer.uiLength = uiBefore;
+      memcpy(pContext, aucSaved, uiContextSize);
+      bMore = true;
+      break;
+    }
+    uiStep++;
+  }
+  return writer.uiLength;
+}
+
+// ------------------------------------------------------------------------------------------------
+// CONNEXIONS
+// ------------------------------------------------------------------------------------------------
+/**
+ * Libération d'une connexion. Le pcb est fermé proprement, ou interrompu (RST) si bAbort.
+ */
+void freeAsyncHttpConnection(AsyncHttpConnection &connection, bool bAbort){
+  if (connection.pPcb != NULL) {
+    tcp_arg(connection.pPcb, NULL);
+    tcp_recv(connection.pPcb, NULL);
+    tcp_sent(connection.pPcb, NULL);
+    tcp_err(connection.pPcb, NULL);
+    if (bAbort || tcp_close(connection.pPcb) != ERR_OK) { tcp_abort(connection.pPcb); }
+    connection.pPcb = NULL;
+  }
+  if (connection.file) { connection.file.close(); }
+  releaseAsyncHttpBlocks(connection.ucFirstBlock);
+  connection.ucFirstBlock = connection.ucLastBlock = ASYNC_HTTP_NO_BLOCK;
+  connection.generator = NULL;
+  connection.state = ASYNC_HTTP_FREE;
+}
+
+/**
+ * Attente d'une nouvelle requête sur la connexion : à l'acceptation, puis après chaque réponse keep-alive
+ */
+void resetAsyncHttpConnection(AsyncHttpConnection &connection){
+  if (connection.file) { connection.file.close(); }
+  releaseAsyncHttpBlocks(connection.ucFirstBlock);
+  connection.ucFirstBlock = connection.ucLastBlock = ASYNC_HTTP_NO_BLOCK;
+  connection.generator = NULL;
+  connection.state = ASYNC_HTTP_REQUEST;
+  connection.bDone = connection.bHeadersSent = connection.bKeepAlive = false;
+  connection.uiLength = connection.uiExpected = 0;
+  connection.ulLastActivity = millis();
+}
+
+/** Décodage d'un argument (%xx et +) sur place */
+void decodeAsyncHttpArg(char *strValue){
+  char *pOut = strValue;
+  for (char *p = strValue; *p; p++) {
+    if (*p == '+') { *pOut++ = ' '; }
+    else if (*p == '%' && isxdigit(p[1]) && isxdigit(p[2])) {
+      char cHex[3] = {p[1], p[2], 0};
+      *pOut++ = (char)strtol(cHex, NULL, 16);
+      p += 2;
+    } else { *pOut++ = *p; }
+  }
+  *pOut = 0;
+}
+
+/** Découpage des arguments "a=1&b=2" sur place */
+void parseAsyncHttpArgs(AsyncHttpConnection &connection, char *strArgs){
+  while (strArgs != NULL && *strArgs && connection.ucNbArgs < ASYNC_HTTP_MAX_ARGS) {
+    char *pNext = strchr(strArgs, '&');
+    if (pNext != NULL) { *pNext++ = 0; }
+    char *pValue = strchr(strArgs, '=');
+    if (pValue != NULL) { *pValue++ = 0; } else { pValue = strArgs + strlen(strArgs); }
+    decodeAsyncHttpArg(strArgs);
+    decodeAsyncHttpArg(pValue);
+    connection.astrArgNames[connection.ucNbArgs] = strArgs;
+    connection.astrArgValues[connection.ucNbArgs++] = pValue;
+    strArgs = pNext;
+  }
+}
+
+/**
+ * Valeur d'un en-tête de la requête (nom sans tenir compte de la casse), NULL s'il est absent
+ */
+const char *findAsyncHttpHeader(const char *strRequest, const char *pHeadersEnd, const char *strName){
+  size_t uiName = strlen(strName);
+  for (const char *p = strstr(strRequest, "\r\n"); p != NULL && p < pHeadersEnd; p = strstr(p + 2, "\r\n")) {
+    if (!strncasecmp(p + 2, strName, uiName) && p[2 + uiName] == ':') {
+      p += 3 + uiName;
+      while (*p == ' ') { p++; }
+      return p;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Longueur totale attendue d'une requête dont les en-têtes sont complets : en-têtes et Content-Length
+ */
+uint16_t getAsyncHttpExpected(AsyncHttpConnection &connection){
+  const char *pHeadersEnd = strstr(connection.cRequest, "\r\n\r\n");
+  if (pHeadersEnd == NULL) { return 0; }
+  uint32_t ulExpected = pHeadersEnd + 4 - connection.cRequest;
+  const char *strLength = findAsyncHttpHeader(connection.cRequest, pHeadersEnd, "Content-Length");
+  if (strLength != NULL) { ulExpected += strtoul(strLength, NULL, 10); }
+  return min(ulExpected, (uint32_t)ASYNC_HTTP_REQUEST_MAX + 1);   // Trop grande : détectée à la réception
+}
+
+/**
+ * Décodage de la requête complète : méthode, URI et arguments (URI et corps de formulaire).
+ * Renvoie false si la requête est invalide.
+ */
+bool parseAsyncHttpRequest(AsyncHttpConnection &connection){
+  char *strRequest = connection.cRequest;
+  connection.strUri = "";
+  connection.ucNbArgs = 0;
+  char *pHeadersEnd = strstr(strRequest, "\r\n\r\n");
+  const char *strType = findAsyncHttpHeader(strRequest, pHeadersEnd, "Content-Type");
+  bool bForm = strType != NULL && !strncmp(strType, "application/x-www-form-urlencoded", 33);
+  const char *strConnection = findAsyncHttpHeader(strRequest, pHeadersEnd, "Connection");
+  // Keep-alive par défaut en HTTP/1.1, sur demande en HTTP/1.0 (la longueur de la réponse décidera)
+  const char *pLineEnd = strstr(strRequest, "\r\n");
+  bool bHttp11 = pLineEnd - strRequest >= 8 && !strncmp(pLineEnd - 8, "HTTP/1.1", 8);
+  if (strConnection != NULL) { connection.bKeepAlive = !strncasecmp(strConnection, "keep-alive", 10); }
+  else { connection.bKeepAlive = bHttp11; }
+  *pHeadersEnd = 0;
+  char *strBody = pHeadersEnd + 4;
+  char *pSpace = strchr(strRequest, ' ');
+  if (pSpace == NULL) { return false; }
+  *pSpace = 0;
+  if (!strcmp(strRequest, "GET")) { connection.method = HTTP_GET; }
+  else if (!strcmp(strRequest, "POST")) { connection.method = HTTP_POST; }
+  else if (!strcmp(strRequest, "PUT")) { connection.method = HTTP_PUT; }
+  else { return false; }
+  char *strUri = pSpace + 1;
+  pSpace = strchr(strUri, ' ');
+  if (pSpace == NULL) { return false; }
+  *pSpace = 0;
+  connection.strUri = strUri;
+  char *strQuery = strchr(strUri, '?');
+  if (strQuery != NULL) { *strQuery++ = 0; }
+  decodeAsyncHttpArg(strUri);
+  parseAsyncHttpArgs(connection, strQuery);
+  if (bForm) { parseAsyncHttpArgs(connection, strBody); }     // Arguments d'un formulaire
+  return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// CALLBACKS LWIP
+// ------------------------------------------------------------------------------------------------
+void onAsyncHttpError(void *pArg, err_t err){
+  AsyncHttpConnection &connection = *(AsyncHttpConnection*)pArg;
+  connection.pPcb = NULL;                                     // Déjà libéré par lwIP
+  freeAsyncHttpConnection(connection, false);
+}
+
+err_t onAsyncHttpSent(void *pArg, struct tcp_pcb *pPcb, u16_t uiLength){
+  ((AsyncHttpConnection*)pArg)->ulLastActivity = millis();   // Le reste est envoyé par la boucle
+  return ERR_OK;
+}
+
+err_t onAsyncHttpRecv(void *pArg, struct tcp_pcb *pPcb, struct pbuf *pBuf, err_t err){
+  AsyncHttpConnection &connection = *(AsyncHttpConnection*)pArg;
+  if (pBuf == NULL) {                                         // Fermée par le client
+    if (connection.state == ASYNC_HTTP_REQUEST) { freeAsyncHttpConnection(connection, false); }
+    connection.bPeerClosed = true;                            // Requête prête ou réponse en cours : on termine l'envoi
+    return ERR_OK;
+  }
+  tcp_recved(pPcb, pBuf->tot_len);
+  connection.ulLastActivity = millis();
+  if (connection.state == ASYNC_HTTP_REQUEST) {
+    connection.bIdle = false;
+    if (connection.uiLength + pBuf->tot_len > ASYNC_HTTP_REQUEST_MAX) {
+      pbuf_free(pBuf);
+      ulAsyncHttpOverflows++;
+      freeAsyncHttpConnection(connection, true);
+      return ERR_ABRT;
+    }
+    connection.uiLength += pbuf_copy_partial(pBuf, connection.cRequest + connection.uiLength, pBuf->tot_len, 0);
+    connection.cRequest[connection.uiLength] = 0;
+    if (connection.uiExpected == 0) { connection.uiExpected = getAsyncHttpExpected(connection); }
+    if (connection.uiExpected > ASYNC_HTTP_REQUEST_MAX) {
+      pbuf_free(pBuf);
+      ulAsyncHttpOverflows++;
+      freeAsyncHttpConnection(connection, true);
+      return ERR_ABRT;
+    }
+    if (connection.uiExpected != 0 && connection.uiLength >= connection.uiExpected) {
+      connection.state = ASYNC_HTTP_READY;
+      esp_schedule();                                         // Fin de l'attente de la boucle (cf. \ref power)
+    }
+  }
+  pbuf_free(pBuf);                                            // Données après la requête : ignorées
+  return ERR_OK;
+}
+
+err_t onAsyncHttpAccept(void *pArg, struct tcp_pcb *pPcb, err_t err){
+  AsyncHttpConnection *pConnection = NULL;
+  AsyncHttpConnection *pIdle = NULL;
+  uint8_t ucUsed = 1;
+  for (uint8_t i = 0; i < ASYNC_HTTP_MAX_CONN; i++) {
+    if (asyncHttpConnections[i].state != ASYNC_HTTP_FREE) {
+      ucUsed++;
+      if (asyncHttpConnections[i].bIdle) { pIdle = &asyncHttpConnections[i]; }
+    }
+    else if (pConnection == NULL) { pConnection = &asyncHttpConnections[i]; }
+  }
+  if (err != ERR_OK) { return err; }
+  if (pConnection == NULL && pIdle != NULL) {                 // Place d'une connexion keep-alive inactive
+    freeAsyncHttpConnection(*pIdle, false);
+    pConnection = pIdle;
+    ucUsed--;
+  }
+  if (pConnection == NULL) {
+    ulAsyncHttpRejected++;
+    tcp_abort(pPcb);
+    return ERR_ABRT;
+  }
+  ulAsyncHttpAccepted++;
+  if (ucUsed > ucAsyncHttpPeak) { ucAsyncHttpPeak = ucUsed; }
+  AsyncHttpConnection &connection = *pConnection;
+  connection.pPcb = pPcb;
+  connection.ucFirstBlock = connection.ucLastBlock = ASYNC_HTTP_NO_BLOCK;
+  connection.bIdle = connection.bPeerClosed = false;
+  resetAsyncHttpConnection(connection);
+  tcp_setprio(pPcb, TCP_PRIO_MIN);
+  tcp_nagle_disable(pPcb);
+  tcp_arg(pPcb, pConnection);
+  tcp_recv(pPcb, onAsyncHttpRecv);
+  tcp_sent(pPcb, onAsyncHttpSent);
+  tcp_err(pPcb, onAsyncHttpError);
+  return ERR_OK;
+}
+
+// ------------------------------------------------------------------------------------------------
+// SERVEUR
+// ------------------------------------------------------------------------------------------------
+class AsyncHttpServer {
+public:
+  AsyncHttpServer(uint16_t uiPort) : uiPort(uiPort) {}
+
+  void onNotFound(void (*handler)()){ requestHandler = handler; }
+
+  void begin(){
+    for (uint8_t i = 0; i < ASYNC_HTTP_BLOCKS; i++) { asyncHttpBlocks[i].ucNext = (i + 1 < ASYNC_HTTP_BLOCKS) ? i + 1 : ASYNC_HTTP_NO_BLOCK; }
+    ucAsyncHttpFreeBlock = 0;
+    struct tcp_pcb *pPcb = tcp_new();
+    if (pPcb == NULL || tcp_bind(pPcb, IP_ADDR_ANY, uiPort) != ERR_OK) {
+      MYDEBUG_PRINTLN("-ASYNC HTTP : Port indisponible");
+      return;
+    }
+    pListenPcb = tcp_listen(pPcb);
+    tcp_accept(pListenPcb, onAsyncHttpAccept);
+  }
+
+  /**
+   * A chaque appel : envoi des réponses en cours et délais, puis traitement d'une requête complète.
+   * Ne bloque jamais sur le réseau.
+   */
+  void handleClient(){
+    uint32_t ulNow = millis();
+    for (uint8_t i = 0; i < ASYNC_HTTP_MAX_CONN; i++) {
+      AsyncHttpConnection &connection = asyncHttpConnections[i];
+      if (connection.state == ASYNC_HTTP_RESPONSE) { pump(connection); }
+      if (connection.state == ASYNC_HTTP_FREE || connection.state == ASYNC_HTTP_READY) { continue; }
+      if (connection.bIdle) {                                   // Keep-alive sans nouvelle requête : fermeture normale
+        if (ulNow - connection.ulLastActivity >= ASYNC_HTTP_KEEPALIVE_TIMEOUT) { freeAsyncHttpConnection(connection, false); }
+        continue;
+      }
+      uint32_t ulTimeout = (connection.state == ASYNC_HTTP_REQUEST) ? ASYNC_HTTP_REQUEST_TIMEOUT : ASYNC_HTTP_RESPONSE_TIMEOUT;
+      if (ulNow - connection.ulLastActivity >= ulTimeout) {
+        ulAsyncHttpTimeouts++;
+        freeAsyncHttpConnection(connection, true);
+      }
+    }
+    for (uint8_t n = 0; n < ASYNC_HTTP_MAX_CONN; n++) {          // Tour de rôle entre les connexions
+      AsyncHttpConnection &connection = asyncHttpConnections[ucNextRequest];
+      ucNextRequest = (ucNextRequest + 1) % ASYNC_HTTP_MAX_CONN;
+      if (connection.state != ASYNC_HTTP_READY) { continue; }
+      connection.state = ASYNC_HTTP_RESPONSE;
+      connection.ulLastActivity = ulNow;
+      pCurrent = &connection;
+      uiContentLength = CONTENT_LENGTH_NOT_SET;
+      if (!parseAsyncHttpRequest(connection)) {
+        connection.bKeepAlive = false;
+        send(400, "text/plain", "Bad Request");
+      }
+      else if (requestHandler != NULL) { requestHandler(); }
+      pCurrent = NULL;
+      if (connection.state == ASYNC_HTTP_RESPONSE) {            // Sinon, interrompue pendant le traitement
+        connection.bDone = true;
+        pump(connection);
+      }
+      return;
+    }
+  }
+
+  // Requête en cours
+  String uri(){ return pCurrent ? String(pCurrent->strUri) : String(); }
+  HTTPMethod method(){ return pCurrent ? pCurrent->method : HTTP_GET; }
+  int args(){ return pCurrent ? pCurrent->ucNbArgs : 0; }
+  String argName(int i){ return (pCurrent && i < pCurrent->ucNbArgs) ? String(pCurrent->astrArgNames[i]) : String(); }
+  String arg(int i){ return (pCurrent && i < pCurrent->ucNbArgs) ? String(pCurrent->astrArgValues[i]) : String(); }
+  String arg(const char *strName){
+    const char *strValue = findArg(strName);
+    return strValue ? String(strValue) : String();
+  }
+  bool hasArg(const char *strName){ return findArg(strName) != NULL; }
+
+  // Réponse
+  void setContentLength(size_t uiLength){ uiContentLength = uiLength; }
+
+  void send(int iCode, const char *strContentType, const char *strContent){
+    size_t uiLength = strlen(strContent);
+    sendHeaders(iCode, strContentType, uiContentLength == CONTENT_LENGTH_NOT_SET ? uiLength : uiContentLength, NULL);
+    write((const uint8_t*)strContent, uiLength);
+  }
+  void send(int iCode, const char *strContentType, const String &strContent){ send(iCode, strContentType, strContent.c_str()); }
+  void sendContent(const char *strContent, size_t uiLength){ write((const uint8_t*)strContent, uiLength); }
+  void sendContent(const char *strContent){ sendContent(strContent, strlen(strContent)); }
+  void sendContent(const String &strContent){ sendContent(strContent.c_str(), strContent.length()); }
+
+  /** Envoi d'un fichier au fil des acquittements, Content-Encoding: gzip pour un .gz */
+  size_t streamFile(File &file, const String &strContentType){
+    if (pCurrent == NULL) { return 0; }
+    sendHeaders(200, strContentType.c_str(), file.size(), String(file.name()).endsWith(".gz") ? "Content-Encoding: gzip\r\n" : NULL);
+    pCurrent->file = SPIFFS.open(file.name(), "r");           // Le fichier de l'appelant est fermé au retour
+    return file.size();
+  }
+
+  /**
+   * Réponse de longueur inconnue produite par étapes au fil des acquittements : le contexte est copié
+   * dans la connexion, le générateur est appelé par la boucle après le retour du traitement.
+   */
+  void sendGenerated(int iCode, const char *strContentType, HttpGenerator generator, const void *pContext, size_t uiContextSize){
+    if (pCurrent == NULL) { return; }
+    if (uiContextSize > ASYNC_HTTP_CONTEXT_SIZE) {
+      MYDEBUG_PRINTLN("-ASYNC HTTP : Contexte de générateur trop grand");
+      send(500, "text/plain", "Internal Server Error");
+      return;
+    }
+    sendHeaders(iCode, strContentType, CONTENT_LENGTH_UNKNOWN, NULL);
+    if (pCurrent->state != ASYNC_HTTP_RESPONSE) { return; }   // Interrompue par l'écriture des en-têtes
+    memcpy(pCurrent->aucContext, pContext, uiContextSize);
+    pCurrent->ucContextSize = uiContextSize;
+    pCurrent->uiStep = 0;
+    pCurrent->generator = generator;
+  }
+
+private:
+  uint16_t             uiPort;
+  struct tcp_pcb      *pListenPcb = NULL;
+  void               (*requestHandler)() = NULL;
+  AsyncHttpConnection *pCurrent = NULL;           // Connexion dont la requête est en cours de traitement
+  size_t               uiContentLength = CONTENT_LENGTH_NOT_SET;
+  uint8_t              ucNextRequest = 0;
+
+  const char *findArg(const char *strName){
+    if (pCurrent == NULL) { return NULL; }
+    for (uint8_t i = 0; i < pCurrent->ucNbArgs; i++) {
+      if (!strcmp(pCurrent->astrArgNames[i], strName)) { return pCurrent->astrArgValues[i]; }
+    }
+    return NULL;
+  }
+
+  const char *getStatusText(int iCode){
+    switch (iCode) {
+      case 200 : return "OK";
+      case 204 : return "No Content";
+      case 400 : return "Bad Request";
+      case 404 : return "Not Found";
+      case 500 : return "Internal Server Error";
+      case 503 : return "Service Unavailable";
+      default  : return "";
+    }
+  }
+
+  /**
+   * Ligne de statut et en-têtes, sans Content-Length si la longueur est inconnue : la connexion est
+   * alors fermée à la fin de la réponse
+   */
+  void sendHeaders(int iCode, const char *strContentType, size_t uiLength, const char *strExtra){
+    if (pCurrent == NULL || pCurrent->bHeadersSent) { return; }
+    pCurrent->bHeadersSent = true;
+    if (uiLength == CONTENT_LENGTH_UNKNOWN) { pCurrent->bKeepAlive = false; }
+    char cHeaders[192];
+    int iLength = snprintf(cHeaders, sizeof(cHeaders), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nConnection: %s\r\n%s",
+                           iCode, getStatusText(iCode), strContentType, pCurrent->bKeepAlive ? "keep-alive" : "close",
+                           strExtra ? strExtra : "");
+    if (uiLength != CONTENT_LENGTH_UNKNOWN && iLength < (int)sizeof(cHeaders)) {
+      iLength += snprintf(cHeaders + iLength, sizeof(cHeaders) - iLength, "Content-Length: %u\r\n", (unsigned)uiLength);
+    }
+    if (iLength < (int)sizeof(cHeaders)) { iLength += snprintf(cHeaders + iLength, sizeof(cHeaders) - iLength, "\r\n"); }
+    write((const uint8_t*)cHeaders, min(iLength, (int)sizeof(cHeaders) - 1));
+  }
+
+  /**
+   * Ecriture de la réponse par le traitement (cf. queueAsyncHttpData()). Pool épuisé : la connexion
+   * est interrompue, une réponse plus longue doit passer par un générateur (sendGenerated()).
+   */
+  void write(const uint8_t *aucData, size_t uiSize){
+    AsyncHttpConnection *pConnection = pCurrent;
+    if (pConnection == NULL || pConnection->pPcb == NULL) { return; }
+    if (!queueAsyncHttpData(pConnection->pPcb, pConnection->ucFirstBlock, pConnection->ucLastBlock, aucData, uiSize)) {
+      MYDEBUG_PRINTLN("-ASYNC HTTP : Pool de réponse épuisé");
+      ulAsyncHttpOverflows++;
+      freeAsyncHttpConnection(*pConnection, true);
+    }
+  }
+
+  /**
+   * Envoi de la suite d'une réponse, dans la limite du tampon d'émission : blocs, puis fichier ou
+   * étapes du générateur. Le générateur n'est appelé que lorsque tout ce qu'il a rendu est parti et
+   * qu'un bloc est libre : ce que le tampon d'émission (ou la file de segments de lwIP) refuse y tient.
+   * Une fois tout écrit, ferme la connexion ou, en keep-alive, attend la requête suivante.
+   */
+  void pump(AsyncHttpConnection &connection){
+    if (connection.pPcb == NULL) { return; }
+    while (connection.ucFirstBlock != ASYNC_HTTP_NO_BLOCK) {
+      AsyncHttpBlock &block = asyncHttpBlocks[connection.ucFirstBlock];
+      size_t uiChunk = min((size_t)(block.uiLength - block.uiSent), (size_t)tcp_sndbuf(connection.pPcb));
+      if (uiChunk == 0 || tcp_write(connection.pPcb, block.aucData + block.uiSent, uiChunk, TCP_WRITE_FLAG_COPY) != ERR_OK) { break; }
+      block.uiSent += uiChunk;
+      if (block.uiSent < block.uiLength) { break; }
+      uint8_t ucNext = block.ucNext;
+      block.ucNext = ASYNC_HTTP_NO_BLOCK;
+      releaseAsyncHttpBlocks(connection.ucFirstBlock);
+      connection.ucFirstBlock = ucNext;
+      if (ucNext == ASYNC_HTTP_NO_BLOCK) { connection.ucLastBlock = ASYNC_HTTP_NO_BLOCK; }
+    }
+    while (connection.ucFirstBlock == ASYNC_HTTP_NO_BLOCK && connection.file && connection.file.available()) {
+      uint8_t aucChunk[ASYNC_HTTP_BLOCK_SIZE];
+      size_t uiChunk = min((size_t)tcp_sndbuf(connection.pPcb), sizeof(aucChunk));
+      if (uiChunk == 0) { break; }
+      uint32_t ulPosition = connection.file.position();
+      uiChunk = connection.file.read(aucChunk, uiChunk);
+      if (tcp_write(connection.pPcb, aucChunk, uiChunk, TCP_WRITE_FLAG_COPY) != ERR_OK) {
+        connection.file.seek(ulPosition, SeekSet);              // File d'émission pleine : on relira
+        break;
+      }
+    }
+    while (connection.generator != NULL && connection.ucFirstBlock == ASYNC_HTTP_NO_BLOCK &&
+           ucAsyncHttpFreeBlock != ASYNC_HTTP_NO_BLOCK) {
+      uint8_t aucChunk[ASYNC_HTTP_BLOCK_SIZE];
+      bool bMore;
+      size_t uiChunk = renderHttpSteps(connection.generator, connection.uiStep, connection.aucContext,
+                                       connection.ucContextSize, aucChunk, sizeof(aucChunk), bMore);
+      if (bMore && uiChunk == 0) {
+        MYDEBUG_PRINTLN("-ASYNC HTTP : Etape de générateur plus grande qu'un bloc");
+        ulAsyncHttpOverflows++;
+        freeAsyncHttpConnection(connection, true);
+        return;
+      }
+      if (!bMore) { connection.generator = NULL; }
+      queueAsyncHttpData(connection.pPcb, connection.ucFirstBlock, connection.ucLastBlock, aucChunk, uiChunk);   // Le surplus tient dans le bloc libre
+    }
+    tcp_output(connection.pPcb);
+    bool bFileDone = !connection.file || !connection.file.available();
+    if (connection.bDone && connection.ucFirstBlock == ASYNC_HTTP_NO_BLOCK && bFileDone && connection.generator == NULL) {
+      if (connection.bKeepAlive && !connection.bPeerClosed) {
+        resetAsyncHttpConnection(connection);
+        connection.bIdle = true;
+      } else {
+        freeAsyncHttpConnection(connection, false);           // lwIP termine l'envoi puis ferme
+      }
+    }
+  }
+};
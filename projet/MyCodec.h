@@ -0,0 +1,407 @@
+/**
+ * \file MyCodec.h
+ * \page codec Encodage des payloads
+ * \brief JSON ou Protobuf pour la télémétrie, les attributs et les RPC
+ *
+ * En JSON, chaque message répète le nom de toutes ses clés : {"MyTelemetryInt":25,"MyTelemetryFloat":...}
+ * pèse plus de 100 octets pour 4 valeurs. Et le décodage des requêtes RPC passe par un document JSON.
+ *
+ * ThingsBoard accepte aussi des payloads Protobuf : dans le profil du dispositif, choisir le
+ * "Transport type" MQTT avec le "Transport payload type" Protobuf, et renseigner les schémas suivants.
+ * Les noms des champs deviennent les clés de la télémétrie et des attributs.
+ * \verbatim
+syntax = "proto3";
+package plante;
+
+message TelemetryMsg {
+  sint32 MyTelemetryInt = 1;
+  float  MyTelemetryFloat = 2;
+  bool   MyTelemetryBool = 3;
+  string MyTelemetryString = 4;
+  uint32 ruleAlert = 5;
+  repeated uint32 soilProbes = 6;
+}
+
+message AttributesMsg {
+  string firmwareVersion = 1;
+  string thingType = 2;
+  uint32 serialNumber = 3;
+  int32  MyActuatorState = 4;
+  uint32 bootCount = 5;
+  uint32 deepSleepWakes = 6;
+  uint32 wifiAttempts = 7;
+  uint32 mqttReconnects = 8;
+  uint32 publishFailures = 9;
+  uint32 watchdogStalls = 10;
+  uint32 radioOnSeconds = 11;
+  float  energyAverageMa = 12;
+  float  energyChargeMah = 13;
+  float  energyMessageUah = 14;
+}
+\endverbatim
+ * Les schémas RPC sont ceux proposés par défaut par ThingsBoard :
+ * RpcRequestMsg {string method = 1; int32 requestId = 2; string params = 3;} et
+ * RpcResponseMsg {string payload = 1;}.
+ *
+ * Les schémas sont figés à la compilation : chaque message est écrit champ par champ dans un Print
+ * (compatible avec la publication en flux du module \ref mqtt), sans document intermédiaire, et la
+ * requête RPC est décodée dans une structure de taille fixe.
+ *
+ * L'encodage est choisi par MQTT_CODEC (modifiable à l'exécution via ucMqttCodec). Au démarrage,
+ * benchmarkCodecs() affiche pour chaque encodage la taille et le temps CPU de chaque message.
+ *
+ * \note CBOR n'est pas proposé : ThingsBoard n'accepte que JSON et Protobuf sur MQTT.
+ *
+ * Fichier \ref MyCodec.h
+ */
+
+#include <ArduinoJson.h>                          // JSON
+
+#define MQTT_CODEC_JSON       0
+#define MQTT_CODEC_PROTOBUF   1
+#define MQTT_CODEC            MQTT_CODEC_JSON     // Encodage par défaut
+#define CODEC_BENCH_LOOPS     100                 // Nombre d'itérations par mesure de benchmarkCodecs()
+
+// Types de champs Protobuf (wire types)
+#define PB_VARINT             0
+#define PB_FIXED64            1
+#define PB_LENGTH             2
+#define PB_FIXED32            5
+
+/** Données de télémétrie */
+struct MqttTelemetry {
+  int32_t     iInt;
+  Fixed       lFloat;                     /*!< En virgule fixe, float sur le fil en Protobuf (cf. \ref fixed) */
+  bool        bBool;
+  const char *strString;
+};
+
+/** Attributs du client */
+struct MqttAttributes {
+  const char *strFirmwareVersion;
+  const char *strThingType;
+  uint32_t    ulSerialNumber;
+  int         iActuatorState;
+  const uint32_t *pulCounters;                    /*!< Compteurs persistants (cf. \ref counters), NULL si absents */
+  const EnergySummary *pEnergy;                   /*!< Bilan énergétique (cf. \ref energy), NULL si absent */
+};
+
+/** Requête RPC décodée */
+struct MqttRpcRequest {
+  char cMethod[32];
+  char cParams[64];                               /*!< Paramètres sérialisés en texte ("true", "42", ...) */
+};
+
+uint8_t ucMqttCodec = MQTT_CODEC;                 // Encodage utilisé
+
+// ------------------------------------------------------------------------------------------------
+// PROTOBUF
+// ------------------------------------------------------------------------------------------------
+void pbWriteVarint(Print &output, uint32_t ulValue){
+  while (ulValue >= 0x80) {
+    output.write((uint8_t)(ulValue | 0x80));
+    ulValue >>= 7;
+  }
+  output.write((uint8_t)ulValue);
+}
+
+void pbWriteTag(Print &output, uint8_t ucField, uint8_t ucType){
+  pbWriteVarint(output, (ucField << 3) | ucType);
+}
+
+void pbWriteUInt(Print &output, uint8_t ucField, uint32_t ulValue){
+  pbWriteTag(output, ucField, PB_VARINT);
+  pbWriteVarint(output, ulValue);
+}
+
+void pbWriteSInt(Print &output, uint8_t ucField, int32_t lValue){
+  pbWriteUInt(output, ucField, ((uint32_t)lValue << 1) ^ (uint32_t)(lValue >> 31));   // ZigZag
+}
+
+void pbWriteFloat(Print &output, uint8_t ucField, float fValue){
+  uint32_t ulBits;
+  memcpy(&ulBits, &fValue, sizeof(ulBits));
+  pbWriteTag(output, ucField, PB_FIXED32);
+  for (uint8_t i = 0; i < 4; i++) { output.write((uint8_t)(ulBits >> (8 * i))); }      // Little endian
+}
+
+void pbWriteString(Print &output, uint8_t ucField, const char *strValue){
+  size_t uiLength = strlen(strValue);
+  pbWriteTag(output, ucField, PB_LENGTH);
+  pbWriteVarint(output, uiLength);
+  output.write((const uint8_t*)strValue, uiLength);
+}
+
+/**
+ * Lecture d'un varint, renvoie false si le buffer est trop court
+ */
+bool pbReadVarint(const uint8_t *aucData, unsigned int uiLength, unsigned int &uiPos, uint32_t &ulValue){
+  ulValue = 0;
+  for (uint8_t ucShift = 0; ucShift < 35; ucShift += 7) {
+    if (uiPos >= uiLength) { return false; }
+    uint8_t ucByte = aucData[uiPos++];
+    ulValue |= (uint32_t)(ucByte & 0x7F) << ucShift;
+    if ((ucByte & 0x80) == 0) { return true; }
+  }
+  return false;
+}
+
+/**
+ * Décodage d'un RpcRequestMsg : seuls method et params sont conservés, les autres champs sont sautés
+ */
+bool pbReadRpcRequest(const uint8_t *aucData, unsigned int uiLength, MqttRpcRequest &request){
+  unsigned int uiPos = 0;
+  while (uiPos < uiLength) {
+    uint32_t ulTag, ulValue;
+    if (!pbReadVarint(aucData, uiLength, uiPos, ulTag)) { return false; }
+    switch (ulTag & 0x07) {
+      case PB_VARINT :
+        if (!pbReadVarint(aucData, uiLength, uiPos, ulValue)) { return false; }
+        break;
+      case PB_FIXED64 : uiPos += 8; break;
+      case PB_FIXED32 : uiPos += 4; break;
+      case PB_LENGTH : {
+        if (!pbReadVarint(aucData, uiLength, uiPos, ulValue) || ulValue > uiLength - uiPos) { return false; }
+        char *cTarget = NULL;
+        size_t uiSize = 0;
+        if ((ulTag >> 3) == 1) { cTarget = request.cMethod; uiSize = sizeof(request.cMethod); }
+        if ((ulTag >> 3) == 3) { cTarget = request.cParams; uiSize = sizeof(request.cParams); }
+        if (cTarget != NULL) {
+          size_t uiCopy = min((size_t)ulValue, uiSize - 1);
+          memcpy(cTarget, aucData + uiPos, uiCopy);
+          cTarget[uiCopy] = 0;
+        }
+        uiPos += ulValue;
+        break;
+      }
+      default :
+        return false;
+    }
+  }
+  return uiPos == uiLength;
+}
+
+// ------------------------------------------------------------------------------------------------
+// ENCODAGE DES MESSAGES
+// ------------------------------------------------------------------------------------------------
+/**
+ * Ecriture des données de télémétrie
+ */
+void writeTelemetry(Print &output, const MqttTelemetry &telemetry){
+  if (ucMqttCodec == MQTT_CODEC_PROTOBUF) {
+    pbWriteSInt(output, 1, telemetry.iInt);
+    pbWriteFloat(output, 2, fixedToFloat(telemetry.lFloat));
+    pbWriteUInt(output, 3, telemetry.bBool);
+    pbWriteString(output, 4, telemetry.strString);
+    return;
+  }
+  output.print("{\"MyTelemetryInt\":");
+  output.print(telemetry.iInt);
+  output.print(",\"MyTelemetryFloat\":");
+  printFixed(output, telemetry.lFloat, 2);
+  output.print(",\"MyTelemetryBool\":");
+  output.print(telemetry.bBool ? 1 : 0);
+  output.print(",\"MyTelemetryString\":\"");
+  output.print(telemetry.strString);
+  output.print("\"}");
+}
+
+/**
+ * Ecriture des attributs du client. strFirmwareVersion NULL : état de l'actuateur seul (mise à jour)
+ */
+void writeAttributes(Print &output, const MqttAttributes &attributes){
+  if (ucMqttCodec == MQTT_CODEC_PROTOBUF) {
+    if (attributes.strFirmwareVersion != NULL) {
+      pbWriteString(output, 1, attributes.strFirmwareVersion);
+      pbWriteString(output, 2, attributes.strThingType);
+      pbWriteUInt(output, 3, attributes.ulSerialNumber);
+    }
+    pbWriteUInt(output, 4, attributes.iActuatorState);                 // int32 positif : simple varint
+    for (uint8_t i = 0; attributes.pulCounters != NULL && i < CNT_NB; i++) {
+      pbWriteUInt(output, 5 + i, attributes.pulCounters[i]);
+    }
+    if (attributes.pEnergy != NULL) {
+      pbWriteFloat(output, 12, fixedToFloat(attributes.pEnergy->lAverageMa));
+      pbWriteFloat(output, 13, fixedToFloat(attributes.pEnergy->lChargeMah));
+      pbWriteFloat(output, 14, fixedToFloat(attributes.pEnergy->lMessageUah));
+    }
+    return;
+  }
+  output.print("{");
+  if (attributes.strFirmwareVersion != NULL) {
+    output.print("\"firmwareVersion\":\"");
+    output.print(attributes.strFirmwareVersion);
+    output.print("\",\"thingType\":\"");
+    output.print(attributes.strThingType);
+    output.print("\",\"serialNumber\":");
+    output.print((unsigned long)attributes.ulSerialNumber);
+    output.print(",");
+  }
+  output.print("\"MyActuatorState\":");
+  output.print(attributes.iActuatorState);
+  for (uint8_t i = 0; attributes.pulCounters != NULL && i < CNT_NB; i++) {
+    output.print(",\"");
+    output.print(COUNTER_NAMES[i]);
+    output.print("\":");
+    output.print((unsigned long)attributes.pulCounters[i]);
+  }
+  if (attributes.pEnergy != NULL) {
+    output.print(",\"energyAverageMa\":");
+    printFixed(output, attributes.pEnergy->lAverageMa, 2);
+    output.print(",\"energyChargeMah\":");
+    printFixed(output, attributes.pEnergy->lChargeMah, 2);
+    output.print(",\"energyMessageUah\":");
+    printFixed(output, attributes.pEnergy->lMessageUah, 2);
+  }
+  output.print("}");
+}
+
+/**
+ * Ecriture d'un balayage des sondes d'humidité du sol (cf. \ref soilsensor) : un seul message pour
+ * toutes les sondes. En Protobuf, champ répété "packed" : chaque valeur (de 0 à 100) tient sur un octet.
+ */
+void writeSoilScan(Print &output, const uint8_t *aucPercent, uint8_t ucCount){
+  if (ucMqttCodec == MQTT_CODEC_PROTOBUF) {
+    pbWriteTag(output, 6, PB_LENGTH);
+    pbWriteVarint(output, ucCount);
+    output.write(aucPercent, ucCount);
+    return;
+  }
+  output.print("{");
+  for (uint8_t i = 0; i < ucCount; i++) {
+    output.print(i > 0 ? ",\"soil" : "\"soil");
+    output.print(i);
+    output.print("\":");
+    output.print(aucPercent[i]);
+  }
+  output.print("}");
+}
+
+/**
+ * Alerte d'une règle (cf. \ref rules) : télémétrie ruleAlert, le numéro de la règle déclenchée
+ */
+void writeRuleAlert(Print &output, uint8_t ucRule){
+  if (ucMqttCodec == MQTT_CODEC_PROTOBUF) {
+    pbWriteUInt(output, 5, ucRule);
+    return;
+  }
+  output.print("{\"ruleAlert\":");
+  output.print(ucRule);
+  output.print("}");
+}
+
+/**
+ * Ecriture d'une réponse RPC déjà sérialisée en JSON.
+ * En Protobuf, la réponse est un RpcResponseMsg dont la payload reste en JSON.
+ */
+void writeRpcPayload(Print &output, const char *strJson){
+  if (ucMqttCodec == MQTT_CODEC_PROTOBUF) {
+    pbWriteString(output, 1, strJson);
+    return;
+  }
+  output.print(strJson);
+}
+
+/**
+ * Ecriture de la réponse à une requête RPC : l'état de l'actuateur.
+ */
+void writeRpcResponse(Print &output, int iActuatorState){
+  char cPayload[32];
+  snprintf(cPayload, sizeof(cPayload), "{\"MyActuatorState\":%d}", iActuatorState);
+  writeRpcPayload(output, cPayload);
+}
+
+// ------------------------------------------------------------------------------------------------
+// DECODAGE DES MESSAGES
+// ------------------------------------------------------------------------------------------------
+/**
+ * Décodage d'une requête RPC. Renvoie false si la payload est invalide.
+ */
+bool readRpcRequest(const uint8_t *aucPayload, unsigned int uiLength, MqttRpcRequest &request){
+  request.cMethod[0] = 0;
+  request.cParams[0] = 0;
+  if (ucMqttCodec == MQTT_CODEC_PROTOBUF) { return pbReadRpcRequest(aucPayload, uiLength, request); }
+
+  StaticJsonDocument<200> jsonDocument;
+  DeserializationError error = deserializeJson(jsonDocument, aucPayload, uiLength);
+  if (error) {
+    MYDEBUG_PRINT("-CODEC : Parsing JSON IMPOSSIBLE ");
+    MYDEBUG_PRINTLN(error.c_str());
+    return false;
+  }
+  strlcpy(request.cMethod, jsonDocument["method"] | "", sizeof(request.cMethod));
+  JsonVariant params = jsonDocument["params"];
+  if (params.is<const char*>()) {
+    strlcpy(request.cParams, params.as<const char*>(), sizeof(request.cParams));
+  } else if (!params.isNull()) {
+    serializeJson(params, request.cParams, sizeof(request.cParams));   // true, 42, {...}
+  }
+  return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// STATISTIQUES
+// ------------------------------------------------------------------------------------------------
+/** Print qui ne fait que compter les octets */
+class ByteCounter : public Print {
+public:
+  size_t uiCount = 0;
+  size_t write(uint8_t ucByte) override { uiCount++; return 1; }
+  size_t write(const uint8_t *aucData, size_t uiSize) override { uiCount += uiSize; return uiSize; }
+};
+
+void printCodecBench(const char *strMessage, size_t uiBytes, uint32_t ulMicros){
+  MYDEBUG_PRINT("-CODEC :   ");
+  MYDEBUG_PRINT(strMessage);
+  MYDEBUG_PRINT(" [");
+  MYDEBUG_PRINT(uiBytes);
+  MYDEBUG_PRINT(" octets / ");
+  MYDEBUG_PRINT((float)ulMicros / CODEC_BENCH_LOOPS);
+  MYDEBUG_PRINTLN(" µs]");
+}
+
+/**
+ * Taille et temps CPU par message de chaque encodage, sur des messages types
+ */
+void benchmarkCodecs(){
+  MqttTelemetry telemetry = {25, FIXED(21.5), true, "MyString"};
+  EnergySummary energy = {FIXED(4.2), FIXED(12.5), FIXED(35.8)};
+  MqttAttributes attributes = {FIRMWAREVERSION, THINGTYPE, ESP.getChipId(), 0, countersRecord.aulValues, &energy};
+  const char *astrNames[2] = {"JSON", "Protobuf"};
+  uint8_t ucCodec = ucMqttCodec;
+
+  // Requête RPC type, dans chaque encodage
+  const char strJsonRequest[] = "{\"method\":\"setActuatorState\",\"params\":true}";
+  const uint8_t aucPbRequest[] = {0x0A, 16, 's','e','t','A','c','t','u','a','t','o','r','S','t','a','t','e',
+                                  0x10, 1, 0x1A, 4, 't','r','u','e'};
+
+  for (uint8_t c = MQTT_CODEC_JSON; c <= MQTT_CODEC_PROTOBUF; c++) {
+    ucMqttCodec = c;
+    MYDEBUG_PRINT("-CODEC : ");
+    MYDEBUG_PRINTLN(astrNames[c]);
+
+    ByteCounter counter;
+    uint32_t ulStart = micros();
+    for (uint16_t i = 0; i < CODEC_BENCH_LOOPS; i++) { writeTelemetry(counter, telemetry); }
+    printCodecBench("Télémétrie", counter.uiCount / CODEC_BENCH_LOOPS, micros() - ulStart);
+
+    counter.uiCount = 0;
+    ulStart = micros();
+    for (uint16_t i = 0; i < CODEC_BENCH_LOOPS; i++) { writeAttributes(counter, attributes); }
+    printCodecBench("Attributs", counter.uiCount / CODEC_BENCH_LOOPS, micros() - ulStart);
+
+    counter.uiCount = 0;
+    ulStart = micros();
+    for (uint16_t i = 0; i < CODEC_BENCH_LOOPS; i++) { writeRpcResponse(counter, 1); }
+    printCodecBench("Réponse RPC", counter.uiCount / CODEC_BENCH_LOOPS, micros() - ulStart);
+
+    const uint8_t *aucRequest = (c == MQTT_CODEC_JSON) ? (const uint8_t*)strJsonRequest : aucPbRequest;
+    unsigned int uiRequest = (c == MQTT_CODEC_JSON) ? strlen(strJsonRequest) : sizeof(aucPbRequest);
+    MqttRpcRequest request;
+    ulStart = micros();
+    for (uint16_t i = 0; i < CODEC_BENCH_LOOPS; i++) { readRpcRequest(aucRequest, uiRequest, request); }
+    printCodecBench("Requête RPC", uiRequest, micros() - ulStart);
+    yield();
+  }
+  ucMqttCodec = ucCodec;
+}
@@ -0,0 +1,189 @@
+/**
+ * \file MyCounters.h
+ * \page counters Compteurs persistants
+ * \brief Compteurs de fonctionnement conservés à travers les resets, le Deep Sleep et les coupures
+ *
+ * Pour calculer la fiabilité ou la consommation d'une flotte d'objets, il faut des compteurs qui
+ * survivent aux redémarrages : nombre de démarrages et de réveils de Deep Sleep, tentatives de
+ * connexion WiFi, (re)connexions aux brokers MQTT, publications échouées, blocages détectés par le
+ * \ref watchdog et temps cumulé radio allumée.
+ *
+ * Les compteurs sont conservés à deux endroits :
+ * - En mémoire RTC (cf. \ref rtcmemory), mise à jour à chaque incrément : elle ne s'use pas et survit
+ *   aux resets et au Deep Sleep.
+ * - Dans le SPIFFS, toutes les CNT_FLASH_PERIOD ms si un compteur a changé, pour survivre aux coupures
+ *   d'alimentation. Le fichier est un anneau de CNT_FLASH_SLOTS emplacements, chacun avec un numéro
+ *   de séquence et un CRC : chaque sauvegarde écrit l'emplacement suivant. Une coupure pendant
+ *   l'écriture n'abîme qu'un emplacement, et on relit au démarrage l'emplacement valide le plus
+ *   récent. Le SPIFFS répartit lui-même ses écritures de pages sur toute la flash ; la période de
+ *   sauvegarde borne le nombre d'écritures (96 par jour).
+ *
+ * Au démarrage, la mémoire RTC est utilisée si elle est valide (c'est la copie la plus récente),
+ * sinon les compteurs sont relus depuis le SPIFFS : on perd au plus CNT_FLASH_PERIOD ms d'activité.
+ *
+ * Les compteurs sont publiés avec les attributs du client à chaque connexion au broker ThingsBoard
+ * (cf. \ref mqtt et \ref codec).
+ *
+ * Fichier \ref MyCounters.h
+ */
+
+#include <ESP8266WiFi.h>
+#include <FS.h>
+
+#define CNT_MAX_COUNTERS    15                // Taille du format (RTC et SPIFFS), pour ajouter des compteurs sans le changer
+#define CNT_FLASH_SLOTS     16                // Emplacements de l'anneau dans le SPIFFS
+#define CNT_FLASH_PERIOD    900000            // Période de sauvegarde dans le SPIFFS (ms)
+#define CNT_FLASH_FILE      "/counters.bin"
+
+/** Compteurs */
+enum Counter : uint8_t {
+  CNT_BOOTS = 0,                          /*!< Démarrages, quelle qu'en soit la cause */
+  CNT_DEEP_SLEEP_WAKES,                   /*!< Réveils de Deep Sleep */
+  CNT_WIFI_ATTEMPTS,                      /*!< Tentatives de connexion WiFi */
+  CNT_MQTT_RECONNECTS,                    /*!< Tentatives de connexion aux brokers MQTT */
+  CNT_PUBLISH_FAILURES,                   /*!< Publications échouées ou refusées */
+  CNT_WATCHDOG_STALLS,                    /*!< Blocages détectés par le watchdog */
+  CNT_RADIO_ON_S,                         /*!< Temps cumulé radio allumée (s) */
+  CNT_NB
+};
+// Noms des attributs ThingsBoard
+const char *COUNTER_NAMES[CNT_NB] = {"bootCount", "deepSleepWakes", "wifiAttempts", "mqttReconnects",
+                                     "publishFailures", "watchdogStalls", "radioOnSeconds"};
+
+/** Compteurs tels qu'ils sont conservés en mémoire RTC et dans le SPIFFS */
+struct CountersRecord {
+  uint32_t ulSequence;                    /*!< Numéro de la dernière sauvegarde dans le SPIFFS */
+  uint32_t aulValues[CNT_MAX_COUNTERS];
+};
+static_assert(CNT_NB <= CNT_MAX_COUNTERS, "Trop de compteurs");
+static_assert(sizeof(CountersRecord) + 4 <= RTC_COUNTERS_SIZE, "Compteurs trop grands pour la mémoire RTC");
+
+/** Emplacement de l'anneau dans le SPIFFS */
+struct CountersSlot {
+  CountersRecord record;
+  uint32_t       ulCrc;
+};
+
+CountersRecord countersRecord;
+bool           bCountersChanged = false;      // Modifiés depuis la dernière sauvegarde dans le SPIFFS
+uint32_t       ulCountersLastFlush = 0;
+uint32_t       ulCountersLastLoop = 0;
+uint32_t       ulCountersRadioMs = 0;         // Temps radio allumée pas encore compté (< 1 s)
+
+// ------------------------------------------------------------------------------------------------
+// COMPTEURS
+// ------------------------------------------------------------------------------------------------
+/**
+ * Incrément d'un compteur, sauvegardé immédiatement en mémoire RTC
+ */
+void incrementCounter(uint8_t ucCounter, uint32_t ulDelta = 1){
+  countersRecord.aulValues[ucCounter] += ulDelta;
+  bCountersChanged = true;
+  writeRTCMemory(RTC_COUNTERS_OFFSET, countersRecord);
+}
+
+/**
+ * Copie des compteurs, pour les publier sans qu'ils changent entre les deux passes de l'encodage
+ */
+void copyCounters(uint32_t *aulValues){
+  memcpy(aulValues, countersRecord.aulValues, CNT_NB * sizeof(uint32_t));
+}
+
+// ------------------------------------------------------------------------------------------------
+// SPIFFS
+// ------------------------------------------------------------------------------------------------
+/**
+ * Lecture de l'emplacement valide le plus récent de l'anneau. Renvoie false s'il n'y en a aucun.
+ */
+bool readCountersFlash(CountersRecord &record){
+  if (!SPIFFS.begin()) { return false; }
+  File file = SPIFFS.open(CNT_FLASH_FILE, "r");
+  if (!file) { return false; }
+  bool bFound = false;
+  CountersSlot slot;
+  while (file.read((uint8_t*)&slot, sizeof(slot)) == sizeof(slot)) {
+    if (slot.ulCrc != crc32(&slot.record, sizeof(slot.record))) { continue; }   // Vide ou écriture interrompue
+    if (!bFound || (int32_t)(slot.record.ulSequence - record.ulSequence) > 0) {
+      record = slot.record;
+      bFound = true;
+    }
+  }
+  file.close();
+  return bFound;
+}
+
+/**
+ * Sauvegarde dans l'emplacement suivant de l'anneau
+ */
+bool flushCounters(){
+  if (!SPIFFS.begin()) { return false; }
+  if (!SPIFFS.exists(CNT_FLASH_FILE)) {                        // Création de l'anneau, emplacements vides
+    File file = SPIFFS.open(CNT_FLASH_FILE, "w");
+    if (!file) { return false; }
+    CountersSlot empty;
+    memset(&empty, 0xFF, sizeof(empty));
+    for (uint8_t i = 0; i < CNT_FLASH_SLOTS; i++) { file.write((uint8_t*)&empty, sizeof(empty)); }
+    file.close();
+  }
+  File file = SPIFFS.open(CNT_FLASH_FILE, "r+");
+  if (!file) { return false; }
+  countersRecord.ulSequence++;
+  CountersSlot slot = {countersRecord, 0};
+  slot.ulCrc = crc32(&slot.record, sizeof(slot.record));
+  bool bOk = file.seek((countersRecord.ulSequence % CNT_FLASH_SLOTS) * sizeof(slot), SeekSet)
+          && file.write((uint8_t*)&slot, sizeof(slot)) == sizeof(slot);
+  file.close();
+  writeRTCMemory(RTC_COUNTERS_OFFSET, countersRecord);
+  if (bOk) { bCountersChanged = false; }
+  MYDEBUG_PRINT("-COUNTERS : Sauvegarde n°");
+  MYDEBUG_PRINT(countersRecord.ulSequence);
+  MYDEBUG_PRINTLN(bOk ? " [OK]" : " [ERREUR]");
+  return bOk;
+}
+
+// ------------------------------------------------------------------------------------------------
+// SETUP & LOOP
+// ------------------------------------------------------------------------------------------------
+/**
+ * Restauration des compteurs (mémoire RTC, sinon SPIFFS) et comptage du démarrage.
+ * A appeler en premier : les autres modules comptent dès leur initialisation.
+ */
+void setupCounters(){
+  if (readRTCMemory(RTC_COUNTERS_OFFSET, countersRecord)) {
+    MYDEBUG_PRINTLN("-COUNTERS : Restaurés depuis la mémoire RTC");
+  } else if (readCountersFlash(countersRecord)) {
+    MYDEBUG_PRINTLN("-COUNTERS : Restaurés depuis le SPIFFS");
+  } else {
+    MYDEBUG_PRINTLN("-COUNTERS : Aucune sauvegarde, remise à zéro");
+    memset(&countersRecord, 0, sizeof(countersRecord));
+  }
+  incrementCounter(CNT_BOOTS);
+  if (ESP.getResetInfoPtr()->reason == REASON_DEEP_SLEEP_AWAKE) { incrementCounter(CNT_DEEP_SLEEP_WAKES); }
+
+  MYDEBUG_PRINT("-COUNTERS :");
+  for (uint8_t i = 0; i < CNT_NB; i++) {
+    MYDEBUG_PRINT(" ");
+    MYDEBUG_PRINT(COUNTER_NAMES[i]);
+    MYDEBUG_PRINT("=");
+    MYDEBUG_PRINT(countersRecord.aulValues[i]);
+  }
+  MYDEBUG_PRINTLN();
+  ulCountersLastLoop = ulCountersLastFlush = millis();
+}
+
+/**
+ * Temps radio allumée, et sauvegarde périodique dans le SPIFFS
+ */
+void loopCounters(){
+  uint32_t ulNow = millis();
+  if (WiFi.getMode() != WIFI_OFF) { ulCountersRadioMs += ulNow - ulCountersLastLoop; }
+  ulCountersLastLoop = ulNow;
+  if (ulCountersRadioMs >= 1000) {
+    incrementCounter(CNT_RADIO_ON_S, ulCountersRadioMs / 1000);
+    ulCountersRadioMs %= 1000;
+  }
+  if (bCountersChanged && ulNow - ulCountersLastFlush >= CNT_FLASH_PERIOD) {
+    ulCountersLastFlush = ulNow;
+    flushCounters();
+  }
+}
@@ -9,6 +9,9 @@
  * - Adafruit Unified Sensor by Adafruit
  * 
  * Délai entre 2 mesures : il dépend du capteur, si on n'a pas l'information (via la librairie unifiée) on le configure à 5s
+ *
+ * Le DHT est un capteur à 2 voies, "temperature" et "humidity" (cf. \ref sensor). Elles sont lues de
+ * la même façon avec les deux bibliothèques : la version unifiée (DHT_U) met aussi à jour les mesures.
  * 
  * Fichier \ref MyDHT.h
  */
@@ -26,92 +29,78 @@ DHT_Unified myDht(DHT_PIN, DHT_TYPE); // Instantiation du DHT Unified
 #else
 DHT myDht(DHT_PIN, DHT_TYPE);         // Instantiation du DHT "classique"
 #endif
-uint32_t delayMS = 5000;              // Délai entre 2 mesures
+#define DHT_MIN_PERIOD 5000              // Délai entre 2 mesures (ms), si on n'a pas l'information du capteur
 
-float fHumidity=0;
-float fTemperature=0;
+class DhtSensor : public Sensor<DhtSensor, 2> {
+public:
+  static constexpr const char *NAME = "dht";
+  static const SensorChannel CHANNELS[];
+  static constexpr uint32_t MIN_PERIOD_MS = DHT_MIN_PERIOD;
+  static constexpr uint32_t COST_US = 25000;     // Trame de 40 bits lue en bit-banging, interruptions masquées
+  enum { TEMPERATURE = 0, HUMIDITY = 1 };
 
-
-void setupDhtSensor(){
-  myDht.begin();
+  void setup(){
+    myDht.begin();
 
 #if DHT_U
-  MYDEBUG_PRINTLN("DHT Unified Sensor");
-  // Information sur le capteur de température
-  sensor_t sensor;
-  myDht.temperature().getSensor(&sensor);
-  MYDEBUG_PRINTLN("------------------------------------");
-  MYDEBUG_PRINTLN("Temperature");
-  MYDEBUG_PRINT  ("Sensor:       "); MYDEBUG_PRINTLN(sensor.name);
-  MYDEBUG_PRINT  ("Driver Ver:   "); MYDEBUG_PRINTLN(sensor.version);
-  MYDEBUG_PRINT  ("Unique ID:    "); MYDEBUG_PRINTLN(sensor.sensor_id);
-  MYDEBUG_PRINT  ("Max Value:    "); MYDEBUG_PRINT(sensor.max_value); MYDEBUG_PRINTLN(" *C");
-  MYDEBUG_PRINT  ("Min Value:    "); MYDEBUG_PRINT(sensor.min_value); MYDEBUG_PRINTLN(" *C");
-  MYDEBUG_PRINT  ("Resolution:   "); MYDEBUG_PRINT(sensor.resolution); MYDEBUG_PRINTLN(" *C");  
-  MYDEBUG_PRINTLN("------------------------------------");
-  // Information sur le capteur de température
-  myDht.humidity().getSensor(&sensor);
-  MYDEBUG_PRINTLN("------------------------------------");
-  MYDEBUG_PRINTLN("Humidity");
-  MYDEBUG_PRINT  ("Sensor:       "); MYDEBUG_PRINTLN(sensor.name);
-  MYDEBUG_PRINT  ("Driver Ver:   "); MYDEBUG_PRINTLN(sensor.version);
-  MYDEBUG_PRINT  ("Unique ID:    "); MYDEBUG_PRINTLN(sensor.sensor_id);
-  MYDEBUG_PRINT  ("Max Value:    "); MYDEBUG_PRINT(sensor.max_value); MYDEBUG_PRINTLN("%");
-  MYDEBUG_PRINT  ("Min Value:    "); MYDEBUG_PRINT(sensor.min_value); MYDEBUG_PRINTLN("%");
-  MYDEBUG_PRINT  ("Resolution:   "); MYDEBUG_PRINT(sensor.resolution); MYDEBUG_PRINTLN("%");  
-  MYDEBUG_PRINTLN("------------------------------------");
-  delayMS = sensor.min_delay/1000;
-  MYDEBUG_PRINT  ("Delay:   "); MYDEBUG_PRINT(delayMS); MYDEBUG_PRINTLN(" ms");  
-  MYDEBUG_PRINTLN("------------------------------------");
+    MYDEBUG_PRINTLN("DHT Unified Sensor");
+    // Information sur le capteur de température
+    sensor_t sensor;
+    myDht.temperature().getSensor(&sensor);
+    MYDEBUG_PRINTLN("------------------------------------");
+    MYDEBUG_PRINTLN("Temperature");
+    MYDEBUG_PRINT  ("Sensor:       "); MYDEBUG_PRINTLN(sensor.name);
+    MYDEBUG_PRINT  ("Driver Ver:   "); MYDEBUG_PRINTLN(sensor.version);
+    MYDEBUG_PRINT  ("Unique ID:    "); MYDEBUG_PRINTLN(sensor.sensor_id);
+    MYDEBUG_PRINT  ("Max Value:    "); MYDEBUG_PRINT(sensor.max_value); MYDEBUG_PRINTLN(" *C");
+    MYDEBUG_PRINT  ("Min Value:    "); MYDEBUG_PRINT(sensor.min_value); MYDEBUG_PRINTLN(" *C");
+    MYDEBUG_PRINT  ("Resolution:   "); MYDEBUG_PRINT(sensor.resolution); MYDEBUG_PRINTLN(" *C");
+    MYDEBUG_PRINTLN("------------------------------------");
+    // Information sur le capteur de température
+    myDht.humidity().getSensor(&sensor);
+    MYDEBUG_PRINTLN("------------------------------------");
+    MYDEBUG_PRINTLN("Humidity");
+    MYDEBUG_PRINT  ("Sensor:       "); MYDEBUG_PRINTLN(sensor.name);
+    MYDEBUG_PRINT  ("Driver Ver:   "); MYDEBUG_PRINTLN(sensor.version);
+    MYDEBUG_PRINT  ("Unique ID:    "); MYDEBUG_PRINTLN(sensor.sensor_id);
+    MYDEBUG_PRINT  ("Max Value:    "); MYDEBUG_PRINT(sensor.max_value); MYDEBUG_PRINTLN("%");
+    MYDEBUG_PRINT  ("Min Value:    "); MYDEBUG_PRINT(sensor.min_value); MYDEBUG_PRINTLN("%");
+    MYDEBUG_PRINT  ("Resolution:   "); MYDEBUG_PRINT(sensor.resolution); MYDEBUG_PRINTLN("%");
+    MYDEBUG_PRINTLN("------------------------------------");
+    ulMinPeriod = sensor.min_delay/1000;          // Délai donné par le capteur
+    MYDEBUG_PRINT  ("Delay:   "); MYDEBUG_PRINT(ulMinPeriod); MYDEBUG_PRINTLN(" ms");
+    MYDEBUG_PRINTLN("------------------------------------");
 #endif
-}
-
-void getDhtData(){
-
-  // Délai minimum entre 2 mesures
-  MYDEBUG_PRINT("-DHT : Délai entre 2 mesure [");
-  MYDEBUG_PRINT(delayMS);
-  MYDEBUG_PRINTLN("] ms");
-  delay(delayMS);
+  }
 
+  /** Les bibliothèques DHT ne renvoient que des floats : conversion en virgule fixe dès la lecture */
+  bool sample(Fixed *alValues){
 #if DHT_U
-  // Get temperature event and print its value.
-  sensors_event_t event;  
-  myDht.temperature().getEvent(&event);
-  if (isnan(event.temperature)) {
-    MYDEBUG_PRINTLN("-DHT : Erreur de lecture de la température du capteur DHT !");
-  }
-  else {
+    sensors_event_t event;
+    myDht.temperature().getEvent(&event);
+    alValues[TEMPERATURE] = fixedFromFloat(event.temperature);
+    myDht.humidity().getEvent(&event);
+    alValues[HUMIDITY] = fixedFromFloat(event.relative_humidity);
+#else
+    alValues[TEMPERATURE] = fixedFromFloat(myDht.readTemperature());
+    alValues[HUMIDITY] = fixedFromFloat(myDht.readHumidity());
+#endif
+    // Vérification que la lecture est correcte
+    if (fixedIsNan(alValues[TEMPERATURE]) || fixedIsNan(alValues[HUMIDITY])) {
+      MYDEBUG_PRINTLN("-DHT : Erreur de lecture du capteur DHT !");
+      return false;
+    }
+    // Affichage
     MYDEBUG_PRINT("-DHT : [");
-    MYDEBUG_PRINT(event.temperature);
-    MYDEBUG_PRINTLN("°C] température !");
-  }
-  // Get humidity event and print its value.
-  myDht.humidity().getEvent(&event);
-  if (isnan(event.relative_humidity)) {
-    MYDEBUG_PRINTLN("-DHT : Erreur de lecture de l'humidité du capteur DHT !");
-  }
-  else {
+    MYDEBUG_PRINT(fixedToFloat(alValues[HUMIDITY]));
+    MYDEBUG_PRINTLN("%] humidité !");
     MYDEBUG_PRINT("-DHT : [");
-    MYDEBUG_PRINT(event.relative_humidity);
-    MYDEBUG_PRINTLN("%] Humidité !");
+    MYDEBUG_PRINT(fixedToFloat(alValues[TEMPERATURE]));
+    MYDEBUG_PRINTLN("°C] température !");
+    return true;
   }
-#else
-  // Lecture des données sur le capteur
-  fHumidity = myDht.readHumidity();
-  fTemperature = myDht.readTemperature();
+};
+const SensorChannel DhtSensor::CHANNELS[] = {{"temperature", "temp", "°C", 1, FIXED(0.5)},
+                                             {"humidity", "hum", "%", 1, FIXED(2)}};
 
-  // Vérification que la lecture est correcte
-  if (isnan(fHumidity) || isnan(fTemperature)) {
-    MYDEBUG_PRINTLN("-DHT : Erreur de lecture du capteur DHT !");
-    return;
-  }
-  // Affichage
-  MYDEBUG_PRINT("-DHT : [");
-  MYDEBUG_PRINT(fHumidity);
-  MYDEBUG_PRINTLN("%] humidité !");
-  MYDEBUG_PRINT("-DHT : [");
-  MYDEBUG_PRINT(fTemperature);
-  MYDEBUG_PRINTLN("°C] température !");
-#endif
-}
+DhtSensor dhtSensor;
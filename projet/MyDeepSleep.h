@@ -62,11 +62,13 @@ void setupDeepSleep(){
 
   WiFi.mode(WIFI_STA);
   WiFi.begin(ssid, password);
+  incrementCounter(CNT_WIFI_ATTEMPTS);
 
   while (WiFi.status() != WL_CONNECTED) {
     MYDEBUG_PRINT(".");
     if (iNbTry++ >= NB_TRYWIFI) {
       MYDEBUG_PRINTLN("Impossible de se connecter au WiFi, je vais faire la sieste !");
+      saveTimeBeforeSleep(DURATION_SLEEP * 1000000);   // L'heure sera connue au réveil
       ESP.deepSleep(DURATION_SLEEP * 1000000, RF_CAL);  // Durée en millisecondes
     }
     delay(500);
@@ -0,0 +1,209 @@
+/**
+ * \file MyEnergy.h
+ * \page energy Bilan énergétique
+ * \brief Charge consommée par état, par module et par message publié
+ *
+ * Pour savoir combien de mAh coûte une mesure publiée, ou comparer deux versions du firmware sur
+ * la batterie, il faut savoir où part l'énergie. L'ESP8266 ne mesure pas son courant : ce module
+ * date chaque changement d'état (micros()) et multiplie la durée de chaque état par un courant
+ * typique, configurable (alEnergyCurrents, setEnergyCurrent()).
+ *
+ * Les états suivent l'imbrication des sections : energyEnter() entre dans un état et renvoie le
+ * précédent, à redonner à energyLeave(), comme pour le watchdog (cf. \ref watchdog).
+ * | Etat         | Section                                               |
+ * |--------------|-------------------------------------------------------|
+ * | active       | boucle, radio allumée                                 |
+ * | radioOff     | boucle, radio arrêtée (WIFI_OFF)                      |
+ * | idle, modem, light, forced | attentes de la boucle (cf. \ref power)  |
+ * | wifiAssoc    | association au point d'accès (cf. \ref esp8266)       |
+ * | tcpConnect   | connexion TCP à un broker en clair                    |
+ * | tlsHandshake | connexion TCP et poignée de main TLS (cf. \ref tls)   |
+ * | publish      | émission d'un message (MQTT, Adafruit IO, ESP-NOW)    |
+ *
+ * La charge de chaque intervalle est attribuée à l'état, et au module en cours au sens du watchdog
+ * (loop, wifi, mqtt, adafruit, http, ntp, sensors). A chaque message publié (energyMessage()), la
+ * charge accumulée par le module depuis son message précédent devient le coût de ce message :
+ * connexion, poignée de main, attente et émission comprises.
+ *
+ * Le bilan est exposé au format texte de Prometheus via GET /metrics, et résumé (courant moyen,
+ * charge, coût moyen d'un message) dans les attributs du client (cf. \ref mqtt et \ref codec).
+ *
+ * \note Ce sont des estimations : la précision dépend des courants renseignés, à mesurer une fois
+ * pour chaque carte (multimètre en série ou INA219).
+ *
+ * Fichier \ref MyEnergy.h
+ */
+
+/** Etats comptés */
+enum EnergyState {
+  ENERGY_ACTIVE = 0,
+  ENERGY_RADIO_OFF,
+  ENERGY_IDLE,
+  ENERGY_MODEM_SLEEP,
+  ENERGY_LIGHT_SLEEP,
+  ENERGY_FORCED_SLEEP,
+  ENERGY_WIFI_ASSOC,
+  ENERGY_TCP_CONNECT,
+  ENERGY_TLS_HANDSHAKE,
+  ENERGY_PUBLISH,
+  ENERGY_NB_STATES
+};
+const char *ENERGY_STATE_NAMES[ENERGY_NB_STATES] = {"active", "radioOff", "idle", "modem", "light", "forced",
+                                                    "wifiAssoc", "tcpConnect", "tlsHandshake", "publish"};
+// Courant typique par état (mA), d'après la documentation Espressif, moyenne avec les réveils DTIM pour les veilles
+Fixed alEnergyCurrents[ENERGY_NB_STATES] = {FIXED(80), FIXED(15), FIXED(70), FIXED(15), FIXED(2), FIXED(0.5),
+                                            FIXED(90), FIXED(80), FIXED(85), FIXED(170)};
+
+/** Bilan d'un état ou d'un module. Charges en mA (virgule fixe) x µs. */
+struct EnergyAccount {
+  uint64_t ullCharge;
+  uint64_t ullUs;
+  uint32_t ulCount;                       /*!< Entrées dans l'état, messages publiés par le module */
+};
+
+/** Résumé publié dans les attributs, figé pour les 2 passes de l'encodage */
+struct EnergySummary {
+  Fixed lAverageMa;                       /*!< Courant moyen depuis le démarrage */
+  Fixed lChargeMah;                       /*!< Charge consommée depuis le démarrage */
+  Fixed lMessageUah;                      /*!< Coût moyen d'un message publié */
+};
+
+EnergyAccount energyStates[ENERGY_NB_STATES];
+EnergyAccount energyModules[WDT_NB_MODULES];
+uint64_t      aullEnergySinceMessage[WDT_NB_MODULES];   // Charge depuis le dernier message du module
+uint64_t      aullEnergyLastMessage[WDT_NB_MODULES];    // Coût du dernier message du module
+uint8_t       ucEnergyState = ENERGY_ACTIVE;
+uint32_t      ulEnergyLast = 0;                         // Dernier changement d'état (micros)
+bool          bEnergyRadio = true;                      // Radio allumée lors du dernier changement d'état
+uint32_t      ulEnergyRadioSwitches = 0;
+
+// ------------------------------------------------------------------------------------------------
+// COMPTAGE
+// ------------------------------------------------------------------------------------------------
+/** Attribution d'un intervalle à un état et au module en cours */
+void energyCharge(uint8_t ucState, uint32_t ulUs){
+  uint64_t ullCharge = (uint64_t)ulUs * alEnergyCurrents[ucState];
+  energyStates[ucState].ullCharge += ullCharge;
+  energyStates[ucState].ullUs += ulUs;
+  EnergyAccount &module = energyModules[ucWatchdogModule];
+  module.ullCharge += ullCharge;
+  module.ullUs += ulUs;
+  aullEnergySinceMessage[ucWatchdogModule] += ullCharge;
+}
+
+/** Clôture de l'intervalle en cours, au changement d'état */
+void energyFlush(){
+  uint32_t ulNow = micros();
+  bool bRadio = (WiFi.getMode() != WIFI_OFF);
+  if (bRadio != bEnergyRadio) {
+    bEnergyRadio = bRadio;
+    ulEnergyRadioSwitches++;
+  }
+  uint8_t ucState = ucEnergyState;
+  if (ucState == ENERGY_ACTIVE && !bRadio) { ucState = ENERGY_RADIO_OFF; }
+  energyCharge(ucState, ulNow - ulEnergyLast);
+  ulEnergyLast = ulNow;
+}
+
+/**
+ * Entrée dans un état. Renvoie l'état précédent, à redonner à energyLeave().
+ */
+uint8_t energyEnter(uint8_t ucState){
+  energyFlush();
+  uint8_t ucPrevious = ucEnergyState;
+  ucEnergyState = ucState;
+  energyStates[ucState].ulCount++;
+  return ucPrevious;
+}
+
+/**
+ * Sortie d'un état
+ */
+void energyLeave(uint8_t ucPrevious){
+  energyFlush();
+  ucEnergyState = ucPrevious;
+}
+
+/**
+ * Durée passée dans un état sans que micros() n'avance (light sleep forcé)
+ */
+void energyAdd(uint8_t ucState, uint32_t ulUs){
+  energyFlush();
+  energyStates[ucState].ulCount++;
+  energyCharge(ucState, ulUs);
+}
+
+/**
+ * Message publié par le module en cours : la charge accumulée depuis son message précédent
+ * devient le coût de ce message
+ */
+void energyMessage(){
+  energyFlush();
+  energyModules[ucWatchdogModule].ulCount++;
+  aullEnergyLastMessage[ucWatchdogModule] = aullEnergySinceMessage[ucWatchdogModule];
+  aullEnergySinceMessage[ucWatchdogModule] = 0;
+}
+
+/**
+ * Courant d'un état (mA), par son nom. Renvoie false si l'état n'existe pas.
+ */
+bool setEnergyCurrent(const char *strState, Fixed lCurrent){
+  for (uint8_t s = 0; s < ENERGY_NB_STATES; s++) {
+    if (!strcmp(strState, ENERGY_STATE_NAMES[s]) && lCurrent >= 0) {
+      energyFlush();                                         // L'intervalle en cours garde l'ancien courant
+      alEnergyCurrents[s] = lCurrent;
+      return true;
+    }
+  }
+  return false;
+}
+
+// ------------------------------------------------------------------------------------------------
+// CONVERSIONS
+// ------------------------------------------------------------------------------------------------
+/** Charge en centièmes de µAh : mA x 100 x µs / 3,6.10^6. Sur 64 bits, pour les totaux cumulés */
+uint64_t energyToUahTotal(uint64_t ullCharge){
+  return ullCharge / 3600000;
+}
+
+/** Charge en µAh (virgule fixe), limitée à 21,4 Ah : pour le coût d'un message, pas pour un total */
+Fixed energyToUah(uint64_t ullCharge){
+  return (Fixed)energyToUahTotal(ullCharge);
+}
+
+/** Charge en mAh (virgule fixe) */
+Fixed energyToMah(uint64_t ullCharge){
+  return (Fixed)(ullCharge / 3600000000ULL);
+}
+
+/** Courant moyen (mA) d'une charge sur une durée */
+Fixed energyToMa(uint64_t ullCharge, uint64_t ullUs){
+  return ullUs ? (Fixed)(ullCharge / ullUs) : 0;
+}
+
+/** Résumé depuis le démarrage : courant moyen, charge et coût moyen d'un message */
+void getEnergySummary(EnergySummary &summary){
+  energyFlush();
+  uint64_t ullCharge = 0, ullUs = 0;
+  uint32_t ulMessages = 0;
+  for (uint8_t s = 0; s < ENERGY_NB_STATES; s++) {
+    ullCharge += energyStates[s].ullCharge;
+    ullUs += energyStates[s].ullUs;
+  }
+  for (uint8_t m = 0; m < WDT_NB_MODULES; m++) { ulMessages += energyModules[m].ulCount; }
+  summary.lAverageMa = energyToMa(ullCharge, ullUs);
+  summary.lChargeMah = energyToMah(ullCharge);
+  summary.lMessageUah = ulMessages ? energyToUah(ullCharge / ulMessages) : 0;
+}
+
+/**
+ * Initialisation, au tout début du setup() : le démarrage est compté comme actif
+ */
+void setupEnergy(){
+  memset(energyStates, 0, sizeof(energyStates));
+  memset(energyModules, 0, sizeof(energyModules));
+  memset(aullEnergySinceMessage, 0, sizeof(aullEnergySinceMessage));
+  memset(aullEnergyLastMessage, 0, sizeof(aullEnergyLastMessage));
+  ucEnergyState = ENERGY_ACTIVE;
+  ulEnergyLast = 0;                                          // Depuis le reset
+}
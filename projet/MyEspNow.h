@@ -0,0 +1,456 @@
+/**
+ * \file MyEspNow.h
+ * \page espnow Passerelle ESP-NOW
+ * \brief Noeuds feuilles sans connexion WiFi, regroupés par une passerelle sur un seul lien MQTT
+ *
+ * Sans passerelle, chaque NodeMCU d'une rangée de serre maintient son association WiFi et sa connexion
+ * au broker : des dizaines de sessions TCP, et une radio allumée en permanence. Avec ESP-NOW (trames
+ * WiFi sans association ni connexion), les rôles se répartissent (ESPNOW_ROLE) :
+ * - ESPNOW_LEAF : la feuille n'est pas associée au point d'accès. Après chaque mesure, elle envoie
+ *   une trame compacte (EspNowFrame : identifiant, numéro de séquence et voies des capteurs en virgule
+ *   fixe, cf. \ref sensors et \ref fixed) à la passerelle, sur le canal ESPNOW_CHANNEL.
+ * - ESPNOW_GATEWAY : la passerelle est associée au point d'accès (elle reçoit les trames sur le canal
+ *   de celui-ci, à régler sur les feuilles) et connectée au broker ThingsBoard (cf. \ref mqtt). Elle
+ *   élimine les trames dupliquées, puis regroupe les mesures des feuilles et les publie avec l'API
+ *   passerelle de ThingsBoard :
+ *   \verbatim
+v1/gateway/connect    {"device":"leaf-00A1B2"}                    (premier message d'une feuille)
+v1/gateway/telemetry  {"leaf-00A1B2":[{"ts":...,"values":{"soil":41,...}},...],"leaf-00C3D4":[...]}
+\endverbatim
+ *   Un lot est publié dès qu'il contient ESPNOW_BATCH_MAX mesures, ou ESPNOW_BATCH_MS ms après sa
+ *   première mesure. Les mesures sont horodatées à la réception (sans heure NTP, ThingsBoard les
+ *   horodate à la réception du lot).
+ *
+ * Les trames sont reçues dans le contexte du WiFi : la callback ne fait que les copier dans une file
+ * (ESPNOW_QUEUE trames), le décodage, le dédoublonnage et les lots sont traités dans loopEspNow().
+ *
+ * Dédoublonnage : chaque feuille numérote ses trames (à partir d'une valeur aléatoire au démarrage).
+ * Une trame dont le numéro n'avance pas de plus de ESPNOW_DEDUP_WINDOW est un doublon (répétition
+ * de la couche MAC) ; un saut de numéro compte les trames perdues. Une feuille silencieuse depuis
+ * ESPNOW_NODE_TIMEOUT ms repart de zéro (redémarrage).
+ *
+ * Le lien radio est accédé via un EspNowTransport (pointeurs de fonctions) :
+ * - espNowRadio : ESP-NOW ;
+ * - espNowLoopback : lien simulé dans le processus, chaque trame envoyée est reçue par l'objet
+ *   lui-même. Avec ESPNOW_ROLE à ESPNOW_LOOPBACK, l'objet est à la fois feuille et passerelle : le
+ *   format des trames, le dédoublonnage et les lots se vérifient avec un seul NodeMCU, sans radio.
+ *
+ * La passerelle garde sa radio allumée en permanence (cf. \ref power) : sans association, une feuille
+ * émet sans savoir si la passerelle écoute.
+ *
+ * Trames reçues, doublons, pertes et lots publiés sont consultables via GET /api/espnow (cf.
+ * \ref httpserver). Une trame est aussi perdue (nodeDrops) quand la table des feuilles est pleine et
+ * que la plus ancienne a encore des mesures dans le lot en attente.
+ *
+ * \note Feuilles et passerelle doivent avoir la même liste de capteurs (même firmware) : les voies
+ * d'une trame sont nommées par la passerelle.
+ *
+ * Fichier \ref MyEspNow.h
+ */
+
+#include <espnow.h>
+extern "C" {
+#include <user_interface.h>                 // wifi_set_channel()
+}
+
+#define ESPNOW_OFF            0
+#define ESPNOW_LEAF           1
+#define ESPNOW_GATEWAY        2
+#define ESPNOW_LOOPBACK       3             // Feuille et passerelle, lien simulé
+#define ESPNOW_ROLE           ESPNOW_OFF
+#define ESPNOW_CHANNEL        1             // Canal des feuilles : celui du point d'accès de la passerelle
+#define ESPNOW_MAGIC          0xE5
+#define ESPNOW_QUEUE          8             // Trames reçues en attente de traitement
+#define ESPNOW_MAX_NODES      16            // Feuilles suivies par la passerelle
+#define ESPNOW_BATCH_MAX      16            // Mesures par lot
+#define ESPNOW_BATCH_MS       5000          // Age max d'un lot avant publication (ms)
+#define ESPNOW_DEDUP_WINDOW   64            // Numéros de séquence considérés comme déjà reçus
+#define ESPNOW_NODE_TIMEOUT   600000        // Silence après lequel une feuille repart de zéro (ms)
+#define ESPNOW_DEVICE_PREFIX  "leaf-"
+
+uint8_t aucEspNowGateway[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};   // Adresse MAC de la passerelle (diffusion par défaut)
+
+/** Trame d'une feuille, en little endian (comme l'ESP8266), sans octet de bourrage */
+struct EspNowFrame {
+  uint8_t  ucMagic;
+  uint8_t  ucNbValues;
+  uint16_t uiSequence;
+  uint32_t ulNodeId;                        /*!< ESP.getChipId() de la feuille */
+  Fixed    alValues[SENSOR_NB_CHANNELS];    /*!< Voies des capteurs, FIXED_NAN si en erreur */
+};
+#define ESPNOW_HEADER_SIZE    offsetof(EspNowFrame, alValues)
+static_assert(ESPNOW_HEADER_SIZE == 8 && sizeof(EspNowFrame) == 8 + SENSOR_NB_CHANNELS * sizeof(Fixed), "Trame avec bourrage");
+static_assert(sizeof(EspNowFrame) <= 250, "Trame trop grande pour ESP-NOW");
+
+/** Réception d'une trame par le lien */
+typedef void (*EspNowReceiver)(const uint8_t *aucMac, const uint8_t *aucData, uint8_t ucLength);
+
+/** Lien radio : ESP-NOW ou simulé */
+struct EspNowTransport {
+  const char *strName;
+  bool (*begin)(EspNowReceiver receiver);
+  bool (*send)(const uint8_t *aucMac, const uint8_t *aucData, uint8_t ucLength);
+};
+
+/** Feuille suivie par la passerelle */
+struct EspNowNode {
+  uint32_t ulNodeId;                        /*!< 0 : emplacement libre */
+  uint16_t uiLastSequence;
+  bool     bConnected;                      /*!< v1/gateway/connect publié */
+  uint32_t ulLastSeen;
+  uint32_t ulFrames;
+  uint32_t ulDuplicates;
+  uint32_t ulLost;
+};
+
+/** Mesure d'une feuille en attente dans le lot */
+struct EspNowSample {
+  uint8_t  ucNode;
+  uint64_t ullTime;                         /*!< Horodatage (ms), 0 sans heure NTP */
+  Fixed    alValues[SENSOR_NB_CHANNELS];
+};
+
+/** Trame reçue, en attente de traitement */
+struct EspNowQueued {
+  uint8_t ucLength;
+  uint8_t aucData[sizeof(EspNowFrame)];
+};
+
+const EspNowTransport *pEspNowTransport = NULL;
+EspNowQueued          espNowQueue[ESPNOW_QUEUE];
+volatile uint8_t      ucEspNowQueueHead = 0;        // Ecrit par la callback
+volatile uint8_t      ucEspNowQueueTail = 0;        // Ecrit par loopEspNow()
+EspNowNode            espNowNodes[ESPNOW_MAX_NODES];
+EspNowSample          espNowBatch[ESPNOW_BATCH_MAX];
+uint8_t               ucEspNowBatchCount = 0;
+uint32_t              ulEspNowBatchStart = 0;       // Réception de la première mesure du lot
+uint16_t              uiEspNowSequence = 0;
+// Statistiques
+uint32_t              ulEspNowSent = 0;
+uint32_t              ulEspNowSendFailures = 0;
+volatile uint32_t     ulEspNowReceived = 0;
+volatile uint32_t     ulEspNowQueueDrops = 0;       // File pleine
+uint32_t              ulEspNowInvalid = 0;          // Trames mal formées
+uint32_t              ulEspNowNodeDrops = 0;        // Trames d'une feuille inconnue, table pleine de feuilles du lot
+uint32_t              ulEspNowBatches = 0;
+uint32_t              ulEspNowBatchSamples = 0;
+uint32_t              ulEspNowBatchDrops = 0;       // Mesures perdues, lot plein sans broker
+
+// ------------------------------------------------------------------------------------------------
+// LIENS
+// ------------------------------------------------------------------------------------------------
+EspNowReceiver espNowReceiver = NULL;
+
+void espNowRadioReceive(uint8_t *aucMac, uint8_t *aucData, uint8_t ucLength){
+  espNowReceiver(aucMac, aucData, ucLength);
+}
+
+void espNowRadioSent(uint8_t *aucMac, uint8_t ucStatus){
+  if (ucStatus != 0) { ulEspNowSendFailures++; }             // Pas d'acquittement de la passerelle
+}
+
+bool espNowRadioBegin(EspNowReceiver receiver){
+  espNowReceiver = receiver;
+  if (esp_now_init() != 0) { return false; }
+  esp_now_set_self_role(ESP_NOW_ROLE_COMBO);
+  esp_now_register_recv_cb(espNowRadioReceive);
+  esp_now_register_send_cb(espNowRadioSent);
+  return true;
+}
+
+bool espNowRadioSend(const uint8_t *aucMac, const uint8_t *aucData, uint8_t ucLength){
+  if (!esp_now_is_peer_exist((uint8_t*)aucMac)) {
+    esp_now_add_peer((uint8_t*)aucMac, ESP_NOW_ROLE_COMBO, ESPNOW_CHANNEL, NULL, 0);
+  }
+  return esp_now_send((uint8_t*)aucMac, (uint8_t*)aucData, ucLength) == 0;
+}
+
+const EspNowTransport espNowRadio = {"esp-now", espNowRadioBegin, espNowRadioSend};
+
+bool espNowLoopbackBegin(EspNowReceiver receiver){
+  espNowReceiver = receiver;
+  return true;
+}
+
+bool espNowLoopbackSend(const uint8_t *aucMac, const uint8_t *aucData, uint8_t ucLength){
+  uint8_t aucSelf[6];
+  WiFi.macAddress(aucSelf);
+  espNowReceiver(aucSelf, aucData, ucLength);                // Reçue aussitôt par l'objet lui-même
+  return true;
+}
+
+const EspNowTransport espNowLoopback = {"loopback", espNowLoopbackBegin, espNowLoopbackSend};
+
+// ------------------------------------------------------------------------------------------------
+// FEUILLE
+// ------------------------------------------------------------------------------------------------
+/**
+ * Envoi des dernières mesures à la passerelle, à appeler après sampleSensors()
+ */
+void sendEspNowSample(){
+  if (pEspNowTransport == NULL || ESPNOW_ROLE == ESPNOW_GATEWAY) { return; }
+  EspNowFrame frame;
+  frame.ucMagic = ESPNOW_MAGIC;
+  frame.ucNbValues = SENSOR_NB_CHANNELS;
+  frame.uiSequence = uiEspNowSequence++;
+  frame.ulNodeId = ESP.getChipId();
+  sensors.values(frame.alValues);
+  uint8_t ucEnergy = energyEnter(ENERGY_PUBLISH);
+  bool bSent = pEspNowTransport->send(aucEspNowGateway, (const uint8_t*)&frame, sizeof(frame));
+  energyLeave(ucEnergy);
+  if (bSent) {
+    ulEspNowSent++;
+    energyMessage();
+  } else {
+    ulEspNowSendFailures++;
+  }
+}
+
+// ------------------------------------------------------------------------------------------------
+// PASSERELLE
+// ------------------------------------------------------------------------------------------------
+/**
+ * Réception d'une trame, dans le contexte du WiFi : copie dans la file, sans traitement
+ */
+void onEspNowFrame(const uint8_t *aucMac, const uint8_t *aucData, uint8_t ucLength){
+  ulEspNowReceived++;
+  uint8_t ucNext = (ucEspNowQueueHead + 1) % ESPNOW_QUEUE;
+  if (ucNext == ucEspNowQueueTail || ucLength > sizeof(EspNowFrame)) {
+    ulEspNowQueueDrops++;
+    return;
+  }
+  espNowQueue[ucEspNowQueueHead].ucLength = ucLength;
+  memcpy(espNowQueue[ucEspNowQueueHead].aucData, aucData, ucLength);
+  ucEspNowQueueHead = ucNext;
+}
+
+/**
+ * Emplacement d'une feuille dans la table, la plus ancienne est remplacée si la table est pleine.
+ * Renvoie -1 si l'emplacement est utilisé par le lot en attente.
+ */
+int8_t findEspNowNode(uint32_t ulNodeId){
+  int8_t cOldest = 0;
+  for (uint8_t i = 0; i < ESPNOW_MAX_NODES; i++) {
+    if (espNowNodes[i].ulNodeId == ulNodeId) { return i; }
+    if (espNowNodes[i].ulNodeId == 0) { cOldest = i; break; }
+    if (espNowNodes[i].ulLastSeen - espNowNodes[cOldest].ulLastSeen > 0x80000000UL) { cOldest = i; }
+  }
+  for (uint8_t i = 0; i < ucEspNowBatchCount; i++) {
+    if (espNowBatch[i].ucNode == cOldest && espNowNodes[cOldest].ulNodeId != 0) { return -1; }
+  }
+  memset(&espNowNodes[cOldest], 0, sizeof(EspNowNode));
+  espNowNodes[cOldest].ulNodeId = ulNodeId;
+  return cOldest;
+}
+
+/**
+ * Dédoublonnage : true si la trame est nouvelle, et mise à jour des pertes de la feuille
+ */
+bool acceptEspNowSequence(EspNowNode &node, uint16_t uiSequence, uint32_t ulNow){
+  bool bFirst = (node.ulFrames == 0 && node.ulDuplicates == 0) || ulNow - node.ulLastSeen >= ESPNOW_NODE_TIMEOUT;
+  node.ulLastSeen = ulNow;
+  int16_t iDelta = (int16_t)(uiSequence - node.uiLastSequence);
+  if (!bFirst && iDelta <= 0 && iDelta > -ESPNOW_DEDUP_WINDOW) {
+    node.ulDuplicates++;
+    return false;
+  }
+  if (!bFirst && iDelta > 1) { node.ulLost += iDelta - 1; }
+  node.uiLastSequence = uiSequence;
+  node.ulFrames++;
+  return true;
+}
+
+/**
+ * Décodage d'une trame de la file et ajout de ses mesures au lot
+ */
+void processEspNowFrame(const EspNowQueued &queued){
+  EspNowFrame frame;
+  memcpy(&frame, queued.aucData, queued.ucLength);
+  if (queued.ucLength < ESPNOW_HEADER_SIZE || frame.ucMagic != ESPNOW_MAGIC || frame.ucNbValues > SENSOR_NB_CHANNELS
+      || queued.ucLength != ESPNOW_HEADER_SIZE + frame.ucNbValues * sizeof(Fixed) || frame.ulNodeId == 0) {
+    ulEspNowInvalid++;
+    return;
+  }
+  uint32_t ulNow = millis();
+  int8_t cNode = findEspNowNode(frame.ulNodeId);
+  if (cNode < 0) {
+    ulEspNowNodeDrops++;
+    return;
+  }
+  if (!acceptEspNowSequence(espNowNodes[cNode], frame.uiSequence, ulNow)) { return; }
+  if (ucEspNowBatchCount == ESPNOW_BATCH_MAX) {                // Broker injoignable : on garde les plus récentes
+    memmove(espNowBatch, espNowBatch + 1, (ESPNOW_BATCH_MAX - 1) * sizeof(EspNowSample));
+    ucEspNowBatchCount--;
+    ulEspNowBatchDrops++;
+  }
+  if (ucEspNowBatchCount == 0) { ulEspNowBatchStart = ulNow; }
+  EspNowSample &sample = espNowBatch[ucEspNowBatchCount++];
+  sample.ucNode = cNode;
+  sample.ullTime = isTimeSet() ? timeNowMs() : 0;
+  for (uint8_t c = 0; c < SENSOR_NB_CHANNELS; c++) {         // Voies absentes d'une feuille plus ancienne
+    sample.alValues[c] = c < frame.ucNbValues ? frame.alValues[c] : FIXED_NAN;
+  }
+}
+
+void printEspNowDevice(Print &output, const EspNowNode &node){
+  char cDevice[20];
+  snprintf(cDevice, sizeof(cDevice), "\"" ESPNOW_DEVICE_PREFIX "%06lX\"", (unsigned long)node.ulNodeId);
+  output.print(cDevice);
+}
+
+/**
+ * Générateurs des payloads de l'API passerelle :
+ * - Connexion d'une feuille, pContext pointe sur la feuille
+ * - Lot de mesures, groupées par feuille
+ */
+void espNowConnectGenerator(Print &output, const void *pContext){
+  output.print("{\"device\":");
+  printEspNowDevice(output, *(const EspNowNode*)pContext);
+  output.print("}");
+}
+
+void espNowBatchGenerator(Print &output, const void *pContext){
+  output.print("{");
+  bool bFirstNode = true;
+  for (uint8_t n = 0; n < ESPNOW_MAX_NODES; n++) {
+    bool bFirstSample = true;
+    for (uint8_t i = 0; i < ucEspNowBatchCount; i++) {
+      const EspNowSample &sample = espNowBatch[i];
+      if (sample.ucNode != n) { continue; }
+      if (bFirstSample) {
+        if (!bFirstNode) { output.print(","); }
+        printEspNowDevice(output, espNowNodes[n]);
+        output.print(":[");
+        bFirstNode = false;
+      } else {
+        output.print(",");
+      }
+      bFirstSample = false;
+      if (sample.ullTime != 0) {
+        output.print("{\"ts\":");
+        output.print((unsigned long)(sample.ullTime / 1000));    // Pas de print(uint64_t) : secondes puis ms
+        char cMs[4];
+        snprintf(cMs, sizeof(cMs), "%03u", (unsigned)(sample.ullTime % 1000));
+        output.print(cMs);
+        output.print(",\"values\":");
+      }
+      bool bFirstValue = true;
+      for (uint8_t c = 0; c < SENSOR_NB_CHANNELS; c++) {
+        if (fixedIsNan(sample.alValues[c])) { continue; }
+        output.print(bFirstValue ? "{\"" : ",\"");
+        output.print(sensors.channel(c)->strName);
+        output.print("\":");
+        printFixed(output, sample.alValues[c], sensors.channel(c)->ucDecimals);
+        bFirstValue = false;
+      }
+      output.print(bFirstValue ? "{}" : "}");
+      if (sample.ullTime != 0) { output.print("}"); }
+    }
+    if (!bFirstSample) { output.print("]"); }
+  }
+  output.print("}");
+}
+
+/**
+ * Publication du lot en attente, et connexion des nouvelles feuilles
+ */
+void publishEspNowBatch(){
+  for (uint8_t n = 0; n < ESPNOW_MAX_NODES; n++) {
+    EspNowNode &node = espNowNodes[n];
+    if (node.ulNodeId == 0 || node.bConnected) { continue; }
+    node.bConnected = publishMqttStream("v1/gateway/connect", espNowConnectGenerator, &node);
+  }
+  if (!publishMqttStream("v1/gateway/telemetry", espNowBatchGenerator, NULL)) { return; }
+  ulEspNowBatches++;
+  ulEspNowBatchSamples += ucEspNowBatchCount;
+  ucEspNowBatchCount = 0;
+}
+
+/**
+ * Traitement des trames reçues et publication des lots, à chaque itération de la boucle
+ */
+void loopEspNow(){
+  if (pEspNowTransport == NULL || ESPNOW_ROLE == ESPNOW_LEAF) { return; }
+  while (ucEspNowQueueTail != ucEspNowQueueHead) {
+    processEspNowFrame(espNowQueue[ucEspNowQueueTail]);
+    ucEspNowQueueTail = (ucEspNowQueueTail + 1) % ESPNOW_QUEUE;
+  }
+  if (ucEspNowBatchCount == 0 || !MyMqttClient.connected()) { return; }
+  if (ucEspNowBatchCount == ESPNOW_BATCH_MAX || millis() - ulEspNowBatchStart >= ESPNOW_BATCH_MS) {
+    publishEspNowBatch();
+  }
+}
+
+// ------------------------------------------------------------------------------------------------
+// STATISTIQUES
+// ------------------------------------------------------------------------------------------------
+/**
+ * Générateur de GET /api/espnow : les compteurs, puis une feuille par étape. Le contexte indique si une
+ * feuille a déjà été envoyée.
+ */
+bool espNowHttpGenerator(Print &output, uint16_t uiStep, void *pContext){
+  bool &bFirst = *(bool*)pContext;
+  char cBuffer[256];                                         // Compteurs à 10 chiffres compris
+  if (uiStep == 0) {
+    snprintf(cBuffer, sizeof(cBuffer),
+             "{\"role\":%d,\"transport\":\"%s\",\"sent\":%lu,\"sendFailures\":%lu,\"received\":%lu,\"queueDrops\":%lu,"
+             "\"invalid\":%lu,\"nodeDrops\":%lu,\"batches\":%lu,\"batchSamples\":%lu,\"batchDrops\":%lu,\"nodes\":[",
+             ESPNOW_ROLE, pEspNowTransport ? pEspNowTransport->strName : "", (unsigned long)ulEspNowSent,
+             (unsigned long)ulEspNowSendFailures, (unsigned long)ulEspNowReceived, (unsigned long)ulEspNowQueueDrops,
+             (unsigned long)ulEspNowInvalid, (unsigned long)ulEspNowNodeDrops, (unsigned long)ulEspNowBatches, (unsigned long)ulEspNowBatchSamples,
+             (unsigned long)ulEspNowBatchDrops);
+    output.print(cBuffer);
+    return true;
+  }
+  if (uiStep > ESPNOW_MAX_NODES) {
+    output.print("]}");
+    return false;
+  }
+  const EspNowNode &node = espNowNodes[uiStep - 1];
+  if (node.ulNodeId == 0) { return true; }
+  snprintf(cBuffer, sizeof(cBuffer),
+           "%s{\"device\":\"" ESPNOW_DEVICE_PREFIX "%06lX\",\"frames\":%lu,\"duplicates\":%lu,\"lost\":%lu,\"ageS\":%lu}",
+           bFirst ? "" : ",", (unsigned long)node.ulNodeId, (unsigned long)node.ulFrames,
+           (unsigned long)node.ulDuplicates, (unsigned long)node.ulLost, (unsigned long)((millis() - node.ulLastSeen) / 1000));
+  output.print(cBuffer);
+  bFirst = false;
+  return true;
+}
+
+/**
+ * GET /api/espnow : trames envoyées et reçues, lots publiés, et état de chaque feuille, produits par
+ * espNowHttpGenerator() au fil des acquittements
+ */
+void handleEspNow(){
+  bool bFirst = true;
+  sendHttpStream(200, "application/json", espNowHttpGenerator, &bFirst, sizeof(bFirst));
+}
+
+/**
+ * Démarrage du lien selon le rôle de l'objet. La feuille n'est pas associée : elle se place sur le
+ * canal de la passerelle.
+ */
+void setupEspNow(){
+  if (ESPNOW_ROLE == ESPNOW_OFF) { return; }
+  uiEspNowSequence = random(0x10000);                        // Pas de doublon apparent après un redémarrage
+  if (ESPNOW_ROLE == ESPNOW_LEAF) {
+    WiFi.mode(WIFI_STA);
+    WiFi.disconnect();
+    wifi_set_channel(ESPNOW_CHANNEL);
+  }
+  const EspNowTransport *pTransport = (ESPNOW_ROLE == ESPNOW_LOOPBACK) ? &espNowLoopback : &espNowRadio;
+  if (!pTransport->begin(onEspNowFrame)) {
+    MYDEBUG_PRINTLN("-ESPNOW : Echec de l'initialisation");
+    return;
+  }
+  pEspNowTransport = pTransport;
+  if (ESPNOW_ROLE != ESPNOW_LEAF) { disablePowerSleep(); }    // Une trame arrivée pendant une veille serait perdue
+  MYDEBUG_PRINT("-ESPNOW : Rôle ");
+  MYDEBUG_PRINT(ESPNOW_ROLE);
+  MYDEBUG_PRINT(" [lien : ");
+  MYDEBUG_PRINT(pTransport->strName);
+  MYDEBUG_PRINT(" / trame : ");
+  MYDEBUG_PRINT(sizeof(EspNowFrame));
+  MYDEBUG_PRINTLN(" octets]");
+  if (ESPNOW_ROLE != ESPNOW_LEAF) { registerHttpRoute("/api/espnow", HTTP_GET, handleEspNow); }
+}
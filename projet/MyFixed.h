@@ -0,0 +1,216 @@
+/**
+ * \file MyFixed.h
+ * \page fixed Virgule fixe
+ * \brief Représentation des mesures en virgule fixe décimale, sans calcul flottant
+ *
+ * L'ESP8266 n'a pas d'unité de calcul flottant : chaque addition, multiplication ou conversion d'un
+ * float est émulée en logiciel (plusieurs centaines de cycles), et l'affichage d'un float
+ * (Print::print(float), dtostrf(), snprintf("%f")) enchaîne divisions et multiplications flottantes.
+ *
+ * Les mesures sont donc représentées en virgule fixe décimale : un Fixed est un entier signé sur 32
+ * bits qui compte des centièmes d'unité (FIXED_SCALE) : 21,5 °C vaut 2150. Le choix d'une échelle
+ * décimale plutôt que binaire (Q16.16) rend l'affichage exact et rapide : les chiffres sont ceux de
+ * l'entier, la virgule est placée à FIXED_DECIMALS chiffres de la fin. Une mesure absente ou en erreur
+ * vaut FIXED_NAN.
+ *
+ * Les opérations courantes sont faites en entiers :
+ * - fixedMulDiv() : produit puis quotient sur 64 bits, arrondi au plus proche (gains, mises à l'échelle).
+ * - fixedMap() : équivalent de map() vers une plage en Fixed (conversions des capteurs analogiques).
+ * - fixedEwma() : moyenne mobile exponentielle, coefficient en 256ème (FIXED_ALPHA()).
+ * - formatFixed() / printFixed() : écriture décimale ; les divisions par 10 sont faites par une
+ *   multiplication par l'inverse (le processeur n'a pas non plus de division matérielle).
+ * - parseFixed() : lecture d'un nombre décimal ("40", "-3.25").
+ *
+ * Les constantes sont écrites avec FIXED(21.5) : la conversion est faite à la compilation. Seules les
+ * bibliothèques qui ne renvoient que des floats (DHT) sont converties une fois, à la lecture.
+ *
+ * Au démarrage (MYDEBUG), benchmarkFixed() compare en cycles CPU les deux représentations sur les
+ * opérations du traitement des mesures.
+ *
+ * Fichier \ref MyFixed.h
+ */
+
+typedef int32_t Fixed;
+
+#define FIXED_SCALE       100                     // Centièmes d'unité
+#define FIXED_DECIMALS    2
+#define FIXED_NAN         ((Fixed)INT32_MIN)      // Mesure absente ou en erreur
+#define FIXED_ONE         FIXED_SCALE
+#define FIXED_BENCH_LOOPS 100                     // Nombre d'itérations par mesure de benchmarkFixed()
+
+/** Constante en virgule fixe, calculée à la compilation : FIXED(21.5) vaut 2150 */
+#define FIXED(x)          ((Fixed)((x) * FIXED_SCALE + ((x) < 0 ? -0.5 : 0.5)))
+/** Coefficient de lissage en 256ème, calculé à la compilation : FIXED_ALPHA(0.2) vaut 51 */
+#define FIXED_ALPHA(x)    ((uint16_t)((x) * 256 + 0.5))
+
+// ------------------------------------------------------------------------------------------------
+// CONVERSIONS
+// ------------------------------------------------------------------------------------------------
+inline bool fixedIsNan(Fixed lValue){ return lValue == FIXED_NAN; }
+
+inline Fixed fixedFromInt(int32_t lValue){ return lValue * FIXED_SCALE; }
+
+/** Partie entière, arrondie au plus proche */
+inline int32_t fixedToInt(Fixed lValue){
+  return (lValue >= 0 ? lValue + FIXED_SCALE / 2 : lValue - FIXED_SCALE / 2) / FIXED_SCALE;
+}
+
+/** Conversion d'un float (bibliothèques qui ne renvoient que des floats), NAN donne FIXED_NAN */
+Fixed fixedFromFloat(float fValue){
+  if (isnan(fValue)) { return FIXED_NAN; }
+  return (Fixed)lroundf(fValue * FIXED_SCALE);
+}
+
+/** Conversion en float (formats de transmission en float), FIXED_NAN donne NAN */
+float fixedToFloat(Fixed lValue){
+  return fixedIsNan(lValue) ? NAN : (float)lValue / FIXED_SCALE;
+}
+
+// ------------------------------------------------------------------------------------------------
+// CALCULS
+// ------------------------------------------------------------------------------------------------
+/** lValue x lNum / lDen, calculé sur 64 bits et arrondi au plus proche */
+Fixed fixedMulDiv(Fixed lValue, int32_t lNum, int32_t lDen){
+  int64_t llProduct = (int64_t)lValue * lNum;
+  if (lDen < 0) { llProduct = -llProduct; lDen = -lDen; }
+  return (Fixed)((llProduct >= 0 ? llProduct + lDen / 2 : llProduct - lDen / 2) / lDen);
+}
+
+/** Equivalent de map() : lValue de [lInMin, lInMax] vers [lOutMin, lOutMax] en Fixed, arrondi au plus proche */
+Fixed fixedMap(int32_t lValue, int32_t lInMin, int32_t lInMax, Fixed lOutMin, Fixed lOutMax){
+  if (lInMax == lInMin) { return lOutMin; }
+  return lOutMin + fixedMulDiv(lValue - lInMin, lOutMax - lOutMin, lInMax - lInMin);
+}
+
+/** Moyenne mobile exponentielle : lAverage + alpha x (lValue - lAverage), alpha en 256ème */
+Fixed fixedEwma(Fixed lAverage, Fixed lValue, uint16_t uiAlpha){
+  if (fixedIsNan(lAverage)) { return lValue; }
+  if (fixedIsNan(lValue)) { return lAverage; }
+  return lAverage + (((lValue - lAverage) * (int32_t)uiAlpha + 128) >> 8);   // Décalage arithmétique : arrondi au plus proche
+}
+
+// ------------------------------------------------------------------------------------------------
+// ECRITURE / LECTURE
+// ------------------------------------------------------------------------------------------------
+/** Division par 10 par multiplication par l'inverse, exacte pour tout entier sur 32 bits */
+inline uint32_t fixedDiv10(uint32_t ulValue){
+  return ((uint64_t)ulValue * 0xCCCCCCCDULL) >> 35;
+}
+
+/**
+ * Ecriture décimale de lValue avec ucDecimals décimales (au plus FIXED_DECIMALS), arrondie au plus
+ * proche. cBuffer doit pouvoir contenir 14 caractères. Renvoie le nombre de caractères écrits.
+ */
+uint8_t formatFixed(char *cBuffer, Fixed lValue, uint8_t ucDecimals){
+  if (fixedIsNan(lValue)) {
+    memcpy(cBuffer, "nan", 4);
+    return 3;
+  }
+  if (ucDecimals > FIXED_DECIMALS) { ucDecimals = FIXED_DECIMALS; }
+  uint32_t ulAbs = (lValue < 0) ? -(uint32_t)lValue : (uint32_t)lValue;
+  if (ucDecimals == 1) { ulAbs = fixedDiv10(ulAbs + 5); }                   // Un seul arrondi
+  else if (ucDecimals == 0) { ulAbs = fixedDiv10(fixedDiv10(ulAbs + 50)); }
+
+  char cDigits[11];                                           // Chiffres, du dernier au premier
+  uint8_t ucNbDigits = 0;
+  do {
+    uint32_t ulQuotient = fixedDiv10(ulAbs);
+    cDigits[ucNbDigits++] = '0' + (ulAbs - ulQuotient * 10);
+    ulAbs = ulQuotient;
+  } while (ulAbs > 0 || ucNbDigits <= ucDecimals);           // Au moins un chiffre avant la virgule
+
+  uint8_t ucLength = 0;
+  if (lValue < 0) {                                           // Pas de "-0"
+    for (uint8_t i = 0; i < ucNbDigits; i++) {
+      if (cDigits[i] != '0') { cBuffer[ucLength++] = '-'; break; }
+    }
+  }
+  while (ucNbDigits > 0) {
+    if (ucNbDigits == ucDecimals) { cBuffer[ucLength++] = '.'; }
+    cBuffer[ucLength++] = cDigits[--ucNbDigits];
+  }
+  cBuffer[ucLength] = 0;
+  return ucLength;
+}
+
+/** Ecriture décimale dans un Print, renvoie le nombre d'octets écrits */
+size_t printFixed(Print &output, Fixed lValue, uint8_t ucDecimals){
+  char cBuffer[14];
+  uint8_t ucLength = formatFixed(cBuffer, lValue, ucDecimals);
+  return output.write((const uint8_t*)cBuffer, ucLength);
+}
+
+/**
+ * Lecture d'un nombre décimal ("40", "-3.25", " 12.5"). Les décimales au-delà de FIXED_DECIMALS sont
+ * tronquées. Renvoie false si la chaîne ne commence pas par un nombre.
+ */
+bool parseFixed(const char *strValue, Fixed &lValue){
+  while (*strValue == ' ') { strValue++; }
+  bool bNegative = (*strValue == '-');
+  if (*strValue == '-' || *strValue == '+') { strValue++; }
+  if ((*strValue < '0' || *strValue > '9') && *strValue != '.') { return false; }
+  int32_t lInt = 0;
+  while (*strValue >= '0' && *strValue <= '9') { lInt = lInt * 10 + (*strValue++ - '0'); }
+  int32_t lFrac = 0;
+  uint8_t ucDecimals = 0;
+  if (*strValue == '.') {
+    strValue++;
+    while (*strValue >= '0' && *strValue <= '9') {
+      if (ucDecimals < FIXED_DECIMALS) { lFrac = lFrac * 10 + (*strValue - '0'); ucDecimals++; }
+      strValue++;
+    }
+  }
+  for (; ucDecimals < FIXED_DECIMALS; ucDecimals++) { lFrac *= 10; }
+  lValue = lInt * FIXED_SCALE + lFrac;
+  if (bNegative) { lValue = -lValue; }
+  return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// STATISTIQUES
+// ------------------------------------------------------------------------------------------------
+void printFixedBench(const char *strOperation, uint32_t ulFloatCycles, uint32_t ulFixedCycles){
+  MYDEBUG_PRINT("-FIXED :   ");
+  MYDEBUG_PRINT(strOperation);
+  MYDEBUG_PRINT(" [float : ");
+  MYDEBUG_PRINT(ulFloatCycles / FIXED_BENCH_LOOPS);
+  MYDEBUG_PRINT(" cycles / virgule fixe : ");
+  MYDEBUG_PRINT(ulFixedCycles / FIXED_BENCH_LOOPS);
+  MYDEBUG_PRINTLN(" cycles]");
+}
+
+/**
+ * Cycles CPU par opération du traitement des mesures, en float et en virgule fixe :
+ * conversion d'une lecture analogique, lissage, écriture décimale
+ */
+void benchmarkFixed(){
+  volatile int32_t lRaw = 617;                                // volatile : pas de calcul à la compilation
+  volatile float fSink = 0;
+  volatile Fixed lSink = 0;
+  char cBuffer[16];
+  uint32_t ulFloat, ulFixed, ulStart;
+
+  ulStart = ESP.getCycleCount();
+  for (uint16_t i = 0; i < FIXED_BENCH_LOOPS; i++) { fSink = (lRaw - 1024) * 100.0f / (0 - 1024); }
+  ulFloat = ESP.getCycleCount() - ulStart;
+  ulStart = ESP.getCycleCount();
+  for (uint16_t i = 0; i < FIXED_BENCH_LOOPS; i++) { lSink = fixedMap(lRaw, 1024, 0, 0, FIXED(100)); }
+  ulFixed = ESP.getCycleCount() - ulStart;
+  printFixedBench("Conversion", ulFloat, ulFixed);
+
+  ulStart = ESP.getCycleCount();
+  for (uint16_t i = 0; i < FIXED_BENCH_LOOPS; i++) { fSink = fSink + 0.2f * (39.75f - fSink); }
+  ulFloat = ESP.getCycleCount() - ulStart;
+  ulStart = ESP.getCycleCount();
+  for (uint16_t i = 0; i < FIXED_BENCH_LOOPS; i++) { lSink = fixedEwma(lSink, FIXED(39.75), FIXED_ALPHA(0.2)); }
+  ulFixed = ESP.getCycleCount() - ulStart;
+  printFixedBench("Lissage", ulFloat, ulFixed);
+
+  ulStart = ESP.getCycleCount();
+  for (uint16_t i = 0; i < FIXED_BENCH_LOOPS; i++) { dtostrf(fSink, 0, 1, cBuffer); }
+  ulFloat = ESP.getCycleCount() - ulStart;
+  ulStart = ESP.getCycleCount();
+  for (uint16_t i = 0; i < FIXED_BENCH_LOOPS; i++) { formatFixed(cBuffer, lSink, 1); }
+  ulFixed = ESP.getCycleCount() - ulStart;
+  printFixedBench("Ecriture", ulFloat, ulFixed);
+}
@@ -0,0 +1,250 @@
+/**
+ * \file MyHttpServer.h
+ * \page httpserver Serveur HTTP partagé
+ * \brief Un seul serveur web sur le port 80, une table de routes pour tous les modules
+ *
+ * Un seul serveur peut écouter sur le port 80. Tous les modules qui servent des pages ou une API
+ * (\ref webserver, \ref ota, \ref rollup, \ref adafruitqos ...) partagent donc le serveur HTTPServer
+ * de ce module, et y déclarent leurs routes avec registerHttpRoute().
+ *
+ * Les routes sont rangées dans une table statique de HTTP_MAX_ROUTES entrées : contrairement à
+ * HTTPServer.on(), qui alloue un objet sur le tas pour chaque route, la table ne coûte rien au
+ * tas et sa taille est connue à la compilation. Toutes les requêtes passent par dispatchHttpRequest()
+ * qui cherche la route (URI exacte et méthode), puis à défaut un fichier statique dans le SPIFFS
+ * (sous HTTP_STATIC_ROOT, la version compressée .gz en priorité), et sinon répond 404.
+ *
+ * A chaque itération de la boucle, loopHttpServer() traite au plus HTTP_WORKERS requêtes et rend la
+ * main après HTTP_LOOP_BUDGET ms : un afflux de requêtes ne retarde pas les autres modules.
+ *
+ * Avec HTTP_ASYNC, HTTPServer est un AsyncHttpServer (cf. \ref asynchttp) : les connexions sont
+ * gérées par les callbacks de lwIP, plusieurs clients à la fois, et la boucle ne traite que des
+ * requêtes complètes. Un client lent ou inactif ne la bloque plus. Sans HTTP_ASYNC, c'est un
+ * ESP8266WebServer. Les routes sont les mêmes dans les deux cas.
+ *
+ * Une réponse longue, de longueur inconnue, est envoyée par sendHttpStream() : le traitement fournit
+ * un générateur (HttpGenerator) qui la produit par étapes. Le serveur asynchrone l'appelle au fil des
+ * acquittements, ESP8266WebServer d'un trait, par blocs de ASYNC_HTTP_BLOCK_SIZE octets.
+ *
+ * Les statistiques (requêtes par route, fichiers statiques, 404, temps de traitement moyen et max)
+ * sont consultables via GET /api/http.
+ *
+ * \note Le SPIFFS doit être monté pour servir les fichiers statiques (cf. \ref timeseries).
+ *
+ * Fichier \ref MyHttpServer.h
+ */
+
+#include <ESP8266WebServer.h>
+#include <FS.h>
+
+#define HTTP_PORT           80
+#define HTTP_MAX_ROUTES     16            // Taille de la table des routes
+#define HTTP_WORKERS        4             // Nombre max de requêtes traitées par itération de la boucle
+#define HTTP_LOOP_BUDGET    50            // Durée max de traitement par itération de la boucle (ms)
+#define HTTP_STATIC_ROOT    "/www"        // Répertoire des fichiers statiques dans le SPIFFS
+#define HTTP_ASYNC          1             // 1 : connexions gérées par lwIP, 0 : ESP8266WebServer
+
+/** Route : URI, méthode et fonction de traitement */
+struct HttpRoute {
+  const char *strUri;
+  HTTPMethod  method;                     /*!< HTTP_ANY pour toutes les méthodes */
+  void      (*handler)();
+  uint32_t    ulHits;                     /*!< Nombre de requêtes traitées */
+};
+
+#if HTTP_ASYNC
+AsyncHttpServer  HTTPServer(HTTP_PORT);
+#else
+ESP8266WebServer HTTPServer(HTTP_PORT);
+#endif
+HttpRoute        httpRoutes[HTTP_MAX_ROUTES];
+uint8_t          ucHttpNbRoutes = 0;
+// Statistiques
+uint32_t         ulHttpRequests = 0;
+uint32_t         ulHttpStatic = 0;         // Fichiers statiques servis
+uint32_t         ulHttpNotFound = 0;
+uint32_t         ulHttpTotalUs = 0;        // Temps de traitement cumulé
+uint32_t         ulHttpMaxUs = 0;
+
+// ------------------------------------------------------------------------------------------------
+// ROUTES
+// ------------------------------------------------------------------------------------------------
+/**
+ * Enregistrement d'une route. Renvoie false si la table est pleine.
+ */
+bool registerHttpRoute(const char *strUri, HTTPMethod method, void (*handler)()){
+  if (ucHttpNbRoutes >= HTTP_MAX_ROUTES) {
+    MYDEBUG_PRINT("-HTTP : Table des routes pleine, route ignorée : ");
+    MYDEBUG_PRINTLN(strUri);
+    return false;
+  }
+  httpRoutes[ucHttpNbRoutes++] = {strUri, method, handler, 0};
+  return true;
+}
+
+bool registerHttpRoute(const char *strUri, void (*handler)()){
+  return registerHttpRoute(strUri, HTTP_ANY, handler);
+}
+
+/**
+ * Type MIME d'un fichier statique selon son extension
+ */
+const char* getHttpContentType(const String &strPath){
+  if (strPath.endsWith(".html")) { return "text/html"; }
+  if (strPath.endsWith(".css"))  { return "text/css"; }
+  if (strPath.endsWith(".js"))   { return "application/javascript"; }
+  if (strPath.endsWith(".json")) { return "application/json"; }
+  if (strPath.endsWith(".png"))  { return "image/png"; }
+  if (strPath.endsWith(".svg"))  { return "image/svg+xml"; }
+  if (strPath.endsWith(".ico"))  { return "image/x-icon"; }
+  return "application/octet-stream";
+}
+
+/**
+ * Envoi d'un fichier statique du SPIFFS, dans sa version compressée si elle existe.
+ * Renvoie false si le fichier n'existe pas.
+ */
+bool serveHttpStatic(const String &strUri){
+  if (HTTPServer.method() != HTTP_GET) { return false; }
+  String strPath = String(HTTP_STATIC_ROOT) + strUri;
+  if (strPath.endsWith("/")) { strPath += "index.html"; }
+  const char *strContentType = getHttpContentType(strPath);
+  if (SPIFFS.exists(strPath + ".gz")) { strPath += ".gz"; }  // streamFile() ajoute Content-Encoding: gzip
+  else if (!SPIFFS.exists(strPath)) { return false; }
+  File file = SPIFFS.open(strPath, "r");
+  if (!file) { return false; }
+  HTTPServer.streamFile(file, strContentType);
+  file.close();
+  ulHttpStatic++;
+  return true;
+}
+
+/**
+ * Réponse de longueur inconnue produite par le générateur, étape par étape (cf. \ref asynchttp). Le
+ * contexte (au plus ASYNC_HTTP_CONTEXT_SIZE octets) est copié : il peut être une variable locale.
+ */
+void sendHttpStream(int iCode, const char *strContentType, HttpGenerator generator, const void *pContext, size_t uiContextSize){
+#if HTTP_ASYNC
+  HTTPServer.sendGenerated(iCode, strContentType, generator, pContext, uiContextSize);
+#else
+  uint8_t aucContext[ASYNC_HTTP_CONTEXT_SIZE];
+  if (uiContextSize > sizeof(aucContext)) {
+    HTTPServer.send(500, "text/plain", "Internal Server Error");
+    return;
+  }
+  memcpy(aucContext, pContext, uiContextSize);
+  HTTPServer.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  HTTPServer.send(iCode, strContentType, "");
+  uint8_t aucChunk[ASYNC_HTTP_BLOCK_SIZE];
+  uint16_t uiStep = 0;
+  bool bMore = true;
+  while (bMore) {
+    size_t uiChunk = renderHttpSteps(generator, uiStep, aucContext, uiContextSize, aucChunk, sizeof(aucChunk), bMore);
+    if (bMore && uiChunk == 0) { break; }                  // Etape plus grande qu'un bloc : réponse tronquée
+    HTTPServer.sendContent((const char*)aucChunk, uiChunk);
+  }
+  HTTPServer.sendContent("");                                // Fin de la réponse
+#endif
+}
+
+/**
+ * Page non trouvée
+ */
+void handleHttpNotFound(){
+  ulHttpNotFound++;
+  String message = "File Not Found\n\n";
+  message.concat("URI: ");
+  message.concat(HTTPServer.uri());
+  message.concat("\nMethod: ");
+  message.concat((HTTPServer.method() == HTTP_GET)?"GET":"POST");
+  message.concat("\nArguments: ");
+  message.concat(HTTPServer.args());
+  message.concat("\n");
+  for (uint8_t i=0; i<HTTPServer.args(); i++){
+    message.concat(" " + HTTPServer.argName(i) + ": " + HTTPServer.arg(i) + "\n");
+  }
+  HTTPServer.send(404, "text/plain", message);
+}
+
+/**
+ * Aiguillage de chaque requête : table des routes, puis fichiers statiques, puis 404
+ */
+void dispatchHttpRequest(){
+  uint32_t ulStart = micros();
+  String strUri = HTTPServer.uri();
+  HTTPMethod method = HTTPServer.method();
+  bool bFound = false;
+  for (uint8_t i = 0; i < ucHttpNbRoutes && !bFound; i++) {
+    HttpRoute &route = httpRoutes[i];
+    if ((route.method == HTTP_ANY || route.method == method) && strUri == route.strUri) {
+      route.handler();
+      route.ulHits++;
+      bFound = true;
+    }
+  }
+  if (!bFound && !serveHttpStatic(strUri)) { handleHttpNotFound(); }
+
+  uint32_t ulElapsed = micros() - ulStart;
+  ulHttpRequests++;
+  ulHttpTotalUs += ulElapsed;
+  if (ulElapsed > ulHttpMaxUs) { ulHttpMaxUs = ulElapsed; }
+}
+
+// ------------------------------------------------------------------------------------------------
+// STATISTIQUES
+// ------------------------------------------------------------------------------------------------
+/**
+ * GET /api/http : requêtes par route et temps de traitement
+ */
+void handleHttpStats(){
+  char cBuffer[160];
+  snprintf(cBuffer, sizeof(cBuffer),
+           "{\"requests\":%lu,\"static\":%lu,\"notFound\":%lu,\"avgUs\":%lu,\"maxUs\":%lu,\"routes\":{",
+           (unsigned long)ulHttpRequests, (unsigned long)ulHttpStatic, (unsigned long)ulHttpNotFound,
+           (unsigned long)(ulHttpRequests ? ulHttpTotalUs / ulHttpRequests : 0), (unsigned long)ulHttpMaxUs);
+  String strResponse = cBuffer;
+  for (uint8_t i = 0; i < ucHttpNbRoutes; i++) {
+    snprintf(cBuffer, sizeof(cBuffer), "%s\"%s\":%lu", i > 0 ? "," : "", httpRoutes[i].strUri, (unsigned long)httpRoutes[i].ulHits);
+    strResponse += cBuffer;
+  }
+  strResponse += "}";
+#if HTTP_ASYNC
+  snprintf(cBuffer, sizeof(cBuffer),
+           ",\"connections\":{\"accepted\":%lu,\"rejected\":%lu,\"timeouts\":%lu,\"overflows\":%lu,\"peak\":%u}",
+           (unsigned long)ulAsyncHttpAccepted, (unsigned long)ulAsyncHttpRejected, (unsigned long)ulAsyncHttpTimeouts,
+           (unsigned long)ulAsyncHttpOverflows, ucAsyncHttpPeak);
+  strResponse += cBuffer;
+#endif
+  strResponse += "}";
+  HTTPServer.send(200, "application/json", strResponse);
+}
+
+// ------------------------------------------------------------------------------------------------
+// SERVEUR
+// ------------------------------------------------------------------------------------------------
+/**
+ * Démarrage du serveur : les routes peuvent être enregistrées avant ou après
+ */
+void setupHttpServer(){
+  // On a besoin d'une connexion WiFi !
+  if (WiFi.status() != WL_CONNECTED){setupWiFi();}  // Connexion WiFi
+  MYDEBUG_PRINTLN("-HTTP : Démarrage du serveur");
+  HTTPServer.onNotFound(dispatchHttpRequest);       // Toutes les requêtes passent par la table des routes
+  registerHttpRoute("/api/http", HTTP_GET, handleHttpStats);
+  HTTPServer.begin();
+}
+
+/**
+ * Traitement des requêtes en attente, dans la limite de HTTP_WORKERS requêtes et HTTP_LOOP_BUDGET ms
+ */
+void loopHttpServer(){
+  uint8_t ucWatchdog = watchdogEnter(WDT_HTTP);
+  uint32_t ulStart = millis();
+  uint32_t ulRequests = ulHttpRequests;
+  for (uint8_t i = 0; i < HTTP_WORKERS && millis() - ulStart < HTTP_LOOP_BUDGET; i++) {
+    HTTPServer.handleClient();
+    if (ulHttpRequests == ulRequests) { break; }      // Plus rien à traiter
+    ulRequests = ulHttpRequests;
+    watchdogYield();
+  }
+  watchdogLeave(ucWatchdog);
+}
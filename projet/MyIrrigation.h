@@ -0,0 +1,192 @@
+/**
+ * \file MyIrrigation.h
+ * \page irrigation Arrosage automatique
+ * \brief Régulation locale de l'humidité du sol : hystérésis ou PI, temps minimum, budget d'arrosage
+ *
+ * Sans régulation locale, arroser demande qu'un humain lise le tableau de bord et actionne le feed
+ * onoff : chaque décision fait un aller-retour par le cloud, et rien ne se passe si le broker est
+ * injoignable. La régulation est donc faite sur l'objet, qui commande directement la pompe
+ * (IRRIGATION_PUMP_PIN) :
+ * - La mesure analogique d'humidité du sol (voie SENSOR_SOIL, cf. \ref soilsensor) est lissée par une
+ *   moyenne mobile exponentielle (IRRIGATION_FILTER) : une mesure isolée ne déclenche pas la pompe.
+ * - Le signal numérique de sécheresse (voie SENSOR_DRYNESS), réglé par le potentiomètre du capteur,
+ *   demande l'arrosage même si la mesure analogique est mal calibrée.
+ * - Deux régulations au choix (IRRIGATION_MODE) :
+ *   - IRRIGATION_HYSTERESIS : la pompe démarre sous la consigne moins IRRIGATION_BAND / 2 et
+ *     s'arrête au-dessus de la consigne plus IRRIGATION_BAND / 2.
+ *   - IRRIGATION_PI : un régulateur proportionnel-intégral calcule la part d'arrosage (de 0 à 100 %)
+ *     de chaque fenêtre de IRRIGATION_WINDOW ms : la pompe tourne en début de fenêtre pendant cette
+ *     part du temps. L'intégrale est bornée (anti-emballement).
+ * - Protections, prioritaires sur la régulation : la pompe tourne au moins IRRIGATION_MIN_ON ms et
+ *   reste arrêtée au moins IRRIGATION_MIN_OFF ms, et ne tourne pas plus de IRRIGATION_BUDGET ms par
+ *   période de IRRIGATION_BUDGET_PERIOD ms.
+ *
+ * La consigne locale (IRRIGATION_SETPOINT) peut être remplacée depuis le cloud : le feed Adafruit IO
+ * "setpoint" (cf. \ref adafruitio) accepte une humidité cible en %, ou "auto" pour revenir à la
+ * consigne locale. La régulation continue de tourner sans le broker.
+ *
+ * La décision est prise à chaque mesure (updateIrrigation()), les temps minimum, le budget et les
+ * fenêtres PI sont appliqués à chaque itération de la boucle (loopIrrigation()). L'état est
+ * consultable via GET /api/irrigation (cf. \ref httpserver).
+ *
+ * Tous les calculs sont en virgule fixe (cf. \ref fixed) : les gains du PI sont convertis en millionièmes
+ * à la compilation, la part d'arrosage est un Fixed de 0 à FIXED_ONE.
+ *
+ * \note Le budget consommé est en RAM : il repart de zéro après un reset.
+ *
+ * Fichier \ref MyIrrigation.h
+ */
+
+#define IRRIGATION_PUMP_PIN       D1          // Commande de la pompe (relais ou MOSFET, actif à l'état haut)
+#define IRRIGATION_HYSTERESIS     0
+#define IRRIGATION_PI             1
+#define IRRIGATION_MODE           IRRIGATION_HYSTERESIS
+#define IRRIGATION_SETPOINT       40          // Consigne locale d'humidité du sol (%)
+#define IRRIGATION_BAND           10          // Largeur de l'hystérésis (%)
+#define IRRIGATION_FILTER         0.2         // Coefficient de la moyenne mobile exponentielle
+#define IRRIGATION_KP             0.05        // Gain proportionnel (part d'arrosage par % d'écart)
+#define IRRIGATION_KI             0.0005      // Gain intégral (part d'arrosage par %.s d'écart)
+#define IRRIGATION_WINDOW         60000       // Fenêtre de la régulation PI (ms)
+#define IRRIGATION_MIN_ON         5000        // Durée minimum de marche de la pompe (ms)
+#define IRRIGATION_MIN_OFF        30000       // Durée minimum d'arrêt de la pompe (ms)
+#define IRRIGATION_BUDGET         600000      // Durée max d'arrosage par période (ms)
+#define IRRIGATION_BUDGET_PERIOD  86400000    // Période du budget (ms)
+
+#define IRRIGATION_KP_PPM         ((int32_t)(IRRIGATION_KP * 1000000 + 0.5))
+#define IRRIGATION_KI_PPM         ((int32_t)(IRRIGATION_KI * 1000000 + 0.5))
+
+Fixed    lIrrigationMoisture = FIXED_NAN;     // Humidité du sol lissée (%)
+Fixed    lIrrigationOverride = FIXED_NAN;     // Consigne imposée par le cloud, FIXED_NAN : consigne locale
+Fixed    lIrrigationIntegral = 0;             // Intégrale de l'erreur (%.s)
+Fixed    lIrrigationDuty = 0;                 // Part d'arrosage demandée, de 0 à FIXED_ONE
+bool     bIrrigationDemand = false;           // Arrosage demandé par la régulation
+bool     bIrrigationPump = false;             // Etat de la pompe
+uint32_t ulIrrigationLastSwitch = 0;          // Dernier changement d'état de la pompe
+uint32_t ulIrrigationLastUpdate = 0;          // Dernière mesure prise en compte
+uint32_t ulIrrigationWindowStart = 0;
+uint32_t ulIrrigationBudgetStart = 0;
+uint32_t ulIrrigationBudgetUsed = 0;          // Durée d'arrosage sur la période en cours (ms)
+uint32_t ulIrrigationLastLoop = 0;
+uint32_t ulIrrigationCycles = 0;              // Démarrages de la pompe
+
+/**
+ * Consigne en vigueur : celle du cloud si elle est définie, sinon la consigne locale
+ */
+Fixed getIrrigationSetpoint(){
+  return fixedIsNan(lIrrigationOverride) ? FIXED(IRRIGATION_SETPOINT) : lIrrigationOverride;
+}
+
+/**
+ * Consigne imposée par le cloud, FIXED_NAN pour revenir à la consigne locale
+ */
+void setIrrigationOverride(Fixed lSetpoint){
+  lIrrigationOverride = fixedIsNan(lSetpoint) ? FIXED_NAN : constrain(lSetpoint, 0, FIXED(100));
+  lIrrigationIntegral = 0;
+  MYDEBUG_PRINT("-IRRIGATION : Consigne ");
+  MYDEBUG_PRINT(fixedToInt(getIrrigationSetpoint()));
+  MYDEBUG_PRINTLN(fixedIsNan(lIrrigationOverride) ? "% [locale]" : "% [cloud]");
+}
+
+/**
+ * Commande de la pompe
+ */
+void setIrrigationPump(bool bOn){
+  if (bOn == bIrrigationPump) { return; }
+  bIrrigationPump = bOn;
+  ulIrrigationLastSwitch = millis();
+  if (bOn) { ulIrrigationCycles++; }
+  digitalWrite(IRRIGATION_PUMP_PIN, bOn ? HIGH : LOW);
+  MYDEBUG_PRINT("-IRRIGATION : Pompe ");
+  MYDEBUG_PRINT(bOn ? "en marche" : "arrêtée");
+  MYDEBUG_PRINT(" [humidité : ");
+  MYDEBUG_PRINT(fixedToInt(lIrrigationMoisture));
+  MYDEBUG_PRINT("% / consigne : ");
+  MYDEBUG_PRINT(fixedToInt(getIrrigationSetpoint()));
+  MYDEBUG_PRINT("% / budget : ");
+  MYDEBUG_PRINT(ulIrrigationBudgetUsed / 1000);
+  MYDEBUG_PRINTLN(" s]");
+}
+
+/**
+ * Prise en compte d'une nouvelle mesure, à appeler après sampleSensors()
+ */
+void updateIrrigation(){
+  Fixed lMoisture = sensors.value(SENSOR_SOIL);
+  if (fixedIsNan(lMoisture)) { return; }                       // Pas encore de mesure
+  uint32_t ulNow = millis();
+  uint32_t ulDt = (ulIrrigationLastUpdate == 0) ? 0 : ulNow - ulIrrigationLastUpdate;
+  ulIrrigationLastUpdate = ulNow;
+  lIrrigationMoisture = fixedEwma(lIrrigationMoisture, lMoisture, FIXED_ALPHA(IRRIGATION_FILTER));
+  Fixed lSetpoint = getIrrigationSetpoint();
+  bool bDry = (sensors.value(SENSOR_DRYNESS) == FIXED_ONE);
+
+#if IRRIGATION_MODE == IRRIGATION_PI
+  Fixed lError = lSetpoint - lIrrigationMoisture;
+  Fixed lDuty = fixedMulDiv(lError, IRRIGATION_KP_PPM, 1000000) + fixedMulDiv(lIrrigationIntegral, IRRIGATION_KI_PPM, 1000000);
+  if ((lDuty > 0 && lDuty < FIXED_ONE) || (lDuty >= FIXED_ONE && lError < 0) || (lDuty <= 0 && lError > 0)) {
+    lIrrigationIntegral += fixedMulDiv(lError, ulDt, 1000);    // Intégration seulement hors saturation
+  }
+  Fixed lDryDuty = fixedMulDiv(FIXED(IRRIGATION_BAND), IRRIGATION_KP_PPM, 1000000);
+  if (bDry && lDuty < lDryDuty) { lDuty = lDryDuty; }
+  lIrrigationDuty = constrain(lDuty, 0, FIXED_ONE);
+  bIrrigationDemand = lIrrigationDuty > 0;
+#else
+  if (lIrrigationMoisture < lSetpoint - FIXED(IRRIGATION_BAND) / 2 || (bDry && lIrrigationMoisture < lSetpoint)) {
+    bIrrigationDemand = true;
+  } else if (lIrrigationMoisture > lSetpoint + FIXED(IRRIGATION_BAND) / 2) {
+    bIrrigationDemand = false;
+  }
+  lIrrigationDuty = bIrrigationDemand ? FIXED_ONE : 0;
+#endif
+}
+
+/**
+ * Application de la décision : fenêtres PI, temps minimum et budget d'arrosage
+ */
+void loopIrrigation(){
+  uint32_t ulNow = millis();
+  if (bIrrigationPump) { ulIrrigationBudgetUsed += ulNow - ulIrrigationLastLoop; }
+  ulIrrigationLastLoop = ulNow;
+  if (ulNow - ulIrrigationBudgetStart >= IRRIGATION_BUDGET_PERIOD) {  // Nouvelle période
+    ulIrrigationBudgetStart = ulNow;
+    ulIrrigationBudgetUsed = 0;
+  }
+  if (ulNow - ulIrrigationWindowStart >= IRRIGATION_WINDOW) { ulIrrigationWindowStart = ulNow; }
+
+  // Décision de la régulation : en PI, la pompe tourne en début de fenêtre
+  bool bWanted = bIrrigationDemand && (ulNow - ulIrrigationWindowStart < (uint32_t)IRRIGATION_WINDOW * lIrrigationDuty / FIXED_ONE);
+  if (ulIrrigationBudgetUsed >= IRRIGATION_BUDGET) { bWanted = false; }      // Budget épuisé : prioritaire
+
+  uint32_t ulSinceSwitch = ulNow - ulIrrigationLastSwitch;
+  if (bWanted && !bIrrigationPump && ulSinceSwitch >= IRRIGATION_MIN_OFF) {
+    setIrrigationPump(true);
+  } else if (!bWanted && bIrrigationPump && (ulSinceSwitch >= IRRIGATION_MIN_ON || ulIrrigationBudgetUsed >= IRRIGATION_BUDGET)) {
+    setIrrigationPump(false);
+  }
+}
+
+/**
+ * GET /api/irrigation : état de la régulation
+ */
+void handleIrrigation(){
+  char cBuffer[256];
+  char cMoisture[14] = "null", cSetpoint[14], cDuty[14];
+  if (!fixedIsNan(lIrrigationMoisture)) { formatFixed(cMoisture, lIrrigationMoisture, 1); }
+  formatFixed(cSetpoint, getIrrigationSetpoint(), 1);
+  formatFixed(cDuty, lIrrigationDuty, 2);
+  snprintf(cBuffer, sizeof(cBuffer),
+           "{\"moisture\":%s,\"setpoint\":%s,\"override\":%s,\"dry\":%d,\"duty\":%s,\"pump\":%s,"
+           "\"cycles\":%lu,\"budgetUsedS\":%lu,\"budgetS\":%lu}",
+           cMoisture, cSetpoint, fixedIsNan(lIrrigationOverride) ? "false" : "true",
+           sensors.value(SENSOR_DRYNESS) == FIXED_ONE, cDuty, bIrrigationPump ? "true" : "false", (unsigned long)ulIrrigationCycles,
+           (unsigned long)(ulIrrigationBudgetUsed / 1000), (unsigned long)(IRRIGATION_BUDGET / 1000));
+  HTTPServer.send(200, "application/json", cBuffer);
+}
+
+void setupIrrigation(){
+  pinMode(IRRIGATION_PUMP_PIN, OUTPUT);
+  digitalWrite(IRRIGATION_PUMP_PIN, LOW);
+  // Le temps minimum d'arrêt s'applique aussi au démarrage (reset pendant un arrosage)
+  ulIrrigationLastSwitch = ulIrrigationLastLoop = ulIrrigationBudgetStart = ulIrrigationWindowStart = millis();
+  registerHttpRoute("/api/irrigation", HTTP_GET, handleIrrigation);
+}
@@ -133,7 +133,7 @@
  *      changer l'état de votre actuateur
  * 
  * Les bibliothèques à utiliser sont les suivantes (préférez l'installation des bibliothèques via l'IDE):
- * - PubSubClient by Nick O'Leary : https://pubsubclient.knolleary.net/ https://github.com/knolleary/pubsubclient/releases/tag/v2.7
+ * - PubSubClient by Nick O'Leary : https://pubsubclient.knolleary.net/ https://github.com/knolleary/pubsubclient/releases/tag/v2.8 (2.8 minimum : setKeepAlive(), cf. keepAliveMQTT())
  * - Arduino JSON by Benoit Blanchon : https://github.com/bblanchon/ArduinoJson
  * 
  * Pour démarrer :
@@ -141,37 +141,257 @@
  * - Hello World Thingsboard : https://thingsboard.io/docs/getting-started-guides/helloworld/
  * - Thingsboard MQTT API (Telemetry, Attributes & RPC) : https://thingsboard.io/docs/reference/mqtt-api/
  * 
+ * <H2>Publication en flux</H2>
+ *
+ * PubSubClient construit chaque message dans un buffer de MQTT_MAX_PACKET_SIZE octets (256 par défaut) :
+ * un message plus long n'est tout simplement pas envoyé. Et préparer la payload dans une String ou un
+ * document JSON demande en plus une allocation contiguë de la taille du message.
+ *
+ * publishMqttStream() envoie une payload de taille quelconque, produite par un générateur : une fonction
+ * qui écrit la payload dans un Print. Le générateur est appelé deux fois :
+ * - Une première fois pour compter les octets, sans rien stocker : la longueur annoncée par
+ *   beginPublish() doit être connue avant d'envoyer le premier octet.
+ * - Une seconde fois pour écrire réellement la payload. Elle passe par un buffer du pool, envoyé au
+ *   client TCP à chaque fois qu'il est plein, puis endPublish().
+ * Les buffers proviennent d'un pool statique (MQTT_POOL_SIZE buffers de MQTT_POOL_BUFFER_SIZE octets) :
+ * pas d'allocation sur le tas, donc pas de fragmentation, et un échec franc si le pool est épuisé.
+ *
+ * \note Le générateur doit produire exactement la même payload lors des deux appels : il ne doit lire
+ * que des valeurs qui ne changent pas entre-temps (pas de millis(), pas de mesure). Sinon le message
+ * est tronqué et la connexion est fermée pour ne pas désynchroniser le broker.
+ *
  * Fichier \ref MyMQTT.h
  */
 
 #include <PubSubClient.h>                         // PubSubClient MQTT
 #include <ESP8266WiFi.h>                          // ESP8266 WiFi
-#include <ArduinoJson.h>                          // JSON
 
 #define MQTT_CLIENTID  "MyNodeMCU"                // Identifiant MQTT
 #define MQTT_TOKEN     "EOHShyDxOYLZWBXULdHg"     // TOKEN du dispositif 
 #define MQTT_SERVER    "demo.thingsboard.io"      // Adresse IP ou URL du broker MQTT
+#define MQTT_TLS       0                          // 1 : MQTT sur TLS (cf. \ref tls), 0 : en clair
+#define MQTT_FINGERPRINT ""                       // Empreinte SHA-1 du certificat du broker, obligatoire avec TLS
+#if MQTT_TLS
+#define MQTT_PORT      8883                       // Port MQTT sur TLS
+#else
 #define MQTT_PORT      1883                       // Port MQTT
+#endif
 #define MQTT_FREQ      10                         // Fréquence en secondes d'envoi des données pour le ticker
+#define MQTT_KEEPALIVE_MARGIN 3000                // PINGREQ envoyé 3 s avant l'échéance du keep-alive (ms)
+#define MQTT_ENERGY_PERIOD 600000                 // Période de mise à jour des attributs du bilan énergétique (ms)
 
+#if MQTT_TLS
+static_assert(sizeof(MQTT_FINGERPRINT) > 1, "MQTT_TLS : renseigner MQTT_FINGERPRINT (cf. MyTLS.h)");
+BearSSL::WiFiClientSecure MyWiFiClient;           // Instanciation d'un client web chiffré
+TlsTransport  MqttTls = {MQTT_SERVER, MQTT_PORT, MQTT_FINGERPRINT, TLS_SLOT_MQTT};  // Session et statistiques TLS
+#else
 WiFiClient    MyWiFiClient;                       // Instanciation d'un client web
+#endif
 PubSubClient  MyMqttClient(MyWiFiClient);         // Instanciation du client MQTT
 Ticker        MyMqttTicker;                       // Ticker pour l'envoi régulier de données au broker
 int           iMqttActuatorPin = 2;               // Broche à utiliser pour l'actuateur
 String        strActuatorKey = "MyActuatorState"; // Nom de l'attribut pour l'actuateur
+uint32_t      ulMqttLastPing = 0;                 // Date du dernier paquet émis : PINGREQ, publication ou connexion (millis)
+uint32_t      ulMqttLastEnergy = 0;               // Date de la dernière publication du bilan énergétique (millis)
+bool          bMqttDataPending = false;           // Télémétrie à envoyer par la boucle (signalée par le Ticker)
+uint32_t      ulMqttCoalesced = 0;                // Télémétries remplacées avant d'avoir été envoyées
+
+/** Attributs publiés à la connexion, figés pour les 2 passes de l'encodage */
+struct MqttAttributesContext {
+  uint32_t      aulCounters[CNT_NB];
+  EnergySummary energy;
+};
+
+#define MQTT_MAX_RPC          4                   // Nombre max de méthodes RPC enregistrées par les autres modules
+
+/** Traitement d'une méthode RPC : la réponse est à publier sur strResponseTopic */
+typedef void (*MqttRpcHandler)(const MqttRpcRequest &request, const char *strResponseTopic);
+
+/** Méthode RPC enregistrée par un autre module */
+struct MqttRpcMethod {
+  const char     *strMethod;
+  MqttRpcHandler  handler;
+};
+
+MqttRpcMethod mqttRpcMethods[MQTT_MAX_RPC];       // Table statique, comme les routes HTTP (cf. \ref httpserver)
+uint8_t       ucMqttNbRpc = 0;
+
+#define MQTT_POOL_SIZE        2                   // Nombre de buffers du pool
+#define MQTT_POOL_BUFFER_SIZE 256                 // Taille d'un buffer, envoyé au client TCP en une écriture
+
+uint8_t       aucMqttPool[MQTT_POOL_SIZE][MQTT_POOL_BUFFER_SIZE];  // Pool de buffers statique
+uint8_t       ucMqttPoolUsed = 0;                 // Bits des buffers utilisés
+uint8_t       ucMqttPoolPeak = 0;                 // Nombre max de buffers utilisés simultanément
+uint32_t      ulMqttPoolMisses = 0;               // Demandes refusées, pool épuisé
+uint32_t      ulMqttStreamPublished = 0;          // Messages publiés en flux
+uint32_t      ulMqttStreamBytes = 0;              // Octets de payload publiés en flux
+uint32_t      ulMqttStreamFailures = 0;           // Publications en flux échouées
+
+/** Générateur de payload : écrit la payload dans output, pContext est passé tel quel */
+typedef void (*MqttGenerator)(Print &output, const void *pContext);
+
+// ------------------------------------------------------------------------------------------------
+// POOL DE BUFFERS
+// ------------------------------------------------------------------------------------------------
+/**
+ * Prise d'un buffer de MQTT_POOL_BUFFER_SIZE octets dans le pool, NULL si le pool est épuisé
+ */
+uint8_t* takeMqttBuffer(){
+  for (uint8_t i = 0; i < MQTT_POOL_SIZE; i++) {
+    if (ucMqttPoolUsed & (1 << i)) { continue; }
+    ucMqttPoolUsed |= 1 << i;
+    uint8_t ucUsed = __builtin_popcount(ucMqttPoolUsed);
+    if (ucUsed > ucMqttPoolPeak) { ucMqttPoolPeak = ucUsed; }
+    return aucMqttPool[i];
+  }
+  ulMqttPoolMisses++;
+  return NULL;
+}
+
+/**
+ * Restitution d'un buffer au pool
+ */
+void releaseMqttBuffer(uint8_t *aucBuffer){
+  for (uint8_t i = 0; i < MQTT_POOL_SIZE; i++) {
+    if (aucBuffer == aucMqttPool[i]) { ucMqttPoolUsed &= ~(1 << i); }
+  }
+}
+
+// ------------------------------------------------------------------------------------------------
+// PUBLICATION EN FLUX
+// ------------------------------------------------------------------------------------------------
+/** Print qui accumule la payload dans un buffer du pool et l'envoie au client MQTT quand il est plein */
+class MqttStreamWriter : public Print {
+public:
+  size_t uiSent = 0;                              // Octets acceptés par le client TCP
+  MqttStreamWriter(uint8_t *aucBuffer) : aucBuffer(aucBuffer) {}
+  size_t write(uint8_t ucByte) override { return write(&ucByte, 1); }
+  size_t write(const uint8_t *aucData, size_t uiSize) override {
+    size_t uiDone = 0;
+    while (uiDone < uiSize) {
+      if (uiLength == MQTT_POOL_BUFFER_SIZE) { sendBuffer(); }
+      size_t uiChunk = min(uiSize - uiDone, (size_t)(MQTT_POOL_BUFFER_SIZE - uiLength));
+      memcpy(aucBuffer + uiLength, aucData + uiDone, uiChunk);
+      uiLength += uiChunk;
+      uiDone += uiChunk;
+    }
+    return uiSize;
+  }
+  void sendBuffer() {
+    if (uiLength == 0) { return; }
+    uiSent += MyMqttClient.write(aucBuffer, uiLength);
+    uiLength = 0;
+  }
+private:
+  uint8_t *aucBuffer;
+  size_t   uiLength = 0;
+};
+
+/**
+ * Publication d'une payload de taille quelconque produite par un générateur, sans la construire en
+ * mémoire : une passe pour mesurer la longueur, une passe pour l'envoyer par blocs.
+ */
+bool publishMqttStream(const char *strTopic, MqttGenerator generator, const void *pContext){
+  if (!MyMqttClient.connected()) { return false; }
+  ByteCounter counter;                            // Première passe : longueur et coût de l'encodage
+  uint32_t ulEncodeMicros = micros();
+  generator(counter, pContext);
+  ulEncodeMicros = micros() - ulEncodeMicros;
+  uint8_t *aucBuffer = takeMqttBuffer();
+  if (aucBuffer == NULL) {
+    ulMqttStreamFailures++;
+    incrementCounter(CNT_PUBLISH_FAILURES);
+    MYDEBUG_PRINTLN("-MQTT : Pool de buffers épuisé");
+    return false;
+  }
+  uint8_t ucEnergy = energyEnter(ENERGY_PUBLISH);
+  bool bOk = MyMqttClient.beginPublish(strTopic, counter.uiCount, false);
+  if (bOk) {
+    MqttStreamWriter writer(aucBuffer);
+    generator(writer, pContext);
+    writer.sendBuffer();
+    bOk = (MyMqttClient.endPublish() != 0) && writer.uiSent == counter.uiCount;
+    if (writer.uiSent != counter.uiCount) {       // Message tronqué : le broker attend encore des octets
+      MYDEBUG_PRINTLN("-MQTT : Payload différente entre les 2 passes, déconnexion");
+      MyMqttClient.disconnect();
+    }
+  }
+  energyLeave(ucEnergy);
+  releaseMqttBuffer(aucBuffer);
+  if (bOk) {
+    ulMqttLastPing = millis();                    // Paquet émis : le PINGREQ aligné peut attendre (cf. keepAliveMQTT())
+    energyMessage();                              // Coût du message pour le module qui publie (cf. \ref energy)
+    ulMqttStreamPublished++;
+    ulMqttStreamBytes += counter.uiCount;
+  } else {
+    ulMqttStreamFailures++;
+    incrementCounter(CNT_PUBLISH_FAILURES);
+  }
+  MYDEBUG_PRINT("-MQTT : Publication en flux sur ");
+  MYDEBUG_PRINT(strTopic);
+  MYDEBUG_PRINT(" [");
+  MYDEBUG_PRINT(counter.uiCount);
+  MYDEBUG_PRINT(" octets / encodage ");
+  MYDEBUG_PRINT(ulEncodeMicros);
+  MYDEBUG_PRINTLN(bOk ? " µs]" : " µs] [ERREUR]");
+  return bOk;
+}
+
+/**
+ * Générateurs des payloads, dans l'encodage choisi (cf. \ref codec) :
+ * - Attributs du client, publiés à la connexion, pContext pointe sur une copie des compteurs persistants
+ *   et du bilan énergétique (MqttAttributesContext)
+ * - Etat de l'actuateur seul : mise à jour de l'attribut
+ * - Bilan énergétique seul, pContext pointe sur une copie (EnergySummary)
+ * - Réponse aux requêtes RPC : état de l'actuateur
+ * - Télémétrie, pContext pointe sur les données (MqttTelemetry)
+ */
+void mqttAttributesGenerator(Print &output, const void *pContext){
+  const MqttAttributesContext *pAttributes = (const MqttAttributesContext*)pContext;
+  MqttAttributes attributes = {FIRMWAREVERSION, THINGTYPE, ESP.getChipId(), digitalRead(iMqttActuatorPin),
+                               pAttributes->aulCounters, &pAttributes->energy};
+  writeAttributes(output, attributes);
+}
+
+void mqttEnergyGenerator(Print &output, const void *pContext){
+  MqttAttributes attributes = {NULL, NULL, 0, digitalRead(iMqttActuatorPin), NULL, (const EnergySummary*)pContext};
+  writeAttributes(output, attributes);
+}
+
+void mqttActuatorGenerator(Print &output, const void *pContext){
+  MqttAttributes attributes = {NULL, NULL, 0, digitalRead(iMqttActuatorPin)};
+  writeAttributes(output, attributes);
+}
+
+void mqttRpcResponseGenerator(Print &output, const void *pContext){
+  writeRpcResponse(output, digitalRead(iMqttActuatorPin));
+}
+
+void mqttTelemetryGenerator(Print &output, const void *pContext){
+  writeTelemetry(output, *(const MqttTelemetry*)pContext);
+}
+
+/** Balayage des sondes d'humidité du sol */
+void mqttSoilScanGenerator(Print &output, const void *pContext){
+  writeSoilScan(output, (const uint8_t*)pContext, SOIL_NB_PROBES);
+}
+
+/** Réponse RPC quelconque, pContext pointe sur la réponse sérialisée en JSON */
+void mqttRpcPayloadGenerator(Print &output, const void *pContext){
+  writeRpcPayload(output, (const char*)pContext);
+}
 
 /**
- * Fonction de récupération de l'état de l'actuateur.
- * Elle renvoie la payload préparée
+ * Enregistrement d'une méthode RPC traitée par un autre module. Renvoie false si la table est pleine.
  */
-String getActuatorStatus() {
-  String strActuatorStatus;  
-  StaticJsonDocument<200> payload;
-  payload[strActuatorKey] = digitalRead(iMqttActuatorPin);
-  serializeJson(payload, strActuatorStatus);
-  MYDEBUG_PRINT("-MQTT : Get actuator Status : ");
-  MYDEBUG_PRINTLN(strActuatorStatus);
-  return strActuatorStatus;
+bool registerMqttRpc(const char *strMethod, MqttRpcHandler handler){
+  if (ucMqttNbRpc >= MQTT_MAX_RPC) {
+    MYDEBUG_PRINT("-MQTT : Table des méthodes RPC pleine, méthode ignorée : ");
+    MYDEBUG_PRINTLN(strMethod);
+    return false;
+  }
+  mqttRpcMethods[ucMqttNbRpc++] = {strMethod, handler};
+  return true;
 }
 
 /**
@@ -182,57 +402,89 @@ String getActuatorStatus() {
  */
 void reconnectMQTT(){
   if (WiFi.status() != WL_CONNECTED){setupWiFi();}                          // Vérification de la connexion WiFi
+  if (WiFi.status() != WL_CONNECTED){return;}                               // Abandon imposé par le watchdog
+  uint8_t ucWatchdog = watchdogEnter(WDT_MQTT);
   while (!MyMqttClient.connected()) {                                       // Vérification de la connexion au serveur MQTT
+    watchdogYield();                                                        // Une tentative = un signe de vie
     MYDEBUG_PRINT("-MQTT : Connexion au serveur MQTT ... ");
-    if ( MyMqttClient.connect(MQTT_CLIENTID, MQTT_TOKEN, NULL) ) { // -------------- Connexion OK au serveur MQTT
+    incrementCounter(CNT_MQTT_RECONNECTS);
+#if MQTT_TLS
+    tlsBeginConnect(MqttTls);
+    bool bConnected = MyMqttClient.connect(MQTT_CLIENTID, MQTT_TOKEN, NULL);
+    tlsEndConnect(MqttTls, bConnected);
+#else
+    uint8_t ucEnergy = energyEnter(ENERGY_TCP_CONNECT);
+    bool bConnected = MyMqttClient.connect(MQTT_CLIENTID, MQTT_TOKEN, NULL);
+    energyLeave(ucEnergy);
+#endif
+    if ( bConnected ) { // ------------------------------------------------------- Connexion OK au serveur MQTT
       MYDEBUG_PRINTLN("[OK]");
+      ulMqttLastPing = millis();
       // ------------------------------------------------------------------- SOUSCRIPTION
       MYDEBUG_PRINTLN("-MQTT : Subscription");
       MyMqttClient.subscribe("v1/devices/me/rpc/request/+");                 // A toute les requêtes RPC
       // ------------------------------------------------------------------- PUBLICATION DES ATTRIBUTS
       MYDEBUG_PRINTLN("-MQTT : Publication des attributs");
-      DynamicJsonDocument jsonPayload(512);                                  // Préparation de la Payload avec
-      jsonPayload["firmwareVersion"] = FIRMWAREVERSION;                      // Version du firmware
-      jsonPayload["thingType"] = THINGTYPE;                                  // Type d'objet
-      jsonPayload["serialNumber"] = ESP.getChipId();                         // Le numéro de série
-      jsonPayload[strActuatorKey] = digitalRead(iMqttActuatorPin);           // Etat de l'actuateur
-                                                                             // PAYLOAD 
-      String strAttributesPayload;                                           // Préparation de la payload Attributes JSON 
-      serializeJson(jsonPayload, strAttributesPayload);                      // Sérialisation du JSON
-      MyMqttClient.publish("v1/devices/me/attributes", getActuatorStatus().c_str()); // Publication de la payload
+      MqttAttributesContext context;
+      copyCounters(context.aulCounters);                                    // Valeurs figées pour les 2 passes
+      getEnergySummary(context.energy);
+      publishMqttStream("v1/devices/me/attributes", mqttAttributesGenerator, &context);
+      ulMqttLastEnergy = millis();
     } else { // ------------------------------------------------------------ Impossible de se connecter au serveur MQTT
       MYDEBUG_PRINT( "[ERREUR] [ rc = " );
       MYDEBUG_PRINT( MyMqttClient.state() );
       MYDEBUG_PRINTLN( " : Nouvelle tentative dans 5 sec]" );
+      if (watchdogRemaining() < 5000 + aulWatchdogBudgets[WDT_MQTT]) { break; }  // Pas le temps d'une autre tentative
       delay(5000);
     }
   }
+  watchdogLeave(ucWatchdog);
 }
 
 /**
- * Récupération des données auprès des différents capteurs
- * puis envoi des données de télémétrie au serveur MQTT
+ * Keep-alive aligné sur les réveils prévus (cf. \ref power). PubSubClient envoie lui-même un PINGREQ
+ * dès que rien n'a été émis, ou rien reçu, depuis MQTT_KEEPALIVE secondes. Il n'a pas d'API de ping :
+ * au réveil prévu qui précède ces échéances, son keep-alive est ramené à 0 le temps d'un loop(), qui
+ * envoie donc le PINGREQ et repousse ses deux échéances (émission et réception). Le PINGRESP est lu
+ * par les loop() suivants. Une publication réussie repousse aussi notre échéance (ulMqttLastPing) :
+ * tant que la télémétrie circule, aucun PINGREQ n'est forcé.
+ * \note Un PINGREQ encore sans réponse ferait déconnecter le client par ce loop() : cela ne peut être
+ * que le nôtre, sans réponse depuis MQTT_KEEPALIVE - MQTT_KEEPALIVE_MARGIN ms, donc un broker perdu.
+ */
+void keepAliveMQTT(){
+  if (!powerPingDue(millis() - ulMqttLastPing, MQTT_KEEPALIVE * 1000UL - MQTT_KEEPALIVE_MARGIN)) { return; }
+  MyMqttClient.setKeepAlive(0);                                             // Echéances dépassées : PINGREQ
+  MyMqttClient.loop();
+  MyMqttClient.setKeepAlive(MQTT_KEEPALIVE);
+  ulMqttLastPing = millis();
+}
+
+/**
+ * Appelée par le Ticker, elle ne fait que signaler que des données sont à envoyer : la publication
+ * (et la reconnexion) se font dans la boucle, jamais au milieu d'une autre publication sur le même
+ * client (règles, ESP-NOW, balayage du sol, bilan énergétique, réponses RPC).
  */
 void getAndSendMqttData(){
-  if (!MyMqttClient.connected() ) { reconnectMQTT(); }
+  if (bMqttDataPending) { ulMqttCoalesced++; }
+  bMqttDataPending = true;
+}
+
+/**
+ * Récupération des données auprès des différents capteurs
+ * puis envoi des données de télémétrie en attente au serveur MQTT
+ */
+void sendMqttData(){
+  if (!bMqttDataPending) { return; }
   if (MyMqttClient.connected()){                                           // Si connecté alors on envoi les données
+    bMqttDataPending = false;
     // ------------------------------------------------------------------- RECUPERATION DES DONNEES
     int myRandomInt = 25+random(-5,5);                                     // Simulation de donnée Int
-    float myRandomFloat = 20+(float)random(-100,100)/10;                   // Simulation de donnée Float
+    Fixed myRandomFloat = FIXED(20) + random(-100,100) * (FIXED_SCALE / 10);   // Simulation de donnée Float, en virgule fixe
     int myRandomBool = rand() % 2;                                         // Simulation de donnée Bool
 
     // ------------------------------------------------------------------- PUBLICATION DES TELEMETRIES
-    DynamicJsonDocument jsonPayload(512);                                  // Préparation de la Payload avec
-    jsonPayload["MyTelemetryInt"] = myRandomInt;                           // Un entier
-    jsonPayload["MyTelemetryFloat"] = myRandomFloat;                       // Un float
-    jsonPayload["MyTelemetryBool"] = myRandomBool;                         // Un booléen
-    jsonPayload["MyTelemetryString"] = "MyString";                         // Un String
-    String strTelemetryPayload;                                            // Préparation de la payload Attributes JSON 
-    serializeJson(jsonPayload, strTelemetryPayload);                       // Sérialisation du JSON
-    MyMqttClient.publish("v1/devices/me/telemetry", strTelemetryPayload.c_str()); // Publication de la payload
-    MYDEBUG_PRINT("-MQTT : Message envoyé [");
-    MYDEBUG_PRINT(strTelemetryPayload);
-    MYDEBUG_PRINTLN("]");
+    MqttTelemetry telemetry = {myRandomInt, myRandomFloat, myRandomBool != 0, "MyString"};
+    publishMqttStream("v1/devices/me/telemetry", mqttTelemetryGenerator, &telemetry);
   }
 }
 
@@ -246,41 +498,42 @@ void getAndSendMqttData(){
  * avec la nouvelle valeur. Message en plus de la réponse à la requête, cf. ci-dessus.
  */
 void onMqttMessage(char* topic, byte* payload, unsigned int length) {
-  StaticJsonDocument<200> jsonDocument;                                 // Préparation du document JSON
-  DeserializationError error = deserializeJson(jsonDocument, payload);  // Désérialisation de la Payload en JSON
-  if (error) {
-    MYDEBUG_PRINT("-MQTT : Parsing JSON IMPOSSIBLE");
-    MYDEBUG_PRINTLN(error.c_str());
+  MqttRpcRequest request;
+  uint32_t ulDecodeMicros = micros();
+  if (!readRpcRequest(payload, length, request)) {                      // Décodage JSON ou Protobuf
+    MYDEBUG_PRINTLN("-MQTT : Payload invalide");
     return;
   }
-#ifdef MYDEBUG
-  String strMessage;
-  serializeJson(jsonDocument, strMessage);
-#endif
+  ulDecodeMicros = micros() - ulDecodeMicros;
   MYDEBUG_PRINT("-MQTT : Message reçu / ");
   MYDEBUG_PRINT("Topic : ");
   MYDEBUG_PRINT(topic);
-  MYDEBUG_PRINT(" / Message : ");
-  MYDEBUG_PRINTLN(strMessage);
+  MYDEBUG_PRINT(" / ");
+  MYDEBUG_PRINT(length);
+  MYDEBUG_PRINT(" octets décodés en ");
+  MYDEBUG_PRINT(ulDecodeMicros);
+  MYDEBUG_PRINTLN(" µs");
 
-  String strMethod = jsonDocument["method"]; // Récupération du nom de la méthode
   MYDEBUG_PRINT("-MQTT : Méthode appelée : ");
-  MYDEBUG_PRINTLN(strMethod);
-  if(strMethod == "getActuatorState"){ // -------------------------------------- getActuatorState
-      String responseTopic = String(topic);                                      // Préparation de la réponse
-      responseTopic.replace("request", "response");                              // Remplacement de la request en response
-      MyMqttClient.publish(responseTopic.c_str(), getActuatorStatus().c_str());  // Envoi de la réponse à la requête
-  } else if (strMethod == "setActuatorState"){ // -------------------------------setActuatorState
-      String strValue = jsonDocument["params"];                                  // Récupération de la valeur demandée
-      String responseTopic = String(topic);                                      // Préparation de la réponse
-      responseTopic.replace("request", "response");                              // Remplacement de la request en response
+  MYDEBUG_PRINTLN(request.cMethod);
+  String responseTopic = String(topic);                                          // Préparation de la réponse
+  responseTopic.replace("request", "response");                                  // Remplacement de la request en response
+  if(!strcmp(request.cMethod, "getActuatorState")){ // ------------------------- getActuatorState
+      publishMqttStream(responseTopic.c_str(), mqttRpcResponseGenerator, NULL);  // Envoi de la réponse à la requête
+  } else if (!strcmp(request.cMethod, "setActuatorState")){ // ------------------setActuatorState
       MYDEBUG_PRINT("-MQTT : paramètre : ");
-      MYDEBUG_PRINTLN(strValue);                                                 
-      if (strValue.equals("true")){ digitalWrite(iMqttActuatorPin, HIGH); }
+      MYDEBUG_PRINTLN(request.cParams);
+      if (!strcmp(request.cParams, "true")){ digitalWrite(iMqttActuatorPin, HIGH); }
       else{ digitalWrite( iMqttActuatorPin, LOW); }
-      MyMqttClient.publish(responseTopic.c_str(), getActuatorStatus().c_str());  // Envoi de la réponse à la requête
-      MyMqttClient.publish("v1/devices/me/attributes", getActuatorStatus().c_str()); // Mise à jour de l'attributs de l'actuateur
+      publishMqttStream(responseTopic.c_str(), mqttRpcResponseGenerator, NULL);  // Envoi de la réponse à la requête
+      publishMqttStream("v1/devices/me/attributes", mqttActuatorGenerator, NULL); // Mise à jour de l'attributs de l'actuateur
   } else {
+    for (uint8_t i = 0; i < ucMqttNbRpc; i++) {                                  // Méthodes des autres modules
+      if (!strcmp(request.cMethod, mqttRpcMethods[i].strMethod)) {
+        mqttRpcMethods[i].handler(request, responseTopic.c_str());
+        return;
+      }
+    }
     MYDEBUG_PRINT("-MQTT : Méthode inconnue");
   }
 }
@@ -290,6 +543,7 @@ void onMqttMessage(char* topic, byte* payload, unsigned int length) {
  * - Serveur et port du broker MQTT
  * - La fonction callback appelée lors de la réception de messages
  * - Un ticker pour l'emission régulière de données vers le broker
+ * - Un aperçu de la taille et du coût des encodages JSON et Protobuf (en debug)
  * - L'initialisation d'un actuateur
  */
 void setupMQTT(){
@@ -298,12 +552,18 @@ void setupMQTT(){
   MYDEBUG_PRINT(" / Port : ");
   MYDEBUG_PRINTLN(MQTT_PORT);
 
+#if MQTT_TLS
+  setupTLS(MqttTls, MyWiFiClient);                     // Session, buffers et empreinte TLS
+#endif
   MyMqttClient.setServer(MQTT_SERVER, MQTT_PORT);      // Configuration de la connexion au serveur MQTT
   MyMqttClient.setCallback(onMqttMessage);             // La fonction de callback qui est executée à chaque réception de message
-  MyMqttTicker.attach(MQTT_FREQ, getAndSendMqttData);  // Envoi régulier des données à l'aide d'un Ticker
+  MyMqttTicker.attach(MQTT_FREQ, getAndSendMqttData);  // Envoi régulier des données, signalé par un Ticker
 
   pinMode(iMqttActuatorPin, OUTPUT);                       // Configuration de l'actuateur
   digitalWrite(iMqttActuatorPin, LOW);                     // Initialisation de l'actuateur à LOW
+#ifdef MYDEBUG
+  benchmarkCodecs();                                       // Taille et coût de chaque encodage
+#endif
 }
 
 /**
@@ -313,4 +573,20 @@ void loopMQTT(){
   // Vérification de l'état de la connexion au serveur MQTT
   if ( !MyMqttClient.connected() ) { reconnectMQTT(); }
   MyMqttClient.loop();
+  sendMqttData();                                       // Télémétrie signalée par le Ticker
+  if (MyMqttClient.connected()) { keepAliveMQTT(); }
+  // Bilan énergétique dans les attributs, pour comparer les versions du firmware (cf. \ref energy)
+  if (MyMqttClient.connected() && millis() - ulMqttLastEnergy >= MQTT_ENERGY_PERIOD) {
+    ulMqttLastEnergy = millis();
+    EnergySummary energy;
+    getEnergySummary(energy);
+    publishMqttStream("v1/devices/me/attributes", mqttEnergyGenerator, &energy);
+  }
+  // Un seul message par balayage des sondes d'humidité du sol, quel que soit leur nombre
+  if (soilSensor.bScanReady && MyMqttClient.connected()) {
+    uint8_t aucPercent[SOIL_NB_PROBES];
+    memcpy(aucPercent, soilSensor.aucPercent, sizeof(aucPercent));
+    soilSensor.bScanReady = false;
+    publishMqttStream("v1/devices/me/telemetry", mqttSoilScanGenerator, aucPercent);
+  }
 }
@@ -2,31 +2,273 @@
  * \file MyNTP.h
  * \page ntp Network Time Protocol (NTP)
  * \brief Quelle heure est il ?
- * 
+ *
  * Les cartes Arduino, ESP8266 et ESP32 ne disposent pas d’horloge temps réel. Nous allons donc récupérer
  * l'heure auprès d'un serveur de temps NTP : Network Time Protocol.
- * Nous pourrons ainsi horodater (timestamp) des mesures, connaître le temps écoulé entre deux événements, 
+ * Nous pourrons ainsi horodater (timestamp) des mesures, connaître le temps écoulé entre deux événements,
  * afficher l’heure courante sur une interface WEB, déclencher une action programmée ...
- * 
+ *
+ * La bibliothèque NTPClient attend la réponse du serveur dans update() : la boucle est bloquée
+ * pendant tout l'aller-retour réseau, voire une seconde entière si le paquet est perdu. Ce module est
+ * le service d'heure unique de l'objet, en SNTP directement sur UDP et sans attente :
+ * - getNTP() envoie la requête, puis vérifie à chaque appel si la réponse est arrivée. L'heure du
+ *   serveur est corrigée de la moitié du temps d'aller-retour.
+ * - L'heure est suivie par rapport à micros() : une référence (heure Unix en µs, valeur de micros())
+ *   est fixée à chaque synchronisation, et recalée avant le débordement de micros() (71 minutes).
+ * - La dérive du quartz (quelques dizaines de ppm, soit quelques secondes par jour) est estimée entre
+ *   deux synchronisations espacées d'au moins 10 minutes, et corrigée en continu.
+ * - L'heure et la dérive sont sauvegardées en mémoire RTC (cf. \ref rtcmemory) : après un reset ou un
+ *   réveil de Deep Sleep (saveTimeBeforeSleep()), l'heure est connue dès le démarrage, de façon
+ *   approchée jusqu'à la synchronisation suivante.
+ * - timeNow() renvoie l'heure Unix (UTC) en secondes, timeNowMs() en millisecondes : un simple calcul,
+ *   utilisable pour horodater chaque mesure. 0 tant que l'heure n'est pas connue.
+ *
+ * \note L'adresse du serveur n'est résolue (DNS, bloquant) qu'au premier envoi, puis après
+ * NTP_MAX_FAILURES échecs consécutifs pour changer de serveur du pool.
+ *
  * Fichier \ref MyNTP.h
  */
 
-#include <NTPClient.h>           //https://github.com/arduino-libraries/NTPClient
 #include <WiFiUdp.h>
 
-WiFiUDP ntpUDP;
-NTPClient timeClient(ntpUDP, "europe.pool.ntp.org", 3600, 60000);
+#define NTP_SERVER          "europe.pool.ntp.org"
+#define NTP_PORT            123
+#define NTP_LOCAL_PORT      2390
+#define NTP_TIMEZONE        3600            // Décalage de l'heure locale en secondes (affichage uniquement)
+#define NTP_SYNC_PERIOD     3600000         // Délai entre 2 synchronisations réussies (ms)
+#define NTP_RETRY           15000           // Délai avant une nouvelle tentative après un échec (ms)
+#define NTP_TIMEOUT         2000            // Délai max d'attente de la réponse (ms)
+#define NTP_MAX_FAILURES    3               // Echecs consécutifs avant une nouvelle résolution DNS
+#define NTP_SAVE_PERIOD     1000            // Délai entre 2 sauvegardes de l'heure en mémoire RTC (ms)
+#define NTP_REBASE_US       1800000000UL    // Recalage de la référence avant le débordement de micros()
+#define NTP_DRIFT_MIN_US    600000000ULL    // Intervalle min entre 2 synchronisations pour estimer la dérive
+#define NTP_DRIFT_MAX_PPB   500000          // Dérive max crédible (500 ppm)
+#define NTP_PACKET_SIZE     48
+#define NTP_UNIX_OFFSET     2208988800UL    // Secondes entre 1900 (NTP) et 1970 (Unix)
 
+/** Heure sauvegardée en mémoire RTC */
+struct NtpRTCTime {
+  uint32_t ulSeconds;                       /*!< Heure Unix à la sauvegarde */
+  uint32_t ulMicros;                        /*!< Fraction de seconde en µs */
+  int32_t  lDriftPpb;                       /*!< Dérive estimée en milliardièmes */
+  uint32_t ulSleepUs;                       /*!< Durée de Deep Sleep prévue après la sauvegarde */
+};
+static_assert(sizeof(NtpRTCTime) + 4 <= RTC_TIME_SIZE, "Heure trop grande pour la mémoire RTC");
+
+WiFiUDP   ntpUDP;
+IPAddress ntpServerIP;
+uint64_t  ullNtpBaseUs = 0;               // Heure Unix (µs) à la référence, 0 si l'heure est inconnue
+uint32_t  ulNtpBaseMicros = 0;            // Valeur de micros() à la référence
+int32_t   lNtpDriftPpb = 0;               // Dérive du quartz (milliardièmes), > 0 si micros() retarde
+uint64_t  ullNtpLastSyncUs = 0;           // Heure de la dernière synchronisation
+bool      bNtpApproximate = false;        // Heure restaurée de la mémoire RTC, pas encore synchronisée
+bool      bNtpWaiting = false;            // Requête envoyée, réponse attendue
+uint32_t  ulNtpRequestMicros;             // micros() à l'envoi de la requête
+uint32_t  ulNtpRequestAt;                 // millis() à l'envoi de la requête
+uint32_t  ulNtpNextSync = 0;              // millis() de la prochaine synchronisation
+uint32_t  ulNtpLastSave = 0;              // millis() de la dernière sauvegarde en mémoire RTC
+uint8_t   ucNtpFailures = 0;              // Echecs consécutifs
+// Statistiques
+uint32_t  ulNtpSyncs = 0;
+uint32_t  ulNtpTimeouts = 0;
+int32_t   lNtpLastOffsetUs = 0;           // Ecart corrigé lors de la dernière synchronisation
+uint32_t  ulNtpLastRttUs = 0;             // Dernier temps d'aller-retour
+
+// ------------------------------------------------------------------------------------------------
+// HEURE COURANTE
+// ------------------------------------------------------------------------------------------------
+/**
+ * Heure Unix en µs correspondant à une valeur de micros(), dérive corrigée
+ */
+uint64_t ntpTimeAt(uint32_t ulMicros){
+  uint32_t ulElapsed = ulMicros - ulNtpBaseMicros;
+  return ullNtpBaseUs + ulElapsed + (int64_t)ulElapsed * lNtpDriftPpb / 1000000000LL;
+}
+
+/**
+ * Heure Unix courante en µs, 0 si inconnue
+ */
+uint64_t timeNowUs(){
+  if (ullNtpBaseUs == 0) { return 0; }
+  uint32_t ulMicros = micros();
+  if (ulMicros - ulNtpBaseMicros >= NTP_REBASE_US) {          // Recalage avant le débordement de micros()
+    ullNtpBaseUs = ntpTimeAt(ulMicros);
+    ulNtpBaseMicros = ulMicros;
+  }
+  return ntpTimeAt(ulMicros);
+}
+
+uint64_t timeNowMs(){ return timeNowUs() / 1000; }
+uint32_t timeNow(){ return timeNowUs() / 1000000; }
+bool     isTimeSet(){ return ullNtpBaseUs != 0; }
+
+/**
+ * Heure locale au format HH:MM:SS
+ */
+void formatTime(char *cBuffer, size_t uiSize){
+  uint32_t ulTime = timeNow() + NTP_TIMEZONE;
+  snprintf(cBuffer, uiSize, "%02lu:%02lu:%02lu", (unsigned long)(ulTime / 3600 % 24),
+           (unsigned long)(ulTime / 60 % 60), (unsigned long)(ulTime % 60));
+}
+
+// ------------------------------------------------------------------------------------------------
+// MEMOIRE RTC
+// ------------------------------------------------------------------------------------------------
+/**
+ * Sauvegarde de l'heure en mémoire RTC. ulSleepUs : durée du Deep Sleep qui va suivre, 0 sinon.
+ */
+void saveTimeBeforeSleep(uint32_t ulSleepUs){
+  if (!isTimeSet()) { return; }
+  uint64_t ullNow = timeNowUs();
+  NtpRTCTime rtcTime = {(uint32_t)(ullNow / 1000000), (uint32_t)(ullNow % 1000000), lNtpDriftPpb, ulSleepUs};
+  writeRTCMemory(RTC_TIME_OFFSET, rtcTime);
+}
+
+/**
+ * Restauration de l'heure après un reset ou un Deep Sleep : micros() est reparti de 0 au démarrage
+ */
+void ntpRestoreTime(){
+  NtpRTCTime rtcTime;
+  if (!readRTCMemory(RTC_TIME_OFFSET, rtcTime) || rtcTime.ulSeconds == 0) { return; }
+  ullNtpBaseUs = (uint64_t)rtcTime.ulSeconds * 1000000 + rtcTime.ulMicros + rtcTime.ulSleepUs;
+  ulNtpBaseMicros = 0;
+  lNtpDriftPpb = rtcTime.lDriftPpb;
+  bNtpApproximate = true;
+  MYDEBUG_PRINT("-NTP : Heure restaurée de la mémoire RTC, dérive ");
+  MYDEBUG_PRINT(lNtpDriftPpb / 1000);
+  MYDEBUG_PRINTLN(" ppm");
+}
+
+// ------------------------------------------------------------------------------------------------
+// SNTP
+// ------------------------------------------------------------------------------------------------
+uint32_t ntpRead32(const uint8_t *aucBuffer){
+  return ((uint32_t)aucBuffer[0] << 24) | ((uint32_t)aucBuffer[1] << 16) | ((uint32_t)aucBuffer[2] << 8) | aucBuffer[3];
+}
+
+/**
+ * Conversion d'un timestamp NTP (secondes depuis 1900, fraction sur 32 bits) en heure Unix en µs
+ */
+uint64_t ntpToUnixUs(const uint8_t *aucBuffer){
+  uint32_t ulFraction = ntpRead32(aucBuffer + 4);
+  return (uint64_t)(ntpRead32(aucBuffer) - NTP_UNIX_OFFSET) * 1000000 + (((uint64_t)ulFraction * 1000000) >> 32);
+}
+
+/**
+ * Envoi d'une requête SNTP (client, version 4). Le champ transmit contient micros() à l'envoi :
+ * le serveur le renvoie dans le champ originate, ce qui permet d'écarter les réponses périmées.
+ */
+bool ntpSendRequest(){
+  if ((!ntpServerIP.isSet() || ucNtpFailures >= NTP_MAX_FAILURES) && !WiFi.hostByName(NTP_SERVER, ntpServerIP)) {
+    return false;
+  }
+  if (ucNtpFailures >= NTP_MAX_FAILURES) { ucNtpFailures = 0; }
+  uint8_t aucPacket[NTP_PACKET_SIZE];
+  memset(aucPacket, 0, sizeof(aucPacket));
+  aucPacket[0] = (4 << 3) | 3;                                // LI 0, version 4, mode 3 (client)
+  while (ntpUDP.parsePacket() > 0) {}                         // Réponses en retard d'une requête précédente
+  ulNtpRequestMicros = micros();
+  for (uint8_t i = 0; i < 4; i++) { aucPacket[44 + i] = ulNtpRequestMicros >> (24 - 8 * i); }
+  if (!ntpUDP.beginPacket(ntpServerIP, NTP_PORT)) { return false; }
+  ntpUDP.write(aucPacket, sizeof(aucPacket));
+  if (!ntpUDP.endPacket()) { return false; }
+  ulNtpRequestAt = millis();
+  bNtpWaiting = true;
+  return true;
+}
+
+/**
+ * Traitement de la réponse : mise à jour de la référence, et de la dérive si la dernière
+ * synchronisation est assez ancienne. Renvoie false si la réponse est invalide.
+ */
+bool ntpReadResponse(uint32_t ulMicros){
+  uint8_t aucPacket[NTP_PACKET_SIZE];
+  if (ntpUDP.read(aucPacket, sizeof(aucPacket)) != NTP_PACKET_SIZE) { return false; }
+  if ((aucPacket[0] & 0x07) != 4 || (aucPacket[0] >> 6) == 3) { return false; }      // Mode serveur, horloge synchronisée
+  if (aucPacket[1] == 0 || aucPacket[1] > 15) { return false; }                       // Stratum (0 : Kiss-o'-Death)
+  if (ntpRead32(aucPacket + 28) != ulNtpRequestMicros) { return false; }              // Réponse à notre requête
+
+  uint64_t ullReceive = ntpToUnixUs(aucPacket + 32);
+  uint64_t ullTransmit = ntpToUnixUs(aucPacket + 40);
+  int64_t llRtt = (int64_t)(uint32_t)(ulMicros - ulNtpRequestMicros) - (int64_t)(ullTransmit - ullReceive);
+  if (llRtt < 0) { llRtt = 0; }
+  uint64_t ullServerNow = ullTransmit + llRtt / 2;            // Heure du serveur à la réception
+
+  if (isTimeSet()) {
+    int64_t llOffset = (int64_t)(ullServerNow - ntpTimeAt(ulMicros));
+    lNtpLastOffsetUs = constrain(llOffset, (int64_t)INT32_MIN, (int64_t)INT32_MAX);
+    uint64_t ullInterval = ullServerNow - ullNtpLastSyncUs;
+    if (!bNtpApproximate && ullNtpLastSyncUs != 0 && ullInterval >= NTP_DRIFT_MIN_US) {
+      int64_t llDrift = lNtpDriftPpb + llOffset * 1000000000LL / (int64_t)ullInterval;
+      lNtpDriftPpb = constrain(llDrift, (int64_t)-NTP_DRIFT_MAX_PPB, (int64_t)NTP_DRIFT_MAX_PPB);
+    }
+  }
+  ullNtpBaseUs = ullServerNow;
+  ulNtpBaseMicros = ulMicros;
+  ullNtpLastSyncUs = ullServerNow;
+  bNtpApproximate = false;
+  ulNtpLastRttUs = llRtt;
+  ulNtpSyncs++;
+  return true;
+}
+
+/**
+ * Service d'heure, sans attente : à appeler à chaque itération de la boucle
+ * - Envoi d'une requête quand une synchronisation est due
+ * - Traitement de la réponse si elle est arrivée, échec si elle n'arrive pas à temps
+ * - Sauvegarde régulière de l'heure en mémoire RTC, pour la retrouver après un reset
+ */
 void getNTP(){
-  MYDEBUG_PRINT("-NTP : ");
-  timeClient.update();
-  MYDEBUG_PRINTLN(timeClient.getFormattedTime());
+  uint8_t ucWatchdog = watchdogEnter(WDT_NTP);
+  uint32_t ulNow = millis();
+  if (bNtpWaiting) {
+    int iSize;
+    while ((iSize = ntpUDP.parsePacket()) > 0) {
+      uint32_t ulMicros = micros();                           // Au plus près de la réception
+      if (iSize >= NTP_PACKET_SIZE && ntpReadResponse(ulMicros)) {
+        bNtpWaiting = false;
+        ucNtpFailures = 0;
+        ulNtpNextSync = ulNow + NTP_SYNC_PERIOD;
+        char cTime[9];
+        formatTime(cTime, sizeof(cTime));
+        MYDEBUG_PRINT("-NTP : ");
+        MYDEBUG_PRINT(cTime);
+        MYDEBUG_PRINT(" [écart : ");
+        MYDEBUG_PRINT(lNtpLastOffsetUs);
+        MYDEBUG_PRINT(" µs / aller-retour : ");
+        MYDEBUG_PRINT(ulNtpLastRttUs);
+        MYDEBUG_PRINT(" µs / dérive : ");
+        MYDEBUG_PRINT(lNtpDriftPpb);
+        MYDEBUG_PRINTLN(" ppb]");
+        break;
+      }
+    }
+    if (bNtpWaiting && ulNow - ulNtpRequestAt >= NTP_TIMEOUT) {
+      MYDEBUG_PRINTLN("-NTP : Pas de réponse du serveur");
+      bNtpWaiting = false;
+      ucNtpFailures++;
+      ulNtpTimeouts++;
+      ulNtpNextSync = ulNow + NTP_RETRY;
+    }
+  } else if ((int32_t)(ulNow - ulNtpNextSync) >= 0 && WiFi.status() == WL_CONNECTED) {
+    if (!ntpSendRequest()) {
+      ucNtpFailures++;
+      ulNtpNextSync = ulNow + NTP_RETRY;
+    }
+  }
+  if (isTimeSet() && ulNow - ulNtpLastSave >= NTP_SAVE_PERIOD) {
+    ulNtpLastSave = ulNow;
+    saveTimeBeforeSleep(0);
+  }
+  watchdogLeave(ucWatchdog);
 }
 
 void setupNTP(){
   // On a besoin d'une connexion à Internet !
   if (WiFi.status() != WL_CONNECTED){
     setupWiFi();
-  }  
-  timeClient.begin();
+  }
+  ntpRestoreTime();
+  ntpUDP.begin(NTP_LOCAL_PORT);
+  ulNtpNextSync = millis();                                   // Première synchronisation au plus tôt
 }
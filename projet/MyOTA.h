@@ -66,13 +66,11 @@
 
 #include <ArduinoOTA.h>
 #include <RemoteDebug.h>
-#include <ESP8266WebServer.h>
 
 #define OTA_HOSTNAME  "My NodeMCU"
 #define OTA_PASSWORD  "MyPassword"
 
 RemoteDebug Debug;
-ESP8266WebServer HTTPServer(80);
 Ticker debugTicker;
 
 /**
@@ -86,36 +84,26 @@ void generateDebugLog(){
   rdebugEln("-Remote DEBUG : Message ERROR");
 }
 
-void handleRoot() {
-  // Page web Root
-  String strRootWebPage;
-  strRootWebPage += ("<head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">");
-  strRootWebPage += ("<link rel=\"icon\" href=\"data:,\">");
-  strRootWebPage += ("<style>html { font-family: Helvetica; display: inline-block; margin: 0px auto; text-align: center;}");
-  strRootWebPage += (".button { background-color: #195B6A; border: none; color: white; padding: 16px 40px;");
-  strRootWebPage += ("text-decoration: none; font-size: 30px; margin: 2px; cursor: pointer;}");
-  strRootWebPage += (".button2 {background-color: #77878A;}</style></head>");
-  strRootWebPage += ("<body><h1>OTA & Remote Debug</h1>");
-  strRootWebPage += ("<p><a href=\"http://joaolopesf.net/remotedebugapp/\">Remote Debug Web App</a></p>");
-  HTTPServer.send(200, "text/html", strRootWebPage);
+// Page d'accueil en flash (cf. \ref template)
+static const char OTA_ROOT_PAGE[] PROGMEM = R"(<head><meta name="viewport" content="width=device-width, initial-scale=1">
+<link rel="icon" href="data:,">
+<style>html { font-family: Helvetica; display: inline-block; margin: 0px auto; text-align: center;}
+.button { background-color: #195B6A; border: none; color: white; padding: 16px 40px;
+text-decoration: none; font-size: 30px; margin: 2px; cursor: pointer;}
+.button2 {background-color: #77878A;}</style></head>
+<body><h1>OTA & Remote Debug</h1>
+<p>{{hostname}} - firmware {{version}}</p>
+<p><a href="http://joaolopesf.net/remotedebugapp/">Remote Debug Web App</a></p>
+)";
 
-//  HTTPServer.send(200, "text/plain", "hello from esp - RemoteDebug Sample!");
+void otaResolver(const char *strName, Print &output){
+  if (!strcmp(strName, "hostname"))     { output.print(OTA_HOSTNAME); }
+  else if (!strcmp(strName, "version")) { output.print(FIRMWAREVERSION); }
 }
 
-void handleNotFound(){
-   // Page not Found
-   String message = "File Not Found\n\n";
-   message.concat("URI: ");
-   message.concat(HTTPServer.uri());
-   message.concat("\nMethod: ");
-   message.concat((HTTPServer.method() == HTTP_GET)?"GET":"POST");
-   message.concat("\nArguments: ");
-   message.concat(HTTPServer.args());
-   message.concat("\n");
-   for (uint8_t i=0; i<HTTPServer.args(); i++){
-       message.concat(" " + HTTPServer.argName(i) + ": " + HTTPServer.arg(i) + "\n");
-   }
-   HTTPServer.send(404, "text/plain", message);
+void handleRoot() {
+  // Page web Root
+  sendTemplate(200, "text/html", OTA_ROOT_PAGE, otaResolver);
 }
 
 /**
@@ -138,9 +126,7 @@ void setupOTA(){
   Debug.showColors(true);               // Un peu de couleurs pour faire joli
   //Debug.setSerialEnabled(true);       // Pour activer un écho des logs sur le port série (si branché)
 
-  HTTPServer.on("/", handleRoot);
-  HTTPServer.onNotFound(handleNotFound);
-  HTTPServer.begin();
+  registerHttpRoute("/ota", HTTP_GET, handleRoot);    // Page d'accueil sur le serveur HTTP partagé
 
   // Ticker pour générer des logs
   debugTicker.attach(2, generateDebugLog);
@@ -153,5 +139,4 @@ void setupOTA(){
 void loopOTA(){
   ArduinoOTA.handle();          // Gestion des demandes de téléversement
   Debug.handle();               // Gestion des messages de remote debug
-  HTTPServer.handleClient();    // Gestion du serveur web
 }
@@ -0,0 +1,323 @@
+/**
+ * \file MyPower.h
+ * \page power Gestion de l'énergie
+ * \brief Veille légère ou modem entre les mesures, sans perdre les connexions MQTT
+ *
+ * Le Deep Sleep (cf. \ref deepsleep) coupe tout, connexions comprises : il ne convient pas à un objet
+ * qui doit rester joignable (serveur HTTP, commandes RPC, dashboard). Sans lui, la radio et le CPU
+ * restent allumés en permanence, même pendant le delay() de la boucle.
+ *
+ * Ce module remplace ce delay() par idlePower(), qui attend jusqu'à la prochaine échéance : la
+ * prochaine mesure (planPowerWake()), ou plus tôt si un module l'a demandé (registerPowerWake(),
+ * balayage des sondes en cours par exemple), et au plus POWER_MAX_SLEEP. Pendant cette attente :
+ * - POWER_MODEM : le modem ne se réveille que pour les balises DTIM du point d'accès (tous les
+ *   POWER_LISTEN_INTERVAL intervalles DTIM), le CPU reste actif ;
+ * - POWER_LIGHT : le CPU est aussi suspendu entre les balises (light sleep automatique), la connexion
+ *   au point d'accès est conservée ;
+ * - WiFi arrêté (WIFI_OFF) : light sleep forcé, sans radio, jusqu'à l'échéance.
+ *
+ * La boucle reprend à l'échéance (timer), sur le GPIO POWER_WAKE_PIN (bouton FLASH) ou à l'arrivée
+ * d'une requête HTTP complète (cf. \ref asynchttp). Les paquets MQTT reçus réveillent la radio et sont
+ * mis en attente par lwIP : ils sont traités à l'itération suivante, au plus POWER_MAX_SLEEP plus tard.
+ *
+ * Chaque PINGREQ réveille la radio pour émettre. Les keep-alive MQTT (\ref adafruitqos, \ref mqtt) sont
+ * donc alignés sur les réveils prévus : powerPingDue() avance le PINGREQ à la mesure qui précède
+ * l'échéance du keep-alive, quand la radio émet de toute façon pour publier. Si les mesures sont trop
+ * espacées pour cela, le PINGREQ part à l'échéance.
+ *
+ * Chaque attente est comptée dans le bilan énergétique (cf. \ref energy), dans l'état de veille
+ * utilisé. Le courant moyen et la charge estimés, les veilles et les réveils sont consultables via
+ * GET /api/power (cf. \ref httpserver). Le module sert aussi le bilan détaillé (GET /metrics) et le
+ * réglage du courant de chaque état (POST /api/energy).
+ *
+ * \note Pendant le light sleep forcé, micros() n'avance pas : la durée comptée est celle demandée.
+ *
+ * \note Une passerelle ESP-NOW (cf. \ref espnow) doit écouter en permanence : les trames des feuilles
+ * arrivent sans prévenir et seraient perdues pendant une veille. Elle appelle disablePowerSleep(), qui
+ * garde la radio allumée quel que soit POWER_MODE.
+ *
+ * Documentation officielle : https://www.espressif.com/sites/default/files/9b-esp8266-low_power_solutions_en_0.pdf
+ *
+ * Fichier \ref MyPower.h
+ */
+
+extern "C" {
+#include <user_interface.h>                 // wifi_fpm_*(), gpio_pin_wakeup_enable()
+}
+
+#define POWER_NONE            0             // delay() simple, radio toujours allumée
+#define POWER_MODEM           1             // Veille modem DTIM
+#define POWER_LIGHT           2             // Light sleep automatique entre les balises DTIM
+#define POWER_MODE            POWER_LIGHT
+#define POWER_LISTEN_INTERVAL 3             // Balises DTIM écoutées : 1 sur 3
+#define POWER_MIN_SLEEP       10            // En dessous, simple delay() (ms)
+#define POWER_MAX_SLEEP       250           // Attente max : les autres modules tournent au moins 4 fois par seconde (ms)
+#define POWER_WAKE_GPIO       1             // 1 : réveil par GPIO, 0 : aucun
+#define POWER_WAKE_PIN        D3            // GPIO de réveil (bouton FLASH, actif à l'état bas)
+#define POWER_MAX_WAKES       4             // Nombre max d'échéances enregistrées par les autres modules
+
+/** Temps avant lequel un module a besoin de la boucle (ms), UINT32_MAX s'il n'attend rien */
+typedef uint32_t (*PowerWakeFn)();
+
+PowerWakeFn       powerWakes[POWER_MAX_WAKES];
+uint8_t           ucPowerNbWakes = 0;
+uint8_t           ucPowerMode = POWER_MODE;     // POWER_NONE si un module a besoin de la radio en permanence
+uint32_t          ulPowerWakeAt = 0;            // Prochain réveil prévu (millis)
+uint32_t          ulPowerSleeps = 0;
+uint32_t          ulPowerGpioWakes = 0;
+uint32_t          ulPowerPingsAligned = 0;      // PINGREQ avancés sur un réveil prévu
+uint32_t          ulPowerPingsDeadline = 0;     // PINGREQ envoyés à l'échéance
+volatile bool     bPowerGpioWake = false;
+
+// ------------------------------------------------------------------------------------------------
+// ECHEANCES
+// ------------------------------------------------------------------------------------------------
+/**
+ * Enregistrement d'une échéance d'un autre module. Renvoie false si la table est pleine.
+ */
+bool registerPowerWake(PowerWakeFn fn){
+  if (ucPowerNbWakes >= POWER_MAX_WAKES) { return false; }
+  powerWakes[ucPowerNbWakes++] = fn;
+  return true;
+}
+
+/** Date (millis) du prochain réveil prévu : la prochaine mesure */
+void planPowerWake(uint32_t ulWakeAt){
+  ulPowerWakeAt = ulWakeAt;
+}
+
+/** Temps restant avant le prochain réveil prévu (ms) */
+uint32_t getPowerNextWake(){
+  int32_t lRemaining = (int32_t)(ulPowerWakeAt - millis());
+  return lRemaining > 0 ? lRemaining : 0;
+}
+
+/**
+ * Keep-alive : renvoie true si le PINGREQ doit partir maintenant, c'est-à-dire si l'échéance
+ * (ulDeadline ms après le dernier paquet, il y a ulElapsed ms) tombe avant le prochain réveil prévu,
+ * ou est atteinte. L'alignement n'est fait que si les réveils sont espacés de moins de la moitié
+ * de l'échéance : au plus un PINGREQ avancé par demi-échéance.
+ */
+bool powerPingDue(uint32_t ulElapsed, uint32_t ulDeadline){
+  if (ulElapsed >= ulDeadline) {
+    ulPowerPingsDeadline++;
+    return true;
+  }
+  uint32_t ulNextWake = getPowerNextWake();
+  if (ulNextWake < ulDeadline / 2 && ulElapsed + ulNextWake >= ulDeadline) {
+    ulPowerPingsAligned++;
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------------------------------------------------------------------
+// VEILLE
+// ------------------------------------------------------------------------------------------------
+void ICACHE_RAM_ATTR onPowerGpio(){
+  bPowerGpioWake = true;
+  esp_schedule();                                            // Fin du delay() en cours
+}
+
+void onPowerForcedWake(){
+  esp_schedule();
+}
+
+/** Light sleep forcé, radio arrêtée, réveil par le timer ou le GPIO */
+void powerForcedSleep(uint32_t ulMs){
+  wifi_fpm_set_sleep_type(LIGHT_SLEEP_T);
+  wifi_fpm_open();
+  wifi_fpm_set_wakeup_cb(onPowerForcedWake);
+  wifi_fpm_do_sleep(ulMs * 1000);
+  delay(ulMs + 1);                                           // Le CPU s'arrête dans le delay()
+  wifi_fpm_close();
+}
+
+/**
+ * Fin de l'itération de la boucle : attente jusqu'à la prochaine échéance, dans l'état le plus
+ * économe compatible avec les connexions en cours
+ */
+void idlePower(){
+  uint32_t ulIdle = min(getPowerNextWake(), (uint32_t)POWER_MAX_SLEEP);
+  for (uint8_t i = 0; i < ucPowerNbWakes; i++) { ulIdle = min(ulIdle, powerWakes[i]()); }
+
+  uint8_t ucState = ENERGY_IDLE;
+  if (ulIdle >= POWER_MIN_SLEEP && ucPowerMode != POWER_NONE) {
+    if (WiFi.getMode() == WIFI_OFF) { ucState = ENERGY_FORCED_SLEEP; }
+    else { ucState = (ucPowerMode == POWER_LIGHT) ? ENERGY_LIGHT_SLEEP : ENERGY_MODEM_SLEEP; }
+    ulPowerSleeps++;
+  }
+  watchdogYield();                                           // L'attente n'est pas un blocage
+  if (ucState == ENERGY_FORCED_SLEEP) {
+    powerForcedSleep(ulIdle);
+    energyAdd(ucState, ulIdle * 1000);                       // micros() n'a pas avancé
+  } else {
+    uint8_t ucEnergy = energyEnter(ucState);
+    delay(ulIdle);                                           // Veille modem ou light sleep configurés au setup
+    energyLeave(ucEnergy);
+  }
+  if (bPowerGpioWake) {
+    bPowerGpioWake = false;
+    ulPowerGpioWakes++;
+    MYDEBUG_PRINTLN("-POWER : Réveil par GPIO");
+  }
+}
+
+// ------------------------------------------------------------------------------------------------
+// API HTTP
+// ------------------------------------------------------------------------------------------------
+/**
+ * GET /api/power : mode, estimations et réveils
+ * {"mode":2,"listenInterval":3,"averageMa":4.21,"chargeMah":1.05,"sleeps":...,"gpioWakes":...,
+ *  "pingsAligned":...,"pingsDeadline":...}
+ */
+void handlePower(){
+  char cBuffer[224];
+  char cAverage[14], cCharge[14];
+  EnergySummary summary;
+  getEnergySummary(summary);
+  formatFixed(cAverage, summary.lAverageMa, 2);
+  formatFixed(cCharge, summary.lChargeMah, 2);
+  snprintf(cBuffer, sizeof(cBuffer),
+           "{\"mode\":%d,\"listenInterval\":%d,\"averageMa\":%s,\"chargeMah\":%s,\"sleeps\":%lu,\"gpioWakes\":%lu,"
+           "\"pingsAligned\":%lu,\"pingsDeadline\":%lu}",
+           ucPowerMode, POWER_LISTEN_INTERVAL, cAverage, cCharge, (unsigned long)ulPowerSleeps,
+           (unsigned long)ulPowerGpioWakes, (unsigned long)ulPowerPingsAligned, (unsigned long)ulPowerPingsDeadline);
+  HTTPServer.send(200, "application/json", cBuffer);
+}
+
+/** Une ligne de /metrics : nom{label="valeur"} mesure */
+void printMetric(Print &output, const char *strName, const char *strLabel, const char *strLabelValue, const char *strValue){
+  char cBuffer[104];
+  snprintf(cBuffer, sizeof(cBuffer), "%s{%s=\"%s\"} %s\n", strName, strLabel, strLabelValue, strValue);
+  output.print(cBuffer);
+}
+
+/** Une ligne de /metrics dont la mesure est en virgule fixe */
+void printMetric(Print &output, const char *strName, const char *strLabel, const char *strLabelValue, Fixed lValue){
+  char cValue[14];
+  formatFixed(cValue, lValue, FIXED_DECIMALS);
+  printMetric(output, strName, strLabel, strLabelValue, cValue);
+}
+
+/**
+ * Une ligne de /metrics pour un total cumulé, en centièmes sur 64 bits : un Fixed déborderait au bout
+ * de 21,4.10^6 unités (21,4 Ah en µAh, 248 jours en secondes)
+ */
+void printMetricTotal(Print &output, const char *strName, const char *strLabel, const char *strLabelValue, uint64_t ullHundredths){
+  char cDigits[20], cValue[24];                              // Chiffres, du dernier au premier
+  uint8_t ucNbDigits = 0, ucLength = 0;
+  do {
+    cDigits[ucNbDigits++] = '0' + ullHundredths % 10;
+    ullHundredths /= 10;
+  } while (ullHundredths > 0 || ucNbDigits <= FIXED_DECIMALS); // Au moins un chiffre avant la virgule
+  while (ucNbDigits > 0) {
+    if (ucNbDigits == FIXED_DECIMALS) { cValue[ucLength++] = '.'; }
+    cValue[ucLength++] = cDigits[--ucNbDigits];
+  }
+  cValue[ucLength] = 0;
+  printMetric(output, strName, strLabel, strLabelValue, cValue);
+}
+
+/**
+ * Générateur de GET /metrics : l'en-tête, puis un état par étape, un module par étape et le bilan
+ */
+bool metricsHttpGenerator(Print &output, uint16_t uiStep, void *pContext){
+  if (uiStep == 0) {
+    energyFlush();                                           // Clôture l'intervalle en cours
+    output.print("# Bilan énergétique estimé\n");
+    return true;
+  }
+  uiStep--;
+  if (uiStep < ENERGY_NB_STATES) {
+    const EnergyAccount &state = energyStates[uiStep];
+    const char *strState = ENERGY_STATE_NAMES[uiStep];
+    printMetric(output, "energy_state_current_ma", "state", strState, alEnergyCurrents[uiStep]);
+    printMetricTotal(output, "energy_state_seconds_total", "state", strState, state.ullUs / 10000);
+    printMetricTotal(output, "energy_state_charge_uah_total", "state", strState, energyToUahTotal(state.ullCharge));
+    printMetric(output, "energy_state_entries_total", "state", strState, fixedFromInt(state.ulCount));
+    return true;
+  }
+  uiStep -= ENERGY_NB_STATES;
+  if (uiStep < WDT_NB_MODULES) {
+    const EnergyAccount &module = energyModules[uiStep];
+    const char *strModule = WATCHDOG_MODULE_NAMES[uiStep];
+    printMetricTotal(output, "energy_module_charge_uah_total", "module", strModule, energyToUahTotal(module.ullCharge));
+    printMetric(output, "energy_module_average_ma", "module", strModule, energyToMa(module.ullCharge, module.ullUs));
+    printMetric(output, "energy_module_messages_total", "module", strModule, fixedFromInt(module.ulCount));
+    if (module.ulCount == 0) { return true; }
+    printMetric(output, "energy_module_message_uah", "module", strModule, energyToUah(module.ullCharge / module.ulCount));
+    printMetric(output, "energy_module_last_message_uah", "module", strModule, energyToUah(aullEnergyLastMessage[uiStep]));
+    return true;
+  }
+  EnergySummary summary;
+  getEnergySummary(summary);
+  char cBuffer[160], cAverage[14], cCharge[14], cMessage[14];
+  formatFixed(cAverage, summary.lAverageMa, FIXED_DECIMALS);
+  formatFixed(cCharge, summary.lChargeMah, FIXED_DECIMALS);
+  formatFixed(cMessage, summary.lMessageUah, FIXED_DECIMALS);
+  snprintf(cBuffer, sizeof(cBuffer),
+           "energy_average_ma %s\nenergy_charge_mah_total %s\nenergy_message_uah %s\nenergy_radio_switches_total %lu\n",
+           cAverage, cCharge, cMessage, (unsigned long)ulEnergyRadioSwitches);
+  output.print(cBuffer);
+  return false;
+}
+
+/**
+ * GET /metrics : bilan énergétique (cf. \ref energy) au format texte de Prometheus, produit par
+ * metricsHttpGenerator() au fil des acquittements
+ */
+void handleMetrics(){
+  sendHttpStream(200, "text/plain; version=0.0.4", metricsHttpGenerator, NULL, 0);
+}
+
+/**
+ * POST /api/energy?state=tlsHandshake&ma=95.5 : courant d'un état, mesuré sur la carte
+ */
+void handleEnergyCurrent(){
+  Fixed lCurrent;
+  if (!parseFixed(HTTPServer.arg("ma").c_str(), lCurrent) || !setEnergyCurrent(HTTPServer.arg("state").c_str(), lCurrent)) {
+    HTTPServer.send(400, "application/json", "{\"ok\":false}");
+    return;
+  }
+  MYDEBUG_PRINT("-POWER : Courant de l'état ");
+  MYDEBUG_PRINT(HTTPServer.arg("state"));
+  MYDEBUG_PRINT(" : ");
+  MYDEBUG_PRINT(fixedToFloat(lCurrent));
+  MYDEBUG_PRINTLN(" mA");
+  HTTPServer.send(200, "application/json", "{\"ok\":true}");
+}
+
+/**
+ * Radio allumée en permanence, quel que soit POWER_MODE : à appeler après setupPower()
+ */
+void disablePowerSleep(){
+  ucPowerMode = POWER_NONE;
+  WiFi.setSleepMode(WIFI_NONE_SLEEP);
+  MYDEBUG_PRINTLN("-POWER : Veille désactivée, radio toujours allumée");
+}
+
+/**
+ * Initialisation : mode de veille du WiFi pendant les delay() et réveil par GPIO
+ */
+void setupPower(){
+#if POWER_MODE == POWER_LIGHT
+  WiFi.setSleepMode(WIFI_LIGHT_SLEEP, POWER_LISTEN_INTERVAL);
+#elif POWER_MODE == POWER_MODEM
+  WiFi.setSleepMode(WIFI_MODEM_SLEEP, POWER_LISTEN_INTERVAL);
+#else
+  WiFi.setSleepMode(WIFI_NONE_SLEEP);
+#endif
+#if POWER_WAKE_GPIO
+  pinMode(POWER_WAKE_PIN, INPUT_PULLUP);
+  gpio_pin_wakeup_enable(GPIO_ID_PIN(POWER_WAKE_PIN), GPIO_PIN_INTR_LOLEVEL);   // Sortie du light sleep
+  attachInterrupt(digitalPinToInterrupt(POWER_WAKE_PIN), onPowerGpio, FALLING);  // Fin du delay()
+#endif
+  MYDEBUG_PRINT("-POWER : Mode ");
+  MYDEBUG_PRINT(POWER_MODE);
+  MYDEBUG_PRINT(", écoute d'une balise DTIM sur ");
+  MYDEBUG_PRINTLN(POWER_LISTEN_INTERVAL);
+  registerHttpRoute("/api/power", HTTP_GET, handlePower);
+  registerHttpRoute("/metrics", HTTP_GET, handleMetrics);
+  registerHttpRoute("/api/energy", HTTP_POST, handleEnergyCurrent);
+}
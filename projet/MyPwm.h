@@ -1,50 +1,197 @@
 /**
  * \file MyPwm.h
- * \page pwm PWM 
+ * \page pwm PWM
  * \brief La modulation de largeur d'impulsions ou Pulse Width Modulation (PWM)
- * 
+ *
  * La modulation de largeur d'impulsions
- * 
+ *
+ * <H2>Animations</H2>
+ * Une rampe écrite avec une boucle de analogWrite() et de delay() bloque tout le reste du programme
+ * le temps de l'animation. Les rampes sont donc confiées à un moteur d'animation cadencé par un
+ * Ticker : fadePwm() démarre une rampe et rend la main immédiatement, le Ticker met à jour toutes
+ * les PWM_TICK_MS ms les rapports cycliques de tous les canaux en cours d'animation (jusqu'à
+ * PWM_MAX_CHANNELS canaux simultanés), puis s'arrête de lui-même quand plus aucune rampe n'est en cours.
+ * Une rampe peut être interrompue à tout moment (stopPwm()) ou remplacée par une autre, qui part du
+ * niveau courant.
+ *
+ * Les niveaux vont de 0 (éteint) à PWMRANGE (luminosité maximale), quelle que soit la polarité de
+ * la broche (la LED de la broche D4 s'allume sur un niveau bas). Trois courbes sont proposées :
+ * - PWM_LINEAR : rapport cyclique proportionnel au temps.
+ * - PWM_GAMMA : luminosité perçue proportionnelle au temps. L'oeil est bien plus sensible aux faibles
+ *   luminosités : le rapport cyclique suit une courbe gamma 2.2 (table de 33 points, interpolée).
+ * - PWM_EASE : comme PWM_GAMMA, avec un départ et une arrivée en douceur (smoothstep).
+ *
  * Fichier \ref MyPwm.h
  */
 
+#include <Ticker.h>
+
 #define LedPin D4            // D4 correspond également à la LED de l'ESP8266 (HIGH & LOW inversés)
+#define PWM_MAX_CHANNELS  4           // Nombre de canaux animés simultanément
+#define PWM_TICK_MS       20          // Période de mise à jour des animations (ms)
+
+// Courbes des rampes
+#define PWM_LINEAR        0
+#define PWM_GAMMA         1
+#define PWM_EASE          2
+
+/** Courbe gamma 2.2 sur 33 points, de 0 à 65535 */
+const uint16_t auiPwmGamma[33] PROGMEM = {
+  0, 32, 147, 359, 676, 1104, 1648, 2314, 3104, 4022, 5072, 6255, 7574, 9033, 10632, 12375, 14263,
+  16298, 18482, 20816, 23303, 25943, 28739, 31692, 34802, 38072, 41503, 45097, 48853, 52774, 56860,
+  61114, 65535};
+
+/** Canal PWM et rampe en cours */
+struct PwmChannel {
+  uint8_t  ucPin;
+  bool     bInverted;                     /*!< Broche active au niveau bas */
+  bool     bActive;                       /*!< Rampe en cours */
+  bool     bYoyo;                         /*!< Rampe répétée en aller-retour jusqu'à stopPwm() */
+  uint8_t  ucCurve;
+  uint16_t uiFrom;
+  uint16_t uiTo;
+  uint16_t uiLevel;                       /*!< Niveau courant, de 0 à PWMRANGE */
+  uint32_t ulStart;
+  uint32_t ulDuration;
+};
+
 int iPWM = 0;                // Variable de stockage de la fréquence PWM
+PwmChannel pwmChannels[PWM_MAX_CHANNELS];
+uint8_t    ucPwmNbChannels = 0;
+Ticker     pwmTicker;
+bool       bPwmTicking = false;
 
-void setupPwm(){
-  pinMode(LedPin, OUTPUT);   // Configuration de la LedPin en sortie
-  digitalWrite(LedPin, LOW); // Initialisation de l'état de la LED
+// ------------------------------------------------------------------------------------------------
+// COURBES
+// ------------------------------------------------------------------------------------------------
+/**
+ * Rapport cyclique correspondant à une luminosité perçue (gamma 2.2), de 0 à PWMRANGE
+ */
+uint16_t pwmGamma(uint16_t uiLevel){
+  uint32_t ulX = (uint32_t)uiLevel * 32 * 256 / PWMRANGE;     // Position dans la table, en 1/256
+  uint8_t ucIndex = ulX >> 8;
+  if (ucIndex >= 32) { return PWMRANGE; }
+  uint32_t ulA = pgm_read_word(&auiPwmGamma[ucIndex]);
+  uint32_t ulB = pgm_read_word(&auiPwmGamma[ucIndex + 1]);
+  uint32_t ulY = ulA + (((ulB - ulA) * (ulX & 0xFF)) >> 8);
+  return (ulY * PWMRANGE + 32767) / 65535;
 }
 
-void playWithPwm(){
-  MYDEBUG_PRINTLN("- PWM : clignote");
-  for (int i=0; i<10; i++){
-    MYDEBUG_PRINT("- PWM : [");
-    MYDEBUG_PRINT(i);
-    MYDEBUG_PRINTLN("]");
-    digitalWrite(LedPin, HIGH);
-    delay(500);
-    digitalWrite(LedPin, LOW);    
-    delay(500);
+/**
+ * Ecriture du niveau d'un canal sur sa broche
+ */
+void pwmWrite(PwmChannel &channel){
+  uint16_t uiDuty = (channel.ucCurve == PWM_LINEAR) ? channel.uiLevel : pwmGamma(channel.uiLevel);
+  analogWrite(channel.ucPin, channel.bInverted ? PWMRANGE - uiDuty : uiDuty);
+}
+
+// ------------------------------------------------------------------------------------------------
+// ANIMATIONS
+// ------------------------------------------------------------------------------------------------
+/**
+ * Mise à jour des canaux en cours d'animation (Ticker). Le Ticker s'arrête quand tout est terminé.
+ */
+void pwmTick(){
+  bool bRunning = false;
+  uint32_t ulNow = millis();
+  for (uint8_t i = 0; i < ucPwmNbChannels; i++) {
+    PwmChannel &channel = pwmChannels[i];
+    if (!channel.bActive) { continue; }
+    uint32_t ulElapsed = ulNow - channel.ulStart;
+    if (ulElapsed >= channel.ulDuration) {                     // Fin de la rampe
+      channel.uiLevel = channel.uiTo;
+      if (channel.bYoyo) {                                     // Rampe suivante en sens inverse
+        channel.uiTo = channel.uiFrom;
+        channel.uiFrom = channel.uiLevel;
+        channel.ulStart = ulNow;
+      } else {
+        channel.bActive = false;
+      }
+    } else {
+      uint32_t ulT = ((uint64_t)ulElapsed << 16) / channel.ulDuration;  // Avancement, de 0 à 65535
+      if (channel.ucCurve == PWM_EASE) {                       // Smoothstep : 3t² - 2t³
+        uint32_t ulT2 = (ulT * ulT) >> 16;
+        uint32_t ulT3 = (ulT2 * ulT) >> 16;
+        ulT = 3 * ulT2 - 2 * ulT3;
+      }
+      int32_t lDelta = (int32_t)channel.uiTo - (int32_t)channel.uiFrom;
+      channel.uiLevel = channel.uiFrom + (int32_t)(((int64_t)lDelta * ulT) >> 16);
+    }
+    pwmWrite(channel);
+    bRunning |= channel.bActive;
   }
+  if (!bRunning) {
+    pwmTicker.detach();
+    bPwmTicking = false;
+  }
+}
+
+/**
+ * Enregistrement d'un canal. Renvoie son numéro, ou -1 si tous les canaux sont utilisés.
+ */
+int8_t attachPwmChannel(uint8_t ucPin, bool bInverted){
+  if (ucPwmNbChannels >= PWM_MAX_CHANNELS) { return -1; }
+  pinMode(ucPin, OUTPUT);
+  pwmChannels[ucPwmNbChannels] = {ucPin, bInverted, false, false, PWM_LINEAR, 0, 0, 0, 0, 0};
+  pwmWrite(pwmChannels[ucPwmNbChannels]);                      // Eteint
+  return ucPwmNbChannels++;
+}
 
-  // On augmente la fréquence PWN de 0 au Maximum
-  // Pour la valeur maximale on utilisera PWMRANGE
-  MYDEBUG_PRINTLN("- PWM : crescendo");
-  for(int i=0; i<PWMRANGE; i++){
-    MYDEBUG_PRINT("- PWM : [");
-    MYDEBUG_PRINT(i);
-    MYDEBUG_PRINTLN("]");
-    analogWrite(LedPin, i);
-    delay(10);
+/**
+ * Démarrage d'une rampe, depuis le niveau courant jusqu'à uiTarget (de 0 à PWMRANGE), sans attente.
+ * Avec une durée nulle, le niveau est appliqué immédiatement.
+ */
+void fadePwm(int8_t cChannel, uint16_t uiTarget, uint32_t ulDurationMs, uint8_t ucCurve = PWM_GAMMA, bool bYoyo = false){
+  if (cChannel < 0 || cChannel >= ucPwmNbChannels) { return; }
+  PwmChannel &channel = pwmChannels[cChannel];
+  channel.uiFrom = channel.uiLevel;
+  channel.uiTo = min(uiTarget, (uint16_t)PWMRANGE);
+  channel.ucCurve = ucCurve;
+  channel.bYoyo = bYoyo;
+  channel.ulStart = millis();
+  channel.ulDuration = ulDurationMs;
+  if (ulDurationMs == 0) {
+    channel.uiLevel = channel.uiTo;
+    channel.bActive = false;
+    pwmWrite(channel);
+    return;
   }
-  // On diminue la fréquence PWN du maximum à 0
-  MYDEBUG_PRINTLN("- PWM : decrescendo");
-  for(int i=PWMRANGE; i>0; i--){
-    MYDEBUG_PRINT("- PWM : [");
-    MYDEBUG_PRINT(i);
-    MYDEBUG_PRINTLN("]");
-    analogWrite(LedPin, i);
-    delay(10);
+  channel.bActive = true;
+  if (!bPwmTicking) {
+    bPwmTicking = true;
+    pwmTicker.attach_ms(PWM_TICK_MS, pwmTick);
   }
 }
+
+/**
+ * Arrêt de la rampe en cours : le canal reste au niveau atteint
+ */
+void stopPwm(int8_t cChannel){
+  if (cChannel < 0 || cChannel >= ucPwmNbChannels) { return; }
+  pwmChannels[cChannel].bActive = false;
+}
+
+/**
+ * Niveau courant d'un canal, de 0 à PWMRANGE
+ */
+uint16_t getPwmLevel(int8_t cChannel){
+  if (cChannel < 0 || cChannel >= ucPwmNbChannels) { return 0; }
+  return pwmChannels[cChannel].uiLevel;
+}
+
+// ------------------------------------------------------------------------------------------------
+// DEMONSTRATION
+// ------------------------------------------------------------------------------------------------
+int8_t cPwmLedChannel = -1;
+
+void setupPwm(){
+  cPwmLedChannel = attachPwmChannel(LedPin, true);            // LED éteinte
+}
+
+/**
+ * La LED "respire" : crescendo puis decrescendo en continu, sans bloquer la boucle
+ */
+void playWithPwm(){
+  MYDEBUG_PRINTLN("- PWM : crescendo / decrescendo");
+  fadePwm(cPwmLedChannel, PWMRANGE, 2000, PWM_EASE, true);
+}
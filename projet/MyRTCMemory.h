@@ -0,0 +1,61 @@
+/**
+ * \file MyRTCMemory.h
+ * \page rtcmemory Mémoire RTC
+ * \brief Conserver des données à travers les resets et le Deep Sleep
+ *
+ * Lors d'un reset ou d'un réveil de Deep Sleep, l'ESP8266 redémarre depuis le setup() et toutes les
+ * variables sont réinitialisées (cf. \ref deepsleep). Seule la mémoire RTC est conservée : 512 octets
+ * disponibles pour l'utilisateur, adressés par blocs de 4 octets (de 0 à 127), via
+ * ESP.rtcUserMemoryRead() et ESP.rtcUserMemoryWrite().
+ *
+ * Contrairement à la flash (SPIFFS, EEPROM), la mémoire RTC ne s'use pas : on peut y écrire à chaque
+ * changement d'état. En revanche elle est perdue à la mise hors tension : son contenu est alors
+ * aléatoire. Chaque zone est donc précédée d'un CRC32 qui permet de savoir si les données sont valides.
+ *
+ * Les modules se partagent la mémoire RTC selon la table d'allocation ci-dessous (offset en blocs de
+ * 4 octets, taille en octets CRC compris).
+ *
+ * \note Une mise à jour OTA écrit sa commande pour eboot dans les 128 premiers octets (blocs 0 à 31)
+ * : leur contenu est perdu au redémarrage qui suit. La fenêtre QoS, les compteurs et le watchdog
+ * sont donc placés au-delà.
+ *
+ * Fichier \ref MyRTCMemory.h
+ */
+
+#include <coredecls.h>                    // crc32()
+
+#define RTC_MEMORY_SIZE     512           // Taille de la mémoire RTC utilisateur en octets
+
+// Table d'allocation. Les blocs 0 à 31 sont écrasés par la commande de eboot lors d'une mise à jour
+// OTA : seules y figurent des données que l'on sait reconstruire.
+#define RTC_TIME_OFFSET     0             // Heure et dérive du quartz (MyNTP.h), perdues sur OTA
+#define RTC_TIME_SIZE       24
+// Blocs 6 à 31 libres, à réserver à des données que l'on peut perdre
+#define RTC_WATCHDOG_OFFSET 32            // Dernier blocage et statistiques du watchdog (MyWatchdog.h)
+#define RTC_WATCHDOG_SIZE   56
+#define RTC_COUNTERS_OFFSET 46            // Compteurs de fonctionnement (MyCounters.h)
+#define RTC_COUNTERS_SIZE   72
+#define RTC_QOS_OFFSET      64            // Fenêtre QoS 1 Adafruit IO (MyAdafruitQoS.h)
+#define RTC_QOS_SIZE        256
+
+/**
+ * Lecture d'une zone de la mémoire RTC.
+ * Renvoie false si la zone est invalide (CRC incorrect, après une mise sous tension par exemple)
+ */
+template <typename T> bool readRTCMemory(uint32_t ulOffset, T &data){
+  static_assert(sizeof(T) % 4 == 0, "La taille doit être un multiple de 4 octets");
+  uint32_t ulCrc;
+  if (!ESP.rtcUserMemoryRead(ulOffset, &ulCrc, sizeof(ulCrc))) { return false; }
+  if (!ESP.rtcUserMemoryRead(ulOffset + 1, (uint32_t*)&data, sizeof(T))) { return false; }
+  return crc32(&data, sizeof(T)) == ulCrc;
+}
+
+/**
+ * Ecriture d'une zone de la mémoire RTC, précédée de son CRC
+ */
+template <typename T> bool writeRTCMemory(uint32_t ulOffset, T &data){
+  static_assert(sizeof(T) % 4 == 0, "La taille doit être un multiple de 4 octets");
+  uint32_t ulCrc = crc32(&data, sizeof(T));
+  return ESP.rtcUserMemoryWrite(ulOffset, &ulCrc, sizeof(ulCrc))
+      && ESP.rtcUserMemoryWrite(ulOffset + 1, (uint32_t*)&data, sizeof(T));
+}
@@ -0,0 +1,286 @@
+/**
+ * \file MyRollup.h
+ * \page rollup Agrégats min/max/moyenne
+ * \brief Agrégation incrémentale des mesures par minute, par heure et par jour
+ *
+ * Le tableau de bord n'affiche que la dernière valeur de chaque feed. Pour tracer une courbe sur une
+ * journée ou un mois, il faudrait récupérer des milliers de points bruts depuis le cloud.
+ *
+ * Nous calculons donc sur l'objet, au fil de l'eau, le minimum, le maximum et la moyenne de chaque
+ * voie des capteurs (cf. \ref sensors) à 3 résolutions : la minute, l'heure et
+ * le jour. Chaque résolution est un anneau de taille fixe d'intervalles (buckets) :
+ * - A chaque mesure, seul le bucket courant de chaque résolution est mis à jour : min, max, somme et
+ *   nombre de points. Coût constant, on ne relit jamais les mesures passées.
+ * - Quand la mesure tombe dans un nouvel intervalle, on avance d'une case dans l'anneau en écrasant le
+ *   bucket le plus ancien. Les intervalles sans mesure n'occupent pas de case.
+ *
+ * Les agrégats sont :
+ * - consultables par l'API HTTP : GET /api/rollups?level=minute|hour|day[&channel=soil|temperature|humidity|dryness]
+ *   qui renvoie pour chaque bucket [début, min, max, moyenne] : quelques centaines d'octets pour un mois.
+ * - publiés en télémétrie sous-échantillonnée (v1/devices/me/telemetry) à la clôture de chaque bucket
+ *   horaire et journalier, horodatés avec le début de l'intervalle. Chaque résolution retient le début
+ *   du dernier bucket publié : les buckets clôturés pendant une déconnexion, ou dont la publication a
+ *   échoué, sont publiés dans l'ordre dès que possible, tant qu'ils sont encore dans l'anneau.
+ *
+ * \note L'API HTTP utilise le serveur du module \ref httpserver, la publication le client du module \ref mqtt
+ *
+ * Fichier \ref MyRollup.h
+ */
+
+#define ROLLUP_NB_CHANNELS  SENSOR_NB_CHANNELS   // Toutes les voies des capteurs
+#define ROLLUP_NB_LEVELS    3             // Minute, heure, jour
+#define ROLLUP_NB_MINUTES   60            // Une heure de buckets d'une minute
+#define ROLLUP_NB_HOURS     24            // Une journée de buckets d'une heure
+#define ROLLUP_NB_DAYS      31            // Un mois de buckets d'une journée
+
+/** Agrégat d'une mesure sur un intervalle, en virgule fixe (cf. \ref fixed) */
+struct RollupValue {
+  Fixed    lMin;
+  Fixed    lMax;
+  int32_t  lSum;                          /*!< Sur 32 bits : |valeur| x nombre de mesures < 21 474 836 unités */
+  uint32_t ulCount;                       /*!< Jusqu'à 86 400 mesures par jour (période de 1 s) */
+};
+
+/** Intervalle de temps : début et agrégat de chaque mesure */
+struct RollupBucket {
+  uint32_t    ulStart;                    /*!< Début de l'intervalle (0 si vide) */
+  RollupValue values[ROLLUP_NB_CHANNELS];
+};
+
+/** Anneau de buckets pour une résolution */
+struct RollupLevel {
+  const char   *strName;                  /*!< Nom utilisé par l'API HTTP */
+  uint32_t      ulPeriod;                 /*!< Durée d'un intervalle en secondes */
+  uint8_t       ucSize;                   /*!< Nombre de buckets de l'anneau */
+  uint8_t       ucHead;                   /*!< Bucket courant */
+  RollupBucket *buckets;
+  uint32_t      ulPublished;              /*!< Début du dernier bucket publié en télémétrie (0 si aucun) */
+};
+
+RollupBucket rollupMinutes[ROLLUP_NB_MINUTES];
+RollupBucket rollupHours[ROLLUP_NB_HOURS];
+RollupBucket rollupDays[ROLLUP_NB_DAYS];
+RollupLevel rollupLevels[ROLLUP_NB_LEVELS] = {
+  {"minute", 60,    ROLLUP_NB_MINUTES, 0, rollupMinutes, 0},
+  {"hour",   3600,  ROLLUP_NB_HOURS,   0, rollupHours,   0},
+  {"day",    86400, ROLLUP_NB_DAYS,    0, rollupDays,    0}
+};
+
+// ------------------------------------------------------------------------------------------------
+// AGREGATION
+// ------------------------------------------------------------------------------------------------
+/**
+ * Prise en compte d'une mesure : O(1) par résolution
+ */
+void rollupAdd(uint32_t ulTime, const Fixed *alValues){
+  for (uint8_t l = 0; l < ROLLUP_NB_LEVELS; l++) {
+    RollupLevel &level = rollupLevels[l];
+    uint32_t ulStart = ulTime - ulTime % level.ulPeriod;
+    RollupBucket *bucket = &level.buckets[level.ucHead];
+    if (bucket->ulStart != ulStart) {                        // Nouvel intervalle : on avance d'une case
+      if (bucket->ulStart != 0) {
+        level.ucHead = (level.ucHead + 1) % level.ucSize;
+        bucket = &level.buckets[level.ucHead];
+      }
+      memset(bucket, 0, sizeof(RollupBucket));
+      bucket->ulStart = ulStart;
+    }
+    for (uint8_t c = 0; c < ROLLUP_NB_CHANNELS; c++) {
+      Fixed lValue = alValues[c];
+      if (fixedIsNan(lValue)) { continue; }                  // Mesure en erreur
+      RollupValue &value = bucket->values[c];
+      if (value.ulCount == 0 || lValue < value.lMin) { value.lMin = lValue; }
+      if (value.ulCount == 0 || lValue > value.lMax) { value.lMax = lValue; }
+      value.lSum += lValue;
+      value.ulCount++;
+    }
+  }
+}
+
+/**
+ * Mise à jour des agrégats avec les dernières mesures de tous les capteurs
+ */
+void updateRollups(){
+  if (!isTimeSet()) { return; }                              // Mesure non horodatable
+  Fixed alValues[ROLLUP_NB_CHANNELS];
+  sensors.values(alValues);
+  rollupAdd(timeNow(), alValues);
+}
+
+/**
+ * Moyenne d'un agrégat, arrondie au plus proche
+ */
+Fixed getRollupAverage(const RollupValue &value){
+  return fixedMulDiv(value.lSum, 1, value.ulCount);
+}
+
+/**
+ * Recherche d'une résolution par son nom, NULL si inconnue
+ */
+RollupLevel* getRollupLevel(const String &strName){
+  for (uint8_t l = 0; l < ROLLUP_NB_LEVELS; l++) {
+    if (strName == rollupLevels[l].strName) { return &rollupLevels[l]; }
+  }
+  return NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+// API HTTP
+// ------------------------------------------------------------------------------------------------
+/** Contexte de la réponse de GET /api/rollups, copié dans la connexion */
+struct RollupStream {
+  const RollupLevel *level;
+  int8_t             cChannel;               /*!< -1 : toutes les mesures */
+  bool               bFirst;                 /*!< Aucun bucket encore envoyé */
+};
+
+/**
+ * Générateur de la réponse de GET /api/rollups : étape 0 l'en-tête et les voies, puis un bucket par
+ * étape, puis la fin du tableau
+ */
+bool rollupsHttpGenerator(Print &output, uint16_t uiStep, void *pContext){
+  RollupStream &stream = *(RollupStream*)pContext;
+  const RollupLevel *level = stream.level;
+  char cBuffer[32 + ROLLUP_NB_CHANNELS * 3 * 15];             // Pire cas d'un bucket : 3 valeurs de 15 caractères par voie
+  if (uiStep == 0) {
+    snprintf(cBuffer, sizeof(cBuffer), "{\"level\":\"%s\",\"period\":%lu,\"channels\":[", level->strName, (unsigned long)level->ulPeriod);
+    output.print(cBuffer);
+    for (uint8_t c = 0; c < ROLLUP_NB_CHANNELS; c++) {
+      if (stream.cChannel >= 0 && stream.cChannel != c) { continue; }
+      snprintf(cBuffer, sizeof(cBuffer), "%s\"%s\"", (stream.cChannel < 0 && c > 0) ? "," : "", sensors.channel(c)->strName);
+      output.print(cBuffer);
+    }
+    output.print("],\"buckets\":[");
+    return true;
+  }
+  if (uiStep > level->ucSize) {
+    output.print("]}");
+    return false;
+  }
+  const RollupBucket &bucket = level->buckets[(level->ucHead + uiStep) % level->ucSize];   // Du plus ancien au plus récent
+  if (bucket.ulStart == 0) { return true; }
+  int iLength = snprintf(cBuffer, sizeof(cBuffer), "%s[%lu", stream.bFirst ? "" : ",", (unsigned long)bucket.ulStart);
+  for (uint8_t c = 0; c < ROLLUP_NB_CHANNELS; c++) {
+    if (stream.cChannel >= 0 && stream.cChannel != c) { continue; }
+    const RollupValue &value = bucket.values[c];
+    if (value.ulCount == 0) {
+      iLength += snprintf(cBuffer + iLength, sizeof(cBuffer) - iLength, ",null,null,null");
+    } else {
+      Fixed alStats[3] = {value.lMin, value.lMax, getRollupAverage(value)};
+      for (uint8_t s = 0; s < 3; s++) {
+        cBuffer[iLength++] = ',';
+        iLength += formatFixed(cBuffer + iLength, alStats[s], 1);
+      }
+    }
+  }
+  snprintf(cBuffer + iLength, sizeof(cBuffer) - iLength, "]");
+  output.print(cBuffer);
+  stream.bFirst = false;
+  return true;
+}
+
+/**
+ * GET /api/rollups?level=minute|hour|day[&channel=soil|temperature|humidity|dryness]
+ * Réponse : {"level":"hour","period":3600,"channels":[...],"buckets":[[début,min,max,moy,...],...]}
+ * du bucket le plus ancien au plus récent, produite bucket par bucket par rollupsHttpGenerator() au
+ * fil des acquittements, sans construire toute la réponse en mémoire.
+ */
+void handleRollups(){
+  RollupLevel *level = getRollupLevel(HTTPServer.hasArg("level") ? HTTPServer.arg("level") : String("hour"));
+  if (level == NULL) {
+    HTTPServer.send(400, "text/plain", "level : minute, hour ou day");
+    return;
+  }
+  int iChannel = -1;                                         // -1 : toutes les mesures
+  if (HTTPServer.hasArg("channel")) {
+    for (uint8_t c = 0; c < ROLLUP_NB_CHANNELS; c++) {
+      if (HTTPServer.arg("channel") == sensors.channel(c)->strName) { iChannel = c; }
+    }
+    if (iChannel < 0) {
+      HTTPServer.send(400, "text/plain", "channel : voie inconnue, cf. /api/sensors");
+      return;
+    }
+  }
+  RollupStream stream = {level, (int8_t)iChannel, true};
+  sendHttpStream(200, "application/json", rollupsHttpGenerator, &stream, sizeof(stream));
+}
+
+// ------------------------------------------------------------------------------------------------
+// PUBLICATION
+// ------------------------------------------------------------------------------------------------
+/** Bucket à publier et sa résolution */
+struct RollupPublication {
+  const RollupLevel  *level;
+  const RollupBucket *bucket;
+};
+
+/**
+ * Générateur de la payload d'un bucket clôturé, horodaté au début de l'intervalle :
+ * {"ts":..., "values":{"soil_hour_min":..., "soil_hour_max":..., "soil_hour_avg":..., ...}}
+ */
+void rollupGenerator(Print &output, const void *pContext){
+  const RollupPublication &publication = *(const RollupPublication*)pContext;
+  const RollupLevel &level = *publication.level;
+  const RollupBucket &bucket = *publication.bucket;
+  output.print("{\"ts\":");
+  output.print((unsigned long)bucket.ulStart);
+  output.print("000,\"values\":{");                         // Horodatage en millisecondes
+  bool bFirst = true;
+  for (uint8_t c = 0; c < ROLLUP_NB_CHANNELS; c++) {
+    const RollupValue &value = bucket.values[c];
+    if (value.ulCount == 0) { continue; }
+    const char *astrStats[3] = {"min", "max", "avg"};
+    Fixed alStats[3] = {value.lMin, value.lMax, getRollupAverage(value)};
+    for (uint8_t i = 0; i < 3; i++) {
+      output.print(bFirst ? "\"" : ",\"");
+      output.print(sensors.channel(c)->strName);
+      output.print("_");
+      output.print(level.strName);
+      output.print("_");
+      output.print(astrStats[i]);
+      output.print("\":");
+      printFixed(output, alStats[i], 2);
+      bFirst = false;
+    }
+  }
+  output.print("}}");
+}
+
+/**
+ * Publication en télémétrie du plus ancien bucket clôturé et pas encore publié d'une résolution. Avec
+ * les 3 mesures la payload dépasse le buffer de PubSubClient : elle est envoyée en flux (cf. \ref mqtt).
+ * Le dernier bucket publié n'avance que si la publication a réussi.
+ */
+void publishRollup(RollupLevel &level){
+  for (uint8_t i = 1; i < level.ucSize; i++) {               // Du plus ancien au plus récent, hors bucket courant
+    const RollupBucket &bucket = level.buckets[(level.ucHead + i) % level.ucSize];
+    if (bucket.ulStart == 0 || bucket.ulStart <= level.ulPublished) { continue; }
+    RollupPublication publication = {&level, &bucket};
+    if (publishMqttStream("v1/devices/me/telemetry", rollupGenerator, &publication)) {
+      level.ulPublished = bucket.ulStart;
+    }
+    return;
+  }
+}
+
+/**
+ * Publication des buckets horaires et journaliers clôturés et pas encore publiés : un par résolution
+ * et par appel, pour ne pas bloquer la boucle au retour d'une longue déconnexion.
+ * Les buckets d'une minute restent sur l'objet (API HTTP) : trop fréquents pour la télémétrie.
+ */
+void loopRollups(){
+  if (!MyMqttClient.connected()) { return; }
+  for (uint8_t l = 1; l < ROLLUP_NB_LEVELS; l++) {
+    RollupLevel &level = rollupLevels[l];
+    const RollupBucket &last = level.buckets[(level.ucHead + level.ucSize - 1) % level.ucSize];   // Dernier clôturé
+    if (last.ulStart > level.ulPublished) { publishRollup(level); }
+  }
+}
+
+/**
+ * Enregistrement de la route HTTP des agrégats
+ */
+void setupRollups(){
+  MYDEBUG_PRINTLN("-ROLLUP : Route /api/rollups");
+  registerHttpRoute("/api/rollups", HTTP_GET, handleRollups);
+}
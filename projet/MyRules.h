@@ -0,0 +1,383 @@
+/**
+ * \file MyRules.h
+ * \page rules Moteur de règles
+ * \brief Règles d'alerte et d'action évaluées sur l'objet, compilées en bytecode par le serveur
+ *
+ * Les alertes sont aujourd'hui calculées dans le cloud, ou codées en dur dans le firmware. Ce module
+ * évalue sur l'objet, à chaque mesure, jusqu'à RULES_MAX règles envoyées par le serveur, sans
+ * recompiler ni reflasher :
+ * - Seuils : humidité du sol < 30, température > 35 ...
+ * - Vitesses de variation : variation par minute entre les 2 dernières mesures.
+ * - Fenêtres de temps : moyenne des n dernières mesures, condition vraie depuis au moins n secondes.
+ *
+ * Chaque règle est un petit programme pour une machine à pile en virgule fixe (cf. \ref fixed), compilé
+ * par le serveur :
+ * \verbatim
+0x01 VAL c        empile la mesure courante du canal c (voie c des capteurs, cf. \ref sensors)
+0x02 DELTA c      empile la variation par minute du canal c entre les 2 dernières mesures
+0x03 AVG c n      empile la moyenne des n dernières mesures du canal c (n <= RULES_HISTORY)
+0x04 CONST lo hi  empile la constante (int16 little endian) / 10
+0x10 LT / 0x11 GT dépile b puis a, empile a < b (a > b), faux si une mesure est absente
+0x12 AND / 0x13 OR / 0x14 NOT
+0x20 HOLD lo hi   dépile une condition, empile 1 si elle est vraie depuis au moins n secondes (uint16)
+\endverbatim
+ * Exemple, sol sec depuis 10 minutes : VAL 0, CONST 300, LT, HOLD 600 soit 01 00 04 2C 01 10 20 58 02.
+ *
+ * Quand le résultat d'une règle passe de faux à vrai, son action est exécutée :
+ * - RULE_ACTION_ACTUATOR : actuateur MQTT à l'état arg (0 ou 1), et mise à jour de l'attribut.
+ * - RULE_ACTION_PUBLISH : publication immédiate de la télémétrie ruleAlert (numéro de la règle).
+ * - RULE_ACTION_BOOST : mesures toutes les RULES_BOOST_PERIOD ms pendant arg x 10 secondes.
+ *
+ * Les règles sont envoyées par RPC (cf. \ref mqtt) : méthode "setRule", paramètre en hexadécimal
+ * "emplacement action arg bytecode..." (un bytecode vide efface l'emplacement), et "clearRules".
+ * Chaque règle est vérifiée à la réception : opcodes et opérandes valides, pile sans débordement,
+ * un seul résultat, au plus un HOLD. Le bytecode ne contient pas de saut : une règle s'exécute en au
+ * plus RULES_MAX_CODE instructions, le temps d'évaluation est borné. Les règles sont sauvegardées
+ * dans le SPIFFS (RULES_FILE) et rechargées au démarrage.
+ *
+ * Le coût d'évaluation de chaque règle (cycles CPU, moyenne et max) et le nombre de déclenchements
+ * sont consultables via GET /api/rules (cf. \ref httpserver).
+ *
+ * Fichier \ref MyRules.h
+ */
+
+#include <FS.h>
+
+#define RULES_MAX           8             // Nombre de règles
+#define RULES_MAX_CODE      24            // Taille max du bytecode d'une règle (octets)
+#define RULES_STACK         8             // Profondeur de la pile
+#define RULES_HISTORY       12            // Mesures conservées par canal (1 minute à 5 secondes)
+#define RULES_NB_CHANNELS   SENSOR_NB_CHANNELS   // Toutes les voies des capteurs
+#define RULES_BOOST_PERIOD  1000          // Période des mesures accélérées (ms)
+#define RULES_FILE          "/rules.bin"
+
+// Opcodes
+#define RULE_OP_VAL         0x01
+#define RULE_OP_DELTA       0x02
+#define RULE_OP_AVG         0x03
+#define RULE_OP_CONST       0x04
+#define RULE_OP_LT          0x10
+#define RULE_OP_GT          0x11
+#define RULE_OP_AND         0x12
+#define RULE_OP_OR          0x13
+#define RULE_OP_NOT         0x14
+#define RULE_OP_HOLD        0x20
+
+// Actions
+#define RULE_ACTION_ACTUATOR  1
+#define RULE_ACTION_PUBLISH   2
+#define RULE_ACTION_BOOST     3
+
+/** Règle telle qu'elle est reçue et sauvegardée */
+struct RuleDefinition {
+  uint8_t ucAction;
+  uint8_t ucArg;
+  uint8_t ucLength;                       /*!< Taille du bytecode, 0 : emplacement vide */
+  uint8_t aucCode[RULES_MAX_CODE];
+};
+
+/** Etat et statistiques d'une règle */
+struct RuleState {
+  bool     bLast;                         /*!< Résultat de la dernière évaluation */
+  bool     bHolding;                      /*!< Condition du HOLD vraie */
+  uint32_t ulHoldSince;                   /*!< Début de la condition du HOLD (millis) */
+  uint32_t ulEvaluations;
+  uint32_t ulTriggers;
+  uint32_t ulTotalCycles;
+  uint32_t ulMaxCycles;
+};
+
+RuleDefinition ruleDefinitions[RULES_MAX];
+RuleState      ruleStates[RULES_MAX];
+Fixed          alRulesHistory[RULES_NB_CHANNELS][RULES_HISTORY];
+uint8_t        ucRulesHead = 0;               // Dernière mesure dans l'historique
+uint8_t        ucRulesCount = 0;              // Nombre de mesures dans l'historique
+uint32_t       ulRulesLastSample = 0;
+uint32_t       ulRulesDt = 0;                 // Intervalle entre les 2 dernières mesures (ms)
+uint32_t       ulRulesBoostUntil = 0;         // Fin des mesures accélérées (millis), 0 si inactif
+
+// ------------------------------------------------------------------------------------------------
+// VERIFICATION
+// ------------------------------------------------------------------------------------------------
+/**
+ * Vérification d'une règle avant de l'accepter : elle pourra ensuite être exécutée sans contrôle
+ */
+bool verifyRule(const RuleDefinition &rule){
+  if (rule.ucAction < RULE_ACTION_ACTUATOR || rule.ucAction > RULE_ACTION_BOOST) { return false; }
+  if (rule.ucLength > RULES_MAX_CODE) { return false; }
+  uint8_t ucDepth = 0, ucHolds = 0;
+  for (uint8_t pc = 0; pc < rule.ucLength; ) {
+    uint8_t ucOp = rule.aucCode[pc++];
+    uint8_t ucOperands = 0;
+    int8_t  cEffect = 0;
+    switch (ucOp) {
+      case RULE_OP_VAL : case RULE_OP_DELTA : ucOperands = 1; cEffect = 1; break;
+      case RULE_OP_AVG : ucOperands = 2; cEffect = 1; break;
+      case RULE_OP_CONST : ucOperands = 2; cEffect = 1; break;
+      case RULE_OP_LT : case RULE_OP_GT : case RULE_OP_AND : case RULE_OP_OR : cEffect = -1; break;
+      case RULE_OP_NOT : break;
+      case RULE_OP_HOLD : ucOperands = 2; ucHolds++; break;
+      default : return false;
+    }
+    if (pc + ucOperands > rule.ucLength) { return false; }
+    if (ucOp <= RULE_OP_AVG && rule.aucCode[pc] >= RULES_NB_CHANNELS) { return false; }
+    if (ucOp == RULE_OP_AVG && (rule.aucCode[pc + 1] == 0 || rule.aucCode[pc + 1] > RULES_HISTORY)) { return false; }
+    if (cEffect <= 0 && ucDepth < (cEffect < 0 ? 2 : 1)) { return false; }       // Pas assez d'opérandes
+    ucDepth += cEffect;
+    if (ucDepth > RULES_STACK) { return false; }
+    pc += ucOperands;
+  }
+  return ucDepth == 1 && ucHolds <= 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// EVALUATION
+// ------------------------------------------------------------------------------------------------
+/**
+ * Ajout des mesures courantes à l'historique
+ */
+void recordRulesSample(){
+  uint32_t ulNow = millis();
+  ulRulesDt = (ulRulesLastSample == 0) ? 0 : ulNow - ulRulesLastSample;
+  ulRulesLastSample = ulNow;
+  ucRulesHead = (ucRulesHead + 1) % RULES_HISTORY;
+  for (uint8_t c = 0; c < RULES_NB_CHANNELS; c++) { alRulesHistory[c][ucRulesHead] = sensors.value(c); }
+  if (ucRulesCount < RULES_HISTORY) { ucRulesCount++; }
+}
+
+/**
+ * Comparaison de 2 valeurs de la pile : fausse si l'une est absente (FIXED_NAN est le plus petit entier)
+ */
+inline bool ruleCompare(Fixed lA, Fixed lB, bool bGreater){
+  if (fixedIsNan(lA) || fixedIsNan(lB)) { return false; }
+  return bGreater ? lA > lB : lA < lB;
+}
+
+/**
+ * Exécution d'une règle vérifiée : renvoie son résultat
+ */
+bool runRule(const RuleDefinition &rule, RuleState &state, uint32_t ulNow){
+  Fixed alStack[RULES_STACK];
+  uint8_t ucSp = 0;
+  for (uint8_t pc = 0; pc < rule.ucLength; ) {
+    uint8_t ucOp = rule.aucCode[pc++];
+    switch (ucOp) {
+      case RULE_OP_VAL :
+        alStack[ucSp++] = alRulesHistory[rule.aucCode[pc++]][ucRulesHead];
+        break;
+      case RULE_OP_DELTA : {
+        const Fixed *alValues = alRulesHistory[rule.aucCode[pc++]];
+        Fixed lLast = alValues[ucRulesHead];
+        Fixed lPrevious = alValues[(ucRulesHead + RULES_HISTORY - 1) % RULES_HISTORY];
+        if (ucRulesCount < 2 || ulRulesDt == 0) { alStack[ucSp++] = 0; }
+        else if (fixedIsNan(lLast) || fixedIsNan(lPrevious)) { alStack[ucSp++] = FIXED_NAN; }
+        else { alStack[ucSp++] = fixedMulDiv(lLast - lPrevious, 60000, ulRulesDt); }
+        break;
+      }
+      case RULE_OP_AVG : {
+        const Fixed *alValues = alRulesHistory[rule.aucCode[pc++]];
+        uint8_t ucN = min(rule.aucCode[pc++], ucRulesCount);
+        int32_t lSum = 0;                                      // RULES_HISTORY x mesure : pas de débordement
+        for (uint8_t i = 0; i < ucN && !fixedIsNan(lSum); i++) {
+          Fixed lValue = alValues[(ucRulesHead + RULES_HISTORY - i) % RULES_HISTORY];
+          lSum = fixedIsNan(lValue) ? FIXED_NAN : lSum + lValue;
+        }
+        alStack[ucSp++] = (ucN == 0 || fixedIsNan(lSum)) ? FIXED_NAN : fixedMulDiv(lSum, 1, ucN);
+        break;
+      }
+      case RULE_OP_CONST :
+        alStack[ucSp++] = (int16_t)(rule.aucCode[pc] | (rule.aucCode[pc + 1] << 8)) * (FIXED_SCALE / 10);
+        pc += 2;
+        break;
+      case RULE_OP_LT :  ucSp--; alStack[ucSp - 1] = ruleCompare(alStack[ucSp - 1], alStack[ucSp], false); break;
+      case RULE_OP_GT :  ucSp--; alStack[ucSp - 1] = ruleCompare(alStack[ucSp - 1], alStack[ucSp], true); break;
+      case RULE_OP_AND : ucSp--; alStack[ucSp - 1] = (alStack[ucSp - 1] != 0) && (alStack[ucSp] != 0); break;
+      case RULE_OP_OR :  ucSp--; alStack[ucSp - 1] = (alStack[ucSp - 1] != 0) || (alStack[ucSp] != 0); break;
+      case RULE_OP_NOT : alStack[ucSp - 1] = (alStack[ucSp - 1] == 0); break;
+      case RULE_OP_HOLD : {
+        uint32_t ulHoldMs = (rule.aucCode[pc] | (rule.aucCode[pc + 1] << 8)) * 1000UL;
+        pc += 2;
+        if (alStack[ucSp - 1] == 0) { state.bHolding = false; }
+        else if (!state.bHolding) { state.bHolding = true; state.ulHoldSince = ulNow; }
+        alStack[ucSp - 1] = state.bHolding && ulNow - state.ulHoldSince >= ulHoldMs;
+        break;
+      }
+    }
+  }
+  return alStack[0] != 0;
+}
+
+void ruleAlertGenerator(Print &output, const void *pContext){
+  writeRuleAlert(output, *(const uint8_t*)pContext);
+}
+
+/**
+ * Action d'une règle qui vient de se déclencher
+ */
+void runRuleAction(uint8_t ucRule){
+  const RuleDefinition &rule = ruleDefinitions[ucRule];
+  MYDEBUG_PRINT("-RULES : Règle ");
+  MYDEBUG_PRINT(ucRule);
+  MYDEBUG_PRINT(" déclenchée, action ");
+  MYDEBUG_PRINTLN(rule.ucAction);
+  switch (rule.ucAction) {
+    case RULE_ACTION_ACTUATOR :
+      digitalWrite(iMqttActuatorPin, rule.ucArg ? HIGH : LOW);
+      publishMqttStream("v1/devices/me/attributes", mqttActuatorGenerator, NULL);
+      break;
+    case RULE_ACTION_PUBLISH :
+      publishMqttStream("v1/devices/me/telemetry", ruleAlertGenerator, &ucRule);
+      break;
+    case RULE_ACTION_BOOST :
+      ulRulesBoostUntil = (millis() + rule.ucArg * 10000UL) | 1;
+      break;
+  }
+}
+
+/**
+ * Evaluation de toutes les règles sur les mesures courantes, à appeler après chaque mesure
+ */
+void evaluateRules(){
+  recordRulesSample();
+  uint32_t ulNow = millis();
+  for (uint8_t i = 0; i < RULES_MAX; i++) {
+    if (ruleDefinitions[i].ucLength == 0) { continue; }
+    RuleState &state = ruleStates[i];
+    uint32_t ulStart = ESP.getCycleCount();
+    bool bResult = runRule(ruleDefinitions[i], state, ulNow);
+    uint32_t ulCycles = ESP.getCycleCount() - ulStart;
+    state.ulEvaluations++;
+    state.ulTotalCycles += ulCycles;
+    if (ulCycles > state.ulMaxCycles) { state.ulMaxCycles = ulCycles; }
+    if (bResult && !state.bLast) {                              // Front montant : déclenchement
+      state.ulTriggers++;
+      runRuleAction(i);
+    }
+    state.bLast = bResult;
+  }
+}
+
+/**
+ * Période des mesures : accélérée tant qu'une règle RULE_ACTION_BOOST le demande
+ */
+uint32_t getRulesSamplePeriod(uint32_t ulDefault){
+  if (ulRulesBoostUntil != 0 && (int32_t)(ulRulesBoostUntil - millis()) > 0) { return RULES_BOOST_PERIOD; }
+  ulRulesBoostUntil = 0;
+  return ulDefault;
+}
+
+// ------------------------------------------------------------------------------------------------
+// RECEPTION ET SAUVEGARDE
+// ------------------------------------------------------------------------------------------------
+/**
+ * Sauvegarde de toutes les règles dans le SPIFFS
+ */
+bool saveRules(){
+  if (!SPIFFS.begin()) { return false; }
+  File file = SPIFFS.open(RULES_FILE, "w");
+  if (!file) { return false; }
+  bool bOk = file.write((uint8_t*)ruleDefinitions, sizeof(ruleDefinitions)) == sizeof(ruleDefinitions);
+  file.close();
+  return bOk;
+}
+
+/**
+ * Chargement des règles depuis le SPIFFS : les règles invalides sont ignorées
+ */
+void loadRules(){
+  memset(ruleDefinitions, 0, sizeof(ruleDefinitions));
+  if (!SPIFFS.begin()) { return; }
+  File file = SPIFFS.open(RULES_FILE, "r");
+  if (!file) { return; }
+  if (file.read((uint8_t*)ruleDefinitions, sizeof(ruleDefinitions)) != sizeof(ruleDefinitions)) {
+    memset(ruleDefinitions, 0, sizeof(ruleDefinitions));
+  }
+  file.close();
+  uint8_t ucNbRules = 0;
+  for (uint8_t i = 0; i < RULES_MAX; i++) {
+    if (ruleDefinitions[i].ucLength == 0) { continue; }
+    if (verifyRule(ruleDefinitions[i])) { ucNbRules++; }
+    else { ruleDefinitions[i].ucLength = 0; }
+  }
+  MYDEBUG_PRINT("-RULES : ");
+  MYDEBUG_PRINT(ucNbRules);
+  MYDEBUG_PRINTLN(" règle(s) chargée(s)");
+}
+
+/**
+ * Décodage hexadécimal. Renvoie le nombre d'octets, -1 si la chaîne est invalide.
+ */
+int decodeRuleHex(const char *strHex, uint8_t *aucData, size_t uiSize){
+  size_t uiLength = strlen(strHex);
+  if (uiLength % 2 != 0 || uiLength / 2 > uiSize) { return -1; }
+  for (size_t i = 0; i < uiLength; i += 2) {
+    char cByte[3] = {strHex[i], strHex[i + 1], 0};
+    char *pEnd;
+    aucData[i / 2] = strtoul(cByte, &pEnd, 16);
+    if (*pEnd != 0) { return -1; }
+  }
+  return uiLength / 2;
+}
+
+/**
+ * RPC setRule : "emplacement action arg bytecode..." en hexadécimal
+ */
+void onRpcSetRule(const MqttRpcRequest &request, const char *strResponseTopic){
+  uint8_t aucData[3 + RULES_MAX_CODE];
+  int iLength = decodeRuleHex(request.cParams, aucData, sizeof(aucData));
+  bool bOk = iLength >= 3 && aucData[0] < RULES_MAX;
+  if (bOk) {
+    RuleDefinition rule = {aucData[1], aucData[2], (uint8_t)(iLength - 3), {0}};
+    memcpy(rule.aucCode, aucData + 3, rule.ucLength);
+    bOk = (rule.ucLength == 0) || verifyRule(rule);
+    if (bOk) {
+      ruleDefinitions[aucData[0]] = rule;
+      memset(&ruleStates[aucData[0]], 0, sizeof(RuleState));
+      bOk = saveRules();
+    }
+  }
+  MYDEBUG_PRINT("-RULES : setRule ");
+  MYDEBUG_PRINT(request.cParams);
+  MYDEBUG_PRINTLN(bOk ? " [OK]" : " [REFUSEE]");
+  publishMqttStream(strResponseTopic, mqttRpcPayloadGenerator, bOk ? "{\"ok\":true}" : "{\"ok\":false}");
+}
+
+/**
+ * RPC clearRules : suppression de toutes les règles
+ */
+void onRpcClearRules(const MqttRpcRequest &request, const char *strResponseTopic){
+  memset(ruleDefinitions, 0, sizeof(ruleDefinitions));
+  memset(ruleStates, 0, sizeof(ruleStates));
+  bool bOk = saveRules();
+  MYDEBUG_PRINTLN("-RULES : Règles supprimées");
+  publishMqttStream(strResponseTopic, mqttRpcPayloadGenerator, bOk ? "{\"ok\":true}" : "{\"ok\":false}");
+}
+
+/**
+ * GET /api/rules : coût d'évaluation et déclenchements de chaque règle
+ */
+void handleRules(){
+  String strResponse = "[";
+  char cBuffer[160];
+  uint8_t ucMHz = ESP.getCpuFreqMHz();
+  for (uint8_t i = 0; i < RULES_MAX; i++) {
+    const RuleState &state = ruleStates[i];
+    if (ruleDefinitions[i].ucLength == 0) { continue; }
+    snprintf(cBuffer, sizeof(cBuffer),
+             "%s{\"rule\":%u,\"action\":%u,\"bytes\":%u,\"evaluations\":%lu,\"triggers\":%lu,\"avgUs\":%.2f,\"maxUs\":%.2f}",
+             strResponse.length() > 1 ? "," : "", i, ruleDefinitions[i].ucAction, ruleDefinitions[i].ucLength,
+             (unsigned long)state.ulEvaluations, (unsigned long)state.ulTriggers,
+             state.ulEvaluations ? (float)state.ulTotalCycles / state.ulEvaluations / ucMHz : 0.0,
+             (float)state.ulMaxCycles / ucMHz);
+    strResponse += cBuffer;
+  }
+  strResponse += "]";
+  HTTPServer.send(200, "application/json", strResponse);
+}
+
+void setupRules(){
+  loadRules();
+  registerMqttRpc("setRule", onRpcSetRule);
+  registerMqttRpc("clearRules", onRpcClearRules);
+  registerHttpRoute("/api/rules", HTTP_GET, handleRules);
+}
@@ -0,0 +1,263 @@
+/**
+ * \file MySampler.h
+ * \page sampler Echantillonnage adaptatif
+ * \brief Période des mesures ajustée à l'activité de chaque voie
+ *
+ * Une période fixe est toujours un mauvais compromis : pendant un arrosage l'humidité du sol varie de
+ * plusieurs % par minute et les mesures toutes les 5 s ratent la montée, alors que la nuit le signal
+ * est plat et chaque mesure (et chaque publication) consomme pour rien.
+ *
+ * Pour chaque voie (cf. \ref sensors), le module suit à chaque nouvelle mesure :
+ * - la moyenne lissée (moyenne mobile exponentielle, SAMPLER_ALPHA) ;
+ * - l'écart moyen à cette moyenne (lissé de la même façon) : le bruit ou les variations brusques ;
+ * - la pente de la moyenne, en unités par minute, calculée sur au moins SAMPLER_SLOPE_WINDOW pour ne
+ *   pas confondre bruit et tendance lorsque les mesures sont rapprochées.
+ *
+ * Une voie est active lorsque sa pente ou son écart moyen dépasse son seuil d'activité (lActivity de
+ * sa SensorChannel, déclaré par le capteur, 0 pour ignorer la voie). Sa période est alors divisée
+ * par SAMPLER_BOOST jusqu'à SAMPLER_MIN_PERIOD, sinon elle augmente de 25 % à chaque mesure jusqu'à
+ * SAMPLER_MAX_PERIOD. La boucle échantillonne au rythme de la voie la plus active (getSamplerPeriod()),
+ * les règles pouvant encore l'accélérer (cf. \ref rules).
+ *
+ * Avec le Deep Sleep (cf. \ref deepsleep), sleepUntilNextSample() n'endort l'objet que si toutes les
+ * voies sont calmes (période maximum) : pendant un arrosage, il reste éveillé pour suivre la montée.
+ * Au réveil, les voies repartent de la période maximum.
+ * \note La mémoire RTC est entièrement allouée (cf. \ref rtcmemory) : les moyennes et pentes ne sont pas
+ * conservées pendant le Deep Sleep, une variation n'est détectée qu'à partir de la 2ème mesure d'un réveil.
+ *
+ * Les périodes et statistiques de chaque voie sont consultables via GET /api/sampler
+ * (cf. \ref httpserver). Au démarrage (MYDEBUG), benchmarkSampler() rejoue une trace synthétique de 2 h
+ * (sol stable et bruité, puis arrosage) et compare le nombre de mesures et l'erreur de reconstruction
+ * (interpolation linéaire entre les mesures) à ceux de la période fixe.
+ *
+ * Fichier \ref MySampler.h
+ */
+
+#define SAMPLER_MIN_PERIOD    1000        // Période minimum, voie active (ms)
+#define SAMPLER_MAX_PERIOD    60000       // Période maximum, voie calme (ms)
+#define SAMPLER_BOOST         4           // Division de la période quand une voie devient active
+#define SAMPLER_ALPHA         FIXED_ALPHA(0.25)   // Lissage de la moyenne et de l'écart moyen
+#define SAMPLER_SLOPE_WINDOW  30000       // Durée minimum du calcul de la pente (ms)
+#define SAMPLER_BENCH_STEP    1000        // Résolution de la trace de benchmarkSampler() (ms)
+
+/** Etat d'une voie */
+struct SamplerChannel {
+  Fixed    lMean;                         /*!< Moyenne lissée */
+  Fixed    lDeviation;                    /*!< Ecart moyen à la moyenne lissée */
+  Fixed    lSlope;                        /*!< Pente de la moyenne (unités par minute) */
+  Fixed    lAnchor;                       /*!< Moyenne au début du calcul de la pente */
+  uint32_t ulAnchorTime;
+  uint32_t ulPeriod;                      /*!< Période souhaitée pour cette voie (ms) */
+  uint32_t ulSamples;
+  uint32_t ulBoosts;                      /*!< Mesures où la voie était active */
+};
+
+SamplerChannel samplerChannels[SENSOR_NB_CHANNELS];
+uint8_t  aucSamplerSensor[SENSOR_NB_CHANNELS];        // Capteur de chaque voie
+uint32_t aulSamplerLastSample[SENSOR_NB_CHANNELS];    // Date du dernier échantillonnage pris en compte
+uint32_t ulSamplerDefault = SAMPLER_MAX_PERIOD;       // Période de départ (et période fixe du benchmark)
+
+// ------------------------------------------------------------------------------------------------
+// CALCUL
+// ------------------------------------------------------------------------------------------------
+/** Remise à zéro d'une voie, avec sa période de départ */
+void samplerReset(SamplerChannel &channel, uint32_t ulPeriod){
+  channel.lMean = channel.lDeviation = channel.lAnchor = FIXED_NAN;
+  channel.lSlope = 0;
+  channel.ulAnchorTime = 0;
+  channel.ulPeriod = ulPeriod;
+  channel.ulSamples = channel.ulBoosts = 0;
+}
+
+/**
+ * Prise en compte d'une nouvelle mesure d'une voie et ajustement de sa période.
+ * lActivity : seuil d'activité (pente en unités/min et écart moyen), 0 pour ne jamais accélérer.
+ * Renvoie true si la voie est active.
+ */
+bool samplerUpdate(SamplerChannel &channel, Fixed lValue, uint32_t ulNow, Fixed lActivity){
+  // Mesure en erreur (capteur absent ou en panne) : rien à apprendre, la voie ralentit comme une voie
+  // calme pour ne pas bloquer la période minimum, ni empêcher le Deep Sleep
+  if (fixedIsNan(lValue)) {
+    channel.ulPeriod = min((uint32_t)SAMPLER_MAX_PERIOD, channel.ulPeriod + channel.ulPeriod / 4);
+    return false;
+  }
+  channel.ulSamples++;
+  if (fixedIsNan(channel.lMean)) {                           // Première mesure
+    channel.lMean = channel.lAnchor = lValue;
+    channel.lDeviation = 0;
+    channel.ulAnchorTime = ulNow;
+    return false;
+  }
+  channel.lDeviation = fixedEwma(channel.lDeviation, abs(lValue - channel.lMean), SAMPLER_ALPHA);
+  channel.lMean = fixedEwma(channel.lMean, lValue, SAMPLER_ALPHA);
+  uint32_t ulElapsed = ulNow - channel.ulAnchorTime;
+  if (ulElapsed >= SAMPLER_SLOPE_WINDOW) {
+    channel.lSlope = fixedMulDiv(channel.lMean - channel.lAnchor, 60000, ulElapsed);
+    channel.lAnchor = channel.lMean;
+    channel.ulAnchorTime = ulNow;
+  }
+  bool bActive = lActivity > 0 && (abs(channel.lSlope) > lActivity || channel.lDeviation > lActivity);
+  if (bActive) {
+    channel.ulBoosts++;
+    channel.ulPeriod = max((uint32_t)SAMPLER_MIN_PERIOD, channel.ulPeriod / SAMPLER_BOOST);
+  } else {
+    channel.ulPeriod = min((uint32_t)SAMPLER_MAX_PERIOD, channel.ulPeriod + channel.ulPeriod / 4);
+  }
+  return bActive;
+}
+
+/** Période des mesures : celle de la voie la plus active */
+uint32_t getSamplerPeriod(){
+  uint32_t ulPeriod = SAMPLER_MAX_PERIOD;
+  for (uint8_t c = 0; c < SENSOR_NB_CHANNELS; c++) { ulPeriod = min(ulPeriod, samplerChannels[c].ulPeriod); }
+  return ulPeriod;
+}
+
+/**
+ * Après sampleSensors() : prise en compte des voies des capteurs effectivement échantillonnés
+ * (un capteur sollicité avant sa période minimum garde ses anciennes valeurs)
+ */
+void updateSampler(){
+  for (uint8_t c = 0; c < SENSOR_NB_CHANNELS; c++) {
+    uint32_t ulLastSample = sensors.info(aucSamplerSensor[c])->ulLastSample;
+    if (ulLastSample == aulSamplerLastSample[c]) { continue; }
+    aulSamplerLastSample[c] = ulLastSample;
+    samplerUpdate(samplerChannels[c], sensors.value(c), ulLastSample, sensors.channel(c)->lActivity);
+  }
+}
+
+// ------------------------------------------------------------------------------------------------
+// DEEP SLEEP
+// ------------------------------------------------------------------------------------------------
+/**
+ * Deep Sleep jusqu'à la prochaine mesure, si toutes les voies sont calmes.
+ * Renvoie false (sans dormir) si une voie est active.
+ */
+bool sleepUntilNextSample(){
+  uint32_t ulPeriod = getSamplerPeriod();
+  if (ulPeriod < SAMPLER_MAX_PERIOD) { return false; }
+  MYDEBUG_PRINT("-SAMPLER : Voies calmes, sieste de ");
+  MYDEBUG_PRINT(ulPeriod / 1000);
+  MYDEBUG_PRINTLN(" s");
+  saveTimeBeforeSleep(ulPeriod * 1000);                      // L'heure sera connue au réveil
+  ESP.deepSleep(ulPeriod * 1000, RF_CAL);
+  return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// API HTTP
+// ------------------------------------------------------------------------------------------------
+/**
+ * GET /api/sampler : période courante et statistiques de chaque voie
+ * {"periodMs":5000,"defaultMs":5000,"channels":[{"name":"soil","periodMs":1000,"samples":...,
+ *  "boosts":...,"mean":41.2,"deviation":0.35,"slope":6.40},...]}
+ */
+void handleSampler(){
+  char cBuffer[192];
+  HTTPServer.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  snprintf(cBuffer, sizeof(cBuffer), "{\"periodMs\":%lu,\"defaultMs\":%lu,\"channels\":[",
+           (unsigned long)getSamplerPeriod(), (unsigned long)ulSamplerDefault);
+  HTTPServer.send(200, "application/json", cBuffer);
+  for (uint8_t c = 0; c < SENSOR_NB_CHANNELS; c++) {
+    const SamplerChannel &channel = samplerChannels[c];
+    char cMean[14] = "null", cDeviation[14] = "null", cSlope[14];
+    if (!fixedIsNan(channel.lMean)) {
+      formatFixed(cMean, channel.lMean, sensors.channel(c)->ucDecimals + 1);
+      formatFixed(cDeviation, channel.lDeviation, FIXED_DECIMALS);
+    }
+    formatFixed(cSlope, channel.lSlope, FIXED_DECIMALS);
+    snprintf(cBuffer, sizeof(cBuffer),
+             "%s{\"name\":\"%s\",\"periodMs\":%lu,\"samples\":%lu,\"boosts\":%lu,\"mean\":%s,\"deviation\":%s,\"slope\":%s}",
+             c > 0 ? "," : "", sensors.channel(c)->strName, (unsigned long)channel.ulPeriod,
+             (unsigned long)channel.ulSamples, (unsigned long)channel.ulBoosts, cMean, cDeviation, cSlope);
+    HTTPServer.sendContent(cBuffer);
+  }
+  HTTPServer.sendContent("]}");
+  HTTPServer.sendContent("");                                // Fin de la réponse
+}
+
+// ------------------------------------------------------------------------------------------------
+// BENCHMARK
+// ------------------------------------------------------------------------------------------------
+#ifdef MYDEBUG
+/** Humidité du sol de la trace : stable 1 h, arrosage de 40 à 80 % en 5 min, puis lent séchage */
+Fixed samplerBenchTruth(uint32_t ulTime){
+  if (ulTime < 3600000) { return FIXED(40); }
+  if (ulTime < 3900000) { return FIXED(40) + fixedMulDiv(FIXED(40), ulTime - 3600000, 300000); }
+  return FIXED(80) - fixedMulDiv(FIXED(10), ulTime - 3900000, 3300000);
+}
+
+/** Mesure bruitée (±0.3 %, générateur pseudo-aléatoire déterministe) */
+Fixed samplerBenchMeasure(uint32_t ulTime, uint32_t &ulSeed){
+  ulSeed = ulSeed * 1103515245 + 12345;
+  return samplerBenchTruth(ulTime) + (Fixed)((ulSeed >> 16) % 61) - 30;
+}
+
+/**
+ * Rejeu de la trace avec une période fixe (bAdaptive false) ou adaptative. Renvoie le nombre de
+ * mesures, et dans lError l'erreur absolue moyenne de l'interpolation linéaire entre les mesures.
+ */
+uint32_t samplerBenchRun(bool bAdaptive, Fixed &lError){
+  const uint32_t ulDuration = 7200000;
+  SamplerChannel channel;
+  samplerReset(channel, ulSamplerDefault);
+  uint32_t ulSeed = 1;
+  uint32_t ulSamples = 0, ulPrevTime = 0;
+  Fixed lPrevValue = FIXED_NAN;
+  int64_t llErrorSum = 0;
+  for (uint32_t ulTime = 0; ulTime <= ulDuration; ) {
+    Fixed lValue = samplerBenchMeasure(ulTime, ulSeed);
+    ulSamples++;
+    if (!fixedIsNan(lPrevValue)) {                           // Erreur de reconstruction depuis la mesure précédente
+      for (uint32_t t = ulPrevTime; t < ulTime; t += SAMPLER_BENCH_STEP) {
+        Fixed lInterpolated = lPrevValue + fixedMulDiv(lValue - lPrevValue, t - ulPrevTime, ulTime - ulPrevTime);
+        llErrorSum += abs(lInterpolated - samplerBenchTruth(t));
+      }
+    }
+    lPrevValue = lValue;
+    ulPrevTime = ulTime;
+    if (bAdaptive) { samplerUpdate(channel, lValue, ulTime, SoilMoistureSensor::CHANNELS[0].lActivity); }
+    uint32_t ulPeriod = bAdaptive ? channel.ulPeriod : ulSamplerDefault;
+    ulTime += (ulPeriod + SAMPLER_BENCH_STEP / 2) / SAMPLER_BENCH_STEP * SAMPLER_BENCH_STEP;   // Arrondi à la résolution de la trace
+    yield();
+  }
+  lError = (Fixed)(llErrorSum / (ulPrevTime / SAMPLER_BENCH_STEP));
+  return ulSamples;
+}
+
+void benchmarkSampler(){
+  Fixed lFixedError, lAdaptiveError;
+  uint32_t ulFixed = samplerBenchRun(false, lFixedError);
+  uint32_t ulAdaptive = samplerBenchRun(true, lAdaptiveError);
+  MYDEBUG_PRINT("-SAMPLER : Trace de 2 h, période fixe ");
+  MYDEBUG_PRINT(ulFixed);
+  MYDEBUG_PRINT(" mesures (erreur moyenne ");
+  MYDEBUG_PRINT(fixedToFloat(lFixedError));
+  MYDEBUG_PRINT(" %), adaptative ");
+  MYDEBUG_PRINT(ulAdaptive);
+  MYDEBUG_PRINT(" mesures (erreur moyenne ");
+  MYDEBUG_PRINT(fixedToFloat(lAdaptiveError));
+  MYDEBUG_PRINTLN(" %)");
+}
+#endif
+
+/**
+ * Initialisation : période de départ des voies (période fixe des mesures), ou période maximum au
+ * réveil de Deep Sleep (l'objet ne s'est endormi que si les voies étaient calmes)
+ */
+void setupSampler(uint32_t ulDefaultPeriod){
+  ulSamplerDefault = ulDefaultPeriod;
+  bool bWake = (ESP.getResetInfoPtr()->reason == REASON_DEEP_SLEEP_AWAKE);
+  for (uint8_t s = 0; s < Sensors::NB_SENSORS; s++) {
+    uint8_t ucLast = (s + 1 < Sensors::NB_SENSORS) ? sensors.firstChannel(s + 1) : SENSOR_NB_CHANNELS;
+    for (uint8_t c = sensors.firstChannel(s); c < ucLast; c++) { aucSamplerSensor[c] = s; }
+  }
+  for (uint8_t c = 0; c < SENSOR_NB_CHANNELS; c++) {
+    samplerReset(samplerChannels[c], bWake ? SAMPLER_MAX_PERIOD : ulDefaultPeriod);
+    aulSamplerLastSample[c] = 0;
+  }
+  registerHttpRoute("/api/sampler", HTTP_GET, handleSampler);
+#ifdef MYDEBUG
+  benchmarkSampler();                                        // Nombre de mesures et erreur, période fixe et adaptative
+#endif
+}
@@ -0,0 +1,156 @@
+/**
+ * \file MySensor.h
+ * \page sensor Capteurs
+ * \brief Cadre générique des capteurs, résolu à la compilation (CRTP), sans appel virtuel ni allocation
+ *
+ * Chaque capteur est une classe qui hérite de Sensor<T, N>, où T est la classe elle-même (Curiously
+ * Recurring Template Pattern) et N son nombre de voies de mesure. Elle déclare à la compilation :
+ * - NAME : nom du capteur ;
+ * - CHANNELS : tableau de N SensorChannel (nom, clé courte, unité, décimales et seuil d'activité de
+ *   chaque voie) ;
+ * - MIN_PERIOD_MS : période minimum entre 2 échantillonnages (le DHT11 ne supporte pas mieux qu'1 s) ;
+ * - COST_US : coût d'un échantillonnage, pour le budget de temps de la boucle (cf. \ref watchdog) ;
+ * et implémente :
+ * - bool sample(Fixed *alValues) : lecture des N voies en virgule fixe (cf. \ref fixed), false en
+ *   cas d'erreur de lecture ;
+ * - optionnellement setup() et loop() (mesures qui se terminent sur plusieurs itérations de la boucle).
+ *
+ * Sensor<T, N> appelle ces fonctions par un static_cast : tout est résolu à la compilation et peut
+ * être inliné. Il gère la période minimum (un capteur sollicité trop tôt garde ses dernières valeurs),
+ * les erreurs de lecture (les voies passent à FIXED_NAN) et mesure le coût réel de chaque échantillonnage.
+ *
+ * Les capteurs sont ensuite regroupés dans une SensorList<...> (cf. \ref sensors) : une liste de types
+ * dont les voies sont numérotées à la suite, dans l'ordre des capteurs. Les modules qui publient ou
+ * enregistrent les mesures parcourent la liste au lieu de citer chaque capteur : ajouter un capteur
+ * revient à écrire sa classe et à l'ajouter à la liste.
+ *
+ * Fichier \ref MySensor.h
+ */
+
+/** Description d'une voie de mesure */
+struct SensorChannel {
+  const char *strName;                    /*!< Nom (API HTTP, agrégats, feeds Adafruit IO) */
+  const char *strKey;                     /*!< Clé courte (publication groupée) */
+  const char *strUnit;
+  uint8_t     ucDecimals;                 /*!< Décimales publiées */
+  Fixed       lActivity;                  /*!< Pente (par minute) ou écart significatif : au-delà, les mesures accélèrent (cf. \ref sampler) */
+};
+
+/** Etat commun à tous les capteurs, consultable sans connaître leur type */
+struct SensorInfo {
+  const char *strName;
+  uint32_t    ulMinPeriod;                /*!< Période minimum entre 2 échantillonnages (ms) */
+  uint32_t    ulCostUs;                   /*!< Coût déclaré d'un échantillonnage (µs) */
+  uint32_t    ulLastCostUs;               /*!< Coût mesuré du dernier échantillonnage (µs) */
+  uint32_t    ulMaxCostUs;                /*!< Coût mesuré maximum (µs) */
+  uint32_t    ulLastSample;               /*!< Date (millis) du dernier échantillonnage */
+  uint32_t    ulSamples;
+  uint32_t    ulErrors;
+};
+
+/**
+ * Capteur de classe T à N voies de mesure
+ */
+template <class T, uint8_t N> class Sensor : public SensorInfo {
+public:
+  static const uint8_t NB_CHANNELS = N;
+  Fixed alValues[N];                      /*!< Dernières valeurs, FIXED_NAN si pas encore lues ou en erreur */
+
+  /** Initialisation, avant la première mesure */
+  void begin(){
+    strName = T::NAME;
+    ulMinPeriod = T::MIN_PERIOD_MS;
+    ulCostUs = T::COST_US;
+    ulLastCostUs = ulMaxCostUs = ulLastSample = ulSamples = ulErrors = 0;
+    for (uint8_t c = 0; c < N; c++) { alValues[c] = FIXED_NAN; }
+    self().setup();
+  }
+
+  /** Echantillonnage si la période minimum est écoulée. Renvoie true si les valeurs ont été lues. */
+  bool update(uint32_t ulNow){
+    if (ulSamples > 0 && ulNow - ulLastSample < ulMinPeriod) { return false; }
+    ulLastSample = ulNow;
+    ulSamples++;
+    uint32_t ulStart = micros();
+    bool bOk = self().sample(alValues);
+    ulLastCostUs = micros() - ulStart;
+    if (ulLastCostUs > ulMaxCostUs) { ulMaxCostUs = ulLastCostUs; }
+    if (!bOk) {
+      ulErrors++;
+      for (uint8_t c = 0; c < N; c++) { alValues[c] = FIXED_NAN; }
+    }
+    return bOk;
+  }
+
+  /** A chaque itération de la boucle */
+  void poll(){ self().loop(); }
+
+  Fixed value(uint8_t ucChannel) const { return alValues[ucChannel]; }
+  static const SensorChannel &channel(uint8_t ucChannel) { return T::CHANNELS[ucChannel]; }
+
+  // Par défaut, rien à faire (masquées par T si besoin)
+  void setup(){}
+  void loop(){}
+
+private:
+  T &self(){ return static_cast<T&>(*this); }
+};
+
+/**
+ * Liste de capteurs, parcourue à la compilation. Les voies sont numérotées à la suite, dans l'ordre
+ * des capteurs.
+ */
+template <class... S> class SensorList;
+
+template <> class SensorList<> {
+public:
+  static const uint8_t  NB_SENSORS = 0;
+  static const uint8_t  NB_CHANNELS = 0;
+  static const uint32_t COST_US = 0;
+  void begin(){}
+  void update(uint32_t ulNow){}
+  void poll(){}
+  void values(Fixed *alValues) const {}
+  Fixed value(uint8_t ucChannel) const { return FIXED_NAN; }
+  const SensorChannel *channel(uint8_t ucChannel) const { return NULL; }
+  const SensorInfo *info(uint8_t ucSensor) const { return NULL; }
+  uint8_t firstChannel(uint8_t ucSensor) const { return 0; }
+};
+
+template <class Head, class... Tail> class SensorList<Head, Tail...> {
+public:
+  static const uint8_t  NB_SENSORS = 1 + SensorList<Tail...>::NB_SENSORS;
+  static const uint8_t  NB_CHANNELS = Head::NB_CHANNELS + SensorList<Tail...>::NB_CHANNELS;
+  static const uint32_t COST_US = Head::COST_US + SensorList<Tail...>::COST_US;   /*!< Coût d'un échantillonnage complet */
+
+  SensorList(Head &head, Tail&... tail) : head(head), tail(tail...) {}
+
+  void begin(){ head.begin(); tail.begin(); }
+  void update(uint32_t ulNow){ head.update(ulNow); tail.update(ulNow); }
+  void poll(){ head.poll(); tail.poll(); }
+
+  /** Copie des valeurs de toutes les voies (NB_CHANNELS valeurs) */
+  void values(Fixed *alValues) const {
+    memcpy(alValues, head.alValues, sizeof(head.alValues));
+    tail.values(alValues + Head::NB_CHANNELS);
+  }
+  Fixed value(uint8_t ucChannel) const {
+    return ucChannel < Head::NB_CHANNELS ? head.value(ucChannel) : tail.value(ucChannel - Head::NB_CHANNELS);
+  }
+  /** Description d'une voie, NULL si elle n'existe pas */
+  const SensorChannel *channel(uint8_t ucChannel) const {
+    return ucChannel < Head::NB_CHANNELS ? &Head::channel(ucChannel) : tail.channel(ucChannel - Head::NB_CHANNELS);
+  }
+  /** Etat d'un capteur, NULL s'il n'existe pas */
+  const SensorInfo *info(uint8_t ucSensor) const {
+    return ucSensor == 0 ? &head : tail.info(ucSensor - 1);
+  }
+  /** Numéro de la première voie d'un capteur */
+  uint8_t firstChannel(uint8_t ucSensor) const {
+    return ucSensor == 0 ? 0 : Head::NB_CHANNELS + tail.firstChannel(ucSensor - 1);
+  }
+
+private:
+  Head &head;
+  SensorList<Tail...> tail;
+};
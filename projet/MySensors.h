@@ -0,0 +1,111 @@
+/**
+ * \file MySensors.h
+ * \page sensors Registre des capteurs
+ * \brief Liste des capteurs de l'objet, échantillonnés et publiés sans les citer un par un
+ *
+ * Les capteurs (cf. \ref sensor) sont regroupés dans la liste Sensors. Leurs voies sont numérotées à
+ * la suite, dans l'ordre de la liste :
+ * | Voie | Nom         | Capteur              |
+ * |------|-------------|----------------------|
+ * | 0    | soil        | \ref soilsensor      |
+ * | 1    | temperature | \ref dht             |
+ * | 2    | humidity    | \ref dht             |
+ * | 3    | dryness     | \ref soilsensor      |
+ *
+ * Les modules qui exploitent les mesures (\ref timeseries, \ref rollup, \ref rules, \ref adafruitio)
+ * parcourent la liste : pour ajouter un capteur, il suffit d'écrire sa classe et de l'ajouter à la
+ * fin de Sensors, sans toucher aux publications. Ajouter les voies à la fin conserve la numérotation
+ * des voies existantes (règles enregistrées).
+ *
+ * sampleSensors() échantillonne tous les capteurs dont la période minimum est écoulée, loopSensors()
+ * fait avancer les mesures en plusieurs temps (balayage des sondes du sol). L'état des capteurs,
+ * leurs voies et leurs dernières valeurs sont consultables via GET /api/sensors (cf. \ref httpserver),
+ * avec le coût déclaré et mesuré de chaque échantillonnage.
+ *
+ * Fichier \ref MySensors.h
+ */
+
+typedef SensorList<SoilMoistureSensor, DhtSensor, SoilDrynessSensor> Sensors;
+Sensors sensors(soilSensor, dhtSensor, drySensor);
+
+#define SENSOR_NB_CHANNELS  Sensors::NB_CHANNELS
+// Voies utilisées directement par les autres modules
+#define SENSOR_SOIL         0
+#define SENSOR_TEMPERATURE  1
+#define SENSOR_HUMIDITY     2
+#define SENSOR_DRYNESS      3
+
+/**
+ * Echantillonnage des capteurs dont la période minimum est écoulée
+ */
+void sampleSensors(){
+  sensors.update(millis());
+}
+
+/**
+ * Mesures en plusieurs temps, à chaque itération de la boucle
+ */
+void loopSensors(){
+  sensors.poll();
+}
+
+/**
+ * Echéance pour la gestion de l'énergie (cf. \ref power) : pas d'attente pendant un balayage des sondes
+ */
+uint32_t sensorsNextWake(){
+  return soilSensor.cScanProbe >= 0 ? 0 : UINT32_MAX;
+}
+
+/**
+ * GET /api/sensors : capteurs, voies et dernières valeurs
+ * {"costUs":...,"sensors":[{"name":"dht","periodMs":5000,"costUs":25000,"lastUs":...,"maxUs":...,
+ *  "samples":...,"errors":...,"channels":[{"name":"temperature","unit":"°C","value":21.0},...]},...]}
+ */
+void handleSensors(){
+  char cBuffer[192];
+  HTTPServer.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  snprintf(cBuffer, sizeof(cBuffer), "{\"costUs\":%lu,\"sensors\":[", (unsigned long)Sensors::COST_US);
+  HTTPServer.send(200, "application/json", cBuffer);
+  for (uint8_t s = 0; s < Sensors::NB_SENSORS; s++) {
+    const SensorInfo *info = sensors.info(s);
+    snprintf(cBuffer, sizeof(cBuffer),
+             "%s{\"name\":\"%s\",\"periodMs\":%lu,\"costUs\":%lu,\"lastUs\":%lu,\"maxUs\":%lu,\"samples\":%lu,\"errors\":%lu,\"channels\":[",
+             s > 0 ? "," : "", info->strName, (unsigned long)info->ulMinPeriod, (unsigned long)info->ulCostUs,
+             (unsigned long)info->ulLastCostUs, (unsigned long)info->ulMaxCostUs, (unsigned long)info->ulSamples,
+             (unsigned long)info->ulErrors);
+    HTTPServer.sendContent(cBuffer);
+    uint8_t ucLast = SENSOR_NB_CHANNELS;
+    if (s + 1 < Sensors::NB_SENSORS) { ucLast = sensors.firstChannel(s + 1); }
+    for (uint8_t c = sensors.firstChannel(s); c < ucLast; c++) {
+      const SensorChannel *channel = sensors.channel(c);
+      Fixed lValue = sensors.value(c);
+      char cValue[14] = "null";
+      if (!fixedIsNan(lValue)) { formatFixed(cValue, lValue, channel->ucDecimals); }
+      snprintf(cBuffer, sizeof(cBuffer), "%s{\"name\":\"%s\",\"unit\":\"%s\",\"value\":%s}",
+               c > sensors.firstChannel(s) ? "," : "", channel->strName, channel->strUnit, cValue);
+      HTTPServer.sendContent(cBuffer);
+    }
+    HTTPServer.sendContent("]}");
+  }
+  HTTPServer.sendContent("]}");
+  HTTPServer.sendContent("");                                // Fin de la réponse
+}
+
+/**
+ * Initialisation de tous les capteurs
+ */
+void setupSensors(){
+  sensors.begin();
+  MYDEBUG_PRINT("-SENSORS : ");
+  MYDEBUG_PRINT(Sensors::NB_SENSORS);
+  MYDEBUG_PRINT(" capteurs, ");
+  MYDEBUG_PRINT(SENSOR_NB_CHANNELS);
+  MYDEBUG_PRINT(" voies, échantillonnage en ");
+  MYDEBUG_PRINT(Sensors::COST_US);
+  MYDEBUG_PRINTLN(" µs au plus");
+  registerHttpRoute("/api/sensors", HTTP_GET, handleSensors);
+  registerPowerWake(sensorsNextWake);
+#ifdef MYDEBUG
+  benchmarkFixed();                                          // Coût des mesures en float et en virgule fixe
+#endif
+}
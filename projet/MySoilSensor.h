@@ -1,9 +1,36 @@
 /**
  * \file MySoilSensor.h
  * \page soilsensor Capteur d'humidité du sol
- * \brief Capteur analogique et numérique
- * 
- * 
+ * \brief Capteur analogique et numérique, plusieurs sondes via un multiplexeur analogique
+ *
+ * Le module comporte deux capteurs distincts (cf. \ref sensor) :
+ * - SoilMoistureSensor : la mesure analogique d'humidité (voie "soil", en %) ;
+ * - SoilDrynessSensor : la sortie numérique du comparateur, réglé par le potentiomètre du module
+ *   (voie "dryness" : 1 si le sol est sec).
+ *
+ * L'ESP8266 n'a qu'une entrée analogique (A0). Pour suivre plusieurs pots avec un seul NodeMCU, les
+ * sondes sont branchées sur un multiplexeur analogique (CD4051 : 8 voies, CD74HC4067 : 16 voies)
+ * dont la sortie commune est reliée à A0 et les entrées de sélection aux broches aucSoilMuxPins.
+ * Avec SOIL_NB_PROBES à 1, la sonde est branchée directement sur A0, sans multiplexeur.
+ *
+ * Le balayage des sondes ne bloque pas la boucle : un échantillonnage démarre un balayage, puis
+ * loop() sélectionne une voie, attend son temps de stabilisation (l'entrée du multiplexeur et
+ * la sonde forment un filtre RC : auiSettleUs, par sonde) sans bloquer, puis lit la voie
+ * (moyenne de SOIL_OVERSAMPLE lectures) et passe à la suivante. Le temps de boucle ne dépend donc pas
+ * du nombre de sondes.
+ *
+ * Les mesures sont rangées par tableaux (structure of arrays) : les valeurs brutes, les pourcentages et
+ * la calibration de chaque sonde sont dans des tableaux séparés, parcourus d'un bloc pour la
+ * conversion et la publication. Chaque sonde a sa propre calibration (valeurs brutes à sec et dans
+ * l'eau, auiDry et auiWet) : deux sondes du même modèle ne donnent pas la même mesure.
+ *
+ * A la fin d'un balayage, la voie "soil" reçoit la moyenne des sondes (c'est la mesure utilisée par
+ * les autres modules), et bScanReady signale qu'un balayage est prêt à être publié en un seul message
+ * (cf. \ref mqtt et \ref codec) : le nombre de messages ne dépend pas non plus du nombre de sondes.
+ *
+ * \note Avec plusieurs sondes, la voie "soil" est celle du balayage précédent à la fin de
+ * l'échantillonnage : le nouveau balayage se termine pendant les itérations suivantes de la boucle.
+ *
  * Fichier \ref MySoilSensor.h
  */
 
@@ -11,27 +38,135 @@
 #define SOIL_ANALOG_PIN   A0      // PIN digitale du niveau d'humidité du sol
 #define MOISTURE_HIGH     1024    // Calibration du capteur : valeur haute (sec)
 #define MOISTURE_LOW      0       // Calibration du capteur : valeur basse (dans l'eau)
-int iSoilMoisture;                // Taux d'humidité du sol, mesure analogique
-int iDigitalThreshold;            // 0 ou 1 si le seuil défini par le potentiomètre est atteint
-
-void setupSoilSensor(){
-  pinMode(SOIL_ANALOG_PIN, INPUT);
-  pinMode(SOIL_DIGITAL_PIN, INPUT);
-}
-
-void getSoilData(){
-  // MOISTURE - ANALOG
-  iSoilMoisture = analogRead(SOIL_ANALOG_PIN);
-  iSoilMoisture = map(iSoilMoisture,MOISTURE_HIGH,MOISTURE_LOW,0,100);
-  MYDEBUG_PRINT("-SOL : [");
-  MYDEBUG_PRINT(iSoilMoisture);
-  MYDEBUG_PRINTLN("%] humidité !");  
-
-  // THRESHOLD - DIGITAL
-  iDigitalThreshold = digitalRead(SOIL_DIGITAL_PIN);
-  if(iDigitalThreshold == HIGH){
-    MYDEBUG_PRINTLN("-SOL : Le sol est sec !");
-  } else {
-    MYDEBUG_PRINTLN("-SOL : Le sol n'est pas trop sec");
-  }
-}
+#define SOIL_NB_PROBES    1       // Nombre de sondes : 1 sans multiplexeur, jusqu'à 16 avec
+#define SOIL_MUX_BITS     4       // Entrées de sélection du multiplexeur : 3 (CD4051) ou 4 (CD74HC4067)
+#define SOIL_SETTLE_US    2000    // Temps de stabilisation par défaut après un changement de voie (µs)
+#define SOIL_OVERSAMPLE   4       // Nombre de lectures moyennées par sonde
+
+const uint8_t aucSoilMuxPins[SOIL_MUX_BITS] = {D5, D6, D7, D8};   // Sélection de la voie, bit de poids faible en premier
+
+// ------------------------------------------------------------------------------------------------
+// HUMIDITE (ANALOGIQUE)
+// ------------------------------------------------------------------------------------------------
+class SoilMoistureSensor : public Sensor<SoilMoistureSensor, 1> {
+public:
+  static constexpr const char *NAME = "soil";
+  static const SensorChannel CHANNELS[];
+  static constexpr uint32_t MIN_PERIOD_MS = 0;
+  static constexpr uint32_t COST_US = SOIL_OVERSAMPLE * 100 + 50;   // Une voie lue par échantillonnage (~100 µs par analogRead)
+  enum { MOISTURE = 0 };
+
+  // Sondes : un tableau par champ
+  uint16_t auiRaw[SOIL_NB_PROBES];        /*!< Dernière valeur brute */
+  uint8_t  aucPercent[SOIL_NB_PROBES];    /*!< Dernière humidité (%) */
+  uint16_t auiDry[SOIL_NB_PROBES];        /*!< Calibration : valeur brute à sec */
+  uint16_t auiWet[SOIL_NB_PROBES];        /*!< Calibration : valeur brute dans l'eau */
+  uint16_t auiSettleUs[SOIL_NB_PROBES];   /*!< Temps de stabilisation de la voie */
+  // Balayage
+  int8_t   cScanProbe = -1;               /*!< Sonde en cours de stabilisation, -1 si pas de balayage */
+  uint32_t ulSelectedAt = 0;              /*!< Date (micros) de la sélection de la voie */
+  uint32_t ulScanStart = 0;
+  uint32_t ulScanUs = 0;                  /*!< Durée du dernier balayage */
+  bool     bScanReady = false;            /*!< Balayage terminé, pas encore publié */
+
+  /** Calibration d'une sonde : valeurs brutes à sec et dans l'eau */
+  void setCalibration(uint8_t ucProbe, uint16_t uiDry, uint16_t uiWet){
+    if (ucProbe >= SOIL_NB_PROBES) { return; }
+    auiDry[ucProbe] = uiDry;
+    auiWet[ucProbe] = uiWet;
+  }
+
+  void setup(){
+    pinMode(SOIL_ANALOG_PIN, INPUT);
+#if SOIL_NB_PROBES > 1
+    for (uint8_t b = 0; b < SOIL_MUX_BITS; b++) { pinMode(aucSoilMuxPins[b], OUTPUT); }
+#endif
+    for (uint8_t i = 0; i < SOIL_NB_PROBES; i++) {
+      setCalibration(i, MOISTURE_HIGH, MOISTURE_LOW);
+      auiSettleUs[i] = (SOIL_NB_PROBES > 1) ? SOIL_SETTLE_US : 0;   // Sans multiplexeur : rien à stabiliser
+    }
+  }
+
+  /** Démarrage d'un balayage des sondes. Avec une seule sonde, la mesure est immédiate. */
+  bool sample(Fixed *alValues){
+    if (cScanProbe < 0) {                                      // Sinon, balayage précédent pas terminé
+      ulScanStart = micros();
+      cScanProbe = 0;
+      select(0);
+      loop();
+    }
+    return true;
+  }
+
+  /** Avancement du balayage : lecture de la voie sélectionnée une fois stabilisée, puis voie suivante */
+  void loop(){
+    if (cScanProbe < 0 || micros() - ulSelectedAt < auiSettleUs[cScanProbe]) { return; }
+    uint32_t ulSum = 0;
+    for (uint8_t i = 0; i < SOIL_OVERSAMPLE; i++) { ulSum += analogRead(SOIL_ANALOG_PIN); }
+    auiRaw[cScanProbe] = ulSum / SOIL_OVERSAMPLE;
+    if (++cScanProbe < SOIL_NB_PROBES) {
+      select(cScanProbe);
+      return;
+    }
+    cScanProbe = -1;                                           // Balayage terminé
+    ulScanUs = micros() - ulScanStart;
+    convert();
+    bScanReady = true;
+    MYDEBUG_PRINT("-SOL : [");
+    MYDEBUG_PRINT(fixedToInt(alValues[MOISTURE]));
+    MYDEBUG_PRINT("%] humidité moyenne de ");
+    MYDEBUG_PRINT(SOIL_NB_PROBES);
+    MYDEBUG_PRINT(" sonde(s) en ");
+    MYDEBUG_PRINT(ulScanUs);
+    MYDEBUG_PRINTLN(" µs");
+  }
+
+private:
+  /** Sélection d'une voie du multiplexeur */
+  void select(uint8_t ucProbe){
+#if SOIL_NB_PROBES > 1
+    for (uint8_t b = 0; b < SOIL_MUX_BITS; b++) { digitalWrite(aucSoilMuxPins[b], (ucProbe >> b) & 1); }
+#endif
+    ulSelectedAt = micros();
+  }
+
+  /** Conversion des valeurs brutes de toutes les sondes, et moyenne, en entiers */
+  void convert(){
+    Fixed lSum = 0;
+    for (uint8_t i = 0; i < SOIL_NB_PROBES; i++) {
+      Fixed lPercent = constrain(fixedMap(auiRaw[i], auiDry[i], auiWet[i], 0, FIXED(100)), 0, FIXED(100));
+      aucPercent[i] = fixedToInt(lPercent);
+      lSum += lPercent;
+    }
+    alValues[MOISTURE] = lSum / SOIL_NB_PROBES;
+  }
+};
+const SensorChannel SoilMoistureSensor::CHANNELS[] = {{"soil", "soil", "%", 0, FIXED(2)}};
+
+// ------------------------------------------------------------------------------------------------
+// SECHERESSE (NUMERIQUE)
+// ------------------------------------------------------------------------------------------------
+class SoilDrynessSensor : public Sensor<SoilDrynessSensor, 1> {
+public:
+  static constexpr const char *NAME = "dryness";
+  static const SensorChannel CHANNELS[];
+  static constexpr uint32_t MIN_PERIOD_MS = 0;
+  static constexpr uint32_t COST_US = 5;
+  enum { DRY = 0 };
+
+  void setup(){
+    pinMode(SOIL_DIGITAL_PIN, INPUT);
+  }
+
+  /** HIGH si le seuil défini par le potentiomètre est atteint */
+  bool sample(Fixed *alValues){
+    bool bDry = (digitalRead(SOIL_DIGITAL_PIN) == HIGH);
+    alValues[DRY] = bDry ? FIXED_ONE : 0;
+    MYDEBUG_PRINTLN(bDry ? "-SOL : Le sol est sec !" : "-SOL : Le sol n'est pas trop sec");
+    return true;
+  }
+};
+const SensorChannel SoilDrynessSensor::CHANNELS[] = {{"dryness", "dry", "", 0, FIXED(0.5)}};
+
+SoilMoistureSensor soilSensor;
+SoilDrynessSensor  drySensor;
@@ -0,0 +1,227 @@
+/**
+ * \file MyTLS.h
+ * \page tls TLS
+ * \brief Connexions MQTT chiffrées, avec reprise de session
+ *
+ * Sur le port 1883, MQTT circule en clair : le jeton ThingsBoard (MQTT_TOKEN) et la clé Adafruit IO
+ * (IO_KEY) sont lisibles par quiconque écoute le réseau. Les deux brokers acceptent MQTT sur TLS,
+ * sur le port 8883, via BearSSL::WiFiClientSecure.
+ *
+ * Mais TLS coûte cher à un ESP8266 : une poignée de main (handshake) complète, avec ses calculs de
+ * clé publique, prend plusieurs secondes, et les buffers d'enregistrement TLS (16 Ko en réception par
+ * défaut) occupent une grande partie du tas. Ce module limite ces coûts :
+ * - Reprise de session : après une première poignée de main complète, les paramètres de session sont
+ *   conservés (BearSSL::Session). Les reconnexions suivantes réutilisent la session : une poignée de
+ *   main abrégée, sans calcul de clé publique. Chaque session est aussi sauvegardée dans le SPIFFS,
+ *   un emplacement par broker (TLS_SESSION_FILE) : elle survit à un reset, à un Deep Sleep et à une
+ *   coupure. Elle n'y est écrite qu'après une poignée de main complète : une reprise, qui garde la
+ *   même session, n'écrit pas la flash.
+ * - Buffers réduits : si le serveur accepte l'extension Maximum Fragment Length (sondée une fois, le
+ *   résultat est sauvegardé avec la session), le buffer de réception passe à TLS_RX_BUFFER octets.
+ *   Le buffer d'émission est toujours réduit à TLS_TX_BUFFER : nos messages sont courts.
+ * - Epinglage du certificat : la connexion n'est acceptée que si l'empreinte SHA-1 du certificat du
+ *   serveur est celle attendue. Pas besoin de l'heure, ni de stocker une autorité de certification.
+ *   Pour récupérer l'empreinte :
+ *   \verbatim openssl s_client -connect io.adafruit.com:8883 < /dev/null | openssl x509 -fingerprint -sha1 -noout \endverbatim
+ *   L'empreinte est obligatoire : un module compilé avec TLS et une empreinte vide ne compile pas
+ *   (static_assert), et une connexion sans empreinte est refusée. Les identifiants (clé, token) ne
+ *   partent jamais vers un serveur non authentifié.
+ *
+ * Chaque connexion est mesurée : durée de la (re)connexion (TLS et CONNECT MQTT), reprise de session
+ * ou non, et tas consommé. Les statistiques sont affichées à chaque connexion.
+ *
+ * \note L'empreinte change à chaque renouvellement du certificat du serveur : il faut alors la
+ * mettre à jour.
+ *
+ * \note Les sessions ne sont pas en mémoire RTC : deux sessions (86 octets de paramètres chacune) ne
+ * tiennent pas à côté de la fenêtre QoS, de l'heure, du watchdog et des compteurs (cf. \ref rtcmemory),
+ * et une seule faisait s'écraser les sessions des deux brokers : aucun ne reprenait la sienne après
+ * un Deep Sleep. Le SPIFFS garde en revanche le secret maître de chaque session au-delà d'une
+ * coupure : comme la clé et le token, il est lisible par qui a accès à la flash.
+ *
+ * Fichier \ref MyTLS.h
+ */
+
+#include <WiFiClientSecure.h>
+
+#define TLS_RX_BUFFER       1024          // Buffer de réception si le serveur accepte Maximum Fragment Length
+#define TLS_RX_BUFFER_MAX   16384         // Buffer de réception sinon (taille max d'un enregistrement TLS)
+#define TLS_TX_BUFFER       512           // Buffer d'émission
+#define TLS_SESSION_FILE    "/tls.bin"    // Sessions sauvegardées, un emplacement par broker
+#define TLS_SLOT_MQTT       0             // Emplacement de la session ThingsBoard (MyMQTT.h)
+#define TLS_SLOT_ADAFRUIT   1             // Emplacement de la session Adafruit IO (MyAdafruitIO.h)
+#define TLS_NB_SLOTS        2
+
+/** Session TLS sauvegardée dans le SPIFFS */
+struct TlsSavedSession {
+  uint32_t ulHost;                        /*!< CRC de l'hôte et du port, pour ne reprendre que sa session */
+  uint16_t uiRxBuffer;                    /*!< Taille du buffer de réception retenue */
+  uint16_t uiReserved;
+  uint8_t  aucParameters[88];             /*!< br_ssl_session_parameters */
+  uint32_t ulCrc;                         /*!< CRC des champs précédents : emplacement vide ou écriture interrompue */
+};
+static_assert(sizeof(br_ssl_session_parameters) <= sizeof(TlsSavedSession::aucParameters), "Session TLS trop grande");
+
+/** Connexion TLS à un broker : client, session et statistiques */
+struct TlsTransport {
+  const char                *strHost;
+  uint16_t                   uiPort;
+  const char                *strFingerprint;   /*!< Empreinte SHA-1 ("AB CD ...") du certificat attendu */
+  uint8_t                    ucSlot;           /*!< Emplacement de la session dans TLS_SESSION_FILE */
+  BearSSL::WiFiClientSecure *pClient;
+  BearSSL::Session           session;
+  uint16_t                   uiRxBuffer;       /*!< 0 tant que non déterminé */
+  uint32_t                   ulConnectStart;
+  uint32_t                   ulHeapBefore;
+  uint8_t                    ucEnergy;         /*!< Etat du bilan énergétique avant la connexion (cf. \ref energy) */
+  uint8_t                    aucSessionId[32];
+  // Statistiques
+  uint32_t                   ulConnections;
+  uint32_t                   ulResumed;        /*!< Connexions avec reprise de session */
+  uint32_t                   ulFailures;
+  uint32_t                   ulLastMs;
+  uint32_t                   ulFullMaxMs;      /*!< Pire connexion avec poignée de main complète */
+  uint32_t                   ulResumedMaxMs;   /*!< Pire connexion avec reprise de session */
+  uint32_t                   ulHeapUsed;       /*!< Tas consommé par la connexion établie */
+};
+
+/**
+ * Identifiant d'un serveur : CRC de son nom et de son port
+ */
+uint32_t tlsHostId(const TlsTransport &transport){
+  char cHost[72];
+  snprintf(cHost, sizeof(cHost), "%s:%u", transport.strHost, transport.uiPort);
+  return crc32(cHost, strlen(cHost));
+}
+
+/**
+ * Sauvegarde de la session dans l'emplacement du broker. Renvoie false en cas d'erreur.
+ */
+bool saveTLSSession(TlsTransport &transport){
+  if (!SPIFFS.begin()) { return false; }
+  if (!SPIFFS.exists(TLS_SESSION_FILE)) {                     // Création du fichier, emplacements vides
+    File file = SPIFFS.open(TLS_SESSION_FILE, "w");
+    if (!file) { return false; }
+    TlsSavedSession empty;
+    memset(&empty, 0xFF, sizeof(empty));
+    for (uint8_t i = 0; i < TLS_NB_SLOTS; i++) { file.write((uint8_t*)&empty, sizeof(empty)); }
+    file.close();
+  }
+  File file = SPIFFS.open(TLS_SESSION_FILE, "r+");
+  if (!file) { return false; }
+  TlsSavedSession saved;
+  memset(&saved, 0, sizeof(saved));
+  saved.ulHost = tlsHostId(transport);
+  saved.uiRxBuffer = transport.uiRxBuffer;
+  memcpy(saved.aucParameters, transport.session.getSession(), sizeof(br_ssl_session_parameters));
+  saved.ulCrc = crc32(&saved, offsetof(TlsSavedSession, ulCrc));
+  bool bOk = file.seek(transport.ucSlot * sizeof(saved), SeekSet)
+          && file.write((uint8_t*)&saved, sizeof(saved)) == sizeof(saved);
+  file.close();
+  return bOk;
+}
+
+/**
+ * Lecture de la session sauvegardée pour ce broker. Renvoie false s'il n'y en a pas.
+ */
+bool readTLSSession(TlsTransport &transport, TlsSavedSession &saved){
+  if (!SPIFFS.begin()) { return false; }
+  File file = SPIFFS.open(TLS_SESSION_FILE, "r");
+  if (!file) { return false; }
+  bool bOk = file.seek(transport.ucSlot * sizeof(saved), SeekSet)
+          && file.read((uint8_t*)&saved, sizeof(saved)) == sizeof(saved);
+  file.close();
+  return bOk && saved.ulCrc == crc32(&saved, offsetof(TlsSavedSession, ulCrc)) && saved.ulHost == tlsHostId(transport);
+}
+
+/**
+ * Configuration d'une connexion TLS :
+ * - Restauration de la session sauvegardée, si elle concerne ce serveur
+ * - Sinon, sondage de l'extension Maximum Fragment Length (une connexion TCP)
+ * - Buffers, session et empreinte du certificat
+ */
+void setupTLS(TlsTransport &transport, BearSSL::WiFiClientSecure &client){
+  transport.pClient = &client;
+  TlsSavedSession saved;
+  if (readTLSSession(transport, saved)) {
+    memcpy(transport.session.getSession(), saved.aucParameters, sizeof(br_ssl_session_parameters));
+    transport.uiRxBuffer = saved.uiRxBuffer;
+    MYDEBUG_PRINT("-TLS : Session restaurée pour ");
+    MYDEBUG_PRINTLN(transport.strHost);
+  }
+  if (transport.uiRxBuffer == 0) {
+    bool bMfln = BearSSL::WiFiClientSecure::probeMaxFragmentLength(transport.strHost, transport.uiPort, TLS_RX_BUFFER);
+    transport.uiRxBuffer = bMfln ? TLS_RX_BUFFER : TLS_RX_BUFFER_MAX;
+  }
+  MYDEBUG_PRINT("-TLS : ");
+  MYDEBUG_PRINT(transport.strHost);
+  MYDEBUG_PRINT(" [buffer de réception : ");
+  MYDEBUG_PRINT(transport.uiRxBuffer);
+  MYDEBUG_PRINTLN(" octets]");
+
+  client.setBufferSizes(transport.uiRxBuffer, TLS_TX_BUFFER);
+  client.setSession(&transport.session);
+  if (strlen(transport.strFingerprint) > 0) {
+    client.setFingerprint(transport.strFingerprint);
+  } else {                                                   // Ni empreinte ni autorité : la poignée de main échoue
+    MYDEBUG_PRINTLN("-TLS : Pas d'empreinte, connexion refusée");
+  }
+}
+
+/**
+ * A appeler juste avant la connexion au broker
+ */
+void tlsBeginConnect(TlsTransport &transport){
+  memcpy(transport.aucSessionId, transport.session.getSession()->session_id, sizeof(transport.aucSessionId));
+  transport.ulHeapBefore = ESP.getFreeHeap();
+  transport.ulConnectStart = millis();
+  transport.ucEnergy = energyEnter(ENERGY_TLS_HANDSHAKE);   // Connexion TCP comprise, dans le même appel
+}
+
+/**
+ * A appeler juste après la connexion au broker : mesures, et sauvegarde de la session si la
+ * connexion a réussi avec une nouvelle session. La session est reprise si le serveur a accepté
+ * l'identifiant proposé : elle est alors déjà sauvegardée.
+ */
+void tlsEndConnect(TlsTransport &transport, bool bConnected){
+  transport.ulLastMs = millis() - transport.ulConnectStart;
+  energyLeave(transport.ucEnergy);
+  if (!bConnected) {
+    transport.ulFailures++;
+    char cError[64];
+    int iError = transport.pClient->getLastSSLError(cError, sizeof(cError));
+    MYDEBUG_PRINT("-TLS : Echec de connexion [");
+    MYDEBUG_PRINT(iError);
+    MYDEBUG_PRINT(" : ");
+    MYDEBUG_PRINT(cError);
+    MYDEBUG_PRINTLN("]");
+    return;
+  }
+  const br_ssl_session_parameters *pParameters = transport.session.getSession();
+  bool bResumed = pParameters->session_id_len > 0 &&
+                  memcmp(transport.aucSessionId, pParameters->session_id, sizeof(transport.aucSessionId)) == 0;
+  transport.ulConnections++;
+  uint32_t ulHeapAfter = ESP.getFreeHeap();
+  transport.ulHeapUsed = (transport.ulHeapBefore > ulHeapAfter) ? transport.ulHeapBefore - ulHeapAfter : 0;
+  if (bResumed) {
+    transport.ulResumed++;
+    if (transport.ulLastMs > transport.ulResumedMaxMs) { transport.ulResumedMaxMs = transport.ulLastMs; }
+  } else {
+    if (transport.ulLastMs > transport.ulFullMaxMs) { transport.ulFullMaxMs = transport.ulLastMs; }
+    if (!saveTLSSession(transport)) { MYDEBUG_PRINTLN("-TLS : Sauvegarde de la session impossible"); }
+  }
+
+  MYDEBUG_PRINT("-TLS : ");
+  MYDEBUG_PRINT(transport.strHost);
+  MYDEBUG_PRINT(bResumed ? " [session reprise / " : " [poignée de main complète / ");
+  MYDEBUG_PRINT(transport.ulLastMs);
+  MYDEBUG_PRINT(" ms / tas consommé : ");
+  MYDEBUG_PRINT(transport.ulHeapUsed);
+  MYDEBUG_PRINT(" octets / tas libre : ");
+  MYDEBUG_PRINT(ulHeapAfter);
+  MYDEBUG_PRINT(" / reprises : ");
+  MYDEBUG_PRINT(transport.ulResumed);
+  MYDEBUG_PRINT("/");
+  MYDEBUG_PRINT(transport.ulConnections);
+  MYDEBUG_PRINTLN("]");
+}
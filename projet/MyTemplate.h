@@ -0,0 +1,120 @@
+/**
+ * \file MyTemplate.h
+ * \page template Pages web en flash
+ * \brief Moteur de templates : pages en PROGMEM, réponse en un minimum de segments TCP
+ *
+ * Construire une page avec des String += ou l'envoyer avec une suite de client.println() coûte cher :
+ * - Chaque += peut réallouer la String : le tas se fragmente, et la page entière finit en RAM.
+ * - Chaque println() est une écriture sur la connexion, qui part souvent dans son propre segment TCP :
+ *   une quinzaine de paquets pour une page d'un Ko.
+ * - Sans Content-Length, le client ne sait pas où finit la réponse : il faut fermer la connexion.
+ *
+ * Les pages sont donc écrites une fois pour toutes en flash (PROGMEM), avec des marqueurs {{nom}}
+ * remplacés au moment de l'envoi par un "resolver" : une fonction qui écrit la valeur du marqueur
+ * dans un Print. sendTemplate() rend la page deux fois :
+ * - Une première fois sans rien stocker, pour calculer le Content-Length.
+ * - Une seconde fois dans un buffer unique de la taille d'un segment TCP (TEMPLATE_BUFFER_SIZE),
+ *   envoyé sur la connexion à chaque fois qu'il est plein : une page d'un Ko part en une écriture,
+ *   après celle des en-têtes HTTP.
+ *
+ * \note Le resolver doit écrire la même valeur lors des deux rendus (cf. \ref mqtt, publication en flux).
+ *
+ * Fichier \ref MyTemplate.h
+ */
+
+#ifdef TCP_MSS
+#define TEMPLATE_BUFFER_SIZE  TCP_MSS     // Un segment TCP
+#else
+#define TEMPLATE_BUFFER_SIZE  1460
+#endif
+#define TEMPLATE_NAME_MAX     16          // Longueur max du nom d'un marqueur
+
+/** Resolver : écrit dans output la valeur du marqueur strName */
+typedef void (*TemplateResolver)(const char *strName, Print &output);
+
+uint8_t  aucTemplateBuffer[TEMPLATE_BUFFER_SIZE];     // Buffer de sortie, partagé par tous les envois
+// Statistiques du dernier envoi
+uint32_t ulTemplateLastUs = 0;
+uint32_t ulTemplateLastBytes = 0;
+uint8_t  ucTemplateLastWrites = 0;
+
+/**
+ * Rendu d'un template en flash dans output. Le texte est copié de la flash par blocs de 32 octets.
+ */
+void renderTemplate(Print &output, PGM_P strTemplate, TemplateResolver resolver){
+  char cChunk[32];
+  uint8_t ucChunk = 0;
+  for (PGM_P p = strTemplate; ; p++) {
+    char c = pgm_read_byte(p);
+    bool bMarker = (c == '{' && pgm_read_byte(p + 1) == '{');
+    if (c == 0 || bMarker || ucChunk == sizeof(cChunk)) {     // Envoi du texte accumulé
+      output.write((const uint8_t*)cChunk, ucChunk);
+      ucChunk = 0;
+    }
+    if (c == 0) { break; }
+    if (bMarker) {                                             // {{nom}}
+      char cName[TEMPLATE_NAME_MAX + 1];
+      uint8_t ucName = 0;
+      PGM_P q = p + 2;
+      char n;
+      while ((n = pgm_read_byte(q)) != 0 && n != '}' && ucName < TEMPLATE_NAME_MAX) { cName[ucName++] = n; q++; }
+      if (n == '}' && pgm_read_byte(q + 1) == '}') {
+        cName[ucName] = 0;
+        resolver(cName, output);
+        p = q + 1;                                             // Sur le second '}'
+        continue;
+      }
+    }
+    cChunk[ucChunk++] = c;
+  }
+}
+
+/** Print qui accumule dans le buffer de sortie et l'envoie au client HTTP quand il est plein */
+class TemplateWriter : public Print {
+public:
+  uint8_t ucWrites = 0;
+  size_t write(uint8_t ucByte) override { return write(&ucByte, 1); }
+  size_t write(const uint8_t *aucData, size_t uiSize) override {
+    size_t uiDone = 0;
+    while (uiDone < uiSize) {
+      if (uiLength == TEMPLATE_BUFFER_SIZE) { sendBuffer(); }
+      size_t uiChunk = min(uiSize - uiDone, (size_t)(TEMPLATE_BUFFER_SIZE - uiLength));
+      memcpy(aucTemplateBuffer + uiLength, aucData + uiDone, uiChunk);
+      uiLength += uiChunk;
+      uiDone += uiChunk;
+    }
+    return uiSize;
+  }
+  void sendBuffer() {
+    if (uiLength == 0) { return; }
+    HTTPServer.sendContent((const char*)aucTemplateBuffer, uiLength);
+    ucWrites++;
+    uiLength = 0;
+  }
+private:
+  size_t uiLength = 0;
+};
+
+/**
+ * Envoi d'une page : en-têtes avec Content-Length, puis la page par blocs d'un segment TCP
+ */
+void sendTemplate(int iCode, const char *strContentType, PGM_P strTemplate, TemplateResolver resolver){
+  uint32_t ulStart = micros();
+  ByteCounter counter;
+  renderTemplate(counter, strTemplate, resolver);              // Première passe : longueur
+  HTTPServer.setContentLength(counter.uiCount);
+  HTTPServer.send(iCode, strContentType, "");                  // En-têtes seuls
+  TemplateWriter writer;
+  renderTemplate(writer, strTemplate, resolver);
+  writer.sendBuffer();
+  ulTemplateLastUs = micros() - ulStart;
+  ulTemplateLastBytes = counter.uiCount;
+  ucTemplateLastWrites = writer.ucWrites + 1;                  // + les en-têtes
+  MYDEBUG_PRINT("-TEMPLATE : ");
+  MYDEBUG_PRINT(ulTemplateLastBytes);
+  MYDEBUG_PRINT(" octets en ");
+  MYDEBUG_PRINT(ucTemplateLastWrites);
+  MYDEBUG_PRINT(" écritures / ");
+  MYDEBUG_PRINT(ulTemplateLastUs);
+  MYDEBUG_PRINTLN(" µs");
+}
@@ -0,0 +1,472 @@
+/**
+ * \file MyTimeSeries.h
+ * \page timeseries Historique compressé
+ * \brief Stockage de plusieurs semaines de mesures sur le SPIFFS
+ *
+ * Stocker les mesures brutes (un horodatage et une valeur sur 32 bits par voie des capteurs, soit 20 octets par point) remplirait
+ * rapidement le SPIFFS et l'userait inutilement. Nous reprenons donc l'encodage de Gorilla
+ * (Facebook, http://www.vldb.org/pvldb/vol8/p1816-teller.pdf) qui tire parti de la régularité des
+ * séries temporelles :
+ * - Les horodatages sont codés en "delta of delta" : avec une mesure toutes les 5 secondes, le delta
+ *   est toujours le même et le delta of delta vaut 0, ce qui se code sur \b 1 \b bit.
+ * - Chaque valeur est codée par un XOR avec la valeur précédente : une valeur qui ne change pas se
+ *   code sur \b 1 \b bit, une valeur qui change peu ne conserve que les bits significatifs du XOR.
+ *   Les valeurs sont en virgule fixe (cf. \ref fixed) : une petite variation ne touche que les bits
+ *   de poids faible, le XOR garde beaucoup de zéros de tête.
+ *
+ * Les points sont ajoutés dans un bloc de taille fixe (TS_BLOCK_SIZE) en mémoire. Quand le bloc est
+ * plein, il est ajouté à la fin du fichier de données (écriture en ajout seul, jamais de réécriture)
+ * et une entrée est ajoutée au fichier d'index : l'horodatage du premier et du dernier point du bloc.
+ * Une lecture sur une période ne décode donc que les blocs concernés.
+ *
+ * Deux fichiers sont utilisés en alternance : quand le fichier courant atteint TS_MAX_BLOCKS blocs,
+ * on repart sur l'autre fichier après l'avoir effacé. On conserve ainsi entre TS_MAX_BLOCKS et
+ * 2 x TS_MAX_BLOCKS blocs d'historique.
+ *
+ * \note Le bloc en cours de remplissage est en RAM : il est perdu en cas de reset (au plus un bloc).
+ *
+ * Fichier \ref MyTimeSeries.h
+ */
+
+#include "FS.h"
+
+#define TS_BLOCK_SIZE     256             // Taille d'un bloc, entête comprise (une page SPIFFS)
+#define TS_MAX_BLOCKS     256             // Nombre de blocs par fichier (64 ko)
+#define TS_NB_VALUES      SENSOR_NB_CHANNELS   // Valeurs par point : toutes les voies des capteurs (cf. \ref sensors)
+#define TS_BLOCK_MAGIC    (0x4600 + TS_NB_VALUES)   // "F" (virgule fixe) et le nombre de valeurs : marqueur de début de bloc
+
+/** Entête d'un bloc */
+struct TsBlockHeader {
+  uint16_t uiMagic;                       /*!< TS_BLOCK_MAGIC */
+  uint16_t uiCount;                       /*!< Nombre de points dans le bloc */
+  uint16_t uiBits;                        /*!< Nombre de bits utilisés dans data */
+  uint16_t uiReserved;
+  uint32_t ulFirstTime;                   /*!< Horodatage du premier point */
+  uint32_t ulLastTime;                    /*!< Horodatage du dernier point */
+};
+
+/** Bloc de taille fixe tel qu'il est écrit sur le SPIFFS */
+struct TsBlock {
+  TsBlockHeader header;
+  uint8_t data[TS_BLOCK_SIZE - sizeof(TsBlockHeader)];
+};
+
+/** Entrée du fichier d'index, une par bloc */
+struct TsIndexEntry {
+  uint32_t ulFirstTime;
+  uint32_t ulLastTime;
+};
+
+/** Etat de l'encodeur (et du décodeur) au sein d'un bloc */
+struct TsCodecState {
+  uint16_t uiPos;                         /*!< Position en bits dans data */
+  uint32_t ulPrevTime;                    /*!< Horodatage du point précédent */
+  int32_t  lPrevDelta;                    /*!< Delta précédent entre 2 horodatages */
+  uint32_t aulPrevValue[TS_NB_VALUES];    /*!< Valeurs précédentes (Fixed) */
+  uint8_t  aucLeading[TS_NB_VALUES];      /*!< Zéros de tête du dernier XOR stocké (0xFF si aucun) */
+  uint8_t  aucTrailing[TS_NB_VALUES];     /*!< Zéros de queue du dernier XOR stocké */
+};
+
+/** Pire cas en bits d'un point : horodatage sur 4+32 bits, puis chaque valeur sur 2+5+5+32 bits */
+#define TS_POINT_MAX_BITS (36 + TS_NB_VALUES * 44)
+#define TS_DATA_BITS      ((uint16_t)(sizeof(((TsBlock*)0)->data) * 8))
+
+/** Fonction appelée pour chaque point lu */
+typedef void (*TsCallback)(uint32_t ulTime, const Fixed *alValues);
+
+const char* strTsDataFiles[2]  = {"/ts0.dat", "/ts1.dat"};   /*!< Fichiers de données */
+const char* strTsIndexFiles[2] = {"/ts0.idx", "/ts1.idx"};   /*!< Fichiers d'index */
+uint8_t     ucTsCurrentFile = 0;                             /*!< Fichier en cours d'écriture */
+uint16_t    uiTsNbBlocks = 0;                                /*!< Nombre de blocs du fichier courant */
+bool        bTsReady = false;                                /*!< SPIFFS monté et état chargé */
+TsBlock     tsBlock;                                         /*!< Bloc en cours de remplissage */
+TsCodecState tsEncoder;                                      /*!< Etat de l'encodeur */
+
+// Statistiques
+uint32_t ulTsNbPoints = 0;                // Nombre de points encodés
+uint32_t ulTsEncodedBits = 0;             // Nombre de bits produits par l'encodeur
+uint32_t ulTsEncodeMicros = 0;            // Temps cumulé d'encodage
+uint32_t ulTsNbDecoded = 0;               // Nombre de points décodés
+uint32_t ulTsDecodeMicros = 0;            // Temps cumulé de décodage
+
+// ------------------------------------------------------------------------------------------------
+// LECTURE / ECRITURE DE BITS
+// ------------------------------------------------------------------------------------------------
+/**
+ * Ecriture des ucNbBits de poids faible de ulValue (bit de poids fort en premier)
+ * \note Les données du bloc doivent avoir été mises à zéro. Les bits au-delà de TS_DATA_BITS sont
+ * ignorés : tsAppend() scelle le bloc avant, ce n'est qu'un garde-fou.
+ */
+void tsWriteBits(TsCodecState &state, uint8_t *pucData, uint32_t ulValue, uint8_t ucNbBits){
+  if (state.uiPos + ucNbBits > TS_DATA_BITS) { return; }
+  while (ucNbBits > 0) {
+    uint8_t ucFree = 8 - (state.uiPos & 7);                  // Bits libres dans l'octet courant
+    uint8_t ucNb = ucNbBits < ucFree ? ucNbBits : ucFree;
+    uint8_t ucChunk = (ulValue >> (ucNbBits - ucNb)) & ((1 << ucNb) - 1);
+    pucData[state.uiPos >> 3] |= ucChunk << (ucFree - ucNb);
+    state.uiPos += ucNb;
+    ucNbBits -= ucNb;
+  }
+}
+
+/**
+ * Lecture de ucNbBits (bit de poids fort en premier)
+ */
+uint32_t tsReadBits(TsCodecState &state, const uint8_t *pucData, uint8_t ucNbBits){
+  uint32_t ulValue = 0;
+  while (ucNbBits > 0) {
+    uint8_t ucLeft = 8 - (state.uiPos & 7);                  // Bits restants dans l'octet courant
+    uint8_t ucNb = ucNbBits < ucLeft ? ucNbBits : ucLeft;
+    uint8_t ucChunk = (pucData[state.uiPos >> 3] >> (ucLeft - ucNb)) & ((1 << ucNb) - 1);
+    ulValue = (ulValue << ucNb) | ucChunk;
+    state.uiPos += ucNb;
+    ucNbBits -= ucNb;
+  }
+  return ulValue;
+}
+
+// ------------------------------------------------------------------------------------------------
+// ENCODAGE
+// ------------------------------------------------------------------------------------------------
+/**
+ * Initialisation de l'état pour un nouveau bloc
+ */
+void tsResetState(TsCodecState &state){
+  memset(&state, 0, sizeof(state));
+  memset(state.aucLeading, 0xFF, sizeof(state.aucLeading));
+}
+
+/**
+ * Horodatage : delta of delta
+ * - '0'                   : identique au delta précédent
+ * - '10'   + 7 bits       : dans [-63, 64]
+ * - '110'  + 9 bits       : dans [-255, 256]
+ * - '1110' + 12 bits      : dans [-2047, 2048]
+ * - '1111' + 32 bits      : sinon
+ */
+void tsEncodeTime(TsCodecState &state, uint8_t *pucData, uint32_t ulTime){
+  int32_t lDelta = (int32_t)(ulTime - state.ulPrevTime);
+  int32_t lDod = lDelta - state.lPrevDelta;
+  if (lDod == 0) {
+    tsWriteBits(state, pucData, 0, 1);
+  } else if (lDod >= -63 && lDod <= 64) {
+    tsWriteBits(state, pucData, 0x2, 2);
+    tsWriteBits(state, pucData, lDod + 63, 7);
+  } else if (lDod >= -255 && lDod <= 256) {
+    tsWriteBits(state, pucData, 0x6, 3);
+    tsWriteBits(state, pucData, lDod + 255, 9);
+  } else if (lDod >= -2047 && lDod <= 2048) {
+    tsWriteBits(state, pucData, 0xE, 4);
+    tsWriteBits(state, pucData, lDod + 2047, 12);
+  } else {
+    tsWriteBits(state, pucData, 0xF, 4);
+    tsWriteBits(state, pucData, (uint32_t)lDod, 32);
+  }
+  state.lPrevDelta = lDelta;
+  state.ulPrevTime = ulTime;
+}
+
+/**
+ * Valeur : XOR avec la valeur précédente
+ * - '0'                                   : valeur identique
+ * - '10' + bits significatifs             : le XOR tient dans la fenêtre du XOR précédent
+ * - '11' + 5 bits (zéros de tête) + 5 bits (longueur - 1) + bits significatifs
+ */
+void tsEncodeValue(TsCodecState &state, uint8_t *pucData, uint8_t i, uint32_t ulValue){
+  uint32_t ulXor = ulValue ^ state.aulPrevValue[i];
+  state.aulPrevValue[i] = ulValue;
+  if (ulXor == 0) {
+    tsWriteBits(state, pucData, 0, 1);
+    return;
+  }
+  uint8_t ucLeading = __builtin_clz(ulXor);
+  uint8_t ucTrailing = __builtin_ctz(ulXor);
+  if (state.aucLeading[i] != 0xFF && ucLeading >= state.aucLeading[i] && ucTrailing >= state.aucTrailing[i]) {
+    tsWriteBits(state, pucData, 0x2, 2);
+    tsWriteBits(state, pucData, ulXor >> state.aucTrailing[i], 32 - state.aucLeading[i] - state.aucTrailing[i]);
+  } else {
+    uint8_t ucLength = 32 - ucLeading - ucTrailing;
+    tsWriteBits(state, pucData, 0x3, 2);
+    tsWriteBits(state, pucData, ucLeading, 5);
+    tsWriteBits(state, pucData, ucLength - 1, 5);
+    tsWriteBits(state, pucData, ulXor >> ucTrailing, ucLength);
+    state.aucLeading[i] = ucLeading;
+    state.aucTrailing[i] = ucTrailing;
+  }
+}
+
+// ------------------------------------------------------------------------------------------------
+// DECODAGE
+// ------------------------------------------------------------------------------------------------
+uint32_t tsDecodeTime(TsCodecState &state, const uint8_t *pucData){
+  int32_t lDod;
+  if (tsReadBits(state, pucData, 1) == 0)      { lDod = 0; }
+  else if (tsReadBits(state, pucData, 1) == 0) { lDod = (int32_t)tsReadBits(state, pucData, 7) - 63; }
+  else if (tsReadBits(state, pucData, 1) == 0) { lDod = (int32_t)tsReadBits(state, pucData, 9) - 255; }
+  else if (tsReadBits(state, pucData, 1) == 0) { lDod = (int32_t)tsReadBits(state, pucData, 12) - 2047; }
+  else                                         { lDod = (int32_t)tsReadBits(state, pucData, 32); }
+  state.lPrevDelta += lDod;
+  state.ulPrevTime += state.lPrevDelta;
+  return state.ulPrevTime;
+}
+
+uint32_t tsDecodeValue(TsCodecState &state, const uint8_t *pucData, uint8_t i){
+  if (tsReadBits(state, pucData, 1) == 0) { return state.aulPrevValue[i]; }
+  if (tsReadBits(state, pucData, 1) == 1) {
+    state.aucLeading[i] = tsReadBits(state, pucData, 5);
+    uint8_t ucLength = tsReadBits(state, pucData, 5) + 1;
+    state.aucTrailing[i] = 32 - state.aucLeading[i] - ucLength;
+  }
+  uint8_t ucLength = 32 - state.aucLeading[i] - state.aucTrailing[i];
+  state.aulPrevValue[i] ^= tsReadBits(state, pucData, ucLength) << state.aucTrailing[i];
+  return state.aulPrevValue[i];
+}
+
+/**
+ * Décodage d'un bloc complet, la callback est appelée pour chaque point compris entre ulFrom et ulTo
+ */
+void tsDecodeBlock(const TsBlock &block, uint32_t ulFrom, uint32_t ulTo, TsCallback callback){
+  TsCodecState state;
+  tsResetState(state);
+  Fixed alValues[TS_NB_VALUES];
+  uint32_t ulStart = micros();
+  for (uint16_t n = 0; n < block.header.uiCount; n++) {
+    uint32_t ulTime;
+    if (n == 0) { // Premier point : horodatage dans l'entête, valeurs brutes
+      ulTime = state.ulPrevTime = block.header.ulFirstTime;
+      for (uint8_t i = 0; i < TS_NB_VALUES; i++) {
+        state.aulPrevValue[i] = tsReadBits(state, block.data, 32);
+      }
+    } else {
+      ulTime = tsDecodeTime(state, block.data);
+      for (uint8_t i = 0; i < TS_NB_VALUES; i++) {
+        tsDecodeValue(state, block.data, i);
+      }
+    }
+    memcpy(alValues, state.aulPrevValue, sizeof(alValues));
+    if (ulTime >= ulFrom && ulTime <= ulTo) {
+      callback(ulTime, alValues);
+    }
+  }
+  ulTsDecodeMicros += micros() - ulStart;
+  ulTsNbDecoded += block.header.uiCount;
+}
+
+/**
+ * Taux de compression et débits d'encodage / décodage
+ */
+void printTimeSeriesStats(){
+  if (ulTsNbPoints == 0) { return; }
+  uint32_t ulRawBytes = ulTsNbPoints * (sizeof(uint32_t) + TS_NB_VALUES * sizeof(Fixed));
+  MYDEBUG_PRINT("-TS : Points : ");
+  MYDEBUG_PRINT(ulTsNbPoints);
+  MYDEBUG_PRINT(" / Brut : ");
+  MYDEBUG_PRINT(ulRawBytes);
+  MYDEBUG_PRINT(" o / Compressé : ");
+  MYDEBUG_PRINT(ulTsEncodedBits / 8);
+  MYDEBUG_PRINT(" o / Ratio : ");
+  MYDEBUG_PRINTLN(ulRawBytes * 8.0 / ulTsEncodedBits);
+  MYDEBUG_PRINT("-TS : Encodage : ");
+  MYDEBUG_PRINT(ulTsEncodeMicros / ulTsNbPoints);
+  MYDEBUG_PRINT(" us/point / Décodage : ");
+  MYDEBUG_PRINT(ulTsNbDecoded ? ulTsDecodeMicros / ulTsNbDecoded : 0);
+  MYDEBUG_PRINTLN(" us/point");
+}
+
+// ------------------------------------------------------------------------------------------------
+// STOCKAGE
+// ------------------------------------------------------------------------------------------------
+/**
+ * Nombre de blocs complets d'un couple de fichiers (données & index)
+ */
+uint16_t tsCountBlocks(uint8_t ucFile){
+  if (!SPIFFS.exists(strTsDataFiles[ucFile]) || !SPIFFS.exists(strTsIndexFiles[ucFile])) { return 0; }
+  File dataFile = SPIFFS.open(strTsDataFiles[ucFile], "r");
+  File indexFile = SPIFFS.open(strTsIndexFiles[ucFile], "r");
+  size_t uiNbData = dataFile.size() / sizeof(TsBlock);
+  size_t uiNbIndex = indexFile.size() / sizeof(TsIndexEntry);
+  dataFile.close();
+  indexFile.close();
+  return uiNbData < uiNbIndex ? uiNbData : uiNbIndex;       // Protection contre une écriture interrompue
+}
+
+/**
+ * Horodatage du dernier bloc d'un fichier, 0 si le fichier est vide
+ */
+uint32_t tsLastTime(uint8_t ucFile, uint16_t uiNbBlocks){
+  if (uiNbBlocks == 0) { return 0; }
+  TsIndexEntry entry = {0, 0};
+  File indexFile = SPIFFS.open(strTsIndexFiles[ucFile], "r");
+  indexFile.seek((uiNbBlocks - 1) * sizeof(TsIndexEntry));
+  indexFile.read((uint8_t*)&entry, sizeof(entry));
+  indexFile.close();
+  return entry.ulLastTime;
+}
+
+/**
+ * Ramène les fichiers de données et d'index à uiNbBlocks blocs complets (écriture interrompue)
+ */
+void tsTruncate(uint8_t ucFile, uint16_t uiNbBlocks){
+  File dataFile = SPIFFS.open(strTsDataFiles[ucFile], "r+");
+  if (dataFile && dataFile.size() != uiNbBlocks * sizeof(TsBlock)) {
+    MYDEBUG_PRINT("-TS : Bloc partiel supprimé dans ");
+    MYDEBUG_PRINTLN(strTsDataFiles[ucFile]);
+    dataFile.truncate(uiNbBlocks * sizeof(TsBlock));
+  }
+  dataFile.close();
+  File indexFile = SPIFFS.open(strTsIndexFiles[ucFile], "r+");
+  if (indexFile && indexFile.size() != uiNbBlocks * sizeof(TsIndexEntry)) {
+    indexFile.truncate(uiNbBlocks * sizeof(TsIndexEntry));
+  }
+  indexFile.close();
+}
+
+/**
+ * Début d'un nouveau bloc en mémoire
+ */
+void tsStartBlock(){
+  memset(&tsBlock, 0, sizeof(tsBlock));
+  tsBlock.header.uiMagic = TS_BLOCK_MAGIC;
+  tsResetState(tsEncoder);
+}
+
+/**
+ * Ecriture du bloc courant à la fin du fichier de données, puis de son entrée d'index.
+ * Bascule sur l'autre fichier si le fichier courant est plein. Si l'une des écritures échoue
+ * (SPIFFS plein), les fichiers sont ramenés au dernier bloc complet et le bloc est perdu : les
+ * points suivants repartent d'un bloc vide.
+ */
+void tsSealBlock(){
+  if (tsBlock.header.uiCount == 0) { return; }
+  tsBlock.header.uiBits = tsEncoder.uiPos;
+
+  if (uiTsNbBlocks >= TS_MAX_BLOCKS) {                       // Fichier plein : on bascule
+    ucTsCurrentFile = 1 - ucTsCurrentFile;
+    SPIFFS.remove(strTsDataFiles[ucTsCurrentFile]);
+    SPIFFS.remove(strTsIndexFiles[ucTsCurrentFile]);
+    uiTsNbBlocks = 0;
+    MYDEBUG_PRINT("-TS : Bascule sur le fichier ");
+    MYDEBUG_PRINTLN(strTsDataFiles[ucTsCurrentFile]);
+  }
+
+  File dataFile = SPIFFS.open(strTsDataFiles[ucTsCurrentFile], "a");
+  bool bWritten = dataFile && dataFile.write((uint8_t*)&tsBlock, sizeof(tsBlock)) == sizeof(tsBlock);
+  dataFile.close();
+  if (bWritten) {
+    TsIndexEntry entry = {tsBlock.header.ulFirstTime, tsBlock.header.ulLastTime};
+    File indexFile = SPIFFS.open(strTsIndexFiles[ucTsCurrentFile], "a");
+    bWritten = indexFile && indexFile.write((uint8_t*)&entry, sizeof(entry)) == sizeof(entry);
+    indexFile.close();
+  }
+  if (!bWritten) {
+    MYDEBUG_PRINTLN("-TS : Impossible d'écrire le bloc, bloc perdu");
+    tsTruncate(ucTsCurrentFile, uiTsNbBlocks);
+    tsStartBlock();
+    return;
+  }
+  uiTsNbBlocks++;
+
+  MYDEBUG_PRINT("-TS : Bloc écrit [");
+  MYDEBUG_PRINT(tsBlock.header.uiCount);
+  MYDEBUG_PRINT(" points / ");
+  MYDEBUG_PRINT(uiTsNbBlocks);
+  MYDEBUG_PRINTLN(" blocs]");
+  printTimeSeriesStats();
+  tsStartBlock();
+}
+
+/**
+ * Ajout d'un point (horodatage + TS_NB_VALUES valeurs) au bloc courant
+ */
+void tsAppend(uint32_t ulTime, const Fixed *alValues){
+  if (!bTsReady) { return; }
+  uint32_t ulStart = micros();
+  if (tsBlock.header.uiCount > 0 && tsEncoder.uiPos + TS_POINT_MAX_BITS > TS_DATA_BITS) {
+    tsSealBlock();
+  }
+  uint16_t uiPosBefore = tsEncoder.uiPos;
+  uint32_t aulValues[TS_NB_VALUES];
+  memcpy(aulValues, alValues, sizeof(aulValues));
+
+  if (tsBlock.header.uiCount == 0) { // Premier point : horodatage dans l'entête, valeurs brutes
+    tsBlock.header.ulFirstTime = tsEncoder.ulPrevTime = ulTime;
+    for (uint8_t i = 0; i < TS_NB_VALUES; i++) {
+      tsWriteBits(tsEncoder, tsBlock.data, aulValues[i], 32);
+      tsEncoder.aulPrevValue[i] = aulValues[i];
+    }
+  } else {
+    tsEncodeTime(tsEncoder, tsBlock.data, ulTime);
+    for (uint8_t i = 0; i < TS_NB_VALUES; i++) {
+      tsEncodeValue(tsEncoder, tsBlock.data, i, aulValues[i]);
+    }
+  }
+  tsBlock.header.ulLastTime = ulTime;
+  tsBlock.header.uiCount++;
+
+  ulTsNbPoints++;
+  ulTsEncodedBits += tsEncoder.uiPos - uiPosBefore;
+  ulTsEncodeMicros += micros() - ulStart;
+}
+
+/**
+ * Lecture de l'historique entre ulFrom et ulTo (inclus), du plus ancien au plus récent.
+ * Seuls les blocs dont l'entrée d'index chevauche la période sont lus et décodés.
+ */
+void readTimeSeries(uint32_t ulFrom, uint32_t ulTo, TsCallback callback){
+  if (!bTsReady) { return; }
+  TsBlock block;
+  for (uint8_t f = 0; f < 2; f++) {
+    uint8_t ucFile = (ucTsCurrentFile + 1 + f) % 2;          // Le fichier le plus ancien en premier
+    uint16_t uiNbBlocks = (ucFile == ucTsCurrentFile) ? uiTsNbBlocks : tsCountBlocks(ucFile);
+    if (uiNbBlocks == 0) { continue; }
+    File indexFile = SPIFFS.open(strTsIndexFiles[ucFile], "r");
+    File dataFile = SPIFFS.open(strTsDataFiles[ucFile], "r");
+    for (uint16_t b = 0; b < uiNbBlocks; b++) {
+      TsIndexEntry entry;
+      indexFile.read((uint8_t*)&entry, sizeof(entry));
+      if (entry.ulLastTime < ulFrom || entry.ulFirstTime > ulTo) { continue; }
+      dataFile.seek(b * sizeof(TsBlock));
+      if (dataFile.read((uint8_t*)&block, sizeof(block)) != sizeof(block) || block.header.uiMagic != TS_BLOCK_MAGIC) {
+        MYDEBUG_PRINTLN("-TS : Bloc corrompu");
+        continue;
+      }
+      tsDecodeBlock(block, ulFrom, ulTo, callback);
+    }
+    indexFile.close();
+    dataFile.close();
+  }
+  tsDecodeBlock(tsBlock, ulFrom, ulTo, callback);           // Et enfin le bloc en cours
+}
+
+/**
+ * Enregistrement des dernières mesures de tous les capteurs
+ */
+void recordTimeSeries(){
+  if (!isTimeSet()) { return; }                              // Mesure non horodatable
+  Fixed alValues[TS_NB_VALUES];
+  sensors.values(alValues);
+  tsAppend(timeNow(), alValues);
+}
+
+/**
+ * Montage du SPIFFS et reprise sur le fichier le plus récent
+ * \note Le SPIFFS reste monté : à appeler après les modules qui le démontent (WiFi Manager)
+ */
+void setupTimeSeries(){
+  MYDEBUG_PRINTLN("-TS : Montage du système de fichier");
+  if (!SPIFFS.begin()) {
+    MYDEBUG_PRINTLN("-TS : Impossible de monter le système de fichier");
+    return;
+  }
+  uint16_t auiNbBlocks[2] = {tsCountBlocks(0), tsCountBlocks(1)};
+  ucTsCurrentFile = (tsLastTime(1, auiNbBlocks[1]) > tsLastTime(0, auiNbBlocks[0])) ? 1 : 0;
+  uiTsNbBlocks = auiNbBlocks[ucTsCurrentFile];
+  tsTruncate(ucTsCurrentFile, uiTsNbBlocks);                 // Bloc partiel d'une écriture interrompue
+  tsStartBlock();
+  bTsReady = true;
+  MYDEBUG_PRINT("-TS : Fichier courant ");
+  MYDEBUG_PRINT(strTsDataFiles[ucTsCurrentFile]);
+  MYDEBUG_PRINT(" [");
+  MYDEBUG_PRINT(uiTsNbBlocks);
+  MYDEBUG_PRINTLN(" blocs]");
+}
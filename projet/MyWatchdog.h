@@ -0,0 +1,257 @@
+/**
+ * \file MyWatchdog.h
+ * \page watchdog Watchdog logiciel
+ * \brief Détection des blocages de la boucle, budget de latence par module
+ *
+ * Le watchdog matériel de l'ESP8266 ne redémarre le module que si le code ne rend jamais la main
+ * (environ 3 secondes sans yield() ni delay()). Une boucle qui attend en appelant delay() - connexion
+ * WiFi, tentatives de connexion MQTT, poignée de main TLS - peut en revanche bloquer loop() pendant
+ * des dizaines de secondes sans que rien ne le signale : les mesures, le serveur HTTP et les messages
+ * reçus attendent.
+ *
+ * Ce module mesure deux durées :
+ * - Le temps écoulé depuis le dernier retour de loop() (watchdogLoop(), appelée en fin de boucle),
+ *   qui ne doit pas dépasser WDT_LOOP_BUDGET.
+ * - Le temps écoulé depuis le dernier signe de vie du module en cours : chaque module entre dans sa
+ *   section avec watchdogEnter(), signale sa progression avec watchdogYield() et en sort avec
+ *   watchdogLeave(). Chaque module a son propre budget (aulWatchdogBudgets).
+ *
+ * Un Ticker vérifie ces budgets toutes les WDT_CHECK_PERIOD ms. Les callbacks des Tickers ne sont
+ * exécutés que lorsque la boucle rend la main (delay(), yield()) : c'est justement le cas des
+ * attentes à surveiller, et il n'y a pas d'accès concurrent aux variables de ce module. Dès qu'un
+ * budget est dépassé, le module fautif, la durée du blocage et un instantané de la pile de la boucle
+ * (adresse et pointeur de pile du dernier yield, premiers mots de la pile, pile libre) sont écrits en
+ * mémoire RTC (cf. \ref rtcmemory), et mis à jour tant que le blocage dure : si le blocage se termine
+ * par un reset, l'enregistrement est conservé. Un dépassement sans aucun yield, invisible au Ticker,
+ * est détecté à la sortie du module par watchdogLeave() (sans instantané de pile).
+ *
+ * Au démarrage, setupWatchdog() affiche la cause du reset, le nombre de redémarrages et de blocages
+ * par module depuis la mise sous tension, et le dernier blocage enregistré.
+ *
+ * Les boucles de connexion consultent watchdogRemaining() et abandonnent, pour réessayer à
+ * l'itération suivante, plutôt que de dépasser le budget de la boucle. Pendant le setup(), les
+ * budgets ne sont pas appliqués : l'attente du WiFi y est normale.
+ *
+ * \note Les sections peuvent s'imbriquer (setupWiFi() appelée depuis reconnectMQTT()) : watchdogEnter()
+ * renvoie le module précédent, à redonner à watchdogLeave().
+ *
+ * Fichier \ref MyWatchdog.h
+ */
+
+#include <Ticker.h>
+#include <cont.h>
+
+extern "C" cont_t *g_pcont;               // Contexte (pile) de la boucle, cf. core_esp8266_main.cpp
+
+#define WDT_CHECK_PERIOD    250           // Période de vérification des budgets (ms)
+#define WDT_LOOP_BUDGET     10000         // Durée max d'une itération de loop() (ms)
+#define WDT_STACK_WORDS     4             // Nombre de mots de pile dans l'instantané
+
+/** Modules surveillés */
+enum WatchdogModule : uint8_t {
+  WDT_LOOP = 0,                           /*!< Code de loop() hors section */
+  WDT_WIFI,
+  WDT_MQTT,
+  WDT_ADAFRUIT,
+  WDT_HTTP,
+  WDT_NTP,
+  WDT_SENSORS,
+  WDT_NB_MODULES
+};
+const char *WATCHDOG_MODULE_NAMES[WDT_NB_MODULES] = {"loop", "wifi", "mqtt", "adafruit", "http", "ntp", "sensors"};
+// Durée max sans signe de vie, par module (ms)
+const uint32_t aulWatchdogBudgets[WDT_NB_MODULES] = {1000, 1000, 8000, 8000, 500, 200, 1000};
+
+/** Statistiques et dernier blocage, conservés en mémoire RTC */
+struct WatchdogRTCRecord {
+  uint8_t  ucModule;                      /*!< Module du dernier blocage */
+  uint8_t  ucActive;                      /*!< 1 si le blocage était en cours lors de la sauvegarde */
+  uint16_t uiBoots;                       /*!< Redémarrages depuis la mise sous tension */
+  uint32_t ulDurationMs;                  /*!< Durée du dernier blocage */
+  uint32_t ulMaxMs;                       /*!< Pire blocage */
+  uint32_t ulUptimeMs;                    /*!< millis() lors du dernier blocage */
+  uint32_t ulPc;                          /*!< Adresse du dernier yield de la boucle, 0 si inconnue */
+  uint32_t ulSp;                          /*!< Pointeur de pile du dernier yield */
+  uint32_t ulFreeStack;                   /*!< Pile libre de la boucle */
+  uint32_t aulStack[WDT_STACK_WORDS];     /*!< Premiers mots de la pile au dernier yield */
+  uint8_t  aucStalls[8];                  /*!< Nombre de blocages par module (saturé à 255) */
+};
+static_assert(WDT_NB_MODULES <= sizeof(WatchdogRTCRecord::aucStalls), "Trop de modules surveillés");
+static_assert(sizeof(WatchdogRTCRecord) + 4 <= RTC_WATCHDOG_SIZE, "Enregistrement trop grand pour la mémoire RTC");
+
+Ticker            watchdogTicker;
+WatchdogRTCRecord watchdogRecord;
+uint8_t           ucWatchdogModule = WDT_LOOP;    // Module en cours
+uint32_t          ulWatchdogYield = 0;            // Dernier signe de vie du module en cours
+uint32_t          ulWatchdogLoopReturn = 0;       // Dernier retour de loop()
+bool              bWatchdogRunning = false;       // Budgets appliqués (après le setup)
+bool              bWatchdogStall = false;         // Blocage en cours
+// Statistiques depuis le démarrage
+uint32_t          ulWatchdogLoopMaxMs = 0;        // Pire itération de loop()
+uint32_t          ulWatchdogStalls = 0;
+
+// ------------------------------------------------------------------------------------------------
+// ENREGISTREMENT
+// ------------------------------------------------------------------------------------------------
+/**
+ * Enregistrement (ou mise à jour) du blocage en cours, en mémoire RTC
+ */
+void watchdogStall(uint32_t ulDurationMs, bool bSnapshot){
+  if (!bWatchdogStall) {                                       // Nouveau blocage
+    bWatchdogStall = true;
+    ulWatchdogStalls++;
+    incrementCounter(CNT_WATCHDOG_STALLS);
+    watchdogRecord.ucModule = ucWatchdogModule;
+    if (watchdogRecord.aucStalls[ucWatchdogModule] < 255) { watchdogRecord.aucStalls[ucWatchdogModule]++; }
+  }
+  watchdogRecord.ucActive = 1;
+  watchdogRecord.ulDurationMs = ulDurationMs;
+  watchdogRecord.ulUptimeMs = millis();
+  if (ulDurationMs > watchdogRecord.ulMaxMs) { watchdogRecord.ulMaxMs = ulDurationMs; }
+  if (bSnapshot) {
+    watchdogRecord.ulPc = (uint32_t)(uintptr_t)g_pcont->pc_yield;
+    watchdogRecord.ulSp = (uint32_t)(uintptr_t)g_pcont->sp_yield;
+    for (uint8_t i = 0; i < WDT_STACK_WORDS; i++) { watchdogRecord.aulStack[i] = g_pcont->sp_yield[i]; }
+  } else {
+    watchdogRecord.ulPc = watchdogRecord.ulSp = 0;
+    memset(watchdogRecord.aulStack, 0, sizeof(watchdogRecord.aulStack));
+  }
+  watchdogRecord.ulFreeStack = cont_get_free_stack(g_pcont);
+  writeRTCMemory(RTC_WATCHDOG_OFFSET, watchdogRecord);
+}
+
+/**
+ * Vérification périodique des budgets (Ticker), exécutée quand la boucle rend la main
+ */
+void watchdogCheck(){
+  if (!bWatchdogRunning) { return; }
+  uint32_t ulNow = millis();
+  uint32_t ulSinceLoop = ulNow - ulWatchdogLoopReturn;
+  if (bWatchdogStall || ulNow - ulWatchdogYield > aulWatchdogBudgets[ucWatchdogModule] || ulSinceLoop > WDT_LOOP_BUDGET) {
+    watchdogStall(ulSinceLoop, true);
+  }
+}
+
+/**
+ * Affichage du dernier blocage enregistré
+ */
+void printWatchdogRecord(){
+  MYDEBUG_PRINT("-WATCHDOG : Blocage de ");
+  MYDEBUG_PRINT(watchdogRecord.ulDurationMs);
+  MYDEBUG_PRINT(" ms dans ");
+  MYDEBUG_PRINT(WATCHDOG_MODULE_NAMES[watchdogRecord.ucModule % WDT_NB_MODULES]);
+  MYDEBUG_PRINT(" [à ");
+  MYDEBUG_PRINT(watchdogRecord.ulUptimeMs);
+  MYDEBUG_PRINT(" ms / pc : 0x");
+  MYDEBUG_PRINTHEX(watchdogRecord.ulPc);
+  MYDEBUG_PRINT(" / sp : 0x");
+  MYDEBUG_PRINTHEX(watchdogRecord.ulSp);
+  MYDEBUG_PRINT(" / pile libre : ");
+  MYDEBUG_PRINT(watchdogRecord.ulFreeStack);
+  MYDEBUG_PRINT(" / pile :");
+  for (uint8_t i = 0; i < WDT_STACK_WORDS; i++) {
+    MYDEBUG_PRINT(" 0x");
+    MYDEBUG_PRINTHEX(watchdogRecord.aulStack[i]);
+  }
+  MYDEBUG_PRINTLN("]");
+}
+
+// ------------------------------------------------------------------------------------------------
+// SECTIONS
+// ------------------------------------------------------------------------------------------------
+/**
+ * Entrée dans la section d'un module. Renvoie le module précédent, à redonner à watchdogLeave().
+ */
+uint8_t watchdogEnter(uint8_t ucModule){
+  uint8_t ucPrevious = ucWatchdogModule;
+  ucWatchdogModule = ucModule;
+  ulWatchdogYield = millis();
+  return ucPrevious;
+}
+
+/**
+ * Signe de vie du module en cours
+ */
+void watchdogYield(){
+  ulWatchdogYield = millis();
+}
+
+/**
+ * Sortie de la section d'un module. Un dépassement de budget sans aucun yield (que le Ticker n'a
+ * donc pas pu voir) est enregistré ici.
+ */
+void watchdogLeave(uint8_t ucPrevious){
+  uint32_t ulNow = millis();
+  if (bWatchdogRunning && !bWatchdogStall && ulNow - ulWatchdogYield > aulWatchdogBudgets[ucWatchdogModule]) {
+    watchdogStall(ulNow - ulWatchdogLoopReturn, false);
+  }
+  ucWatchdogModule = ucPrevious;
+  ulWatchdogYield = ulNow;
+}
+
+/**
+ * Temps restant avant le dépassement du budget de la boucle (ms), illimité pendant le setup()
+ */
+uint32_t watchdogRemaining(){
+  if (!bWatchdogRunning) { return UINT32_MAX; }
+  uint32_t ulSinceLoop = millis() - ulWatchdogLoopReturn;
+  return (ulSinceLoop < WDT_LOOP_BUDGET) ? WDT_LOOP_BUDGET - ulSinceLoop : 0;
+}
+
+/**
+ * A appeler à la fin de chaque itération de loop() : fin du blocage éventuel, et début du suivant
+ */
+void watchdogLoop(){
+  uint32_t ulNow = millis();
+  uint32_t ulElapsed = ulNow - ulWatchdogLoopReturn;
+  if (bWatchdogRunning && ulElapsed > ulWatchdogLoopMaxMs) { ulWatchdogLoopMaxMs = ulElapsed; }
+  if (bWatchdogStall) {                                        // Fin du blocage
+    bWatchdogStall = false;
+    watchdogRecord.ucActive = 0;
+    watchdogRecord.ulDurationMs = ulElapsed;
+    if (ulElapsed > watchdogRecord.ulMaxMs) { watchdogRecord.ulMaxMs = ulElapsed; }
+    writeRTCMemory(RTC_WATCHDOG_OFFSET, watchdogRecord);
+    printWatchdogRecord();
+  }
+  ucWatchdogModule = WDT_LOOP;
+  ulWatchdogLoopReturn = ulWatchdogYield = ulNow;
+  bWatchdogRunning = true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// SETUP
+// ------------------------------------------------------------------------------------------------
+/**
+ * Rapport du démarrage précédent et lancement des vérifications
+ */
+void setupWatchdog(){
+  if (!readRTCMemory(RTC_WATCHDOG_OFFSET, watchdogRecord)) {
+    memset(&watchdogRecord, 0, sizeof(watchdogRecord));        // Mise sous tension
+  }
+  watchdogRecord.uiBoots++;
+  MYDEBUG_PRINT("-WATCHDOG : Démarrage n°");
+  MYDEBUG_PRINT(watchdogRecord.uiBoots);
+  MYDEBUG_PRINT(" [reset : ");
+  MYDEBUG_PRINT(ESP.getResetReason());
+  MYDEBUG_PRINT(" / pire blocage : ");
+  MYDEBUG_PRINT(watchdogRecord.ulMaxMs);
+  MYDEBUG_PRINT(" ms / blocages :");
+  for (uint8_t i = 0; i < WDT_NB_MODULES; i++) {
+    MYDEBUG_PRINT(" ");
+    MYDEBUG_PRINT(WATCHDOG_MODULE_NAMES[i]);
+    MYDEBUG_PRINT("=");
+    MYDEBUG_PRINT(watchdogRecord.aucStalls[i]);
+  }
+  MYDEBUG_PRINTLN("]");
+  if (watchdogRecord.ulDurationMs > 0) {
+    if (watchdogRecord.ucActive) {                             // Le blocage s'est terminé par un reset
+      MYDEBUG_PRINTLN("-WATCHDOG : Le dernier blocage s'est terminé par un reset");
+    }
+    printWatchdogRecord();
+  }
+  watchdogRecord.ucActive = 0;
+  writeRTCMemory(RTC_WATCHDOG_OFFSET, watchdogRecord);
+
+  ulWatchdogLoopReturn = ulWatchdogYield = millis();
+  watchdogTicker.attach_ms(WDT_CHECK_PERIOD, watchdogCheck);
+}
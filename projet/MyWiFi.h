@@ -55,14 +55,26 @@ void setupWiFi(){
   /* Explicitly set the ESP8266 to be a WiFi-client, otherwise, it by default,
      would try to act as both a client and an access-point and could cause
      network-issues with your other WiFi-devices on your WiFi-network. */
+  uint8_t ucWatchdog = watchdogEnter(WDT_WIFI);
+  uint8_t ucEnergy = energyEnter(ENERGY_WIFI_ASSOC);
   WiFi.mode(WIFI_STA);
   WiFi.begin(ssid, password);
+  incrementCounter(CNT_WIFI_ATTEMPTS);
 
   while (WiFi.status() != WL_CONNECTED) {
+    if (watchdogRemaining() < 500) {                   // Budget de la boucle épuisé : on réessaiera plus tard
+      MYDEBUG_PRINTLN(" [abandon]");
+      energyLeave(ucEnergy);
+      watchdogLeave(ucWatchdog);
+      return;
+    }
     delay(500);
+    watchdogYield();
     MYDEBUG_PRINT(".");
   }
   MYDEBUG_PRINTLN("");
+  energyLeave(ucEnergy);
+  watchdogLeave(ucWatchdog);
 
   MYDEBUG_PRINT("-WIFI : connecté avec l'adresse IP : ");
   MYDEBUG_PRINTLN(WiFi.localIP());
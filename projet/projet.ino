@@ -28,43 +28,84 @@
  * fonctionnalités des objets connectés :
  * - Port Série
  * - \ref debug
+ * - \ref fixed
  * - \ref esp8266
  * - \ref nodemcu
  * - \ref pwm
+ * - \ref sensor
  * - \ref soilsensor
  * - \ref dht
+ * - \ref sensors
+ * - \ref sampler
  * - \ref tickers
  * - \ref timers
  * - \ref deepsleep
  * - \ref spiffs
  * - \ref ntp
+ * - \ref codec
+ * - \ref timeseries
  * - \ref wifimanager
+ * - \ref asynchttp
+ * - \ref httpserver
+ * - \ref power
+ * - \ref template
  * - \ref webserver
  * - \ref ota
+ * - \ref tls
  * - \ref mqtt
+ * - \ref rollup
+ * - \ref rules
+ * - \ref irrigation
+ * - \ref espnow
  * - \ref adafruitio
+ * - \ref adafruitqos
+ * - \ref rtcmemory
+ * - \ref watchdog
+ * - \ref energy
+ * - \ref counters
 */
 
 #define FIRMWAREVERSION "1.0"
 #define THINGTYPE       "NodeMCU"
+#define SAMPLE_PERIOD   5000      // Période des mesures au démarrage, adaptée ensuite (cf. MySampler.h)
 
 // ------------------------------------------------------------------------------------------------
 // MODULES
 #include "MyDebug.h"        // Debug
+#include "MyFixed.h"        // Virgule fixe
+#include "MyRTCMemory.h"    // Mémoire RTC conservée à travers les resets
+#include "MyCounters.h"     // Compteurs persistants
+#include "MyWatchdog.h"     // Watchdog logiciel
+#include "MyEnergy.h"       // Bilan énergétique
 #include "MyWiFi.h"         // WiFi du ESP8266
+#include "MyNTP.h"          // Network Time Protocol
+#include "MyCodec.h"        // Encodage des payloads JSON / Protobuf
 #include "MyNodeMCU.h"      // Correspondance entre les PINs Arduino et NodeMCU
 #include "MyPwm.h"          // Pulse Width Modulation (PWM)
+#include "MySensor.h"       // Cadre générique des capteurs
 #include "MySoilSensor.h"   // Capteur d'humidité du sol
 #include "MyDht.h"          // Digital Humidity & Temperature (DHT)
 #include "MyTicker.h"       // Tickers
 #include "MyTimer.h"        // Timers
 #include "MyDeepSleep.h"    // Sleep modes
 #include "MySPIFFS.h"       // SPIFFS
-#include "MyNTP.h"          // Network Time Protocol
 #include "MyWiFiManager.h"  // WiFi Manager
+#include "MyAsyncHttp.h"    // Serveur HTTP asynchrone
+#include "MyHttpServer.h"   // Serveur HTTP partagé
+#include "MyPower.h"        // Veille entre les mesures
+#include "MySensors.h"      // Registre des capteurs
+#include "MySampler.h"      // Echantillonnage adaptatif
+#include "MyTimeSeries.h"   // Historique compressé sur SPIFFS
+#include "MyTemplate.h"     // Pages web en flash
 #include "MyWebServer.h"    // Web Server
 #include "MyOTA.h"          // Over The Air (OTA)
+#include "MyTLS.h"          // MQTT sur TLS
 #include "MyMQTT.h"         // MQTT
+#include "MyRollup.h"       // Agrégats min/max/moyenne
+#include "MyRules.h"        // Moteur de règles
+#include "MyIrrigation.h"   // Arrosage automatique
+#include "MyEspNow.h"       // Passerelle ESP-NOW
+#include "MyAdafruitQoS.h"  // Adafruit IO QoS 1
 #include "MyAdafruitIO.h"     // Adafruit IO
 // ------------------------------------------------------------------------------------------------
 
@@ -79,37 +120,70 @@
 void setup() {
   Serial.begin(115200);
   MYDEBUG_PRINTLN("------------------- SETUP");
+  setupEnergy();      // Bilan énergétique depuis le reset
+  setupCounters();    // Restauration des compteurs et comptage du démarrage
+  setupWatchdog();    // Rapport du démarrage précédent et surveillance de la boucle
   setupWiFi();        // Initialisation du WiFi
-  setupSoilSensor();  // Initialisation du capteur d'humidité du sol
-  setupDhtSensor();   // Initialisation du capteur DHT
+  setupSensors();     // Initialisation des capteurs (sol, DHT)
 //  setupTicker();      // Initialisation d'un Ticker
 //  setupTimer();       // Initialisation du Timer1 du NodeMCU
 //  setupDeepSleep();   // Initialisation du mode Deep Sleep
 //  setupSPIFFS();      // Initialisation du SPIFFS avec un fichier de configuration
-//  setupNTP();         // Initialisation de l'heure
 setupWiFiManager(); // Initialisation du WiFi Manager
+  setupNTP();         // Initialisation de l'heure
+  setupTimeSeries();  // Initialisation de l'historique (après le WiFi Manager qui démonte le SPIFFS)
+  setupHttpServer();  // Initialisation du serveur HTTP partagé
+  setupPower();       // Veille modem ou light sleep entre les mesures
 //  setupWebServer();   // Initialisation du serveur web
 //  setupOTA();         // Initialisation de la mise à jour de firmware OTA
 //  setupMQTT();          // Initialisation du client MQTT
+  setupRollups();     // Initialisation de l'API des agrégats
+  setupRules();       // Chargement des règles et méthodes RPC associées
+  setupIrrigation();  // Initialisation de la régulation de l'arrosage
+  setupSampler(SAMPLE_PERIOD);  // Période des mesures adaptée à l'activité des voies
+//  setupEspNow();      // Feuille ou passerelle ESP-NOW (cf. ESPNOW_ROLE)
   setupAdafruitIO();
 }
 
 // ------------------------------------------------------------------------------------------------
 // LOOP
 // ------------------------------------------------------------------------------------------------
+uint32_t ulLastSample = 0;            // Date (millis) des dernières mesures
+
 /**
  * Après avoir créé une fonction setup(), qui initialise et fixe les valeurs de démarrage du programme, 
  * la fonction loop () fait exactement ce que son nom suggère et s'exécute en boucle 
  * sans fin, permettant à votre programme de s'exécuter et de répondre.
 */
 void loop() {
-  MYDEBUG_PRINTLN("------------------- LOOP");
-  getSoilData();      // Lecture des données du capteur d'humidité du sol
-  getDhtData();       // Lecture des données du capteur DHT
-//  getNTP();           // Récupération de l'heure auprès du serveur NTP
-//  loopWebServer();    // Gestion des clients du serveur Web
+  // Les mesures sont cadencées sur millis() : la boucle ne bloque pas et les messages reçus
+  // (dashboard, RPC) sont traités sans attendre la fin d'un délai
+  uint32_t ulPeriod = getRulesSamplePeriod(getSamplerPeriod());
+  if (millis() - ulLastSample >= ulPeriod) {
+    ulLastSample = millis();
+    MYDEBUG_PRINTLN("------------------- LOOP");
+    uint8_t ucWatchdog = watchdogEnter(WDT_SENSORS);
+    sampleSensors();    // Lecture des capteurs dont la période minimum est écoulée
+    watchdogLeave(ucWatchdog);
+    updateSampler();    // Activité des voies et période des prochaines mesures
+    evaluateRules();    // Règles d'alerte et d'action sur la nouvelle mesure
+    updateIrrigation(); // Décision d'arrosage sur la nouvelle mesure
+    recordTimeSeries(); // Enregistrement des mesures dans l'historique
+    updateRollups();    // Mise à jour des agrégats min/max/moyenne
+    sendEspNowSample(); // Envoi des mesures à la passerelle (feuille ESP-NOW)
+//    sleepUntilNextSample(); // Deep Sleep jusqu'à la prochaine mesure si toutes les voies sont calmes
+  }
+  planPowerWake(ulLastSample + ulPeriod);  // Prochaine mesure : réveil prévu, sur lequel s'alignent les PINGREQ
+  loopHttpServer();   // Gestion des clients du serveur HTTP
 //  loopOTA();          // Gestion des mises à jour de firmware par WiFi
 //  loopMQTT();         // Gestion de la connexion au broker MQTT
+  getNTP();           // Synchronisation de l'heure auprès du serveur NTP, sans attente
+  loopRollups();      // Publication des agrégats clôturés
   loopAdafruitIO();
-  delay(5000);        // Délai si nécessaire
+  loopSensors();      // Mesures en plusieurs temps (balayage des sondes du sol)
+  loopIrrigation();   // Pompe : temps minimum, budget et fenêtres PI
+  loopEspNow();       // Trames des feuilles et lots de la passerelle ESP-NOW
+  loopCounters();     // Temps radio et sauvegarde des compteurs
+  idlePower();        // Veille jusqu'à la prochaine échéance, laisse la main au WiFi
+  watchdogLoop();     // Fin de l'itération pour le watchdog
 }